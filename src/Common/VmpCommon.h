@@ -1,5 +1,6 @@
 #pragma once
 #include <tuple>
+#include <functional>
 #include <cereal/archives/binary.hpp>
 
 struct VmAddress
@@ -22,9 +23,24 @@ struct VmAddress
 	{
 		return std::tie(raw, vmdata) < std::tie(other.raw, other.vmdata);
 	}
+	bool operator==(const VmAddress& other) const
+	{
+		return raw == other.raw && vmdata == other.vmdata;
+	}
 	template <class Archive>
 	void serialize(Archive& ar)
 	{
 		ar(raw, vmdata);
 	}
+};
+
+//hash for the unordered containers keyed by VmAddress
+struct VmAddressHash
+{
+	size_t operator()(const VmAddress& addr) const
+	{
+		size_t seed = std::hash<size_t>()(addr.raw);
+		seed ^= std::hash<size_t>()(addr.vmdata) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+		return seed;
+	}
 };
\ No newline at end of file
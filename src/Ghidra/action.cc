@@ -18,8 +18,19 @@
 
 #include "coreaction.hh"
 
+#include <chrono>
+
 namespace ghidra {
 
+std::atomic<bool> Action::profiling(false);
+
+/// \return the current time of the steady clock in nanoseconds
+static uint8 profileClock(void)
+
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 /// Specify the name, group, and properties of the Action
 /// \param f is the collection of property flags
 /// \param nm is the Action name
@@ -34,6 +45,8 @@ Action::Action(uint4 f,const string &nm,const string &g)
   basegroup = g;
   count_tests = 0;
   count_apply = 0;
+  count_changes = 0;
+  time_spent = 0;
 }
 
 /// If enabled, issue a warning that this Action has been applied
@@ -96,6 +109,29 @@ void Action::printStatistics(ostream &s) const
   s << name << dec << " Tested=" << count_tests << " Applied=" << count_apply << endl;
 }
 
+/// \param kind is the kind of Action being recorded
+/// \param res is the list to append to
+void Action::addProfile(const string &kind,vector<ActionProfile> &res) const
+
+{
+  res.emplace_back();
+  ActionProfile &prof(res.back());
+  prof.kind = kind;
+  prof.name = name;
+  prof.group = basegroup;
+  prof.tests = count_tests;
+  prof.applies = count_apply;
+  prof.changes = count_changes;
+  prof.nanos = time_spent;
+}
+
+/// \param res is the list to append to
+void Action::collectProfile(vector<ActionProfile> &res) const
+
+{
+  addProfile("action",res);
+}
+
 /// \param data is the new function \b this Action may affect
 void Action::reset(Funcdata &data)
 
@@ -110,6 +146,8 @@ void Action::resetStats(void)
 {
   count_tests = 0;
   count_apply = 0;
+  count_changes = 0;
+  time_spent = 0;
 }
 
 /// Check if there was an active \e action breakpoint on this Action
@@ -316,7 +354,15 @@ int4 Action::perform(Funcdata& data)
 #ifdef OPACTION_DEBUG
             data.debugActivate();
 #endif
-            res = debugApply(data);// Start or continue action
+            if (profiling) {
+                uint8 startTime = profileClock();
+                res = debugApply(data);// Start or continue action
+                time_spent += profileClock() - startTime;
+                if (res >= 0 && lcount < count)
+                    count_changes += count - lcount;
+            }
+            else
+                res = debugApply(data);// Start or continue action
 #ifdef OPACTION_DEBUG
             data.debugModPrint(getName());
 #endif
@@ -616,6 +662,15 @@ void ActionGroup::printStatistics(ostream &s) const
     (*iter)->printStatistics(s);
 }
 
+void ActionGroup::collectProfile(vector<ActionProfile> &res) const
+
+{
+  addProfile("group",res);
+  vector<Action *>::const_iterator iter;
+  for(iter = list.begin();iter!=list.end();++iter)
+    (*iter)->collectProfile(res);
+}
+
 /// \param g is the groupname to which \b this Rule belongs
 /// \param fl is the set of properties
 /// \param nm is the name of the Rule
@@ -628,6 +683,8 @@ Rule::Rule(const string &g,uint4 fl,const string &nm)
   basegroup = g;
   count_tests = 0;
   count_apply = 0;
+  count_changes = 0;
+  time_spent = 0;
 }
 
 /// This method is called whenever \b this Rule applies. If warnings have been
@@ -660,6 +717,8 @@ void Rule::resetStats(void)
 {
   count_tests = 0;
   count_apply = 0;
+  count_changes = 0;
+  time_spent = 0;
 }
 
 #ifdef OPACTION_DEBUG
@@ -700,6 +759,21 @@ void Rule::printStatistics(ostream &s) const
   s << name << dec << " Tested=" << count_tests << " Applied=" << count_apply << endl;
 }
 
+/// \param res is the list to append to
+void Rule::collectProfile(vector<ActionProfile> &res) const
+
+{
+  res.emplace_back();
+  ActionProfile &prof(res.back());
+  prof.kind = "rule";
+  prof.name = name;
+  prof.group = basegroup;
+  prof.tests = count_tests;
+  prof.applies = count_apply;
+  prof.changes = count_changes;
+  prof.nanos = time_spent;
+}
+
 /// Populate the given array with all possible OpCodes this Rule might apply to.
 /// By default, this method returns all possible OpCodes
 /// \param oplist is the array to populate
@@ -840,7 +914,15 @@ int4 ActionPool::processOp(PcodeOp *op,Funcdata &data)
     data.debugActivate();
 #endif
     rl->count_tests += 1;
-    res = rl->applyOp(op,data);
+    if (Action::profiling) {
+      uint8 startTime = profileClock();
+      res = rl->applyOp(op,data);
+      rl->time_spent += profileClock() - startTime;
+      if (res > 0)
+        rl->count_changes += res;
+    }
+    else
+      res = rl->applyOp(op,data);
 #ifdef _DEBUG
     std::string testName = rl->getName();
 #endif
@@ -975,6 +1057,16 @@ void ActionPool::printStatistics(ostream &s) const
     (*iter)->printStatistics(s);
 }
 
+void ActionPool::collectProfile(vector<ActionProfile> &res) const
+
+{
+  vector<Rule *>::const_iterator iter;
+
+  addProfile("pool",res);
+  for(iter=allrules.begin();iter!=allrules.end();++iter)
+    (*iter)->collectProfile(res);
+}
+
 const char ActionDatabase::universalname[] = "universal";
 
 ActionDatabase::~ActionDatabase(void)
@@ -1163,4 +1255,27 @@ Action *ActionDatabase::deriveAction(const string &baseaction, const string &grp
   return newact;
 }
 
+/// Root Actions that were never performed are skipped
+/// \param res will hold the profiles keyed by \e root Action name
+void ActionDatabase::collectProfile(map<string,vector<ActionProfile> > &res) const
+
+{
+  map<string,Action *>::const_iterator iter;
+  for(iter=actionmap.begin();iter!=actionmap.end();++iter) {
+    Action *act = (*iter).second;
+    if (act == (Action *)0 || act->getNumTests() == 0) continue;
+    act->collectProfile(res[(*iter).first]);
+  }
+}
+
+void ActionDatabase::resetStats(void)
+
+{
+  map<string,Action *>::iterator iter;
+  for(iter=actionmap.begin();iter!=actionmap.end();++iter) {
+    if ((*iter).second != (Action *)0)
+      (*iter).second->resetStats();
+  }
+}
+
 } // End namespace ghidra
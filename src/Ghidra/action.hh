@@ -20,6 +20,8 @@
 
 #include "block.hh"
 
+#include <atomic>
+
 namespace ghidra {
 
 /// \brief The list of groups defining a \e root Action
@@ -41,6 +43,17 @@ public:
 
 class Rule;
 
+/// \brief Accumulated cost of a single Action or Rule, collected while Action::profiling is on
+struct ActionProfile {
+  string kind;			///< "action", "group", "pool" or "rule"
+  string name;			///< Name of the Action or Rule
+  string group;			///< Base group of the Action or Rule
+  uint4 tests;			///< Number of times it was tried
+  uint4 applies;		///< Number of times it made changes
+  uint8 changes;		///< Total number of changes made
+  uint8 nanos;			///< Wall-clock time spent, including any sub-actions
+};
+
 /// \brief Large scale transformations applied to the varnode/op graph
 ///
 /// The base for objects that make changes to the syntax tree of a Funcdata
@@ -84,6 +97,8 @@ protected:
   uint4 flags;			///< Behavior properties
   uint4 count_tests;		///< Number of times apply() has been called
   uint4 count_apply;		///< Number of times apply() made changes
+  uint8 count_changes;		///< Total changes made by apply(), only while profiling
+  uint8 time_spent;		///< Nanoseconds spent in apply(), only while profiling
   string name;			///< Name of the action
   string basegroup;		///< Base group this action belongs to
   void issueWarning(Architecture *glb);	///< Warn that this Action has applied
@@ -91,7 +106,9 @@ protected:
   bool checkActionBreak(void);	///< Check action breakpoint
   void turnOnWarnings(void) { flags |= rule_warnings_on; }	///< Enable warnings for this Action
   void turnOffWarnings(void) { flags &= ~rule_warnings_on; }	///< Disable warnings for this Action
+  void addProfile(const string &kind,vector<ActionProfile> &res) const;	///< Append the profile of \b this Action
 public:
+  static std::atomic<bool> profiling;	///< Record time and change counts in perform() and ActionPool, read by every worker thread
   Action(uint4 f,const string &nm,const string &g);		///< Base constructor for an Action
   virtual ~Action(void) {}					///< Destructor
 #ifdef OPACTION_DEBUG
@@ -100,6 +117,7 @@ public:
 #endif
   int4 debugApply(Funcdata& data);
   virtual void printStatistics(ostream &s) const;		///< Dump statistics to stream
+  virtual void collectProfile(vector<ActionProfile> &res) const;	///< Collect profiles of \b this and all sub-actions
   int4 perform(Funcdata &data); 				///< Perform this action (if necessary)
   bool setBreakPoint(uint4 tp,const string &specify);		///< Set a breakpoint on this action
   virtual void clearBreakPoints(void);				///< Clear all breakpoints set on \b this Action
@@ -163,6 +181,7 @@ public:
   virtual bool turnOffDebug(const string &nm);
 #endif
   virtual void printStatistics(ostream &s) const;
+  virtual void collectProfile(vector<ActionProfile> &res) const;
 };
 
 /// \brief Action which checks if restart (sub)actions have been generated
@@ -209,6 +228,8 @@ private:
   string basegroup;		///< Group to which \b this Rule belongs
   uint4 count_tests;		///< Number of times \b this Rule has attempted to apply
   uint4 count_apply;		///< Number of times \b this Rule has successfully been applied
+  uint8 count_changes;		///< Total changes made by \b this Rule, only while profiling
+  uint8 time_spent;		///< Nanoseconds spent in applyOp(), only while profiling
   void issueWarning(Architecture *glb);	///< If enabled, print a warning that this Rule has been applied
 public:
   Rule(const string &g,uint4 fl,const string &nm);		///< Construct given group, properties name
@@ -248,6 +269,7 @@ public:
   virtual void reset(Funcdata &data);				///< Reset \b this Rule
   virtual void resetStats(void);				///< Reset Rule statistics
   virtual void printStatistics(ostream &s) const;		///< Print statistics for \b this Rule
+  void collectProfile(vector<ActionProfile> &res) const;	///< Append the profile of \b this Rule
 #ifdef OPACTION_DEBUG
   virtual bool turnOnDebug(const string &nm);			///< Turn on debugging
   virtual bool turnOffDebug(const string &nm);			///< Turn off debugging
@@ -279,6 +301,7 @@ public:
   virtual void printState(ostream &s) const;
   virtual Rule *getSubRule(const string &specify);
   virtual void printStatistics(ostream &s) const;
+  virtual void collectProfile(vector<ActionProfile> &res) const;
 #ifdef OPACTION_DEBUG
   virtual bool turnOnDebug(const string &nm);
   virtual bool turnOffDebug(const string &nm);
@@ -328,6 +351,9 @@ public:
 
   //ڽvmp handler
   void buildVmpHandlerAction(Architecture* glb);
+  void buildVmpHandlerSlimAction(Architecture* glb);
+  void collectProfile(map<string,vector<ActionProfile> > &res) const;	///< Collect profiles per \e root Action
+  void resetStats(void);					///< Reset statistics of every \e root Action
   void buildVmpBlockAction(Architecture* glb);
   void buildVmpBlockOptimize(Architecture* glb);
 
@@ -590,6 +590,7 @@ void Architecture::buildAction(DocumentStorage &store)
   allacts.universalAction(this);
   allacts.resetDefaults();
   allacts.buildVmpHandlerAction(this);
+  allacts.buildVmpHandlerSlimAction(this);
   allacts.buildVmpBlockAction(this);
   allacts.buildVmpBlockOptimize(this);
 }
@@ -6050,6 +6050,91 @@ void ActionDatabase::buildVmpHandlerAction(Architecture* conf)
     act->addAction(new ActionStop("base"));
 }
 
+/// Build "vmphandlerslim", the minimal pipeline used to lift a handler for the matchers.
+/// A handler is a straight-line trace, so only heritage, constant propagation, the VMP dead-code
+/// removal and the rules producing the forms the matchers read are kept. The pointer and type rules
+/// stay as well, the check-esp and exit matchers read the stack PTRSUB and PTRADD forms they build.
+/// \param conf is the Architecture that will use the Action
+void ActionDatabase::buildVmpHandlerSlimAction(Architecture* conf)
+{
+    ActionGroup* act;
+    ActionGroup* actmainloop;
+    ActionGroup* actfullloop;
+    ActionPool* actprop, * actprop2;
+    ActionPool* actcleanup;
+    AddrSpace* stackspace = conf->getStackSpace();
+
+    act = new ActionRestartGroup(Action::rule_onceperfunc, "vmphandlerslim", 1);
+    registerAction("vmphandlerslim", act);
+
+    act->addAction(new ActionVmpStart("base"));
+    act->addAction(new ActionConstbase("base"));
+    act->addAction(new ActionDefaultParams("base"));
+    {
+        actfullloop = new ActionGroup(Action::rule_repeatapply, "fullloop");
+        {
+            actmainloop = new ActionGroup(Action::rule_repeatapply, "mainloop");
+            actmainloop->addAction(new ActionUnreachable("base"));
+            actmainloop->addAction(new ActionVarnodeProps("base"));
+            actmainloop->addAction(new ActionHeritage("base"));
+            actmainloop->addAction(new ActionSegmentize("base"));
+            actmainloop->addAction(new ActionVmpHandlerDeadCode("deadcode", stackspace));
+            actmainloop->addAction(new ActionSpacebase("base"));
+            actmainloop->addAction(new ActionNonzeroMask("analysis"));
+            actmainloop->addAction(new ActionInferTypes("typerecovery"));
+            {
+                actprop = new ActionPool(Action::rule_repeatapply, "oppool1");
+                actprop->addRule(new RuleVmpLoadConst("deadcode"));
+                actprop->addRule(new RuleVmpEarlyRemoval("deadcode", stackspace));
+                actprop->addRule(new RuleCollapseConstants("analysis"));
+                actprop->addRule(new RulePropagateCopy("analysis"));
+                actprop->addRule(new RuleTermOrder("analysis"));
+                actprop->addRule(new RuleCollectTerms("analysis"));
+                actprop->addRule(new RuleTrivialArith("analysis"));
+                actprop->addRule(new RuleTrivialBool("analysis"));
+                actprop->addRule(new RuleTrivialShift("analysis"));
+                actprop->addRule(new RuleIdentityEl("analysis"));
+                actprop->addRule(new RuleOrMask("analysis"));
+                actprop->addRule(new RuleAndMask("analysis"));
+                actprop->addRule(new RuleDoubleSub("analysis"));
+                actprop->addRule(new RuleSub2Add("analysis"));
+                actprop->addRule(new RuleAddMultCollapse("analysis"));
+                actprop->addRule(new RuleZextEliminate("analysis"));
+                actprop->addRule(new RuleConcatZext("analysis"));
+                actprop->addRule(new RulePiece2Zext("analysis"));
+                actprop->addRule(new RuleHumptyDumpty("analysis"));
+                actprop->addRule(new RuleSubvarSubpiece("subvar"));
+            }
+            actmainloop->addAction(actprop);
+            actmainloop->addAction(new ActionMultiCse("analysis"));
+            actmainloop->addAction(new ActionStackPtrFlow("stackptrflow", stackspace));
+            actmainloop->addAction(new ActionConstantPtr("typerecovery"));
+            {
+                actprop2 = new ActionPool(Action::rule_repeatapply, "oppool2");
+                actprop2->addRule(new RulePushPtr("typerecovery"));
+                actprop2->addRule(new RuleStructOffset0("typerecovery"));
+                actprop2->addRule(new RulePtrArith("typerecovery"));
+            }
+            actmainloop->addAction(actprop2);
+        }
+        actfullloop->addAction(actmainloop);
+        actfullloop->addAction(new ActionVmpHandlerDeadCode("deadcode", stackspace));
+        actfullloop->addAction(new ActionStartTypes("typerecovery"));
+    }
+    act->addAction(actfullloop);
+    act->addAction(new ActionStartCleanUp("cleanup"));
+    {
+        actcleanup = new ActionPool(Action::rule_repeatapply, "cleanup");
+        actcleanup->addRule(new RuleMultNegOne("cleanup"));
+        actcleanup->addRule(new RuleAddUnsigned("cleanup"));
+        actcleanup->addRule(new Rule2Comp2Sub("cleanup"));
+        actcleanup->addRule(new RuleSubRight("cleanup"));
+        actcleanup->addRule(new RuleExtensionPush("cleanup"));
+    }
+    act->addAction(actcleanup);
+    act->addAction(new ActionStop("base"));
+}
+
 /// Construct the \b universal Action that contains all possible components
 /// \param conf is the Architecture that will use the Action
 void ActionDatabase::universalAction(Architecture *conf)
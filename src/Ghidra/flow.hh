@@ -146,7 +146,7 @@ private:
 public:
 	//GhidraExtension
 	void generateVmpNodeOps(VmpNode* node);
-	void generateVmpBlockOps(VmpBasicBlock* node,bool buildRet);
+	void generateVmpBlockOps(VmpBasicBlock* node,bool buildRet,size_t startIndex = 0x0);
 	void generateVmpFunctionOps(VmpFunction* node);
 	void beginProcessInstruction(list<PcodeOp*>::const_iterator& oiter, bool& emptyflag);
 public:
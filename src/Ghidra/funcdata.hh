@@ -30,6 +30,7 @@
 class VmpNode;
 class VmpBasicBlock;
 class VmpFunction;
+class VmpBlockSlice;
 
 namespace ghidra {
 
@@ -144,13 +145,19 @@ public:
     //GhidraExtension
     VmpNode* nodeInput = nullptr;
     VmpBasicBlock* vm_basicblock = nullptr;
+    //index of the first lifted instruction of vm_basicblock
+    size_t vm_blockStart = 0x0;
+    //instructions of vm_basicblock to lift, all of them when null
+    const VmpBlockSlice* vm_blockSlice = nullptr;
+    //op time where every lifted instruction starts, the last entry starts the return
+    vector<uintm> vm_insStart;
     VmpFunction* vm_func = nullptr;
     //ڼ¼Ż
     std::uint64_t actIdx = 0x0;
     ///< Container of PcodeOp objects for \b this function
     PcodeOpBank obank;
     void followVmpNode(VmpNode* node);
-	void followVmpBasicBlock(VmpBasicBlock* node);
+	void followVmpBasicBlock(VmpBasicBlock* node, size_t startIndex = 0x0);
     void followVmpFunction(VmpFunction* vmFunc);
     void buildReturnVal();
     //չ
@@ -906,7 +906,7 @@ void PcodeOpBank::clearCodeLists(void)
 PcodeOp *PcodeOpBank::create(int4 inputs,const Address &pc)
 
 {
-  PcodeOp *op = new PcodeOp(inputs,SeqNum(pc,uniqid++));
+  PcodeOp *op = new(arena.allocate()) PcodeOp(inputs,SeqNum(pc,uniqid++));
   optree[op->getSeqNum()] = op;
   op->setFlag(PcodeOp::dead);		// Start out life as dead
   op->insertiter = deadlist.insert(deadlist.end(),op);
@@ -923,7 +923,7 @@ PcodeOp *PcodeOpBank::create(int4 inputs,const SeqNum &sq)
 
 {
   PcodeOp *op;
-  op = new PcodeOp(inputs,sq);
+  op = new(arena.allocate()) PcodeOp(inputs,sq);
   if (sq.getTime() >= uniqid)
     uniqid = sq.getTime() + 1;
 
@@ -1162,16 +1162,17 @@ void PcodeOpBank::clear(void)
   list<PcodeOp *>::iterator iter;
 
   for(iter=alivelist.begin();iter!=alivelist.end();++iter)
-    delete *iter;
+    (*iter)->~PcodeOp();
   for(iter=deadlist.begin();iter!=deadlist.end();++iter)
-    delete *iter;
+    (*iter)->~PcodeOp();
   for(iter=deadandgone.begin();iter!=deadandgone.end();++iter)
-    delete *iter;
+    (*iter)->~PcodeOp();
   optree.clear();
   alivelist.clear();
   deadlist.clear();
   clearCodeLists();
   deadandgone.clear();
+  arena.reset();		// Slots are reused, destructors ran above
   uniqid = 0;
 }
 
@@ -306,6 +306,7 @@ public:
   list<PcodeOp *> useroplist;		///< List of user-defined PcodeOps
   list<PcodeOp *> deadandgone;		///< List of retired PcodeOps
   uintm uniqid;				///< Counter for producing unique id's for each op
+  NodeArena<PcodeOp> arena;		///< Storage for every PcodeOp owned by \b this
   void addToCodeList(PcodeOp *op);	///< Add given PcodeOp to specific op-code list
   void removeFromCodeList(PcodeOp *op);	///< Remove given PcodeOp from specific op-code list
   void clearCodeLists(void);		///< Clear all op-code specific lists
@@ -152,6 +152,7 @@ void SleighArchitecture::loadLanguageDescription(const string &specfile,ostream
 SleighArchitecture::~SleighArchitecture(void)
 
 {
+  if (privateTranslator) return;	// Owned translator is freed by ~Architecture
   translate = (const Translate *)0;
 }
 
@@ -168,6 +169,7 @@ string SleighArchitecture::getDescription(void) const
 bool SleighArchitecture::isTranslateReused(void)
 
 {
+  if (privateTranslator) return false;
   return (translators.find(languageindex) != translators.end());
 }
 
@@ -183,6 +185,7 @@ Translate *SleighArchitecture::buildTranslator(DocumentStorage &store)
     return sleigh;
   }
   sleigh = new Sleigh(loader,context);
+  if (privateTranslator) return sleigh;
   translators[languageindex] = sleigh;
   return sleigh;
 }
@@ -342,22 +345,33 @@ void SleighArchitecture::resolveArchitecture(void)
     throw LowlevelError("No sleigh specification for "+baseid);
 }
 
-void SleighArchitecture::buildSpecFile(DocumentStorage &store)
+/// The processor specification, compiler specification and compiled SLEIGH file for the
+/// active language and compiler are looked up in the known spec directories.
+/// \param processorfile will hold the path of the .pspec file
+/// \param compilerfile will hold the path of the .cspec file
+/// \param slafile will hold the path of the .sla file
+void SleighArchitecture::findSpecFiles(string &processorfile,string &compilerfile,string &slafile) const
 
-{ // Given a specific language, make sure relevant spec files are loaded
-  bool language_reuse = isTranslateReused();
+{
   const LanguageDescription &language(description[languageindex]);
   string compiler = archid.substr(archid.rfind(':')+1);
   const CompilerTag &compilertag( language.getCompiler(compiler));
+
+  specpaths.findFile(processorfile,language.getProcessorSpec());
+  specpaths.findFile(compilerfile,compilertag.getSpec());
+  specpaths.findFile(slafile,language.getSlaFile());
+}
+
+void SleighArchitecture::buildSpecFile(DocumentStorage &store)
+
+{ // Given a specific language, make sure relevant spec files are loaded
+  bool language_reuse = isTranslateReused();
   
   string processorfile;
   string compilerfile;
   string slafile;
   
-  specpaths.findFile(processorfile,language.getProcessorSpec());
-  specpaths.findFile(compilerfile,compilertag.getSpec());
-  if (!language_reuse)
-    specpaths.findFile(slafile,language.getSlaFile());
+  findSpecFiles(processorfile,compilerfile,slafile);
   
   try {
     Document *doc = store.openDocument(processorfile);
@@ -435,6 +449,7 @@ SleighArchitecture::SleighArchitecture(const string &fname,const string &targ,os
   filename = fname;
   target = targ;
   errorstream = estream;
+  privateTranslator = false;
 }
 
 /// This is run once when spinning up the decompiler.
@@ -115,8 +115,10 @@ class SleighArchitecture : public Architecture {
   bool isTranslateReused(void);				///< Test if last Translate object can be reused
 protected:
   ostream *errorstream;					///< Error stream associated with \b this SleighArchitecture
+  bool privateTranslator;				///< Build a Translate owned by \b this instead of the shared one
   // buildLoader must be filled in by derived class
   static void collectSpecFiles(ostream &errs);		///< Gather specification files in normal locations
+  void findSpecFiles(string &processorfile,string &compilerfile,string &slafile) const;	///< Locate the spec files of the active language
   virtual Translate *buildTranslator(DocumentStorage &store);
   virtual PcodeInjectLibrary *buildPcodeInjectLibrary(void);
   virtual void buildTypegrp(DocumentStorage &store);
@@ -1138,10 +1138,11 @@ void VarnodeBank::clear(void)
   VarnodeLocSet::iterator iter;
 
   for(iter=loc_tree.begin();iter!=loc_tree.end();++iter)
-    delete *iter;
+    (*iter)->~Varnode();
 
   loc_tree.clear();
   def_tree.clear();
+  arena.reset();		// Slots are reused, destructors ran above
   uniqid = uniqbase;		// Reset counter to base value
   create_index = 0;		// Reset varnode creation index
 }
@@ -1155,7 +1156,7 @@ void VarnodeBank::clear(void)
 Varnode *VarnodeBank::create(int4 s,const Address &m,Datatype *ct)
 
 {
-  Varnode *vn = new Varnode(s,m,ct);
+  Varnode *vn = new(arena.allocate()) Varnode(s,m,ct);
   
   vn->create_index = create_index++;
   vn->lociter = loc_tree.insert(vn).first; // Frees can always be inserted without duplication
@@ -1176,7 +1177,7 @@ Varnode *VarnodeBank::createUnique(int4 s,Datatype *ct)
 }
 
 /// The Varnode object is removed from the sorted lists and
-/// its memory reclaimed
+/// its memory handed back to the arena
 /// \param vn is the Varnode to remove
 void VarnodeBank::destroy(Varnode *vn)
 
@@ -1186,7 +1187,8 @@ void VarnodeBank::destroy(Varnode *vn)
 
   loc_tree.erase(vn->lociter);
   def_tree.erase(vn->defiter);
-  delete vn;
+  vn->~Varnode();
+  arena.release(vn);
 }
 
 /// Enter the Varnode into both the \e location and \e definition based trees.
@@ -1203,7 +1205,8 @@ Varnode *VarnodeBank::xref(Varnode *vn)
   if (!check.second) {		// Set already contains this varnode
     othervn = *(check.first);
     replace(vn,othervn); // Patch ops using the old varnode
-    delete vn;
+    vn->~Varnode();
+    arena.release(vn);
     return othervn;
   }
 				// Otherwise a new insertion
@@ -1316,7 +1319,7 @@ Varnode *VarnodeBank::setDef(Varnode *vn,PcodeOp *op)
 Varnode *VarnodeBank::createDef(int4 s,const Address &m, Datatype *ct,PcodeOp *op)
 
 {
-  Varnode *vn = new Varnode(s,m,ct);
+  Varnode *vn = new(arena.allocate()) Varnode(s,m,ct);
   vn->create_index = create_index++;
   vn->setDef(op);
   return xref(vn);
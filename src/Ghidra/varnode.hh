@@ -38,6 +38,49 @@ extern AttributeId ATTRIB_INPUT;	///< Marshaling attribute "input"
 extern AttributeId ATTRIB_PERSISTS;	///< Marshaling attribute "persists"
 extern AttributeId ATTRIB_UNAFF;	///< Marshaling attribute "unaff"
 
+/// \brief Slab storage for the objects owned by a single analysis container
+///
+/// Objects are carved out of fixed size slabs and individually released slots are
+/// recycled through a free list.  The slabs stay allocated across reset(), so a
+/// container that is cleared and reanalyzed does not return to the heap for every
+/// object.  Only the storage is recycled: reset() rewinds the slab cursor and does
+/// not destroy anything.  Varnode and PcodeOp own heap state (covers, descendant
+/// lists, input vectors), so the owner still runs every destructor before a reset().
+/// Blocks, covers and heritage state are not allocated here.
+template<typename T>
+class NodeArena {
+  enum { slabsize = 256 };		///< Number of objects in a single slab
+  vector<char *> slabs;			///< Raw storage, each slab holds \b slabsize objects
+  int4 curslab;				///< Index of the slab currently being carved
+  int4 curpos;				///< Next unused slot within the current slab
+  vector<void *> freelist;		///< Slots released since the last reset
+  NodeArena(const NodeArena &op2);	///< Not copyable
+  NodeArena &operator=(const NodeArena &op2);	///< Not assignable
+public:
+  NodeArena(void) { curslab = 0; curpos = 0; }	///< Constructor
+  ~NodeArena(void) {				///< Destructor, releases every slab
+    for(int4 i=0;i<slabs.size();++i)
+      ::operator delete(slabs[i]);
+  }
+  void *allocate(void) {			///< Get storage for one object
+    if (!freelist.empty()) {
+      void *res = freelist.back();
+      freelist.pop_back();
+      return res;
+    }
+    if (curslab == slabs.size())
+      slabs.push_back((char *)::operator new(sizeof(T) * slabsize));
+    void *res = slabs[curslab] + sizeof(T) * curpos;
+    if (++curpos == slabsize) {
+      curslab += 1;
+      curpos = 0;
+    }
+    return res;
+  }
+  void release(void *ptr) { freelist.push_back(ptr); }	///< Hand back storage of a destroyed object
+  void reset(void) { freelist.clear(); curslab = 0; curpos = 0; }	///< Make every slot available again
+};
+
 /// \brief Compare two Varnode pointers by location then definition
 struct VarnodeCompareLocDef {
   bool operator()(const Varnode *a,const Varnode *b) const;	///< Functional comparison operator
@@ -366,6 +409,7 @@ class VarnodeBank {
   VarnodeLocSet loc_tree;	///< Varnodes sorted by location then def
   VarnodeDefSet def_tree;	///< Varnodes sorted by def then location
   mutable Varnode searchvn;	///< Template varnode for searching trees
+  NodeArena<Varnode> arena;	///< Storage for every Varnode owned by \b this
   Varnode *xref(Varnode *vn);	///< Insert a Varnode into the sorted lists
 public:
   VarnodeBank(AddrSpaceManager *m);				///< Construct the container
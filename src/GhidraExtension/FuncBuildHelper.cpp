@@ -218,6 +218,23 @@ void FuncBuildHelper::BuildPushRegister(ghidra::Funcdata& data, size_t addr, con
     return;
 }
 
+int FuncBuildHelper::BuildEspAdjust(ghidra::Funcdata& data, size_t addr, int delta)
+{
+	if (delta == 0x0) {
+		return 0x0;
+	}
+	auto regESP = data.getArch()->translate->getRegister("ESP");
+	ghidra::Address pc = ghidra::Address(data.getArch()->getDefaultCodeSpace(), addr);
+
+	//esp = esp + delta
+	ghidra::PcodeOp* opAdd = data.newOp(2, pc);
+	data.opSetOpcode(opAdd, ghidra::CPUI_INT_ADD);
+	data.newVarnodeOut(regESP.size, regESP.getAddr(), opAdd);
+	data.opSetInput(opAdd, data.newVarnode(regESP.size, regESP.space, regESP.offset), 0);
+	data.opSetInput(opAdd, data.newConstant(4, std::uint32_t(delta)), 1);
+	return 0x1;
+}
+
 void FuncBuildHelper::BuildPushConst(ghidra::Funcdata& data, size_t addr, size_t val, size_t valSize)
 {
     auto regESP = data.getArch()->translate->getRegister("ESP");
@@ -34,6 +34,8 @@ public:
     static void BuildPushConst(ghidra::Funcdata& data, size_t addr, size_t val, size_t valSize);
     //push eax
     static void BuildPushRegister(ghidra::Funcdata& data, size_t addr, const ghidra::VarnodeData& regData);
+    //esp = esp + delta, returns the number of built instructions
+    static int BuildEspAdjust(ghidra::Funcdata& data, size_t addr, int delta);
 
 	//andunique
 	static ghidra::Varnode* BuildAnd(ghidra::Funcdata& data, size_t addr, ghidra::Varnode* v1, ghidra::Varnode* v2, size_t opSize);
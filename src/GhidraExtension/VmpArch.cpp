@@ -1,28 +1,31 @@
 #include "VmpArch.h"
 #include "IDALoadImage.h"
+#include "VmpSpecCache.h"
 #include "../Ghidra/libdecomp.hh"
 #include "../Helper/IDAWrapper.h"
 #include "../Helper/AsmBuilder.h"
+#include "../Helper/VmpRegister.h"
 #include "../Manager/exceptions.h"
 #include "../GhidraExtension/VmpNode.h"
 #include "../GhidraExtension/VmpControlFlow.h"
 #include "../GhidraExtension/VmpFunction.h"
 #include "../Ghidra/funcdata.hh"
+#include <map>
+#include <tuple>
+#include <iomanip>
+#include <algorithm>
 
 #ifdef DeveloperMode
 #pragma optimize("", off) 
 #endif
 
-VmpArchitecture* gArch = nullptr;
-
-VmpArchitecture::VmpArchitecture() :ghidra::SleighArchitecture("", "", 0x0)
+VmpArchitecture::VmpArchitecture(bool isolated) :ghidra::SleighArchitecture("", "", 0x0), pcodeCache(this)
 {
+    privateTranslator = isolated;
     if (!initVmpArchitecture()) {
         throw Exception("InitVmpArchitecture error.");
     }
 	ghidra::Sleigh* sleigh = (ghidra::Sleigh*)translate;
-
-    gArch = this;
     if (arch_type == ARCH_X86) {
 		for (unsigned int n = 0; n < 16; n++) {
 			std::string vmRegName = "R" + std::to_string(n);
@@ -44,6 +47,7 @@ VmpArchitecture::VmpArchitecture() :ghidra::SleighArchitecture("", "", 0x0)
 			sleigh->symtab.getGlobalScope()->addSymbol(symbol);
 		}
     }
+    VmpRegister::InternTranslator(translate);
 }
 
 VmpArchitecture::~VmpArchitecture()
@@ -92,11 +96,35 @@ void VmpArchitecture::resolveArchitecture(void)
     }
 }
 
+void VmpArchitecture::buildSpecFile(ghidra::DocumentStorage& store)
+{
+    std::string processorFile, compilerFile, slaFile;
+    findSpecFiles(processorFile, compilerFile, slaFile);
+    std::uint64_t specStamp = VmpSpecCache::StampSpecFiles({ processorFile, compilerFile, slaFile });
+    std::string snapshotName = archid;
+    std::replace(snapshotName.begin(), snapshotName.end(), ':', '_');
+    std::string snapshotPath = IDAWrapper::idadir("plugins") + "\\Revampire\\" + snapshotName + ".spec";
+    if (VmpSpecCache::LoadSnapshot(snapshotPath, specStamp, store)) {
+        return;
+    }
+    SleighArchitecture::buildSpecFile(store);
+    //a reused translator skips the sla, only complete sets are written
+    const ghidra::Element* slaRoot = store.getTag("sleigh");
+    if (!slaRoot) {
+        return;
+    }
+    VmpSpecCache::SaveSnapshot(snapshotPath, specStamp, { store.getTag("processor_spec"), store.getTag("compiler_spec"), slaRoot });
+}
+
 bool VmpArchitecture::initVmpArchitecture()
 {
-    std::string ghidraroot = IDAWrapper::idadir("plugins") + "\\Ghidra";
-    std::vector<std::string> extrapaths;
-    ghidra::startDecompilerLibrary(ghidraroot.c_str(), extrapaths);
+    static bool bLibraryStarted = false;
+    if (!bLibraryStarted) {
+        std::string ghidraroot = IDAWrapper::idadir("plugins") + "\\Ghidra";
+        std::vector<std::string> extrapaths;
+        ghidra::startDecompilerLibrary(ghidraroot.c_str(), extrapaths);
+        bLibraryStarted = true;
+    }
     std::string errmsg;
     bool iserror = false;
     ghidra::DocumentStorage store;	// temporary storage for xml docs
@@ -157,7 +185,7 @@ ghidra::Funcdata* VmpArchitecture::OptimizeBlock(ghidra::Funcdata* fd)
 	return fd;
 }
 
-ghidra::Funcdata* VmpArchitecture::AnaVmpBasicBlock(VmpBasicBlock* basicBlock)
+ghidra::Funcdata* VmpArchitecture::AnaVmpBasicBlock(VmpBasicBlock* basicBlock, size_t startIndex, const VmpBlockSlice* slice)
 {
 	ghidra::Address startAddr(getDefaultCodeSpace(), 0x0);
 	ghidra::Funcdata* fd = symboltab->getGlobalScope()->findFunction(startAddr);
@@ -166,7 +194,8 @@ ghidra::Funcdata* VmpArchitecture::AnaVmpBasicBlock(VmpBasicBlock* basicBlock)
 	}
 	clearAnalysis(fd);
 	fd->clearExtensionData();
-	fd->followVmpBasicBlock(basicBlock);
+	fd->vm_blockSlice = slice;
+	fd->followVmpBasicBlock(basicBlock, startIndex);
 	ghidra::Action* rootAction = allacts.setCurrent("vmpblock");
 	rootAction->reset(*fd);
 	auto res = rootAction->perform(*fd);
@@ -181,6 +210,106 @@ ghidra::Funcdata* VmpArchitecture::AnaVmpBasicBlock(VmpBasicBlock* basicBlock)
 	return fd;
 }
 
+ghidra::Funcdata* VmpArchitecture::LiftVmpBasicBlock(VmpBasicBlock* basicBlock)
+{
+	ghidra::Address startAddr(getDefaultCodeSpace(), 0x0);
+	ghidra::Funcdata* fd = symboltab->getGlobalScope()->findFunction(startAddr);
+	if (!fd) {
+		fd = symboltab->getGlobalScope()->addFunction(startAddr, "")->getFunction();
+	}
+	clearAnalysis(fd);
+	fd->clearExtensionData();
+	fd->followVmpBasicBlock(basicBlock);
+	return fd;
+}
+
+void VmpArchitecture::EnableActionProfile(bool bEnable)
+{
+    ghidra::Action::profiling = bEnable;
+}
+
+bool VmpArchitecture::IsActionProfileEnabled()
+{
+    return ghidra::Action::profiling;
+}
+
+static std::string escapeJson(const std::string& str)
+{
+    std::string retStr;
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            retStr.push_back('\\');
+        }
+        retStr.push_back(c);
+    }
+    return retStr;
+}
+
+void VmpArchitecture::DumpActionProfile(const std::vector<VmpArchitecture*>& archList, std::ostream& txtOut, std::ostream& jsonOut)
+{
+    struct ProfileKey
+    {
+        std::string root;
+        std::string kind;
+        std::string name;
+        std::string group;
+        bool operator<(const ProfileKey& other) const {
+            return std::tie(root, kind, name, group) < std::tie(other.root, other.kind, other.name, other.group);
+        }
+    };
+    //actions sharing a name inside one root are summed
+    std::map<ProfileKey, ghidra::ActionProfile> sumMap;
+    for (VmpArchitecture* arch : archList) {
+        std::map<std::string, std::vector<ghidra::ActionProfile>> rootMap;
+        arch->allacts.collectProfile(rootMap);
+        arch->allacts.resetStats();
+        for (auto& rootItem : rootMap) {
+            for (const ghidra::ActionProfile& prof : rootItem.second) {
+                ProfileKey key{ rootItem.first, prof.kind, prof.name, prof.group };
+                auto it = sumMap.find(key);
+                if (it == sumMap.end()) {
+                    sumMap[key] = prof;
+                    continue;
+                }
+                it->second.tests += prof.tests;
+                it->second.applies += prof.applies;
+                it->second.changes += prof.changes;
+                it->second.nanos += prof.nanos;
+            }
+        }
+    }
+    std::vector<std::pair<ProfileKey, ghidra::ActionProfile>> sortList(sumMap.begin(), sumMap.end());
+    std::sort(sortList.begin(), sortList.end(), [](const auto& a, const auto& b) {
+        return a.second.nanos > b.second.nanos;
+    });
+    //group and pool times include their members
+    txtOut << std::left << std::setw(16) << "root" << std::setw(8) << "kind" << std::setw(28) << "name" << std::setw(18) << "group"
+        << std::right << std::setw(12) << "ms" << std::setw(12) << "tests" << std::setw(12) << "applied" << std::setw(12) << "changes" << "\n";
+    jsonOut << "[\n";
+    for (unsigned int n = 0; n < sortList.size(); ++n) {
+        const ProfileKey& key = sortList[n].first;
+        const ghidra::ActionProfile& prof = sortList[n].second;
+        txtOut << std::left << std::setw(16) << key.root << std::setw(8) << key.kind << std::setw(28) << key.name << std::setw(18) << key.group
+            << std::right << std::setw(12) << std::fixed << std::setprecision(3) << (prof.nanos / 1000000.0)
+            << std::setw(12) << prof.tests << std::setw(12) << prof.applies << std::setw(12) << prof.changes << "\n";
+        jsonOut << "  {\"root\":\"" << escapeJson(key.root) << "\",\"kind\":\"" << key.kind << "\",\"name\":\"" << escapeJson(key.name)
+            << "\",\"group\":\"" << escapeJson(key.group) << "\",\"nanos\":" << prof.nanos << ",\"tests\":" << prof.tests
+            << ",\"applied\":" << prof.applies << ",\"changes\":" << prof.changes << "}";
+        jsonOut << (n + 1 < sortList.size() ? ",\n" : "\n");
+    }
+    jsonOut << "]\n";
+}
+
+void VmpArchitecture::SetSlimHandlerAction(bool bSlim)
+{
+    bSlimHandlerAction = bSlim;
+}
+
+VmpPcodeCache& VmpArchitecture::PcodeCache()
+{
+    return pcodeCache;
+}
+
 ghidra::Funcdata* VmpArchitecture::AnaVmpHandler(VmpNode* nodeInput)
 {
     //Դ
@@ -195,7 +324,7 @@ ghidra::Funcdata* VmpArchitecture::AnaVmpHandler(VmpNode* nodeInput)
     clearAnalysis(fd);
     fd->clearExtensionData();
     fd->followVmpNode(nodeInput);
-    ghidra::Action* rootAction = allacts.setCurrent("vmphandler");
+    ghidra::Action* rootAction = allacts.setCurrent(bSlimHandlerAction ? "vmphandlerslim" : "vmphandler");
     rootAction->reset(*fd);
     auto res = rootAction->perform(*fd);
     if (res < 0) {
@@ -1,5 +1,7 @@
 #pragma once
 #include "../Ghidra/sleigh_arch.hh"
+#include "VmpPcodeCache.h"
+#include <ostream>
 
 namespace ghidra
 {
@@ -9,6 +11,7 @@ namespace ghidra
 class VmpNode;
 class VmpBasicBlock;
 class VmpFunction;
+class VmpBlockSlice;
 
 
 class VmpArchitecture :public ghidra::SleighArchitecture
@@ -21,21 +24,36 @@ public:
 		ARCH_X86_64,
 	};
 public:
-	VmpArchitecture();
+	//isolated instances own their translator and can run on a worker thread
+	VmpArchitecture(bool isolated = false);
 	~VmpArchitecture();
 public:
 	architecture_e ArchType();
 	ghidra::Funcdata* AnaVmpHandler(VmpNode* nodeInput);
-	ghidra::Funcdata* AnaVmpBasicBlock(VmpBasicBlock* basicBlock);
+	//startIndex lifts only the tail of the block, slice drops the instructions it does not keep
+	ghidra::Funcdata* AnaVmpBasicBlock(VmpBasicBlock* basicBlock, size_t startIndex = 0x0, const VmpBlockSlice* slice = nullptr);
+	//raw pcode of the whole block, no action is run
+	ghidra::Funcdata* LiftVmpBasicBlock(VmpBasicBlock* basicBlock);
 	ghidra::Funcdata* AnaVmpFunction(VmpFunction* func);
 	ghidra::Funcdata* OptimizeBlock(ghidra::Funcdata* fd);
+	//switch handler analysis between the slim pipeline and the full "vmphandler" group
+	void SetSlimHandlerAction(bool bSlim);
+	//raw pcode of instructions already translated by this architecture
+	VmpPcodeCache& PcodeCache();
+	//opt-in wall-clock profile of every action and rule, see ghidra::Action::profiling
+	static void EnableActionProfile(bool bEnable);
+	static bool IsActionProfileEnabled();
+	//sorted report summed over the given architectures, their statistics are reset afterwards
+	static void DumpActionProfile(const std::vector<VmpArchitecture*>& archList, std::ostream& txtOut, std::ostream& jsonOut);
 protected:
 	void buildLoader(ghidra::DocumentStorage& store) override;
 	void resolveArchitecture(void) override;
+	//load the spec documents from the binary snapshot when it is up to date
+	void buildSpecFile(ghidra::DocumentStorage& store) override;
 private:
 	bool initVmpArchitecture();
 private:
 	architecture_e arch_type;
+	bool bSlimHandlerAction = true;
+	VmpPcodeCache pcodeCache;
 };
-
-extern VmpArchitecture* gArch;
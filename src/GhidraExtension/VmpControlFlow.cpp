@@ -1,9 +1,10 @@
 #include "VmpControlFlow.h"
 #include <sstream>
+#include <algorithm>
 #include <fstream>
 #include <graph.hpp>
-#include "../Helper/IDAWrapper.h"
 #include "../Manager/exceptions.h"
+#include "../Manager/SectionManager.h"
 #include "../GhidraExtension/VmpFunction.h"
 #include "../GhidraExtension/VmpArch.h"
 #include "../Helper/UnicornHelper.h"
@@ -14,6 +15,26 @@
 #pragma optimize("", off) 
 #endif
 
+//worker architecture of the task running on this thread, the main thread uses the function one
+static thread_local VmpArchitecture* taskArch = nullptr;
+//record of the task running on this thread
+static thread_local VmpTaskRecord* taskRecord = nullptr;
+
+//lookups, edges and blocks are only recorded by tasks that really run
+static VmpTaskRecord* recordingTask()
+{
+	if (taskRecord && !taskRecord->bReplayed) {
+		return taskRecord;
+	}
+	return nullptr;
+}
+
+//native code is decoded against the ida database, which is only safe on the main thread
+static bool isMainThreadTask(const VmpFlowBuildContext& task)
+{
+	return task.btype == VmpFlowBuildContext::HANDLE_NORMAL || task.btype == VmpFlowBuildContext::HANDLE_VMP_EXIT;
+}
+
 VmpControlFlow::VmpControlFlow() :graph(this)
 {
 
@@ -24,7 +45,7 @@ VmpControlFlow::~VmpControlFlow()
 
 }
 
-VmpControlFlowBuilder::VmpControlFlowBuilder(VmpFunction& fd):data(fd)
+VmpControlFlowBuilder::VmpControlFlowBuilder(VmpFunction& fd):data(fd), tfg(fd.trace.tfg), scheduler(isMainThreadTask)
 {
 
 }
@@ -42,8 +63,8 @@ VmpFlowBuildContext::VmpFlowBuildContext()
 void VmpRegStatus::ClearStatus()
 {
 	isSelected = false;
-	reg_code = "";
-	reg_stack = "";
+	reg_code = VmpRegister::REG_NONE;
+	reg_stack = VmpRegister::REG_NONE;
 }
 
 std::string VmpBasicBlock::MakeGraphTxt()
@@ -114,11 +135,41 @@ ptrdiff_t __stdcall VmpControlFlowShowGraph::graph_callback(void* ud, int code,
 
 void VmpControlFlowBuilder::linkBlockEdge(VmAddress from, VmAddress to)
 {
-	fromEdges[from].insert(to);
+	std::lock_guard<std::mutex> lock(flowMutex);
+	addEdge(from, to);
+	VmpTaskRecord* record = recordingTask();
+	if (record) {
+		record->edges.push_back(std::make_pair(from, to));
+	}
+}
+
+void VmpControlFlowBuilder::addEdge(VmAddress from, VmAddress to)
+{
+	std::vector<VmAddress>& edgeList = fromEdges[from];
+	if (std::find(edgeList.begin(), edgeList.end(), to) == edgeList.end()) {
+		edgeList.push_back(to);
+	}
+}
+
+VmpBasicBlock* VmpControlFlowBuilder::claimNewBlock(VmAddress startAddr, bool isVmBlock)
+{
+	{
+		std::lock_guard<std::mutex> lock(flowMutex);
+		if (!visited.insert(startAddr).second) {
+			return nullptr;
+		}
+		VmpTaskRecord* record = recordingTask();
+		if (record) {
+			record->bClaimed = true;
+			record->claimAddr = startAddr;
+		}
+	}
+	return createNewBlock(startAddr, isVmBlock);
 }
 
 VmpBasicBlock* VmpControlFlowBuilder::createNewBlock(VmAddress startAddr, bool isVmBlock)
 {
+	std::lock_guard<std::mutex> lock(flowMutex);
 	VmpBasicBlock* newBlock = &data.cfg.blocksMap[startAddr];
 	if (data.cfg.blocksMap.size() == 1) {
 		data.cfg.startBlock = newBlock;
@@ -128,6 +179,13 @@ VmpBasicBlock* VmpControlFlowBuilder::createNewBlock(VmAddress startAddr, bool i
 	if (isVmBlock) {
 		newBlock->setVmInsBlock();
 	}
+	VmpTaskRecord* record = recordingTask();
+	if (record) {
+		record->bHasBlock = true;
+		record->bVmBlock = isVmBlock;
+		record->blockEntry = startAddr;
+		record->liveBlock = newBlock;
+	}
 	return newBlock;
 }
 
@@ -156,9 +214,18 @@ bool isNormalTerminalInstruction(RawInstruction* data)
 	return false;
 }
 
+bool VmpControlFlowBuilder::isVmpEntry(size_t addr)
+{
+	VmpTaskRecord* record = recordingTask();
+	if (record) {
+		record->entryProbes.insert(addr);
+	}
+	return data.VmpEngine()->EntryIndex().IsVmpEntry(addr);
+}
+
 void VmpControlFlowBuilder::addNextTask(size_t fromAddr, size_t nextAddr)
 {
-	if (IDAWrapper::isVmpEntry(nextAddr)) {
+	if (isVmpEntry(nextAddr)) {
 		addVmpEntryBuildTask(fromAddr, nextAddr);
 	}
 	else {
@@ -168,14 +235,21 @@ void VmpControlFlowBuilder::addNextTask(size_t fromAddr, size_t nextAddr)
 
 void VmpControlFlowBuilder::fallthruNormal(VmpFlowBuildContext& task)
 {
-	if (visited.count(task.start_addr)) {
-		return;
+	{
+		std::lock_guard<std::mutex> lock(flowMutex);
+		if (!visited.insert(task.start_addr).second) {
+			return;
+		}
+		VmpTaskRecord* record = recordingTask();
+		if (record) {
+			record->bClaimed = true;
+			record->claimAddr = task.start_addr;
+		}
 	}
-	visited.insert(task.start_addr);
 	size_t curAddr = task.start_addr.raw;
 	VmpBasicBlock* curBasicBlock = nullptr;
 	while (true) {
-		if (IDAWrapper::isVmpEntry(curAddr)) {
+		if (isVmpEntry(curAddr)) {
 			size_t fromAddr = 0x0;
 			if (curBasicBlock != nullptr) {
 				RawInstruction* rawIns = static_cast<RawInstruction*>(curBasicBlock->insList.back().get());
@@ -223,7 +297,7 @@ void VmpControlFlowBuilder::addVmpEntryBuildTask(VmAddress fromAddr, VmAddress v
 	newTask->btype = VmpFlowBuildContext::HANDLE_VMP_ENTRY;
 	newTask->start_addr = vmEntryAddr;
 	newTask->from_addr = fromAddr;
-	anaQueue.push(std::move(newTask));
+	pushTask(std::move(newTask));
 }
 
 void VmpControlFlowBuilder::addNormalBuildTask(VmAddress startAddr)
@@ -231,7 +305,22 @@ void VmpControlFlowBuilder::addNormalBuildTask(VmAddress startAddr)
 	auto newTask = std::make_unique<VmpFlowBuildContext>();
 	newTask->btype = VmpFlowBuildContext::HANDLE_NORMAL;
 	newTask->start_addr = startAddr;
-	anaQueue.push(std::move(newTask));
+	pushTask(std::move(newTask));
+}
+
+void VmpControlFlowBuilder::addVmpExitBuildTask(VmAddress fromAddr, VmAddress exitAddr)
+{
+	auto newTask = std::make_unique<VmpFlowBuildContext>();
+	newTask->btype = VmpFlowBuildContext::HANDLE_VMP_EXIT;
+	newTask->start_addr = exitAddr;
+	newTask->from_addr = fromAddr;
+	pushTask(std::move(newTask));
+}
+
+void VmpControlFlowBuilder::pushTask(std::unique_ptr<VmpFlowBuildContext> task)
+{
+	task->parent = taskRecord;
+	scheduler.Push(std::move(task));
 }
 
 void VmpControlFlowBuilder::fallthruVmp(VmpFlowBuildContext& task)
@@ -241,8 +330,124 @@ void VmpControlFlowBuilder::fallthruVmp(VmpFlowBuildContext& task)
 	return;
 }
 
+void VmpControlFlowBuilder::fallthruVmExit(VmpFlowBuildContext& task)
+{
+	//leaving to another vm entry does not continue the current function
+	if (isVmpEntry(task.start_addr.raw)) {
+		return;
+	}
+	linkBlockEdge(task.from_addr, task.start_addr);
+	fallthruNormal(task);
+}
+
+void VmpControlFlowBuilder::runTask(VmpFlowBuildContext& task, unsigned int worker)
+{
+	taskArch = worker ? workerArchs[worker - 1] : nullptr;
+	taskRecord = adoptRecord(task);
+	if (taskRecord->bReplayed) {
+		replayTask(*taskRecord);
+	}
+	else if (task.btype == VmpFlowBuildContext::HANDLE_NORMAL) {
+		fallthruNormal(task);
+	}
+	else if (task.btype == VmpFlowBuildContext::HANDLE_VMP_EXIT) {
+		fallthruVmExit(task);
+	}
+	else {
+		fallthruVmp(task);
+	}
+	finishRecord(*taskRecord);
+	taskRecord = nullptr;
+}
+
+VmpTaskRecord* VmpControlFlowBuilder::adoptRecord(VmpFlowBuildContext& task)
+{
+	std::lock_guard<std::mutex> lock(flowMutex);
+	VmpTaskRecord* record = task.replay;
+	//vm jumps depend on their unicorn context, they are only replayed through their parent
+	if (!record && task.btype != VmpFlowBuildContext::HANDLE_VMP_JMP) {
+		auto it = replayIndex.find(std::make_tuple(int(task.btype), task.start_addr, task.from_addr));
+		if (it != replayIndex.end()) {
+			record = it->second;
+		}
+	}
+	if (record && !record->bDirty && !record->bReplayed) {
+		record->bReplayed = true;
+	}
+	else {
+		newRecords.push_back(std::make_unique<VmpTaskRecord>());
+		record = newRecords.back().get();
+		record->btype = task.btype;
+		record->start_addr = task.start_addr;
+		record->from_addr = task.from_addr;
+	}
+	record->parent = task.parent;
+	if (task.parent) {
+		task.parent->children.push_back(record);
+	}
+	return record;
+}
+
+void VmpControlFlowBuilder::replayTask(VmpTaskRecord& record)
+{
+	std::vector<VmpTaskRecord*> childList;
+	{
+		std::lock_guard<std::mutex> lock(flowMutex);
+		//children add themselves back when they run
+		childList.swap(record.children);
+		for (const auto& edge : record.edges) {
+			addEdge(edge.first, edge.second);
+		}
+		//another task built the same address first
+		if (record.bClaimed && !visited.insert(record.claimAddr).second) {
+			return;
+		}
+	}
+	if (record.bHasBlock) {
+		VmpBasicBlock* newBlock = createNewBlock(record.blockEntry, record.bVmBlock);
+		std::istringstream ss(record.blockData);
+		bool bLoaded = false;
+		try {
+			cereal::BinaryInputArchive ar(ss);
+			bLoaded = newBlock->LoadInstructions(ar);
+		}
+		catch (cereal::Exception&) {
+			bLoaded = false;
+		}
+		if (!bLoaded) {
+			throw Exception("replay block error");
+		}
+	}
+	for (const auto& child : childList) {
+		auto childTask = std::make_unique<VmpFlowBuildContext>();
+		childTask->btype = child->btype;
+		childTask->start_addr = child->start_addr;
+		childTask->from_addr = child->from_addr;
+		childTask->replay = child;
+		pushTask(std::move(childTask));
+	}
+}
+
+void VmpControlFlowBuilder::finishRecord(VmpTaskRecord& record)
+{
+	if (!record.liveBlock) {
+		return;
+	}
+	//the block is saved before buildFinalFunction and merging change it
+	std::ostringstream ss;
+	{
+		cereal::BinaryOutputArchive ar(ss);
+		record.liveBlock->SaveInstructions(ar);
+	}
+	record.blockData = ss.str();
+	record.liveBlock = nullptr;
+}
+
 VmpArchitecture* VmpControlFlowBuilder::Arch()
 {
+	if (taskArch) {
+		return taskArch;
+	}
 	return data.Arch();
 }
 
@@ -251,22 +456,52 @@ Vmp3xHandlerFactory& VmpControlFlowBuilder::HandlerCache()
 	return data.VmpEngine()->HandlerCache();
 }
 
+VmpHandlerPool& VmpControlFlowBuilder::HandlerPool()
+{
+	return data.VmpEngine()->HandlerPool();
+}
+
 bool VmpControlFlowBuilder::BuildCFG(size_t startAddr)
 {
+	//tasks of the previous build are replayed unless an entry they looked up changed
+	VmpBuildTrace& trace = data.trace;
+	prevRecords = std::move(trace.records);
+	trace.records.clear();
+	trace.entryProbes.clear();
+	for (const auto& record : prevRecords) {
+		if (record->bDirty || record->btype == VmpFlowBuildContext::HANDLE_VMP_JMP) {
+			continue;
+		}
+		replayIndex.emplace(std::make_tuple(int(record->btype), record->start_addr, record->from_addr), record.get());
+	}
+	taskRecord = nullptr;
 	auto startTask = std::make_unique<VmpFlowBuildContext>();
 	startTask->btype = VmpFlowBuildContext::HANDLE_NORMAL;
 	startTask->start_addr = startAddr;
-	anaQueue.push(std::move(startTask));
-	while (!anaQueue.empty()) {
-		auto curTask = std::move(anaQueue.front());
-		anaQueue.pop();
-		if (curTask->btype == VmpFlowBuildContext::HANDLE_NORMAL) {
-			fallthruNormal(*curTask);
-		}
-		else {
-			fallthruVmp(*curTask);
+	pushTask(std::move(startTask));
+	//vm branches are independent, build them on the handler pool workers
+	workerArchs.clear();
+	HandlerPool().BorrowArchs(workerArchs);
+	if (!workerArchs.empty()) {
+		//workers read bytes from the snapshot, it has to be built on the main thread
+		SectionManager::Main();
+	}
+	scheduler.Run(workerArchs.size(), [this](VmpFlowBuildContext& task, unsigned int worker) {
+		runTask(task, worker);
+	});
+	//keep the replayed records, the rest of the previous build is gone
+	for (auto& record : prevRecords) {
+		if (record->bReplayed) {
+			newRecords.push_back(std::move(record));
 		}
 	}
+	prevRecords.clear();
+	replayIndex.clear();
+	for (auto& record : newRecords) {
+		record->bReplayed = false;
+		trace.entryProbes.insert(record->entryProbes.begin(), record->entryProbes.end());
+	}
+	trace.records = std::move(newRecords);
 	buildEdges();
 	buildFinalFunction();
 	return true;
@@ -344,17 +579,14 @@ void VmpControlFlowBuilder::buildEdges()
 			basicBlock->setEndBlock();
 			continue;
 		}
-		auto edgeList = itEdge->second;
-		std::set<VmAddress> linkedCache;
+		//edges are unique already, sorting keeps the branch order of the old set
+		std::vector<VmAddress>& edgeList = itEdge->second;
+		std::sort(edgeList.begin(), edgeList.end());
 		for (const auto& edgeAddr : edgeList) {
 			auto itChild = data.cfg.blocksMap.find(edgeAddr);
 			if (itChild == data.cfg.blocksMap.end()) {
 				continue;
 			}
-			if (linkedCache.count(edgeAddr)) {
-				continue;
-			}
-			linkedCache.insert(edgeAddr);
 			VmpBasicBlock* edgeBlock = &itChild->second;
 			basicBlock->outBlocks.push_back(edgeBlock);
 			edgeBlock->inBlocks.push_back(basicBlock);
@@ -400,7 +632,7 @@ bool VmpControlFlow::checkMerge(VmpBasicBlock* bb)
 void VmpControlFlow::MergeNodes()
 {
 	//ȷ޷ϲĽڵ
-	std::set<VmAddress> badNodeList;
+	std::unordered_set<VmAddress, VmAddressHash> badNodeList;
 	bool bUpdateNode;
 	do
 	{
@@ -423,6 +655,156 @@ void VmpControlFlow::MergeNodes()
 	} while (bUpdateNode);
 }
 
+//cereal saves instructions through a unique_ptr, the snapshot does not take ownership
+struct InstructionView
+{
+	void operator()(VmpInstruction*) const {};
+};
+
+void VmpBasicBlock::SaveInstructions(cereal::BinaryOutputArchive& ar)
+{
+	ar(insList.size());
+	for (const auto& ins : insList) {
+		bool bRaw = ins->IsRawInstruction();
+		ar(bRaw);
+		if (bRaw) {
+			ar(ins->GetAddress());
+			continue;
+		}
+		VmpInstruction* vmIns = (VmpInstruction*)ins.get();
+		std::unique_ptr<VmpInstruction, InstructionView> insView(vmIns);
+		ar(insView);
+		vmIns->SaveOperands(ar);
+	}
+}
+
+bool VmpBasicBlock::LoadInstructions(cereal::BinaryInputArchive& ar)
+{
+	size_t insCount = 0x0;
+	ar(insCount);
+	for (size_t n = 0; n < insCount; ++n) {
+		bool bRaw = false;
+		ar(bRaw);
+		if (bRaw) {
+			VmAddress insAddr;
+			ar(insAddr);
+			std::unique_ptr<RawInstruction> rawIns = DisasmManager::Main().DecodeInstruction(insAddr.raw);
+			if (!rawIns) {
+				return false;
+			}
+			insList.push_back(std::move(rawIns));
+			continue;
+		}
+		std::unique_ptr<VmpInstruction> vmIns;
+		ar(vmIns);
+		if (!vmIns) {
+			return false;
+		}
+		vmIns->LoadOperands(ar);
+		insList.push_back(std::move(vmIns));
+	}
+	return true;
+}
+
+void VmpControlFlow::Clear()
+{
+	blocksMap.clear();
+	startBlock = nullptr;
+	graph.nodesList.clear();
+	graph.txtList.clear();
+}
+
+bool VmpBuildTrace::Invalidate(size_t entryAddr)
+{
+	if (!entryProbes.count(entryAddr)) {
+		return false;
+	}
+	for (const auto& record : records) {
+		if (!record->entryProbes.count(entryAddr)) {
+			continue;
+		}
+		//a replayed parent queues its vm jumps without their unicorn context, it has to run again
+		VmpTaskRecord* dirtyRecord = record.get();
+		while (dirtyRecord->btype == VmpFlowBuildContext::HANDLE_VMP_JMP && dirtyRecord->parent) {
+			dirtyRecord = dirtyRecord->parent;
+		}
+		record->bDirty = true;
+		dirtyRecord->bDirty = true;
+	}
+	return true;
+}
+
+void VmpControlFlow::SaveGraph(cereal::BinaryOutputArchive& ar)
+{
+	VmAddress startEntry;
+	if (startBlock) {
+		startEntry = startBlock->blockEntry;
+	}
+	ar(startEntry, blocksMap.size());
+	for (auto& eBlock : blocksMap) {
+		VmpBasicBlock& basicBlock = eBlock.second;
+		std::vector<VmAddress> outList;
+		for (const auto& outBlock : basicBlock.outBlocks) {
+			outList.push_back(outBlock->blockEntry);
+		}
+		ar(basicBlock.blockEntry, basicBlock.flags, outList);
+		basicBlock.SaveInstructions(ar);
+	}
+}
+
+bool VmpControlFlow::readGraph(cereal::BinaryInputArchive& ar)
+{
+	VmAddress startEntry;
+	size_t blockCount = 0x0;
+	ar(startEntry, blockCount);
+	std::map<VmAddress, std::vector<VmAddress>> outEdges;
+	for (size_t n = 0; n < blockCount; ++n) {
+		VmAddress blockEntry;
+		unsigned int blockFlags = 0x0;
+		std::vector<VmAddress> outList;
+		ar(blockEntry, blockFlags, outList);
+		VmpBasicBlock& basicBlock = blocksMap[blockEntry];
+		basicBlock.blockEntry = blockEntry;
+		basicBlock.flags = blockFlags;
+		outEdges[blockEntry] = std::move(outList);
+		if (!basicBlock.LoadInstructions(ar)) {
+			return false;
+		}
+	}
+	for (const auto& eEdge : outEdges) {
+		VmpBasicBlock* fromBlock = &blocksMap[eEdge.first];
+		for (const auto& toAddr : eEdge.second) {
+			auto itChild = blocksMap.find(toAddr);
+			if (itChild == blocksMap.end()) {
+				return false;
+			}
+			fromBlock->outBlocks.push_back(&itChild->second);
+			itChild->second.inBlocks.push_back(fromBlock);
+		}
+	}
+	auto itStart = blocksMap.find(startEntry);
+	if (itStart == blocksMap.end()) {
+		return false;
+	}
+	startBlock = &itStart->second;
+	return true;
+}
+
+bool VmpControlFlow::LoadGraph(cereal::BinaryInputArchive& ar)
+{
+	bool bLoaded = false;
+	try {
+		bLoaded = readGraph(ar);
+	}
+	catch (cereal::Exception&) {
+		bLoaded = false;
+	}
+	if (!bLoaded) {
+		Clear();
+	}
+	return bLoaded;
+}
+
 #ifdef DeveloperMode
 #pragma optimize("", on) 
 #endif
\ No newline at end of file
@@ -3,11 +3,15 @@
 #include <queue>
 #include <memory>
 #include <set>
+#include <mutex>
+#include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include "../Helper/UnicornHelper.h"
 #include "../Manager/DisasmManager.h"
 #include "../VmpCore/VmpTraceFlowGraph.h"
 #include "../VmpCore/VmpUnicorn.h"
+#include "../VmpCore/VmpFlowScheduler.h"
 #include "../GhidraExtension/VmpNode.h"
 #include "../GhidraExtension/VmpInstruction.h"
 #include "../Common/VmpCommon.h"
@@ -18,15 +22,17 @@ class VmpControlFlow;
 class VmpArchitecture;
 class VmpBasicBlock;
 class Vmp3xHandlerFactory;
+class VmpHandlerPool;
+class VmpTaskRecord;
 
 class VmpRegStatus
 {
 public:
 	void ClearStatus();
 	//vmֽĴ
-	std::string reg_code;
+	VmpRegId reg_code = VmpRegister::REG_NONE;
 	//vmջĴ
-	std::string reg_stack;
+	VmpRegId reg_stack = VmpRegister::REG_NONE;
 	//Ƿѡ˼Ĵ
 	bool isSelected = false;
 };
@@ -46,6 +52,8 @@ public:
 		HANDLE_NORMAL = 0x0,
 		HANDLE_VMP_ENTRY,
 		HANDLE_VMP_JMP,
+		//native code after a vm exit, checked against vm entries on the main thread
+		HANDLE_VMP_EXIT,
 	};
 	enum VM_MATCH_STATUS {
 		FIND_VM_INIT = 0x0,
@@ -70,6 +78,55 @@ public:
 	VmAddress from_addr;
 	//ģ״̬
 	VM_MATCH_STATUS status;
+	//record of the previous build to replay, only set for the children of a replayed task
+	VmpTaskRecord* replay = nullptr;
+	//record of the task that queued this one
+	VmpTaskRecord* parent = nullptr;
+};
+
+//what one build task looked up and produced
+//the next build of the function replays it, unless an entry it looked up was marked or unmarked
+
+class VmpTaskRecord
+{
+public:
+	VmpFlowBuildContext::FlowBuildType btype;
+	VmAddress start_addr;
+	VmAddress from_addr;
+	//addresses looked up as vm entries
+	std::set<size_t> entryProbes;
+	std::vector<std::pair<VmAddress, VmAddress>> edges;
+	//visited address taken by the task
+	bool bClaimed = false;
+	VmAddress claimAddr;
+	//the block created by the task, saved before the graph is finished
+	bool bHasBlock = false;
+	bool bVmBlock = false;
+	VmAddress blockEntry;
+	std::string blockData;
+	std::vector<VmpTaskRecord*> children;
+	//record of the task that queued this one in the build that produced it
+	VmpTaskRecord* parent = nullptr;
+	//one of the entryProbes changed
+	bool bDirty = false;
+	//taken over by the running build
+	bool bReplayed = false;
+	//block being filled by the running task
+	VmpBasicBlock* liveBlock = nullptr;
+};
+
+class VmpBuildTrace
+{
+public:
+	//mark the tasks that looked the address up, false if the graph does not depend on it
+	//a vm jump can not run without its parent, the nearest other ancestor is marked instead
+	bool Invalidate(size_t entryAddr);
+public:
+	std::vector<std::unique_ptr<VmpTaskRecord>> records;
+	//every address the graph looked up, also known for graphs loaded from disk
+	std::set<size_t> entryProbes;
+	//traces of all vm tasks, kept so replayed tasks do not have to run again
+	VmpTraceFlowGraph tfg;
 };
 
 class VmpControlFlowBuilder
@@ -81,32 +138,58 @@ public:
 	bool BuildCFG(size_t startAddr);
 protected:
 	VmpBasicBlock* createNewBlock(VmAddress startAddr,bool isVmBlock);
+	//create the block unless another task already visited the address
+	VmpBasicBlock* claimNewBlock(VmAddress startAddr, bool isVmBlock);
 	void addVmpEntryBuildTask(VmAddress fromAddr,VmAddress vmEntryAddr);
 	void addNormalBuildTask(VmAddress startAddr);
+	void addVmpExitBuildTask(VmAddress fromAddr, VmAddress exitAddr);
+	void pushTask(std::unique_ptr<VmpFlowBuildContext> task);
+	bool isParallelBuild() { return scheduler.IsParallel(); };
+	//vm entry lookup, recorded as a dependency of the running task
+	bool isVmpEntry(size_t addr);
 private:
+	//architecture of the worker running the current task
 	VmpArchitecture* Arch();
 	Vmp3xHandlerFactory& HandlerCache();
+	VmpHandlerPool& HandlerPool();
+	void runTask(VmpFlowBuildContext& task, unsigned int worker);
+	VmpTaskRecord* adoptRecord(VmpFlowBuildContext& task);
+	void replayTask(VmpTaskRecord& record);
+	void finishRecord(VmpTaskRecord& record);
 	void fallthruVmp(VmpFlowBuildContext& task);
 	void fallthruNormal(VmpFlowBuildContext& task);
+	void fallthruVmExit(VmpFlowBuildContext& task);
 
 	void addNextTask(size_t fromAddr, size_t nextAddr);
 
 	void linkBlockEdge(VmAddress from, VmAddress to);
+	//caller holds flowMutex
+	void addEdge(VmAddress from, VmAddress to);
 	void buildEdges();
 	void buildFinalFunction();
 public:
-	VmpTraceFlowGraph tfg;
+	VmpTraceFlowGraph& tfg;
+	//guards tfg while blocks are built in parallel
+	std::mutex tfgMutex;
 protected:
-	std::queue<std::unique_ptr<VmpFlowBuildContext>> anaQueue;
+	VmpFlowScheduler scheduler;
 private:
-	std::set<VmAddress> visited;
-	std::map<VmAddress, VmpBasicBlock*> instructionMap;
-	std::map<VmAddress, std::set<VmAddress>> fromEdges;
+	//guards visited, fromEdges and the blocks of the cfg
+	std::mutex flowMutex;
+	std::vector<VmpArchitecture*> workerArchs;
+	std::unordered_set<VmAddress, VmAddressHash> visited;
+	//an instruction has few successors, a vector is cheaper than a set
+	std::unordered_map<VmAddress, std::vector<VmAddress>, VmAddressHash> fromEdges;
+	//records of the previous build, the context free ones are also looked up by task
+	std::vector<std::unique_ptr<VmpTaskRecord>> prevRecords;
+	std::map<std::tuple<int, VmAddress, VmAddress>, VmpTaskRecord*> replayIndex;
+	std::vector<std::unique_ptr<VmpTaskRecord>> newRecords;
 	VmpFunction& data;
 };
 
 class VmpBasicBlock
 {
+	friend class VmpControlFlow;
 	enum {
 		start_block = 0x1,
 		end_block = 0x2,
@@ -124,6 +207,9 @@ public:
 	bool isStartBlock() { return ((flags & start_block) != 0); };
 	void setVmInsBlock() { flags |= vm_ins_block; };
 	bool isVmInsBlock() { return ((flags & vm_ins_block) != 0); };
+	//raw instructions are saved by address and decoded again on load
+	void SaveInstructions(cereal::BinaryOutputArchive& ar);
+	bool LoadInstructions(cereal::BinaryInputArchive& ar);
 public:
 	std::vector<std::unique_ptr<vm_inst>> insList;
 	std::vector<VmpBasicBlock*> inBlocks;
@@ -160,8 +246,13 @@ public:
 	~VmpControlFlow();
 	VmpBasicBlock* StartBlock() { return startBlock; };
 	void MergeNodes();
+	void Clear();
+	//snapshot of the finished graph
+	void SaveGraph(cereal::BinaryOutputArchive& ar);
+	bool LoadGraph(cereal::BinaryInputArchive& ar);
 private:
 	bool checkMerge(VmpBasicBlock* bb);
+	bool readGraph(cereal::BinaryInputArchive& ar);
 protected:
 	VmpBasicBlock* startBlock;
 public:
@@ -50,4 +50,44 @@ void VmpFunction::FollowVmp(size_t start)
     }
 	VmpControlFlowBuilder builder(*this);
 	builder.BuildCFG(startAddr);
+}
+
+size_t VmpFunction::EstimateFootprint()
+{
+	//map and set nodes carry about three pointers and a color on top of the value
+	const size_t nodeCost = 0x20;
+	size_t total = sizeof(VmpFunction);
+	for (auto& eBlock : cfg.blocksMap) {
+		VmpBasicBlock& basicBlock = eBlock.second;
+		total += nodeCost + sizeof(eBlock);
+		total += (basicBlock.inBlocks.size() + basicBlock.outBlocks.size()) * sizeof(VmpBasicBlock*);
+		for (const auto& ins : basicBlock.insList) {
+			if (ins->IsRawInstruction()) {
+				total += sizeof(RawInstruction) + sizeof(cs_insn) + sizeof(cs_detail);
+			}
+			else {
+				//the largest vm instruction, close enough for the others
+				total += sizeof(VmpOpExit);
+			}
+		}
+	}
+	for (const auto& record : trace.records) {
+		total += sizeof(VmpTaskRecord) + record->blockData.size();
+		total += record->entryProbes.size() * (nodeCost + sizeof(size_t));
+		total += record->edges.size() * sizeof(std::pair<VmAddress, VmAddress>);
+		total += record->children.size() * sizeof(VmpTaskRecord*);
+	}
+	total += trace.entryProbes.size() * (nodeCost + sizeof(size_t));
+	const VmpTraceFlowGraph& tfg = trace.tfg;
+	for (const auto& eNode : tfg.nodeMap) {
+		total += nodeCost + sizeof(eNode) + eNode.second.addrList.size() * sizeof(size_t);
+	}
+	total += tfg.instructionToNodeMap.size() * (nodeCost + sizeof(std::pair<size_t, VmpTraceFlowNodeIndex>));
+	for (const auto& eEdge : tfg.fromEdges) {
+		total += nodeCost + sizeof(eEdge) + eEdge.second.size() * 2 * sizeof(size_t);
+	}
+	for (const auto& eEdge : tfg.toEdges) {
+		total += nodeCost + sizeof(eEdge) + eEdge.second.size() * 2 * sizeof(size_t);
+	}
+	return total;
 }
\ No newline at end of file
@@ -12,11 +12,15 @@ public:
 	~VmpFunction();
 	void FollowVmp(size_t startAddr);
 	void CreateGraph();
+	//rough bytes held by the graph and the build trace
+	size_t EstimateFootprint();
 	VmpArchitecture* Arch();
 	VmpReEngine* VmpEngine();
 public:
 	size_t startAddr;
 	VmpControlFlow cfg;
+	//dependencies of cfg on the vm entries, used to rebuild only what changed
+	VmpBuildTrace trace;
 private:
 	VmpArchitecture* arch;
 	VmpReEngine* reEngine;
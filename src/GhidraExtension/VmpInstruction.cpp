@@ -2,14 +2,14 @@
 #include <functional>
 #include <lines.hpp>
 #include "VmpArch.h"
+#include "../Helper/IDAWrapper.h"
 
 void colorAddr(std::ostream& ss, size_t addr, const char* tag)
 {
-	auto archType = gArch->ArchType();
-	if (archType == VmpArchitecture::ARCH_X86) {
+	if (!IDAWrapper::is64BitProgram()) {
 		ss << SCOLOR_ON << tag <<  "0x" << std::setfill('0') << std::setw(8) << std::hex << addr << SCOLOR_OFF << tag;
 	}
-	else if(archType == VmpArchitecture::ARCH_X86_64){
+	else {
 		ss << SCOLOR_ON << tag << "0x" << std::setfill('0') << std::setw(16) << std::hex << addr << SCOLOR_OFF << tag;
 	}
 }
@@ -6,6 +6,7 @@
 #include "../Manager/DisasmManager.h"
 #include "../Ghidra/varnode.hh"
 #include "../Common/VmpCommon.h"
+#include "../Helper/VmpRegister.h"
 
 enum VmpOpType
 {
@@ -74,6 +75,11 @@ public:
 	{
 		ar(addr, opType, opSize);
 	}
+	//operands of this instance, handler patterns leave them out and only the graph snapshot keeps them
+	virtual void SaveOperands(cereal::BinaryOutputArchive& ar) {};
+	virtual void LoadOperands(cereal::BinaryInputArchive& ar) {};
+	//native instructions whose register context MakeInstruction reads besides the handler entry
+	virtual void GetContextProbes(std::vector<size_t>& outAddr) {};
 	static size_t GetMemAccessSize(size_t addr);
 public:
 	VmAddress addr;
@@ -90,6 +96,13 @@ public:
 	~UserOpConnect() {};
 	int BuildInstruction(ghidra::Funcdata& data) override;
 	void PrintRaw(std::ostream& ss) override {};
+	void SaveOperands(cereal::BinaryOutputArchive& ar) override { ar(connectAddr); };
+	void LoadOperands(cereal::BinaryInputArchive& ar) override { ar(connectAddr); };
+	template <class Archive>
+	void serialize(Archive& ar)
+	{
+		ar(cereal::base_class<VmpInstruction>(this));
+	}
 public:
 	size_t connectAddr = 0x0;
 };
@@ -114,6 +127,11 @@ public:
 	VmpOpUnknown() { opType = VM_UNKNOWN; };
 	~VmpOpUnknown() {};
 	void PrintRaw(std::ostream& ss) override;
+	template <class Archive>
+	void serialize(Archive& ar)
+	{
+		ar(cereal::base_class<VmpInstruction>(this));
+	}
 };
 
 class VmpOpCpuid :public VmpInstruction
@@ -163,15 +181,37 @@ public:
 
 class VmpOpInit :public VmpInstruction
 {
+public:
+	//a pushed register or constant, the space is resolved by the architecture that builds the pcode
+	struct StoreData
+	{
+		std::string space;
+		size_t offset = 0x0;
+		int size = 0x0;
+		StoreData() {};
+		StoreData(const std::string& spc, size_t off, int sz) :space(spc), offset(off), size(sz) {};
+		template <class Archive>
+		void serialize(Archive& ar)
+		{
+			ar(space, offset, size);
+		}
+	};
 public:
 	VmpOpInit() { opType = VM_INIT; };
 	~VmpOpInit() {};
 	int BuildInstruction(ghidra::Funcdata& data) override;
 	void PrintRaw(std::ostream& ss) override;
 	void BuildX86Asm(triton::Context* ctx) override;
+	void SaveOperands(cereal::BinaryOutputArchive& ar) override { ar(storeContext); };
+	void LoadOperands(cereal::BinaryInputArchive& ar) override { ar(storeContext); };
+	template <class Archive>
+	void serialize(Archive& ar)
+	{
+		ar(cereal::base_class<VmpInstruction>(this));
+	}
 public:
 	//ѹĶջ
-	std::vector<ghidra::VarnodeData> storeContext;
+	std::vector<StoreData> storeContext;
 };
 
 class VmpOpExit :public VmpInstruction
@@ -188,9 +228,12 @@ public:
 	{
 		ar(cereal::base_class<VmpInstruction>(this), exitData);
 	}
+	void SaveOperands(cereal::BinaryOutputArchive& ar) override { ar(exitContext, exitAddress); };
+	void LoadOperands(cereal::BinaryInputArchive& ar) override { ar(exitContext, exitAddress); };
 public:
 	//˳ļĴ
-	std::vector<ghidra::VarnodeData> exitContext;
+	//register names, resolved by the architecture that builds the pcode
+	std::vector<std::string> exitContext;
 	size_t exitAddress = 0x0;
 public:
 	std::vector<std::string> exitData;
@@ -203,6 +246,13 @@ public:
 	~VmpOpExitCall() {};
 	void PrintRaw(std::ostream& ss) override;
 	int BuildInstruction(ghidra::Funcdata& data) override;
+	void SaveOperands(cereal::BinaryOutputArchive& ar) override { ar(callAddr, exitAddress, isLoad); };
+	void LoadOperands(cereal::BinaryInputArchive& ar) override { ar(callAddr, exitAddress, isLoad); };
+	template <class Archive>
+	void serialize(Archive& ar)
+	{
+		ar(cereal::base_class<VmpInstruction>(this));
+	}
 public:
 	size_t callAddr = 0x0;
 	size_t exitAddress = 0x0;
@@ -218,15 +268,28 @@ public:
 	int BuildInstruction(ghidra::Funcdata& data) override;
 	void BuildX86Asm(triton::Context* ctx) override;
 	std::unique_ptr<VmpInstruction> MakeInstruction(VmpFlowBuildContext* ctx, VmpNode& input) override;
+	void GetContextProbes(std::vector<size_t>& outAddr) override { outAddr.push_back(storeAddr); };
+	//registers are saved by name, interned ids are not stable across sessions
 	template <class Archive>
-	void serialize(Archive& ar)
+	void save(Archive& ar) const
 	{
-		ar(cereal::base_class<VmpInstruction>(this), storeAddr, reg_code, reg_stack);
+		ar(cereal::base_class<VmpInstruction>(this), storeAddr, VmpRegister::Name(reg_code), VmpRegister::Name(reg_stack));
 	}
+	template <class Archive>
+	void load(Archive& ar)
+	{
+		std::string codeName;
+		std::string stackName;
+		ar(cereal::base_class<VmpInstruction>(this), storeAddr, codeName, stackName);
+		reg_code = VmpRegister::Intern(codeName);
+		reg_stack = VmpRegister::Intern(stackName);
+	}
+	void SaveOperands(cereal::BinaryOutputArchive& ar) override { ar(vmRegOffset); };
+	void LoadOperands(cereal::BinaryInputArchive& ar) override { ar(vmRegOffset); };
 public:
 	size_t storeAddr = 0x0;
-	std::string reg_code;
-	std::string reg_stack;
+	VmpRegId reg_code = VmpRegister::REG_NONE;
+	VmpRegId reg_stack = VmpRegister::REG_NONE;
 public:
 	//Ĵƫ
 	int vmRegOffset = 0x0;
@@ -241,11 +304,14 @@ public:
 	int BuildInstruction(ghidra::Funcdata& data) override;
 	void BuildX86Asm(triton::Context* ctx) override;
 	std::unique_ptr<VmpInstruction> MakeInstruction(VmpFlowBuildContext* ctx, VmpNode& input) override;
+	void GetContextProbes(std::vector<size_t>& outAddr) override { outAddr.push_back(loadAddr); };
 	template <class Archive>
 	void serialize(Archive& ar)
 	{
 		ar(cereal::base_class<VmpInstruction>(this), loadAddr);
 	}
+	void SaveOperands(cereal::BinaryOutputArchive& ar) override { ar(vmRegOffset); };
+	void LoadOperands(cereal::BinaryInputArchive& ar) override { ar(vmRegOffset); };
 public:
 	size_t loadAddr = 0x0;
 public:
@@ -262,11 +328,14 @@ public:
 	int BuildInstruction(ghidra::Funcdata& data) override;
 	void BuildX86Asm(triton::Context* ctx) override;
 	std::unique_ptr<VmpInstruction> MakeInstruction(VmpFlowBuildContext* ctx, VmpNode& input) override;
+	void GetContextProbes(std::vector<size_t>& outAddr) override { outAddr.push_back(storeAddr); };
 	template <class Archive>
 	void serialize(Archive& ar)
 	{
 		ar(cereal::base_class<VmpInstruction>(this), loadAddr, storeAddr);
 	}
+	void SaveOperands(cereal::BinaryOutputArchive& ar) override { ar(immVal); };
+	void LoadOperands(cereal::BinaryInputArchive& ar) override { ar(immVal); };
 public:
 	size_t loadAddr;
 	size_t storeAddr;
@@ -280,6 +349,11 @@ public:
 	VmpOpCheckEsp() { opType = VM_CHECK_ESP; };
 	~VmpOpCheckEsp() {};
 	void PrintRaw(std::ostream& ss) override {};
+	template <class Archive>
+	void serialize(Archive& ar)
+	{
+		ar(cereal::base_class<VmpInstruction>(this));
+	}
 };
 
 class VmpOpAdd : public VmpInstruction
@@ -424,6 +498,8 @@ public:
 	{
 		ar(cereal::base_class<VmpInstruction>(this));
 	}
+	void SaveOperands(cereal::BinaryOutputArchive& ar) override { ar(branchList, isBuildJmp); };
+	void LoadOperands(cereal::BinaryInputArchive& ar) override { ar(branchList, isBuildJmp); };
 public:
 	//VmJmpType jmpType;
 	std::vector<size_t> branchList;
@@ -444,6 +520,8 @@ public:
 	{
 		ar(cereal::base_class<VmpInstruction>(this));
 	}
+	void SaveOperands(cereal::BinaryOutputArchive& ar) override { ar(targetAddr, isBuildJmp); };
+	void LoadOperands(cereal::BinaryInputArchive& ar) override { ar(targetAddr, isBuildJmp); };
 public:
 	size_t targetAddr = 0x0;
 	bool isBuildJmp = false;
@@ -580,3 +658,8 @@ REGISTER_VMPINSTRUCTION(VmpOpDiv)
 REGISTER_VMPINSTRUCTION(VmpOpMul)
 REGISTER_VMPINSTRUCTION(VmpOpPopfd)
 REGISTER_VMPINSTRUCTION(VmpOpExit)
+REGISTER_VMPINSTRUCTION(VmpOpInit)
+REGISTER_VMPINSTRUCTION(VmpOpExitCall)
+REGISTER_VMPINSTRUCTION(VmpOpUnknown)
+REGISTER_VMPINSTRUCTION(VmpOpCheckEsp)
+REGISTER_VMPINSTRUCTION(UserOpConnect)
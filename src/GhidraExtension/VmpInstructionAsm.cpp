@@ -33,7 +33,7 @@ void VmpOpExit::BuildX86Asm(triton::Context* ctx)
 {
 	//X86AsmBuilder& x86Asm = AsmBuilder::X86();
 	//for (unsigned int n = 0; n < exitContext.size(); ++n) {
-	//	std::string regName = GhidraHelper::GetVarnodeRegName(exitContext[n]);
+	//	const std::string& regName = exitContext[n];
 	//	if (regName == "EIP" || regName == "ESP") {
 	//		continue;
 	//	}
@@ -15,12 +15,16 @@ int VmpOpInit::BuildInstruction(ghidra::Funcdata& data)
 {
 	int step = 0x0;
 	for (const auto& context : storeContext) {
-		if (context.getAddr().getSpace()->getName() == "const") {
-			FuncBuildHelper::BuildPushConst(data, addr.vmdata, context.getAddr().getOffset(), 0x4);
+		if (context.space == "const") {
+			FuncBuildHelper::BuildPushConst(data, addr.vmdata, context.offset, 0x4);
 			step++;
 		}
-		else if (context.getAddr().getSpace()->getName() == "register") {
-			FuncBuildHelper::BuildPushRegister(data, addr.vmdata, context);
+		else if (context.space == "register") {
+			ghidra::VarnodeData regData;
+			regData.space = data.getArch()->getSpaceByName(context.space);
+			regData.offset = context.offset;
+			regData.size = context.size;
+			FuncBuildHelper::BuildPushRegister(data, addr.vmdata, regData);
 			step++;
 		}
 	}
@@ -232,12 +236,13 @@ int VmpOpExit::BuildInstruction(ghidra::Funcdata& data)
 	auto regESP = data.getArch()->translate->getRegister("ESP");
 	ghidra::Address pc = ghidra::Address(data.getArch()->getDefaultCodeSpace(), addr.vmdata);
 	for (unsigned int n = 0; n < exitContext.size(); ++n) {
-		if (exitContext[n] == regESP) {
+		auto regExit = data.getArch()->translate->getRegister(exitContext[n]);
+		if (regExit == regESP) {
 			continue;
 		}
 		ghidra::PcodeOp* opLoad = data.newOp(2, pc);
 		data.opSetOpcode(opLoad, ghidra::CPUI_LOAD);
-		data.newVarnodeOut(exitContext[n].size, exitContext[n].getAddr(), opLoad);
+		data.newVarnodeOut(regExit.size, regExit.getAddr(), opLoad);
 		data.opSetInput(opLoad, data.newVarnodeSpace(data.getArch()->getSpaceByName("ram")), 0);
 		data.opSetInput(opLoad, data.newVarnode(regESP.size, regESP.space, regESP.offset), 1);
 		//esp = esp + 0x4
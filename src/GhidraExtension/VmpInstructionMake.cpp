@@ -237,8 +237,6 @@ std::unique_ptr<VmpInstruction> VmpOpExit::MakeInstruction(VmpFlowBuildContext*
 {
 	std::unique_ptr<VmpOpExit> vOpExit = std::make_unique<VmpOpExit>();
 	vOpExit->addr = input.readVmAddress(buildCtx->vmreg.reg_code);
-	for (unsigned int n = 0; n < exitData.size(); ++n) {
-		vOpExit->exitContext.push_back(gArch->translate->getRegister(exitData[n]));
-	}
+	vOpExit->exitContext = exitData;
 	return vOpExit;
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
 #include "../GhidraExtension/FuncBuildHelper.h"
 #include "../GhidraExtension/VmpControlFlow.h"
 #include "../GhidraExtension/VmpFunction.h"
+#include "../GhidraExtension/VmpArch.h"
+#include "../Helper/VmpBlockSlicer.h"
 
 #ifdef DeveloperMode
 #pragma optimize("", off) 
@@ -118,7 +120,7 @@ void ghidra::FlowInfo::generateVmpFunctionOps(VmpFunction* vmFunc)
     if (!bb) {
         return;
     }
-    std::set<VmAddress> visited;
+    std::unordered_set<VmAddress, VmAddressHash> visited;
     std::vector<VmpBasicBlock*> blockList;
     blockList.push_back(bb);
 	bool startbasic = true;
@@ -137,27 +139,43 @@ void ghidra::FlowInfo::generateVmpFunctionOps(VmpFunction* vmFunc)
     return;
 }
 
-void ghidra::FlowInfo::generateVmpBlockOps(VmpBasicBlock* bblock, bool buildRet)
+void ghidra::FlowInfo::generateVmpBlockOps(VmpBasicBlock* bblock, bool buildRet, size_t startIndex)
 {
 	clearProperties();
 	bool isfallthru = false;
     bool startbasic = true;
 	bool emptyflag;
 	list<PcodeOp*>::const_iterator oiter;
-    for (unsigned int n = 0; n < bblock->insList.size(); ++n) {
+	//single block lifts remember where every instruction starts
+	if (buildRet) {
+		data.vm_insStart.clear();
+	}
+    for (size_t n = startIndex; n < bblock->insList.size(); ++n) {
         beginProcessInstruction(oiter, emptyflag);
+		if (buildRet) {
+			data.vm_insStart.push_back(obank.getUniqId());
+		}
         int4 step = 0x0;
         ghidra::Address curaddr;
+		bool bDropped = data.vm_blockSlice && !data.vm_blockSlice->IsKept(n);
         if (bblock->insList[n]->IsRawInstruction()) {
             RawInstruction* rawIns = static_cast<RawInstruction*>(bblock->insList[n].get());
             curaddr = ghidra::Address(glb->getDefaultCodeSpace(), rawIns->raw->address);
-            step = glb->translate->oneInstruction(emitter, curaddr);
+			if (!bDropped) {
+				step = static_cast<VmpArchitecture*>(glb)->PcodeCache().OneInstruction(emitter, curaddr);
+			}
         }
         else {
 			VmpInstruction* vmIns = static_cast<VmpInstruction*>(bblock->insList[n].get());
             curaddr = ghidra::Address(glb->getDefaultCodeSpace(), vmIns->addr.vmdata);
-			step = vmIns->BuildInstruction(data);
+			if (!bDropped) {
+				step = vmIns->BuildInstruction(data);
+			}
         }
+		//a dropped instruction only keeps its change of esp
+		if (bDropped) {
+			step = FuncBuildHelper::BuildEspAdjust(data, curaddr.getOffset(), data.vm_blockSlice->EspDelta(n));
+		}
 		if (step) {
 			VisitStat& stat(visited[curaddr]);
 			stat.size = step;
@@ -177,6 +195,7 @@ void ghidra::FlowInfo::generateVmpBlockOps(VmpBasicBlock* bblock, bool buildRet)
 
 	//жûretβ
     if (buildRet) {
+		data.vm_insStart.push_back(obank.getUniqId());
 		VmpInstruction* endIns = static_cast<VmpInstruction*>(bblock->insList[bblock->insList.size() - 1].get());
 		ghidra::Address endAddr(glb->getDefaultCodeSpace(), endIns->addr.vmdata);
 		auto itEnd = std::prev(obank.endDead());
@@ -230,7 +249,7 @@ void ghidra::FlowInfo::generateVmpNodeOps(VmpNode* node)
             step = BuildFakeRet(data, curaddr);
         }
 		else {
-			step = glb->translate->oneInstruction(emitter, curaddr);
+			step = static_cast<VmpArchitecture*>(glb)->PcodeCache().OneInstruction(emitter, curaddr);
 		}
         if (step) {
 			VisitStat& stat(visited[curaddr]); // Mark that we visited this instruction
@@ -276,7 +295,7 @@ void ghidra::Funcdata::startVmpProcessing(void)
         followVmpNode(nodeInput);
     }
     else if (vm_basicblock) {
-        followVmpBasicBlock(vm_basicblock);
+        followVmpBasicBlock(vm_basicblock, vm_blockStart);
     }
 	else if (vm_func) {
         followVmpFunction(vm_func);
@@ -295,6 +314,8 @@ void ghidra::Funcdata::clearExtensionData()
 	actIdx = 0x0;
 	nodeInput = nullptr;
     vm_basicblock = nullptr;
+    vm_blockStart = 0x0;
+    vm_blockSlice = nullptr;
     vm_func = nullptr;
 }
 
@@ -351,9 +372,10 @@ void ghidra::Funcdata::followVmpFunction(VmpFunction* vmFunc)
 		flags |= baddata_present;
 }
 
-void ghidra::Funcdata::followVmpBasicBlock(VmpBasicBlock* node)
+void ghidra::Funcdata::followVmpBasicBlock(VmpBasicBlock* node, size_t startIndex)
 {
     vm_basicblock = node;
+    vm_blockStart = startIndex;
 	if (!obank.empty()) {
 		if ((flags & blocks_generated) == 0)
 			throw LowlevelError("Function loaded for inlining");
@@ -364,7 +386,7 @@ void ghidra::Funcdata::followVmpBasicBlock(VmpBasicBlock* node)
 	FlowInfo flow(*this, obank, bblocks, qlst);
 	flow.setFlags(fl);
 	flow.setMaximumInstructions(glb->max_instructions);
-    flow.generateVmpBlockOps(vm_basicblock, true);
+    flow.generateVmpBlockOps(vm_basicblock, true, vm_blockStart);
 	buildReturnVal();
 #ifdef DeveloperMode
 	std::stringstream ss;
@@ -449,7 +471,7 @@ void VmpNode::append(VmpNode& other)
     contextList.insert(contextList.end(), other.contextList.begin(), other.contextList.end());
 }
 
-VmAddress VmpNode::readVmAddress(const std::string& reg_code)
+VmAddress VmpNode::readVmAddress(VmpRegId reg_code)
 {
     VmAddress retaddr;
     if (addrList.empty()) {
@@ -460,11 +482,11 @@ VmAddress VmpNode::readVmAddress(const std::string& reg_code)
     return retaddr;
 }
 
-size_t VmpNode::findRegContext(size_t eip, const std::string& regName)
+size_t VmpNode::findRegContext(size_t eip, VmpRegId reg)
 {
     for (unsigned int n = 0; n < contextList.size(); ++n) {
         if (contextList[n].EIP == eip) {
-            return contextList[n].ReadReg(regName);
+            return contextList[n].ReadReg(reg);
         }
     }
     return 0x0;
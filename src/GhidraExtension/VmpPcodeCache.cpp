@@ -0,0 +1,93 @@
+#include "VmpPcodeCache.h"
+#include "../Ghidra/architecture.hh"
+#include <string.h>
+
+#ifdef DeveloperMode
+#pragma optimize("", off) 
+#endif
+
+//handler instructions of a whole session fit easily, drop everything beyond that
+const size_t MaxEntryCount = 0x40000;
+
+void VmpPcodeCache::RecordEmit::dump(const ghidra::Address& addr, ghidra::OpCode opc, ghidra::VarnodeData* outvar, ghidra::VarnodeData* vars, ghidra::int4 isize)
+{
+	RawPcode pcode;
+	pcode.addr = addr;
+	pcode.opc = opc;
+	pcode.bHasOut = (outvar != nullptr);
+	if (outvar) {
+		pcode.outVar = *outvar;
+	}
+	pcode.inVars.assign(vars, vars + isize);
+	pcodeList.push_back(std::move(pcode));
+}
+
+VmpPcodeCache::VmpPcodeCache(ghidra::Architecture* glb)
+{
+	arch = glb;
+}
+
+void VmpPcodeCache::Clear()
+{
+	entryMap.clear();
+}
+
+void VmpPcodeCache::readContext(const ghidra::Address& addr, std::vector<ghidra::uintm>& outContext)
+{
+	outContext.clear();
+	if (!arch->context) {
+		return;
+	}
+	const ghidra::uintm* words = arch->context->getContext(addr);
+	outContext.assign(words, words + arch->context->getContextSize());
+}
+
+bool VmpPcodeCache::isValidEntry(const CacheEntry& entry, const ghidra::Address& addr)
+{
+	//a changed context makes sleigh produce different pcode, the image bytes are trusted until Clear
+	if (arch->context) {
+		const ghidra::uintm* words = arch->context->getContext(addr);
+		if (entry.context.size() != arch->context->getContextSize()) {
+			return false;
+		}
+		if (memcmp(words, entry.context.data(), entry.context.size() * sizeof(ghidra::uintm))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void VmpPcodeCache::replay(CacheEntry& entry, ghidra::PcodeEmit& emit)
+{
+	for (RawPcode& pcode : entry.pcodeList) {
+		emit.dump(pcode.addr, pcode.opc, pcode.bHasOut ? &pcode.outVar : nullptr, pcode.inVars.data(), pcode.inVars.size());
+	}
+}
+
+ghidra::int4 VmpPcodeCache::OneInstruction(ghidra::PcodeEmit& emit, const ghidra::Address& addr)
+{
+	auto it = entryMap.find(addr.getOffset());
+	if (it != entryMap.end()) {
+		if (isValidEntry(it->second, addr)) {
+			replay(it->second, emit);
+			return it->second.length;
+		}
+		entryMap.erase(it);
+	}
+	//read the context before sleigh applies the commits of this instruction
+	CacheEntry entry;
+	readContext(addr, entry.context);
+	RecordEmit recorder(entry.pcodeList);
+	entry.length = arch->translate->oneInstruction(recorder, addr);
+	replay(entry, emit);
+	if (entryMap.size() >= MaxEntryCount) {
+		entryMap.clear();
+	}
+	ghidra::int4 length = entry.length;
+	entryMap[addr.getOffset()] = std::move(entry);
+	return length;
+}
+
+#ifdef DeveloperMode
+#pragma optimize("", on) 
+#endif
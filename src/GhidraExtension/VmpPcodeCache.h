@@ -0,0 +1,54 @@
+#pragma once
+#include <map>
+#include <vector>
+#include "../Ghidra/translate.hh"
+
+namespace ghidra
+{
+	class Architecture;
+}
+
+//raw pcode of single instructions, replayed instead of running sleigh again
+//address spaces belong to one translator, so every architecture owns its own cache
+
+class VmpPcodeCache
+{
+	struct RawPcode
+	{
+		ghidra::Address addr;
+		ghidra::OpCode opc;
+		bool bHasOut;
+		ghidra::VarnodeData outVar;
+		std::vector<ghidra::VarnodeData> inVars;
+	};
+	struct CacheEntry
+	{
+		ghidra::int4 length;
+		//context words the pcode was built from
+		std::vector<ghidra::uintm> context;
+		std::vector<RawPcode> pcodeList;
+	};
+	//collects the ops sleigh emits for one instruction
+	class RecordEmit :public ghidra::PcodeEmit
+	{
+	public:
+		RecordEmit(std::vector<RawPcode>& out) :pcodeList(out) {};
+		void dump(const ghidra::Address& addr, ghidra::OpCode opc, ghidra::VarnodeData* outvar, ghidra::VarnodeData* vars, ghidra::int4 isize) override;
+	private:
+		std::vector<RawPcode>& pcodeList;
+	};
+public:
+	VmpPcodeCache(ghidra::Architecture* glb);
+	~VmpPcodeCache() {};
+	//same as translate->oneInstruction, the pcode of a known instruction is replayed
+	ghidra::int4 OneInstruction(ghidra::PcodeEmit& emit, const ghidra::Address& addr);
+	//called from the idb byte_patched event, hits do not read the bytes again
+	void Clear();
+private:
+	bool isValidEntry(const CacheEntry& entry, const ghidra::Address& addr);
+	void readContext(const ghidra::Address& addr, std::vector<ghidra::uintm>& outContext);
+	void replay(CacheEntry& entry, ghidra::PcodeEmit& emit);
+private:
+	ghidra::Architecture* arch;
+	std::map<ghidra::uintb, CacheEntry> entryMap;
+};
@@ -0,0 +1,182 @@
+#include "VmpSpecCache.h"
+#include "../Ghidra/marshal.hh"
+#include "../Ghidra/error.hh"
+#include <fstream>
+#include <memory>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+
+#ifdef DeveloperMode
+#pragma optimize("", off) 
+#endif
+
+//bump when the snapshot layout changes
+const std::uint64_t SnapshotVersion = 0x2;
+
+//decoded snapshots by path, the documents live until the process exits
+struct DecodedSnapshot
+{
+	std::uint64_t specStamp;
+	std::vector<std::unique_ptr<ghidra::Document>> docList;
+};
+static std::mutex snapshotLock;
+static std::map<std::string, DecodedSnapshot> snapshotMap;
+static std::vector<std::unique_ptr<ghidra::Document>> retiredDocs;
+
+//ids above ELEM_UNKNOWN, they only appear in the snapshot file
+ghidra::ElementId ELEM_VMP_SPEC = ghidra::ElementId("vmp_spec", 0x400);
+ghidra::ElementId ELEM_VMP_SPECNODE = ghidra::ElementId("vmp_specnode", 0x401);
+ghidra::ElementId ELEM_VMP_SPECATTR = ghidra::ElementId("vmp_specattr", 0x402);
+
+static void encodeElement(ghidra::Encoder& encoder, const ghidra::Element* el)
+{
+	encoder.openElement(ELEM_VMP_SPECNODE);
+	encoder.writeString(ghidra::ATTRIB_NAME, el->getName());
+	if (!el->getContent().empty()) {
+		encoder.writeString(ghidra::ATTRIB_CONTENT, el->getContent());
+	}
+	for (int n = 0; n < el->getNumAttributes(); ++n) {
+		encoder.openElement(ELEM_VMP_SPECATTR);
+		encoder.writeString(ghidra::ATTRIB_NAME, el->getAttributeName(n));
+		encoder.writeString(ghidra::ATTRIB_VALUE, el->getAttributeValue(n));
+		encoder.closeElement(ELEM_VMP_SPECATTR);
+	}
+	const ghidra::List& children = el->getChildren();
+	for (auto it = children.begin(); it != children.end(); ++it) {
+		encodeElement(encoder, *it);
+	}
+	encoder.closeElement(ELEM_VMP_SPECNODE);
+}
+
+static void decodeElement(ghidra::Decoder& decoder, ghidra::Element* parent)
+{
+	ghidra::uint4 elemId = decoder.openElement(ELEM_VMP_SPECNODE);
+	//the parent owns the new element right away, nothing leaks on a decode error
+	ghidra::Element* el = new ghidra::Element(parent);
+	parent->addChild(el);
+	for (;;) {
+		ghidra::uint4 attribId = decoder.getNextAttributeId();
+		if (attribId == 0x0) {
+			break;
+		}
+		if (attribId == ghidra::ATTRIB_NAME) {
+			el->setName(decoder.readString());
+		}
+		else if (attribId == ghidra::ATTRIB_CONTENT) {
+			std::string content = decoder.readString();
+			el->addContent(content.c_str(), 0x0, content.size());
+		}
+	}
+	while (decoder.peekElement() == ELEM_VMP_SPECATTR) {
+		ghidra::uint4 attrId = decoder.openElement(ELEM_VMP_SPECATTR);
+		std::string name = decoder.readString(ghidra::ATTRIB_NAME);
+		std::string value = decoder.readString(ghidra::ATTRIB_VALUE);
+		el->addAttribute(name, value);
+		decoder.closeElement(attrId);
+	}
+	while (decoder.peekElement() == ELEM_VMP_SPECNODE) {
+		decodeElement(decoder, el);
+	}
+	decoder.closeElement(elemId);
+}
+
+std::uint64_t VmpSpecCache::StampSpecFiles(const std::vector<std::string>& fileList)
+{
+	//fnv-1a over the version, every path and the size and write time of every file
+	std::uint64_t hash = 0xcbf29ce484222325;
+	auto mix = [&hash](const void* data, size_t size) {
+		for (size_t n = 0; n < size; ++n) {
+			hash ^= ((const unsigned char*)data)[n];
+			hash *= 0x100000001b3;
+		}
+	};
+	mix(&SnapshotVersion, sizeof(SnapshotVersion));
+	for (const std::string& fileName : fileList) {
+		mix(fileName.c_str(), fileName.size() + 1);
+		std::uint64_t fileSize = 0x0;
+		std::uint64_t writeTime = 0x0;
+		struct stat fileStat;
+		if (stat(fileName.c_str(), &fileStat) == 0x0) {
+			fileSize = fileStat.st_size;
+			writeTime = fileStat.st_mtime;
+		}
+		mix(&fileSize, sizeof(fileSize));
+		mix(&writeTime, sizeof(writeTime));
+	}
+	return hash;
+}
+
+bool VmpSpecCache::LoadSnapshot(const std::string& path, std::uint64_t specStamp, ghidra::DocumentStorage& store)
+{
+	std::lock_guard<std::mutex> lock(snapshotLock);
+	auto itSnapshot = snapshotMap.find(path);
+	if (itSnapshot == snapshotMap.end() || itSnapshot->second.specStamp != specStamp) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			return false;
+		}
+		DecodedSnapshot snapshot;
+		snapshot.specStamp = specStamp;
+		try {
+			ghidra::PackedDecode decoder(nullptr);
+			decoder.ingestStream(file);
+			ghidra::uint4 elemId = decoder.openElement(ELEM_VMP_SPEC);
+			if (decoder.readUnsignedInteger(ghidra::ATTRIB_VALUE) != specStamp) {
+				return false;
+			}
+			while (decoder.peekElement() == ELEM_VMP_SPECNODE) {
+				std::unique_ptr<ghidra::Document> doc = std::make_unique<ghidra::Document>();
+				decodeElement(decoder, doc.get());
+				snapshot.docList.push_back(std::move(doc));
+			}
+			decoder.closeElement(elemId);
+		}
+		catch (ghidra::DecoderError&) {
+			return false;
+		}
+		catch (ghidra::LowlevelError&) {
+			return false;
+		}
+		if (snapshot.docList.empty()) {
+			return false;
+		}
+		//stores of older architectures may still point into a replaced entry, it is kept alive
+		if (itSnapshot != snapshotMap.end()) {
+			for (auto& doc : itSnapshot->second.docList) {
+				retiredDocs.push_back(std::move(doc));
+			}
+			itSnapshot->second = std::move(snapshot);
+		}
+		else {
+			itSnapshot = snapshotMap.emplace(path, std::move(snapshot)).first;
+		}
+	}
+	//the store only maps the tags, the documents stay owned by the snapshot
+	for (auto& doc : itSnapshot->second.docList) {
+		store.registerTag(doc->getRoot());
+	}
+	return true;
+}
+
+void VmpSpecCache::SaveSnapshot(const std::string& path, std::uint64_t specStamp, const std::vector<const ghidra::Element*>& rootList)
+{
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		return;
+	}
+	ghidra::PackedEncode encoder(file);
+	encoder.openElement(ELEM_VMP_SPEC);
+	encoder.writeUnsignedInteger(ghidra::ATTRIB_VALUE, specStamp);
+	for (const ghidra::Element* root : rootList) {
+		if (root) {
+			encodeElement(encoder, root);
+		}
+	}
+	encoder.closeElement(ELEM_VMP_SPEC);
+	file.close();
+}
+
+#ifdef DeveloperMode
+#pragma optimize("", on) 
+#endif
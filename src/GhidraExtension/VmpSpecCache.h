@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace ghidra
+{
+	class DocumentStorage;
+	class Element;
+}
+
+//binary snapshot of the parsed spec documents (pspec, cspec and sla)
+//written in the packed marshal format, later startups skip the xml parser
+//a decoded snapshot is kept for the process, every later architecture registers the same documents
+
+namespace VmpSpecCache
+{
+	//hash over the path, size and write time of the spec files, a snapshot is only used when it matches
+	std::uint64_t StampSpecFiles(const std::vector<std::string>& fileList);
+	//register the snapshot documents in the store, false if the file is missing or stale
+	bool LoadSnapshot(const std::string& path, std::uint64_t specStamp, ghidra::DocumentStorage& store);
+	void SaveSnapshot(const std::string& path, std::uint64_t specStamp, const std::vector<const ghidra::Element*>& rootList);
+}
@@ -43,8 +43,7 @@ std::vector<size_t> VmpBranchExtractor::ExtractVmAllBranch(ghidra::Funcdata* fd)
 	}
 	for (unsigned int n = 0; n < retOp->numInput(); ++n) {
 		ghidra::Varnode* vn = retOp->getIn(n);
-        std::string retRegName = fd->getArch()->translate->getRegisterName(vn->getSpace(), vn->getOffset(), vn->getSize());
-		if (retRegName != "EIP") {
+		if (GetVarnodeRegId(vn) != VmpRegister::REG_EIP) {
 			continue;
 		}
 		ghidra::PcodeOp* defOp = vn->getDef();
@@ -69,63 +68,159 @@ std::vector<size_t> VmpBranchExtractor::ExtractVmAllBranch(ghidra::Funcdata* fd)
     return nextBrachList;
 }
 
-void PcodeOpTracer::traceOpCode(ghidra::PcodeOp* op, bool bAccessMem, std::vector<TraceResult>& outResult)
+PcodeTraceSummary::TraceRoot PcodeTraceSummary::InputRoot(size_t opAddr, ghidra::Varnode* vn)
 {
-    if (!op) {
-        return;
-    }
-    auto code = op->code();
-    int inputNum = op->numInput();
-    if (code == ghidra::CPUI_CALLOTHER) {
-        ghidra::UserPcodeOp* userOp = fd->getArch()->userops.getOp(op->getIn(0)->getOffset());
-        if (userOp) {
-            TraceResult tmpResult;
-            tmpResult.name = userOp->getOperatorName(op);
-            tmpResult.addr = op->getAddr().getOffset();
-            if (!filterResult.count(tmpResult)) {
-                filterResult.insert(tmpResult);
-                outResult.push_back(tmpResult);
-            }
-        }
-        return;
-    }
-    if (code == ghidra::CPUI_LOAD) {
-        bAccessMem = true;
-    }
-    for (int n = 0; n < inputNum; ++n) {
-        traceNode(op->getAddr().getOffset(), op->getIn(n), bAccessMem, outResult);
-    }
+	TraceRoot retRoot;
+	auto it = inputNameCache.find(vn);
+	if (it != inputNameCache.end()) {
+		retRoot.reg = it->second;
+	}
+	else {
+		if (vn->getSpace()->getName() == "stack") {
+			retRoot.reg = VmpRegister::Intern("stack");
+		}
+		else if (vn->getSpace()->getName() == "ram") {
+			retRoot.reg = VmpRegister::Intern("ram");
+		}
+		else {
+			retRoot.reg = VmpRegister::FromVarnode(vn->getSpace(), vn->getOffset(), vn->getSize());
+		}
+		inputNameCache[vn] = retRoot.reg;
+	}
+	retRoot.addr = opAddr;
+	retRoot.bAccessMem = false;
+	retRoot.bUserOp = false;
+	retRoot.offset = vn->getOffset();
+	return retRoot;
 }
 
-void PcodeOpTracer::traceNode(size_t opAddr, ghidra::Varnode* vn, bool bAccessMem, std::vector<TraceResult>& outResult)
+void PcodeTraceSummary::buildOpRoots(ghidra::PcodeOp* op, std::vector<TraceRoot>& outRoots)
 {
-    if (vn->isInput()) {
-        TraceResult tmpResult;
-        if (vn->getSpace()->getName() == "stack") {
-            tmpResult.name = "stack";
-        }
-        else if (vn->getSpace()->getName() == "ram") {
-            tmpResult.name = "ram";
-        }
-        else {
-            tmpResult.name = fd->getArch()->translate->getRegisterName(vn->getSpace(), vn->getOffset(), vn->getSize());
-        }
-        tmpResult.addr = opAddr;
-        tmpResult.bAccessMem = bAccessMem;
-        tmpResult.offset = vn->getOffset();
-        if (!filterResult.count(tmpResult)) {
-            filterResult.insert(tmpResult);
-            outResult.push_back(tmpResult);
-        }
-        return;
-    }
-    traceOpCode(vn->getDef(), bAccessMem, outResult);
+	std::set<TraceRoot> filter;
+	auto addRoot = [&](TraceRoot root) {
+		if (op->code() == ghidra::CPUI_LOAD && !root.bUserOp) {
+			root.bAccessMem = true;
+		}
+		if (filter.insert(root).second) {
+			outRoots.push_back(root);
+		}
+	};
+	if (op->code() == ghidra::CPUI_CALLOTHER) {
+		ghidra::UserPcodeOp* userOp = fd->getArch()->userops.getOp(op->getIn(0)->getOffset());
+		if (userOp) {
+			TraceRoot tmpRoot;
+			tmpRoot.reg = VmpRegister::Intern(userOp->getOperatorName(op));
+			tmpRoot.addr = op->getAddr().getOffset();
+			tmpRoot.bAccessMem = false;
+			tmpRoot.bUserOp = true;
+			tmpRoot.offset = 0x0;
+			outRoots.push_back(tmpRoot);
+		}
+		return;
+	}
+	size_t opAddr = op->getAddr().getOffset();
+	for (int n = 0; n < op->numInput(); ++n) {
+		ghidra::Varnode* vn = op->getIn(n);
+		if (vn->isInput()) {
+			addRoot(InputRoot(opAddr, vn));
+			continue;
+		}
+		ghidra::PcodeOp* defOp = vn->getDef();
+		if (!defOp) {
+			continue;
+		}
+		auto it = opRoots.find(defOp);
+		if (it == opRoots.end()) {
+			continue;
+		}
+		for (const TraceRoot& root : it->second) {
+			addRoot(root);
+		}
+	}
+}
+
+const std::vector<PcodeTraceSummary::TraceRoot>& PcodeTraceSummary::OpRoots(ghidra::PcodeOp* op)
+{
+	auto itFind = opRoots.find(op);
+	if (itFind != opRoots.end()) {
+		return itFind->second;
+	}
+	//post-order walk, children are summarised before their users
+	std::set<ghidra::PcodeOp*> inProgress;
+	std::vector<std::pair<ghidra::PcodeOp*, bool>> workList;
+	workList.push_back(std::make_pair(op, false));
+	while (!workList.empty()) {
+		auto curItem = workList.back();
+		workList.pop_back();
+		ghidra::PcodeOp* curOp = curItem.first;
+		if (curItem.second) {
+			std::vector<TraceRoot> roots;
+			buildOpRoots(curOp, roots);
+			opRoots[curOp] = std::move(roots);
+			inProgress.erase(curOp);
+			continue;
+		}
+		if (opRoots.count(curOp) || inProgress.count(curOp)) {
+			continue;
+		}
+		inProgress.insert(curOp);
+		workList.push_back(std::make_pair(curOp, true));
+		if (curOp->code() == ghidra::CPUI_CALLOTHER) {
+			continue;
+		}
+		for (int n = curOp->numInput() - 1; n >= 0; --n) {
+			ghidra::Varnode* vn = curOp->getIn(n);
+			if (vn->isInput()) {
+				continue;
+			}
+			ghidra::PcodeOp* defOp = vn->getDef();
+			if (defOp && !opRoots.count(defOp) && !inProgress.count(defOp)) {
+				workList.push_back(std::make_pair(defOp, false));
+			}
+		}
+	}
+	return opRoots[op];
+}
+
+PcodeOpTracer::PcodeOpTracer(ghidra::Funcdata* f)
+{
+	ownSummary = std::make_unique<PcodeTraceSummary>(f);
+	summary = ownSummary.get();
+}
+
+PcodeOpTracer::PcodeOpTracer(PcodeTraceSummary& s)
+{
+	summary = &s;
+}
+
+void PcodeOpTracer::addResult(const PcodeTraceSummary::TraceRoot& root, std::vector<TraceResult>& outResult)
+{
+	if (!filterResult.insert(root).second) {
+		return;
+	}
+	TraceResult tmpResult;
+	tmpResult.reg = root.reg;
+	tmpResult.addr = root.addr;
+	tmpResult.bAccessMem = root.bAccessMem;
+	tmpResult.offset = root.offset;
+	outResult.push_back(tmpResult);
 }
 
 std::vector<TraceResult> PcodeOpTracer::TraceInput(size_t startAddr, ghidra::Varnode* vn)
 {
     std::vector<TraceResult> retResult;
-    traceNode(startAddr, vn, false, retResult);
+	if (vn->isInput()) {
+		addResult(summary->InputRoot(startAddr, vn), retResult);
+		return retResult;
+	}
+	ghidra::PcodeOp* defOp = vn->getDef();
+	if (!defOp) {
+		return retResult;
+	}
+	const auto& roots = summary->OpRoots(defOp);
+	for (const auto& root : roots) {
+		addResult(root, retResult);
+	}
     return retResult;
 }
 
@@ -134,10 +229,15 @@ std::string GhidraHelper::GetVarnodeRegName(ghidra::Varnode* vn)
 	if (vn->getSpace()->getName() != "register") {
 		return "";
 	}
-	return gArch->translate->getRegisterName(vn->getSpace(), vn->getOffset(), vn->getSize());
+	return vn->getSpace()->getTrans()->getRegisterName(vn->getSpace(), vn->getOffset(), vn->getSize());
+}
+
+VmpRegId GhidraHelper::GetVarnodeRegId(ghidra::Varnode* vn)
+{
+	return VmpRegister::FromVarnode(vn->getSpace(), vn->getOffset(), vn->getSize());
 }
 
 std::string GhidraHelper::GetVarnodeRegName(const ghidra::VarnodeData& vn)
 {
-	return gArch->translate->getRegisterName(vn.space, vn.offset, vn.size);
+	return vn.space->getTrans()->getRegisterName(vn.space, vn.offset, vn.size);
 }
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include <vector>
 #include <string>
 #include <set>
+#include <tuple>
+#include <memory>
+#include "VmpRegister.h"
 
 //һЩGhidraķװ
 
@@ -20,12 +23,13 @@ namespace GhidraHelper
 	struct TraceResult
 	{
 		TraceResult() {
+			reg = VmpRegister::REG_NONE;
 			addr = 0x0;
 			bAccessMem = false;
 			offset = 0x0;
 		}
-		//
-		std::string name;
+		//interned register or userop name
+		VmpRegId reg;
 		//ַָ
 		size_t addr;
 		//ǷΪڴ
@@ -42,22 +46,52 @@ namespace GhidraHelper
 			if (offset != other.offset) {
 				return offset < other.offset;
 			}
-			return name < other.name;
+			return reg < other.reg;
 		}
 	};
 
+	//trace roots of every pcodeop in a funcdata, computed once per op
+	class PcodeTraceSummary
+	{
+	public:
+		struct TraceRoot
+		{
+			VmpRegId reg;
+			size_t addr;
+			bool bAccessMem;
+			//roots from CALLOTHER never become memory accesses
+			bool bUserOp;
+			std::uint64_t offset;
+			bool operator<(const TraceRoot& other) const {
+				return std::tie(addr, bAccessMem, offset, reg) < std::tie(other.addr, other.bAccessMem, other.offset, other.reg);
+			}
+		};
+	public:
+		PcodeTraceSummary(ghidra::Funcdata* f) { fd = f; };
+		~PcodeTraceSummary() {};
+		const std::vector<TraceRoot>& OpRoots(ghidra::PcodeOp* op);
+		TraceRoot InputRoot(size_t opAddr, ghidra::Varnode* vn);
+	private:
+		void buildOpRoots(ghidra::PcodeOp* op, std::vector<TraceRoot>& outRoots);
+	private:
+		ghidra::Funcdata* fd;
+		std::map<ghidra::PcodeOp*, std::vector<TraceRoot>> opRoots;
+		std::map<ghidra::Varnode*, VmpRegId> inputNameCache;
+	};
+
     class PcodeOpTracer
     {
     public:
-        PcodeOpTracer(ghidra::Funcdata* f) { fd = f; };
+        PcodeOpTracer(ghidra::Funcdata* f);
+        PcodeOpTracer(PcodeTraceSummary& s);
         ~PcodeOpTracer() {};
         std::vector<TraceResult> TraceInput(size_t startAddr, ghidra::Varnode* vn);
     private:
-        void traceNode(size_t opAddr, ghidra::Varnode* vn, bool bAccessMem, std::vector<TraceResult>& outResult);
-        void traceOpCode(ghidra::PcodeOp* op, bool bAccessMem, std::vector<TraceResult>& outResult);
+        void addResult(const PcodeTraceSummary::TraceRoot& root, std::vector<TraceResult>& outResult);
     private:
-        ghidra::Funcdata* fd;
-        std::set<TraceResult> filterResult;
+        std::unique_ptr<PcodeTraceSummary> ownSummary;
+        PcodeTraceSummary* summary;
+        std::set<PcodeTraceSummary::TraceRoot> filterResult;
     };
 
 
@@ -74,5 +108,7 @@ namespace GhidraHelper
 
 	std::string GetVarnodeRegName(ghidra::Varnode* vn);
 
+	VmpRegId GetVarnodeRegId(ghidra::Varnode* vn);
+
 	std::string GetVarnodeRegName(const ghidra::VarnodeData& vn);
 }
\ No newline at end of file
@@ -8,6 +8,11 @@
 #include <frame.hpp>
 #include <sstream>
 #include <iomanip>
+#include <thread>
+#include "../Manager/SectionManager.h"
+
+//the plugin is loaded by the ida main thread
+static const std::thread::id mainThreadId = std::this_thread::get_id();
 
 void IDAWrapper::show_wait_box(const char* msg)
 {
@@ -21,6 +26,10 @@ void IDAWrapper::hide_wait_box()
 
 int IDAWrapper::get_bytes(void* buf, unsigned int size, unsigned int ea, int gmb_flags /*= 0*/, void* mask /*= nullptr*/)
 {
+    //worker threads read from the segment snapshot instead
+    if (!isMainThread()) {
+        return SectionManager::Main().ReadBytes(buf, size, ea);
+    }
     return ::get_bytes(buf, size, ea, gmb_flags, mask);
 }
 
@@ -165,10 +174,32 @@ bool IDAWrapper::is64BitProgram()
     return inf_is_64bit();
 }
 
-bool IDAWrapper::isVmpEntry(size_t startAddr)
+static const char* const VmpEntryComment = "vmp entry";
+
+std::vector<size_t> IDAWrapper::findVmpEntries()
 {
-	if (IDAWrapper::get_cmt(startAddr) == "vmp entry") {
-		return true;
+	std::vector<size_t> retList;
+	ea_t maxEa = inf_get_max_ea();
+	//next_that starts after the address it is given
+	ea_t ea = inf_get_min_ea();
+	if (!has_cmt(get_flags(ea))) {
+		ea = next_that(ea, maxEa, f_has_cmt);
 	}
-	return false;
+	while (ea != BADADDR) {
+		if (IDAWrapper::get_cmt(ea) == VmpEntryComment) {
+			retList.push_back(ea);
+		}
+		ea = next_that(ea, maxEa, f_has_cmt);
+	}
+	return retList;
+}
+
+void IDAWrapper::setVmpEntry(size_t startAddr, bool bMark)
+{
+	IDAWrapper::set_cmt(startAddr, bMark ? VmpEntryComment : "", false);
+}
+
+bool IDAWrapper::isMainThread()
+{
+	return std::this_thread::get_id() == mainThreadId;
 }
\ No newline at end of file
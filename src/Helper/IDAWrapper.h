@@ -34,5 +34,10 @@ public:
 
     static bool is64BitProgram();
 
-	static bool isVmpEntry(size_t startAddr);
+	//vm entries are saved as a comment, VmpEntryIndex keeps them in memory
+	static std::vector<size_t> findVmpEntries();
+	static void setVmpEntry(size_t startAddr, bool bMark);
+
+	//ida api may only be called from the main thread
+	static bool isMainThread();
 };
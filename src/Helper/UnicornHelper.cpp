@@ -122,81 +122,58 @@ std::uint32_t reg_context::ReadReg(x86_reg reg)
     return 0x0;
 }
 
-std::uint32_t reg_context::ReadReg(const std::string& regName)
+std::uint32_t reg_context::ReadReg(VmpRegId reg)
 {
-    if (regName == "AL") {
+    switch (reg) {
+    case VmpRegister::REG_AL:
         return EAX & 0xFF;
-    }
-    else if (regName == "BL") {
+    case VmpRegister::REG_BL:
         return EBX & 0xFF;
-    }
-    else if (regName == "CL") {
+    case VmpRegister::REG_CL:
         return ECX & 0xFF;
-    }
-    else if (regName == "DL") {
+    case VmpRegister::REG_DL:
         return EDX & 0xFF;
-    }
-    else if (regName == "AH") {
+    case VmpRegister::REG_AH:
         return EAX & 0xFF00;
-    }
-    else if (regName == "BH") {
+    case VmpRegister::REG_BH:
         return EBX & 0xFF00;
-    }
-    else if (regName == "CH") {
+    case VmpRegister::REG_CH:
         return ECX & 0xFF00;
-    }
-    else if (regName == "DH") {
+    case VmpRegister::REG_DH:
         return EDX & 0xFF00;
-    }
-    else if (regName == "AX") {
+    case VmpRegister::REG_AX:
         return EAX & 0xFFFF;
-    }
-    else if (regName == "BX") {
+    case VmpRegister::REG_BX:
         return EBX & 0xFFFF;
-    }
-    else if (regName == "CX") {
+    case VmpRegister::REG_CX:
         return ECX & 0xFFFF;
-    }
-    else if (regName == "DX") {
+    case VmpRegister::REG_DX:
         return EDX & 0xFFFF;
-    }
-    else if (regName == "SP") {
+    case VmpRegister::REG_SP:
         return ESP & 0xFFFF;
-    }
-    else if (regName == "BP") {
+    case VmpRegister::REG_BP:
         return EBP & 0xFFFF;
-    }
-    else if (regName == "SI") {
+    case VmpRegister::REG_SI:
         return ESI & 0xFFFF;
-    }
-    else if (regName == "DI") {
+    case VmpRegister::REG_DI:
         return EDI & 0xFFFF;
-    }
-    else if (regName == "EAX") {
+    case VmpRegister::REG_EAX:
         return EAX;
-    }
-    else if (regName == "EBX") {
+    case VmpRegister::REG_EBX:
         return EBX;
-    }
-    else if (regName == "ECX") {
+    case VmpRegister::REG_ECX:
         return ECX;
-    }
-    else if (regName == "EDX") {
+    case VmpRegister::REG_EDX:
         return EDX;
-    }
-    else if (regName == "ESP") {
+    case VmpRegister::REG_ESP:
         return ESP;
-    }
-    else if (regName == "EBP") {
+    case VmpRegister::REG_EBP:
         return EBP;
-    }
-    else if (regName == "ESI") {
+    case VmpRegister::REG_ESI:
         return ESI;
-    }
-    else if (regName == "EDI") {
+    case VmpRegister::REG_EDI:
         return EDI;
-    }
-    else if (regName == "eflags") {
+    case VmpRegister::REG_EFLAGS:
         return EFLAGS;
     }
     return 0x0;
@@ -220,34 +197,34 @@ std::unique_ptr<VmpUnicornContext> VmpUnicornContext::DefaultContext()
     return retContext;
 }
 
-void VmpUnicornContext::FixVmJmpVal(const std::string& reg_stack, size_t newVal)
+void VmpUnicornContext::FixVmJmpVal(VmpRegId reg_stack, size_t newVal)
 {
     size_t newVspVal = context.ESP + 0xC0;
-    if (reg_stack == "EAX") {
+    if (reg_stack == VmpRegister::REG_EAX) {
         context.EAX = newVspVal;
     }
-    else if (reg_stack == "EBX") {
+    else if (reg_stack == VmpRegister::REG_EBX) {
 		context.EBX = newVspVal;
 	}
-	else if (reg_stack == "ECX") {
+	else if (reg_stack == VmpRegister::REG_ECX) {
 		context.ECX = newVspVal;
 	}
-	else if (reg_stack == "EDX") {
+	else if (reg_stack == VmpRegister::REG_EDX) {
 		context.EDX = newVspVal;
 	}
-	else if (reg_stack == "EBP") {
+	else if (reg_stack == VmpRegister::REG_EBP) {
 		context.EBP = newVspVal;
 	}
-	else if (reg_stack == "ESI") {
+	else if (reg_stack == VmpRegister::REG_ESI) {
 		context.ESI = newVspVal;
 	}
-	else if (reg_stack == "EDI") {
+	else if (reg_stack == VmpRegister::REG_EDI) {
 		context.EDI = newVspVal;
 	}
     SetVmJmpVal(reg_stack, newVal);
 }
 
-void VmpUnicornContext::SetVmJmpVal(const std::string& reg_stack, size_t newVal)
+void VmpUnicornContext::SetVmJmpVal(VmpRegId reg_stack, size_t newVal)
 {
     size_t vmStack = context.ReadReg(reg_stack);
     int stackOffset = vmStack - stackCodeBase;
@@ -256,27 +233,27 @@ void VmpUnicornContext::SetVmJmpVal(const std::string& reg_stack, size_t newVal)
 	}
 }
 
-void VmpUnicornContext::SetVmCodeVal(const std::string& reg_code, size_t newVal)
+void VmpUnicornContext::SetVmCodeVal(VmpRegId reg_code, size_t newVal)
 {
-    if (reg_code == "EAX") {
+    if (reg_code == VmpRegister::REG_EAX) {
         context.EAX = newVal;
     }
-    else if (reg_code == "EBX") {
+    else if (reg_code == VmpRegister::REG_EBX) {
 		context.EBX = newVal;
     }
-    else if (reg_code == "ECX") {
+    else if (reg_code == VmpRegister::REG_ECX) {
 		context.ECX = newVal;
 	}
-	else if (reg_code == "EDX") {
+	else if (reg_code == VmpRegister::REG_EDX) {
 		context.EDX = newVal;
 	}
-	else if (reg_code == "EBP") {
+	else if (reg_code == VmpRegister::REG_EBP) {
 		context.EBP = newVal;
 	}
-	else if (reg_code == "ESI") {
+	else if (reg_code == VmpRegister::REG_ESI) {
 		context.ESI = newVal;
 	}
-	else if (reg_code == "EDI") {
+	else if (reg_code == VmpRegister::REG_EDI) {
 		context.EDI = newVal;
 	}
 }
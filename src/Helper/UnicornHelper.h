@@ -2,6 +2,7 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include "VmpRegister.h"
 
 enum x86_reg;
 struct cs_x86_op;
@@ -21,7 +22,7 @@ struct reg_context
 public:
     std::uint32_t ReadReg(x86_reg reg);
     std::uint32_t ReadMemReg(cs_x86_op& op);
-    std::uint32_t ReadReg(const std::string& regName);
+    std::uint32_t ReadReg(VmpRegId reg);
 };
 
 std::string GetX86RegName(x86_reg reg);
@@ -31,9 +32,9 @@ class VmpUnicornContext
 public:
     static std::unique_ptr<VmpUnicornContext> DefaultContext();
     static size_t DefaultEsp();
-    void SetVmJmpVal(const std::string& reg_stack, size_t newVal);
-	void FixVmJmpVal(const std::string& reg_stack, size_t newVal);
-    void SetVmCodeVal(const std::string& reg_code, size_t newVal);
+    void SetVmJmpVal(VmpRegId reg_stack, size_t newVal);
+	void FixVmJmpVal(VmpRegId reg_stack, size_t newVal);
+    void SetVmCodeVal(VmpRegId reg_code, size_t newVal);
 public:
     reg_context context;
     size_t stackCodeBase;
@@ -1,187 +1,799 @@
 #include "VmpBlockAnalyzer.h"
 #include "../Ghidra/funcdata.hh"
 #include "./GhidraHelper.h"
-#include "../Manager/exceptions.h"
 #include "../VmpCore/VmpBlockBuilder.h"
 #include "../GhidraExtension/VmpControlFlow.h"
+#include <set>
+#include <unordered_set>
 
 #ifdef DeveloperMode
 #pragma optimize("", off) 
 #endif
 
-z3::expr DeepStackFix::EvaluatePcodeOp(z3::context& ctx, ghidra::PcodeOp* defOp)
+void BlockWriterIndex::Build(ghidra::BlockBasic* block)
 {
-	if (!defOp) {
-		return ctx.bv_const("empty", 32);
+	Clear();
+	bb = block;
+	int pos = 0x0;
+	for (auto it = bb->beginOp(); it != bb->endOp(); ++it, ++pos) {
+		ghidra::PcodeOp* curOp = *it;
+		opPos[curOp] = pos;
+		Writer writer;
+		writer.pos = pos;
+		writer.op = curOp;
+		if (curOp->code() == ghidra::CPUI_STORE) {
+			ghidra::Varnode* vPtr = curOp->getIn(1);
+			storeMap[std::make_pair(vPtr->getSpace(), vPtr->getOffset())].push_back(writer);
+			continue;
+		}
+		ghidra::Varnode* vOut = curOp->getOut();
+		if (!vOut) {
+			continue;
+		}
+		writerMap[std::make_pair(vOut->getSpace(), vOut->getOffset())].push_back(writer);
+		int& spaceMax = maxSize[vOut->getSpace()];
+		if (vOut->getSize() > spaceMax) {
+			spaceMax = vOut->getSize();
+		}
+	}
+}
+
+void BlockWriterIndex::Clear()
+{
+	bb = nullptr;
+	opPos.clear();
+	writerMap.clear();
+	storeMap.clear();
+	maxSize.clear();
+}
+
+ghidra::PcodeOp* BlockWriterIndex::FindWriter(ghidra::PcodeOp* op, ghidra::Varnode* vn) const
+{
+	auto itPos = opPos.find(op);
+	if (itPos == opPos.end()) {
+		return nullptr;
+	}
+	auto itMax = maxSize.find(vn->getSpace());
+	if (itMax == maxSize.end()) {
+		return nullptr;
+	}
+	//only writers starting in [offset - maxSize + 1, offset + size) can overlap
+	std::uint64_t readStart = vn->getOffset();
+	std::uint64_t readEnd = readStart + vn->getSize();
+	std::uint64_t lowStart = 0x0;
+	if (readStart >= std::uint64_t(itMax->second - 1)) {
+		lowStart = readStart - (itMax->second - 1);
+	}
+	const Writer* bestWriter = nullptr;
+	auto itWriter = writerMap.lower_bound(std::make_pair(vn->getSpace(), lowStart));
+	auto itStop = writerMap.lower_bound(std::make_pair(vn->getSpace(), readEnd));
+	for (; itWriter != itStop; ++itWriter) {
+		const std::vector<Writer>& writerList = itWriter->second;
+		auto itLast = std::lower_bound(writerList.begin(), writerList.end(), itPos->second, [](const Writer& w, int pos) {
+			return w.pos < pos;
+		});
+		while (itLast != writerList.begin()) {
+			--itLast;
+			if (bestWriter && itLast->pos < bestWriter->pos) {
+				break;
+			}
+			ghidra::Varnode* vOut = itLast->op->getOut();
+			if (vOut->getOffset() + vOut->getSize() > readStart) {
+				bestWriter = &(*itLast);
+				break;
+			}
+		}
+	}
+	if (!bestWriter) {
+		return nullptr;
+	}
+	return bestWriter->op;
+}
+
+ghidra::PcodeOp* BlockWriterIndex::FindStore(ghidra::PcodeOp* op, ghidra::Varnode* ptr) const
+{
+	auto itPos = opPos.find(op);
+	if (itPos == opPos.end()) {
+		return nullptr;
+	}
+	auto itStore = storeMap.find(std::make_pair(ptr->getSpace(), ptr->getOffset()));
+	if (itStore == storeMap.end()) {
+		return nullptr;
+	}
+	const std::vector<Writer>& storeList = itStore->second;
+	auto itLast = std::lower_bound(storeList.begin(), storeList.end(), itPos->second, [](const Writer& w, int pos) {
+		return w.pos < pos;
+	});
+	if (itLast == storeList.begin()) {
+		return nullptr;
+	}
+	--itLast;
+	return itLast->op;
+}
+
+bool PcodeExprEvaluator::resolveInput(const OpInput& input, StackSource& out)
+{
+	out = StackSource();
+	ghidra::Varnode* vn = input.vn;
+	ghidra::PcodeOp* defOp = vn->getDef();
+	if (defOp) {
+		out.writer = defOp;
+		return true;
+	}
+	if (vn->isConstant()) {
+		out.value = vn->getAddr().getOffset();
+		return true;
+	}
+	//registers hold ESP, VSP and the vm pointers on entry, they do not make a tail untrustworthy
+	if (vn->isInput()) {
+		out.reg = GhidraHelper::GetVarnodeRegId(vn);
+		if (out.reg != VmpRegister::REG_NONE) {
+			return true;
+		}
+	}
+	if (vn->getSpace()->getName() == "stack") {
+		return ResolveStackVarnode(input.reader, vn, out);
+	}
+	return false;
+}
+
+const PcodeExprEvaluator::OpNode& PcodeExprEvaluator::opNode(ghidra::PcodeOp* defOp)
+{
+	auto itNode = opGraph.find(defOp);
+	if (itNode != opGraph.end()) {
+		return itNode->second;
 	}
+	OpNode& node = opGraph[defOp];
+	std::vector<OpInput> inputList;
+	bool bCollected = true;
 	switch (defOp->code())
 	{
+	case ghidra::CPUI_COPY:
+	case ghidra::CPUI_INT_NEGATE:
+		inputList.push_back(OpInput{ defOp, defOp->getIn(0) });
+		break;
 	case ghidra::CPUI_INT_ADD:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) + EvaluateVarnode(ctx, defOp, defOp->getIn(1));
 	case ghidra::CPUI_INT_SUB:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) - EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_COPY:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0));
+	case ghidra::CPUI_INT_AND:
+	case ghidra::CPUI_INT_OR:
+	case ghidra::CPUI_INT_XOR:
+		inputList.push_back(OpInput{ defOp, defOp->getIn(0) });
+		inputList.push_back(OpInput{ defOp, defOp->getIn(1) });
+		break;
+	default:
+		bCollected = CollectSpecialInputs(defOp, inputList);
 		break;
+	}
+	if (!bCollected) {
+		return node;
+	}
+	node.inputs.resize(inputList.size());
+	for (size_t n = 0; n < inputList.size(); ++n) {
+		if (!resolveInput(inputList[n], node.inputs[n])) {
+			return node;
+		}
+	}
+	node.bSupported = true;
+	return node;
+}
+
+bool PcodeExprEvaluator::buildEvalOrder(ghidra::PcodeOp* root, const std::function<bool(ghidra::PcodeOp*)>& isDone, std::vector<ghidra::PcodeOp*>& outOrder)
+{
+	outOrder.clear();
+	if (isDone(root)) {
+		return true;
+	}
+	//post order walk with an explicit stack, deep expressions do not recurse
+	//op and the index of its next input to visit
+	std::vector<std::pair<ghidra::PcodeOp*, size_t>> walkStack;
+	//false while the op is on the walk stack, true once it is ordered
+	std::unordered_map<ghidra::PcodeOp*, bool> walkState;
+	walkStack.emplace_back(root, 0x0);
+	walkState[root] = false;
+	while (!walkStack.empty()) {
+		ghidra::PcodeOp* curOp = walkStack.back().first;
+		const OpNode& node = opNode(curOp);
+		bool bFailed = !node.bSupported;
+		ghidra::PcodeOp* nextOp = nullptr;
+		while (!bFailed && walkStack.back().second < node.inputs.size()) {
+			ghidra::PcodeOp* writer = node.inputs[walkStack.back().second++].writer;
+			if (!writer || isDone(writer)) {
+				continue;
+			}
+			auto itState = walkState.find(writer);
+			if (itState == walkState.end()) {
+				nextOp = writer;
+				break;
+			}
+			//a writer still on the stack means the dataflow loops
+			if (!itState->second) {
+				bFailed = true;
+			}
+		}
+		if (bFailed) {
+			//every op on the stack depends on the failed one
+			for (auto& frame : walkStack) {
+				opGraph[frame.first].bSupported = false;
+			}
+			return false;
+		}
+		if (nextOp) {
+			walkStack.emplace_back(nextOp, 0x0);
+			walkState[nextOp] = false;
+			continue;
+		}
+		walkState[curOp] = true;
+		outOrder.push_back(curOp);
+		walkStack.pop_back();
+	}
+	return true;
+}
+
+z3::expr PcodeExprEvaluator::sourceExpr(const StackSource& src)
+{
+	if (src.writer) {
+		return opMemo.at(src.writer);
+	}
+	if (src.reg != VmpRegister::REG_NONE) {
+		return Z3Context().bv_const(VmpRegister::Name(src.reg).c_str(), 32);
+	}
+	return Z3Context().bv_val(src.value, 32);
+}
+
+bool PcodeExprEvaluator::IsRegConst(const z3::expr& e, VmpRegId reg)
+{
+	return e.is_const() && z3::eq(e, sourceExpr(StackSource::FromReg(reg)));
+}
+
+bool PcodeExprEvaluator::evaluateOp(ghidra::PcodeOp* defOp, const std::vector<z3::expr>& inputs, z3::expr& out)
+{
+	switch (defOp->code())
+	{
+	case ghidra::CPUI_INT_ADD:
+		out = inputs[0] + inputs[1];
+		return true;
+	case ghidra::CPUI_INT_SUB:
+		out = inputs[0] - inputs[1];
+		return true;
+	case ghidra::CPUI_COPY:
+		out = inputs[0];
+		return true;
 	case ghidra::CPUI_INT_AND:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) & EvaluateVarnode(ctx, defOp, defOp->getIn(1));
+		out = inputs[0] & inputs[1];
+		return true;
 	case ghidra::CPUI_INT_OR:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) | EvaluateVarnode(ctx, defOp, defOp->getIn(1));
+		out = inputs[0] | inputs[1];
+		return true;
+	case ghidra::CPUI_INT_XOR:
+		out = inputs[0] ^ inputs[1];
+		return true;
 	case ghidra::CPUI_INT_NEGATE:
-		return ~EvaluateVarnode(ctx, defOp, defOp->getIn(0));
-	case ghidra::CPUI_INT_MULT:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) * EvaluateVarnode(ctx, defOp, defOp->getIn(1));
+		out = ~inputs[0];
+		return true;
 	default:
 		break;
 	}
-	throw Exception("bad defcode");
+	return EvaluateSpecialOp(defOp, inputs, out);
 }
 
-z3::expr DeepStackFix::EvalutaeStackVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn)
+bool PcodeExprEvaluator::EvaluatePcodeOp(ghidra::PcodeOp* defOp, z3::expr& out)
 {
-	//λԭʼop
-	std::list<ghidra::PcodeOp*>::iterator it = bb->endOp();
-	auto itBegin = bb->beginOp();
-	while (it != bb->beginOp()) {
-		--it;
-		ghidra::PcodeOp* curOp = *it;
-		if (curOp == op) {
-			break;
+	if (!defOp) {
+		out = Z3Context().bv_const("empty", 32);
+		return true;
+	}
+	//every op is evaluated once, shared inputs reuse the same z3 node
+	std::vector<ghidra::PcodeOp*> evalOrder;
+	if (!buildEvalOrder(defOp, [this](ghidra::PcodeOp* op) { return opMemo.count(op) != 0; }, evalOrder)) {
+		return false;
+	}
+	std::vector<z3::expr> inputs;
+	for (ghidra::PcodeOp* curOp : evalOrder) {
+		const OpNode& node = opGraph[curOp];
+		inputs.clear();
+		for (const StackSource& src : node.inputs) {
+			inputs.push_back(sourceExpr(src));
+		}
+		z3::expr result(Z3Context());
+		if (!evaluateOp(curOp, inputs, result)) {
+			opGraph[curOp].bSupported = false;
+			return false;
 		}
+		opMemo.emplace(curOp, result);
 	}
-	while (it != itBegin) {
-		--it;
-		ghidra::PcodeOp* curOp = *it;
-		ghidra::Varnode* vOut = curOp->getOut();
-		if (!vOut) {
-			continue;
+	out = opMemo.at(defOp);
+	return true;
+}
+
+bool PcodeExprEvaluator::EvaluateVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, z3::expr& out)
+{
+	StackSource src;
+	if (!resolveInput(OpInput{ op, vn }, src)) {
+		return false;
+	}
+	if (src.writer) {
+		return EvaluatePcodeOp(src.writer, out);
+	}
+	out = sourceExpr(src);
+	return true;
+}
+
+bool PcodeExprEvaluator::CollectSpecialInputs(ghidra::PcodeOp* defOp, std::vector<OpInput>& outInputs)
+{
+	return false;
+}
+
+bool PcodeExprEvaluator::EvaluateSpecialOp(ghidra::PcodeOp* defOp, const std::vector<z3::expr>& inputs, z3::expr& out)
+{
+	return false;
+}
+
+bool PcodeExprEvaluator::SimplifySpecialOp(ghidra::PcodeOp* defOp, const std::vector<LinearExpr>& inputs, LinearExpr& out)
+{
+	return false;
+}
+
+bool PcodeExprEvaluator::linearOp(ghidra::PcodeOp* defOp, const std::vector<LinearExpr>& inputs, LinearExpr& out)
+{
+	switch (defOp->code())
+	{
+	case ghidra::CPUI_COPY:
+		out = inputs[0];
+		return true;
+	case ghidra::CPUI_INT_ADD:
+	case ghidra::CPUI_INT_SUB:
+	{
+		const LinearExpr& a = inputs[0];
+		const LinearExpr& b = inputs[1];
+		//two different registers do not fold into one term
+		if (!a.IsConst() && !b.IsConst() && a.reg != b.reg) {
+			return false;
 		}
-		if (vOut->getSpace() != vn->getSpace()) {
-			continue;
+		out.reg = a.IsConst() ? b.reg : a.reg;
+		if (defOp->code() == ghidra::CPUI_INT_ADD) {
+			out.coef = a.coef + b.coef;
+			out.offset = a.offset + b.offset;
 		}
-		if (vOut->getOffset() != vn->getOffset()) {
-			continue;
+		else {
+			out.coef = a.coef - b.coef;
+			out.offset = a.offset - b.offset;
+		}
+		return true;
+	}
+	case ghidra::CPUI_INT_NEGATE:
+		//~x == -x - 1
+		out.reg = inputs[0].reg;
+		out.coef = 0x0 - inputs[0].coef;
+		out.offset = ~inputs[0].offset;
+		return true;
+	case ghidra::CPUI_INT_AND:
+	case ghidra::CPUI_INT_OR:
+	{
+		LinearExpr a = inputs[0];
+		LinearExpr b = inputs[1];
+		bool bAnd = (defOp->code() == ghidra::CPUI_INT_AND);
+		if (a.IsConst() && b.IsConst()) {
+			out.offset = bAnd ? (a.offset & b.offset) : (a.offset | b.offset);
+			return true;
 		}
-		if(vOut->getSize() != vn->getSize()){
-			//To do...
+		if (a == b) {
+			out = a;
+			return true;
+		}
+		if (b.IsConst()) {
+			std::swap(a, b);
+		}
+		if (a.IsConst()) {
+			//x & 0, x & -1, x | 0, x | -1
+			if (a.offset == 0x0) {
+				out = bAnd ? a : b;
+				return true;
+			}
+			if (a.offset == 0xFFFFFFFF) {
+				out = bAnd ? b : a;
+				return true;
+			}
+			return false;
+		}
+		//x & ~x, x | ~x
+		if (a.reg == b.reg && b.coef == 0x0 - a.coef && b.offset == ~a.offset) {
+			out.offset = bAnd ? 0x0 : 0xFFFFFFFF;
+			return true;
+		}
+		return false;
+	}
+	case ghidra::CPUI_INT_XOR:
+	{
+		LinearExpr a = inputs[0];
+		LinearExpr b = inputs[1];
+		if (a.IsConst() && b.IsConst()) {
+			out.offset = a.offset ^ b.offset;
+			return true;
+		}
+		//x ^ x
+		if (a == b) {
+			return true;
+		}
+		if (b.IsConst()) {
+			std::swap(a, b);
+		}
+		//x ^ 0, x ^ -1 == ~x
+		if (a.IsConst()) {
+			if (a.offset == 0x0) {
+				out = b;
+				return true;
+			}
+			if (a.offset == 0xFFFFFFFF) {
+				out.reg = b.reg;
+				out.coef = 0x0 - b.coef;
+				out.offset = ~b.offset;
+				return true;
+			}
+			return false;
 		}
-		return EvaluatePcodeOp(ctx, curOp);
+		//x ^ ~x
+		if (a.reg == b.reg && b.coef == 0x0 - a.coef && b.offset == ~a.offset) {
+			out.offset = 0xFFFFFFFF;
+			return true;
+		}
+		return false;
 	}
-	throw Exception("bad stack varnode");
+	default:
+		break;
+	}
+	return SimplifySpecialOp(defOp, inputs, out);
 }
 
-z3::expr DeepStackFix::EvaluateVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn)
+bool PcodeExprEvaluator::linearSource(const StackSource& src, LinearExpr& out)
 {
-	ghidra::PcodeOp* defOp = vn->getDef();
-	if (defOp) {
-		return EvaluatePcodeOp(ctx, defOp);
+	out = LinearExpr();
+	if (src.writer) {
+		//failed simplifications are cached too, later users fail fast
+		auto itMemo = linearMemo.find(src.writer);
+		if (itMemo == linearMemo.end() || !itMemo->second.first) {
+			return false;
+		}
+		out = itMemo->second.second;
+		return true;
 	}
-	if (vn->isConstant()) {
-		return ctx.bv_val(vn->getAddr().getOffset(), 32);
+	if (src.reg != VmpRegister::REG_NONE) {
+		out.reg = src.reg;
+		out.coef = 0x1;
+		return true;
+	}
+	out.offset = std::uint32_t(src.value);
+	return true;
+}
+
+bool PcodeExprEvaluator::linearMba(ghidra::PcodeOp* defOp, LinearExpr& out)
+{
+	//mba form of an add, (a | b) + (a & b) == a + b
+	if (defOp->code() != ghidra::CPUI_INT_ADD) {
+		return false;
+	}
+	const OpNode& node = opGraph[defOp];
+	if (node.inputs.size() != 2) {
+		return false;
+	}
+	ghidra::PcodeOp* orOp = node.inputs[0].writer;
+	ghidra::PcodeOp* andOp = node.inputs[1].writer;
+	if (!orOp || !andOp) {
+		return false;
+	}
+	if (orOp->code() == ghidra::CPUI_INT_AND) {
+		std::swap(orOp, andOp);
 	}
-	std::string regName = GhidraHelper::GetVarnodeRegName(vn);
-	if (!regName.empty()) {
-		if (vn->isInput()) {
-			return ctx.bv_const(regName.c_str(), 32);
+	if (orOp->code() != ghidra::CPUI_INT_OR || andOp->code() != ghidra::CPUI_INT_AND) {
+		return false;
+	}
+	const OpNode& orNode = opGraph[orOp];
+	const OpNode& andNode = opGraph[andOp];
+	if (orNode.inputs.size() != 2 || andNode.inputs.size() != 2) {
+		return false;
+	}
+	LinearExpr orIn[2];
+	LinearExpr andIn[2];
+	for (int n = 0; n < 2; ++n) {
+		if (!linearSource(orNode.inputs[n], orIn[n]) || !linearSource(andNode.inputs[n], andIn[n])) {
+			return false;
 		}
 	}
-	if (vn->getSpace()->getName() == "stack") {
-		return EvalutaeStackVarnode(ctx, op, vn);
+	bool bSameOperands = (orIn[0] == andIn[0] && orIn[1] == andIn[1]) || (orIn[0] == andIn[1] && orIn[1] == andIn[0]);
+	if (!bSameOperands) {
+		return false;
+	}
+	std::vector<LinearExpr> sumInputs = { orIn[0], orIn[1] };
+	return linearOp(defOp, sumInputs, out);
+}
+
+bool PcodeExprEvaluator::SimplifyPcodeOp(ghidra::PcodeOp* defOp, LinearExpr& out)
+{
+	out = LinearExpr();
+	if (!defOp) {
+		return false;
+	}
+	std::vector<ghidra::PcodeOp*> evalOrder;
+	if (!buildEvalOrder(defOp, [this](ghidra::PcodeOp* op) { return linearMemo.count(op) != 0; }, evalOrder)) {
+		return false;
+	}
+	std::vector<LinearExpr> inputs;
+	for (ghidra::PcodeOp* curOp : evalOrder) {
+		const OpNode& node = opGraph[curOp];
+		inputs.clear();
+		bool bLinear = true;
+		for (const StackSource& src : node.inputs) {
+			LinearExpr tmpExpr;
+			if (!linearSource(src, tmpExpr)) {
+				bLinear = false;
+				break;
+			}
+			inputs.push_back(tmpExpr);
+		}
+		LinearExpr result;
+		if (bLinear) {
+			bLinear = linearOp(curOp, inputs, result);
+		}
+		else {
+			//the bitwise halves of a mixed expression are not linear, their sum may be
+			bLinear = linearMba(curOp, result);
+		}
+		if (!bLinear) {
+			result = LinearExpr();
+		}
+		else if (result.coef == 0x0) {
+			result.reg = VmpRegister::REG_NONE;
+		}
+		linearMemo.emplace(curOp, std::make_pair(bLinear, result));
+	}
+	const std::pair<bool, LinearExpr>& rootMemo = linearMemo.at(defOp);
+	out = rootMemo.second;
+	return rootMemo.first;
+}
+
+bool PcodeExprEvaluator::CollectNegatedConsts(ghidra::PcodeOp* op, ghidra::Varnode* vn, std::vector<size_t>& outList)
+{
+	outList.clear();
+	StackSource src;
+	if (!resolveInput(OpInput{ op, vn }, src) || !src.writer) {
+		return false;
+	}
+	std::set<size_t> filterSet;
+	std::unordered_set<ghidra::PcodeOp*> visited;
+	std::vector<ghidra::PcodeOp*> walkList;
+	walkList.push_back(src.writer);
+	visited.insert(src.writer);
+	while (!walkList.empty()) {
+		ghidra::PcodeOp* curOp = walkList.back();
+		walkList.pop_back();
+		auto itNode = opGraph.find(curOp);
+		if (itNode == opGraph.end() || !itNode->second.bSupported) {
+			return false;
+		}
+		const OpNode& node = itNode->second;
+		if (curOp->code() == ghidra::CPUI_INT_NEGATE) {
+			LinearExpr inExpr;
+			if (linearSource(node.inputs[0], inExpr) && inExpr.IsConst()) {
+				if (filterSet.insert(inExpr.offset).second) {
+					outList.push_back(inExpr.offset);
+				}
+				continue;
+			}
+		}
+		for (const StackSource& input : node.inputs) {
+			if (input.writer && visited.insert(input.writer).second) {
+				walkList.push_back(input.writer);
+			}
+		}
 	}
-	throw Exception("bad varnode");
+	return true;
 }
 
+bool PcodeExprEvaluator::SimplifyVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, LinearExpr& out)
+{
+	out = LinearExpr();
+	StackSource src;
+	if (!resolveInput(OpInput{ op, vn }, src)) {
+		return false;
+	}
+	if (src.writer) {
+		return SimplifyPcodeOp(src.writer, out);
+	}
+	if (src.reg != VmpRegister::REG_NONE) {
+		out.reg = src.reg;
+		out.coef = 0x1;
+		return true;
+	}
+	out.offset = std::uint32_t(src.value);
+	return true;
+}
+
+bool PcodeExprEvaluator::FindStackWriter(ghidra::PcodeOp* op, ghidra::Varnode* vn, ghidra::PcodeOp*& outWriter)
+{
+	if (!writerIndex.IsBuilt(bb)) {
+		writerIndex.Build(bb);
+	}
+	outWriter = writerIndex.FindWriter(op, vn);
+	if (!outWriter) {
+		return true;
+	}
+	//a wider write at the same offset still holds the low bytes of vn
+	ghidra::Varnode* vOut = outWriter->getOut();
+	if (vOut->getOffset() != vn->getOffset() || vOut->getSize() < vn->getSize()) {
+		outWriter = nullptr;
+		return false;
+	}
+	return true;
+}
+
+bool PcodeExprEvaluator::FindReachingStore(ghidra::PcodeOp* op, ghidra::Varnode* ptr, ghidra::PcodeOp*& outStore)
+{
+	if (!writerIndex.IsBuilt(bb)) {
+		writerIndex.Build(bb);
+	}
+	outStore = writerIndex.FindStore(op, ptr);
+	if (!outStore) {
+		return true;
+	}
+	//a store of another width only defines part of the loaded value
+	if (outStore->getIn(1)->getSize() != ptr->getSize() || outStore->getIn(2)->getSize() != op->getOut()->getSize()) {
+		outStore = nullptr;
+		return false;
+	}
+	return true;
+}
+
+z3::context& PcodeExprEvaluator::Z3Context()
+{
+	if (!z3Ctx) {
+		z3Ctx = std::make_unique<z3::context>();
+	}
+	return *z3Ctx;
+}
+
+void PcodeExprEvaluator::ClearMemo()
+{
+	opGraph.clear();
+	opMemo.clear();
+	linearMemo.clear();
+	writerIndex.Clear();
+}
+
+bool DeepStackFix::CollectSpecialInputs(ghidra::PcodeOp* defOp, std::vector<OpInput>& outInputs)
+{
+	if (defOp->code() != ghidra::CPUI_INT_MULT) {
+		return false;
+	}
+	outInputs.push_back(OpInput{ defOp, defOp->getIn(0) });
+	outInputs.push_back(OpInput{ defOp, defOp->getIn(1) });
+	return true;
+}
+
+bool DeepStackFix::EvaluateSpecialOp(ghidra::PcodeOp* defOp, const std::vector<z3::expr>& inputs, z3::expr& out)
+{
+	if (defOp->code() != ghidra::CPUI_INT_MULT) {
+		return false;
+	}
+	out = inputs[0] * inputs[1];
+	return true;
+}
+
+bool DeepStackFix::SimplifySpecialOp(ghidra::PcodeOp* defOp, const std::vector<LinearExpr>& inputs, LinearExpr& out)
+{
+	if (defOp->code() != ghidra::CPUI_INT_MULT) {
+		return false;
+	}
+	LinearExpr a = inputs[0];
+	LinearExpr b = inputs[1];
+	if (b.IsConst()) {
+		std::swap(a, b);
+	}
+	if (!a.IsConst()) {
+		return false;
+	}
+	out.reg = b.reg;
+	out.coef = b.coef * a.offset;
+	out.offset = b.offset * a.offset;
+	return true;
+}
+
+bool DeepStackFix::ResolveStackVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, StackSource& out)
+{
+	ghidra::PcodeOp* writer = nullptr;
+	if (!FindStackWriter(op, vn, writer) || !writer) {
+		return false;
+	}
+	out = StackSource::FromWriter(writer);
+	return true;
+}
+
+void DeepStackFix::rewriteLoadToStack(ghidra::PcodeOp* curOp, std::uint32_t stackOffset)
+{
+	ghidra::Varnode* newvn = fd->newVarnode(curOp->getOut()->getSize(), fd->getArch()->getStackSpace(), stackOffset);
+	fd->opSetInput(curOp, newvn, 0);
+	fd->opRemoveInput(curOp, 1);
+	fd->opSetOpcode(curOp, ghidra::CPUI_COPY);
+	ghidra::Varnode* refvn = curOp->getOut();
+	if (refvn->isSpacebasePlaceholder()) {
+		refvn->clearSpacebasePlaceholder();	// Clear the trigger
+		ghidra::PcodeOp* placeOp = refvn->loneDescend();
+		if (placeOp != (ghidra::PcodeOp*)0) {
+			ghidra::FuncCallSpecs* fc = fd->getCallSpecs(placeOp);
+			if (fc != (ghidra::FuncCallSpecs*)0)
+				fc->resolveSpacebaseRelative(*fd, refvn);
+		}
+	}
+}
+
+void DeepStackFix::rewriteStoreToStack(ghidra::PcodeOp* curOp, std::uint32_t stackOffset)
+{
+	ghidra::int4 size = curOp->getIn(2)->getSize();
+	ghidra::Address stackVar(fd->getArch()->getStackSpace(), stackOffset);
+	fd->newVarnodeOut(size, stackVar, curOp);
+	curOp->getOut()->setStackStore();
+	fd->opRemoveInput(curOp, 1);
+	fd->opRemoveInput(curOp, 0);
+	fd->opSetOpcode(curOp, ghidra::CPUI_COPY);
+}
 
 bool DeepStackFix::FixLoadRam(ghidra::PcodeOp* curOp)
 {
-	z3::context ctx;
-	z3::expr formula(ctx);
-	try{
-		formula = EvaluateVarnode(ctx, curOp, curOp->getIn(1));
+	//most pointers fold to ESP + c without asking z3
+	LinearExpr ptr;
+	if (SimplifyVarnode(curOp, curOp->getIn(1), ptr)) {
+		if (!ptr.IsRegOffset(VmpRegister::REG_ESP)) {
+			return false;
+		}
+		rewriteLoadToStack(curOp, ptr.offset);
+		return ptr.offset != 0x0;
 	}
-	catch(Exception& ex){
+	z3::expr formula(Z3Context());
+	if (!EvaluateVarnode(curOp, curOp->getIn(1), formula)) {
 		return false;
 	}
-	z3::params params(ctx);
+	z3::params params(Z3Context());
 	params.set("bv_not_simpl", true);
 	formula = formula.simplify(params);
-	std::string formulaExpr = formula.to_string();
 	if (formula.is_app() && formula.decl().decl_kind() == Z3_OP_BADD) {
 		z3::expr arg1 = formula.arg(0);
 		z3::expr arg2 = formula.arg(1);
-		if (arg1.is_numeral() && arg2.decl().name().str() == "ESP") {
-			ghidra::Varnode* newvn = fd->newVarnode(curOp->getOut()->getSize(), fd->getArch()->getStackSpace(), arg1.as_uint64());
-			fd->opSetInput(curOp, newvn, 0);
-			fd->opRemoveInput(curOp, 1);
-			fd->opSetOpcode(curOp, ghidra::CPUI_COPY);
-			ghidra::Varnode* refvn = curOp->getOut();
-			if (refvn->isSpacebasePlaceholder()) {
-				refvn->clearSpacebasePlaceholder();	// Clear the trigger
-				ghidra::PcodeOp* placeOp = refvn->loneDescend();
-				if (placeOp != (ghidra::PcodeOp*)0) {
-					ghidra::FuncCallSpecs* fc = fd->getCallSpecs(placeOp);
-					if (fc != (ghidra::FuncCallSpecs*)0)
-						fc->resolveSpacebaseRelative(*fd, refvn);
-				}
-			}
+		if (arg1.is_numeral() && IsRegConst(arg2, VmpRegister::REG_ESP)) {
+			rewriteLoadToStack(curOp, std::uint32_t(arg1.as_uint64()));
 			return true;
 		}
 	}
-	else if (formula.is_const() && formula.decl().name().str() == "ESP") {
-		ghidra::Varnode* newvn = fd->newVarnode(curOp->getOut()->getSize(), fd->getArch()->getStackSpace(), 0x0);
-		fd->opSetInput(curOp, newvn, 0);
-		fd->opRemoveInput(curOp, 1);
-		fd->opSetOpcode(curOp, ghidra::CPUI_COPY);
-		ghidra::Varnode* refvn = curOp->getOut();
-		if (refvn->isSpacebasePlaceholder()) {
-			refvn->clearSpacebasePlaceholder();	// Clear the trigger
-			ghidra::PcodeOp* placeOp = refvn->loneDescend();
-			if (placeOp != (ghidra::PcodeOp*)0) {
-				ghidra::FuncCallSpecs* fc = fd->getCallSpecs(placeOp);
-				if (fc != (ghidra::FuncCallSpecs*)0)
-					fc->resolveSpacebaseRelative(*fd, refvn);
-			}
-		}
+	else if (IsRegConst(formula, VmpRegister::REG_ESP)) {
+		rewriteLoadToStack(curOp, 0x0);
 	}
 	return false;
 }
 
 bool DeepStackFix::FixStoreRam(ghidra::PcodeOp* curOp)
 {
-	z3::context ctx;
-	z3::expr formula(ctx);
-	try{
-		formula = EvaluateVarnode(ctx, curOp, curOp->getIn(1));
+	LinearExpr ptr;
+	if (SimplifyVarnode(curOp, curOp->getIn(1), ptr)) {
+		if (!ptr.IsRegOffset(VmpRegister::REG_ESP)) {
+			return false;
+		}
+		rewriteStoreToStack(curOp, ptr.offset);
+		return true;
 	}
-	catch (Exception& ex){
+	z3::expr formula(Z3Context());
+	if (!EvaluateVarnode(curOp, curOp->getIn(1), formula)) {
 		return false;
 	}
-	std::string ss1 = formula.to_string();
-	z3::params params(ctx);
+	z3::params params(Z3Context());
 	params.set("bv_not_simpl", true);
 	formula = formula.simplify(params);
-	std::string ss2 = formula.to_string();
-	ghidra::int4 size = curOp->getIn(2)->getSize();
 	if (formula.is_app() && formula.decl().decl_kind() == Z3_OP_BADD) {
 		z3::expr arg1 = formula.arg(0);
 		z3::expr arg2 = formula.arg(1);
-		if (arg1.is_numeral() && arg2.decl().name().str() == "ESP") {
-			ghidra::Address stackVar(fd->getArch()->getStackSpace(), uint32_t(arg1.as_uint64()));
-			fd->newVarnodeOut(size, stackVar, curOp);
-			curOp->getOut()->setStackStore();
-			fd->opRemoveInput(curOp, 1);
-			fd->opRemoveInput(curOp, 0);
-			fd->opSetOpcode(curOp, ghidra::CPUI_COPY);
+		if (arg1.is_numeral() && IsRegConst(arg2, VmpRegister::REG_ESP)) {
+			rewriteStoreToStack(curOp, std::uint32_t(arg1.as_uint64()));
 			return true;
 		}
 	}
-	else if (formula.is_const() && formula.decl().name().str() == "ESP") {
-		ghidra::Address stackVar(fd->getArch()->getStackSpace(), 0x0);
-		fd->newVarnodeOut(size, stackVar, curOp);
-		curOp->getOut()->setStackStore();
-		fd->opRemoveInput(curOp, 1);
-		fd->opRemoveInput(curOp, 0);
-		fd->opSetOpcode(curOp, ghidra::CPUI_COPY);
+	else if (IsRegConst(formula, VmpRegister::REG_ESP)) {
+		rewriteStoreToStack(curOp, 0x0);
 		return true;
 	}
 	return false;
@@ -211,6 +823,8 @@ int DeepStackFix::FixAllRam(ghidra::Funcdata* func)
 				bFixSuccess = FixLoadRam(curOp);
 			}
 			if (bFixSuccess) {
+				//the rewritten op changes what later stack reads resolve to
+				ClearMemo();
 				itBeginOp = itOp;
 				ret = 0x1;
 				break;
@@ -222,108 +836,79 @@ int DeepStackFix::FixAllRam(ghidra::Funcdata* func)
 }
 
 
-z3::expr RotateContextAnalyzer::EvaluatePcodeOp(z3::context& ctx, ghidra::PcodeOp* defOp)
+bool RotateContextAnalyzer::CollectSpecialInputs(ghidra::PcodeOp* defOp, std::vector<OpInput>& outInputs)
 {
-	if (!defOp) {
-		return ctx.bv_const("empty", 32);
-	}
-	switch (defOp->code())
-	{
-	case ghidra::CPUI_INT_ADD:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) + EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_INT_SUB:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) - EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_COPY:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0));
-	case ghidra::CPUI_INT_AND:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) & EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_INT_OR:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) | EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_INT_NEGATE:
-		return ~EvaluateVarnode(ctx, defOp, defOp->getIn(0));
-	case ghidra::CPUI_INT_MULT:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) * EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	default:
-		break;
+	if (defOp->code() != ghidra::CPUI_INT_MULT) {
+		return false;
 	}
-	throw Exception("bad defcode");
+	outInputs.push_back(OpInput{ defOp, defOp->getIn(0) });
+	outInputs.push_back(OpInput{ defOp, defOp->getIn(1) });
+	return true;
 }
 
-z3::expr RotateContextAnalyzer::EvaluateVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn)
+bool RotateContextAnalyzer::EvaluateSpecialOp(ghidra::PcodeOp* defOp, const std::vector<z3::expr>& inputs, z3::expr& out)
 {
-	ghidra::PcodeOp* defOp = vn->getDef();
-	if (defOp) {
-		return EvaluatePcodeOp(ctx, defOp);
+	if (defOp->code() != ghidra::CPUI_INT_MULT) {
+		return false;
 	}
-	if (vn->isConstant()) {
-		return ctx.bv_val(vn->getAddr().getOffset(), 32);
+	out = inputs[0] * inputs[1];
+	return true;
+}
+
+bool RotateContextAnalyzer::SimplifySpecialOp(ghidra::PcodeOp* defOp, const std::vector<LinearExpr>& inputs, LinearExpr& out)
+{
+	if (defOp->code() != ghidra::CPUI_INT_MULT) {
+		return false;
 	}
-	std::string regName = GhidraHelper::GetVarnodeRegName(vn);
-	if (!regName.empty()) {
-		if (vn->isInput()) {
-			return ctx.bv_const(regName.c_str(), 32);
-		}
+	LinearExpr a = inputs[0];
+	LinearExpr b = inputs[1];
+	if (b.IsConst()) {
+		std::swap(a, b);
 	}
-	if (vn->getSpace()->getName() == "stack") {
-		return EvalutaeStackVarnode(ctx, op, vn);
+	if (!a.IsConst()) {
+		return false;
 	}
-	throw Exception("bad varnode");
+	out.reg = b.reg;
+	out.coef = b.coef * a.offset;
+	out.offset = b.offset * a.offset;
+	return true;
 }
 
-z3::expr RotateContextAnalyzer::EvalutaeStackVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn)
+bool RotateContextAnalyzer::ResolveStackVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, StackSource& out)
 {
-	//λԭʼop
-	std::list<ghidra::PcodeOp*>::iterator it = bb->endOp();
-	auto itBegin = bb->beginOp();
-	while (it != bb->beginOp()) {
-		--it;
-		ghidra::PcodeOp* curOp = *it;
-		if (curOp == op) {
-			break;
-		}
+	ghidra::PcodeOp* writer = nullptr;
+	if (!FindStackWriter(op, vn, writer)) {
+		return false;
 	}
-	int stackOffset = vn->getOffset();
-	while (it != itBegin) {
-		--it;
-		ghidra::PcodeOp* curOp = *it;
-		ghidra::Varnode* vOut = curOp->getOut();
-		if (!vOut) {
-			continue;
+	if (writer) {
+		if (writer->getOut()->getSize() != vn->getSize()) {
+			return false;
 		}
-		if (vOut->getSpace() != vn->getSpace()) {
-			continue;
-		}
-		int newStackOffset = vOut->getOffset();
-		if (newStackOffset > stackOffset && newStackOffset - stackOffset < 4) {
-			throw Exception("bad assign");
-		}
-		if (newStackOffset != stackOffset) {
-			continue;
-		}
-		if (vOut->getSize() != vn->getSize()) {
-			throw Exception("bad assign");
-		}
-		return EvaluatePcodeOp(ctx, curOp);
+		out = StackSource::FromWriter(writer);
+		return true;
 	}
+	int stackOffset = vn->getOffset();
 	if (vn->getSize() != 4) {
-		throw Exception("bad stack varnode src");
+		return false;
 	}
 	if (stackOffset % 4) {
-		throw Exception("bad stack varnode src");
+		return false;
 	}
 	int idx = stackOffset / 4;
 	auto itSrc = oldCtx->contextMap.find(idx);
 	if (itSrc == oldCtx->contextMap.end()) {
-		throw Exception("bad stack varnode src");
+		return false;
 	}
 	if (itSrc->second.space->getName() == "const") {
-		return ctx.bv_val(itSrc->second.offset, 32);
+		out = StackSource::FromConst(itSrc->second.offset);
+		return true;
 	}
-	std::string regName = fd->getArch()->translate->getRegisterName(itSrc->second.space, itSrc->second.offset, itSrc->second.size);
-	if (!regName.empty()) {
-		return ctx.bv_const(regName.c_str(), 32);
+	VmpRegId regId = VmpRegister::FromVarnode(itSrc->second.space, itSrc->second.offset, itSrc->second.size);
+	if (regId != VmpRegister::REG_NONE) {
+		out = StackSource::FromReg(regId);
+		return true;
 	}
-	throw Exception("bad stack varnode src");
+	return false;
 }
 
 bool RotateContextAnalyzer::getEndStackOffset(int& outOffset)
@@ -334,8 +919,7 @@ bool RotateContextAnalyzer::getEndStackOffset(int& outOffset)
 	}
 	for (unsigned int n = 0; n < retOp->numInput(); ++n) {
 		ghidra::Varnode* vn = retOp->getIn(n);
-		std::string retRegName = fd->getArch()->translate->getRegisterName(vn->getSpace(), vn->getOffset(), vn->getSize());
-		if (retRegName != "ESP") {
+		if (GhidraHelper::GetVarnodeRegId(vn) != VmpRegister::REG_ESP) {
 			continue;
 		}
 		ghidra::PcodeOp* defOp = vn->getDef();
@@ -344,8 +928,7 @@ bool RotateContextAnalyzer::getEndStackOffset(int& outOffset)
 		}
 		if (defOp->code() == ghidra::CPUI_COPY) {
 			ghidra::Varnode* vn = defOp->getIn(0);
-			std::string regName = fd->getArch()->translate->getRegisterName(vn->getSpace(), vn->getOffset(), vn->getSize());
-			if (vn->isInput() && regName == "ESP") {
+			if (vn->isInput() && GhidraHelper::GetVarnodeRegId(vn) == VmpRegister::REG_ESP) {
 				outOffset = 0x0;
 				return true;
 			}
@@ -353,8 +936,7 @@ bool RotateContextAnalyzer::getEndStackOffset(int& outOffset)
 		else if (defOp->code() == ghidra::CPUI_INT_ADD) {
 			ghidra::Varnode* v0 = defOp->getIn(0);
 			ghidra::Varnode* v1 = defOp->getIn(1);
-			std::string regName = fd->getArch()->translate->getRegisterName(v0->getSpace(), v0->getOffset(), v0->getSize());
-			if (v0->isInput() && regName == "ESP" && v1->isConstant()) {
+			if (v0->isInput() && GhidraHelper::GetVarnodeRegId(v0) == VmpRegister::REG_ESP && v1->isConstant()) {
 				outOffset = v1->getOffset();
 				return true;
 			}
@@ -400,19 +982,29 @@ bool RotateContextAnalyzer::UpdateRotateContext(VmpRotateContext& rotate_ctx, Vm
 		if (stackOffset % 4) {
 			continue;
 		}
-		z3::context ctx;
-		z3::expr formula(ctx);
-		try {
-			formula = EvaluateVarnode(ctx, curOp, curOp->getIn(1));
+		ghidra::VarnodeData tmpData;
+		LinearExpr slotExpr;
+		if (SimplifyVarnode(curOp, curOp->getIn(1), slotExpr)) {
+			if (slotExpr.IsConst()) {
+				tmpData.space = fd->getArch()->getConstantSpace();
+				tmpData.offset = slotExpr.offset;
+				tmpData.size = 0x4;
+				out_ctx.contextMap[idx] = tmpData;
+			}
+			else if (slotExpr.coef == 0x1 && slotExpr.offset == 0x0) {
+				tmpData = fd->getArch()->translate->getRegister(VmpRegister::Name(slotExpr.reg));
+				basicReg.insert(fd->getArch()->translate->getRegisterName(tmpData.space, tmpData.offset, tmpData.size));
+				out_ctx.contextMap[idx] = tmpData;
+			}
+			continue;
 		}
-		catch (Exception& ex) {
+		z3::expr formula(Z3Context());
+		if (!EvaluateVarnode(curOp, curOp->getIn(1), formula)) {
 			continue;
 		}
-		z3::params params(ctx);
+		z3::params params(Z3Context());
 		params.set("bv_not_simpl", true);
 		formula = formula.simplify(params);
-		std::string formulaExpr = formula.to_string();
-		ghidra::VarnodeData tmpData;
 		if (formula.is_numeral()) {
 			tmpData.space = fd->getArch()->getConstantSpace();
 			tmpData.offset = formula.as_uint64();
@@ -420,7 +1012,7 @@ bool RotateContextAnalyzer::UpdateRotateContext(VmpRotateContext& rotate_ctx, Vm
 			out_ctx.contextMap[idx] = tmpData;
 		}
 		else if (formula.is_const()) {
-			tmpData = fd->getArch()->translate->getRegister(formulaExpr);
+			tmpData = fd->getArch()->translate->getRegister(formula.decl().name().str());
 			std::string regName = fd->getArch()->translate->getRegisterName(tmpData.space, tmpData.offset, tmpData.size);
 			basicReg.insert(regName);
 			out_ctx.contextMap[idx] = tmpData;
@@ -433,126 +1025,68 @@ bool RotateContextAnalyzer::UpdateRotateContext(VmpRotateContext& rotate_ctx, Vm
 	return true;
 }
 
-z3::expr VmpBranchAnalyzer::EvaluateLoadVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn)
-{
-	//λԭʼop
-	std::list<ghidra::PcodeOp*>::iterator it = bb->endOp();
-	auto itBegin = bb->beginOp();
-	while (it != bb->beginOp()) {
-		--it;
-		ghidra::PcodeOp* curOp = *it;
-		if (curOp == op) {
-			break;
-		}
-	}
-	while (it != itBegin) {
-		--it;
-		ghidra::PcodeOp* curOp = *it;
-		if (curOp->code() != ghidra::CPUI_STORE) {
-			continue;
-		}
-		ghidra::Varnode* vStoreNode = curOp->getIn(1);
-		if (vStoreNode->getSpace() != vn->getSpace()) {
-			continue;
-		}
-		if (vStoreNode->getOffset() != vn->getOffset()) {
-			continue;
-		}
-		if (vStoreNode->getSize() != vn->getSize()) {
-			//To to do...
-		}
-		return EvaluateVarnode(ctx, curOp, curOp->getIn(2));
-	}
-	if (bLoaded) {
-		throw Exception("too much esp load");
-	}
-	bLoaded = true;
-	return EvaluateVarnode(ctx, op, vn);
-}
-
-z3::expr VmpBranchAnalyzer::EvalutaeStackVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn)
+bool VmpBranchAnalyzer::CollectSpecialInputs(ghidra::PcodeOp* defOp, std::vector<OpInput>& outInputs)
 {
-	//λԭʼop
-	std::list<ghidra::PcodeOp*>::iterator it = bb->endOp();
-	auto itBegin = bb->beginOp();
-	while (it != bb->beginOp()) {
-		--it;
-		ghidra::PcodeOp* curOp = *it;
-		if (curOp == op) {
-			break;
-		}
-	}
-	while (it != itBegin) {
-		--it;
-		ghidra::PcodeOp* curOp = *it;
-		ghidra::Varnode* vOut = curOp->getOut();
-		if (!vOut) {
-			continue;
-		}
-		if (vOut->getSpace() != vn->getSpace()) {
-			continue;
-		}
-		if (vOut->getOffset() != vn->getOffset()) {
-			continue;
+	switch (defOp->code())
+	{
+	case ghidra::CPUI_INT_LEFT:
+	case ghidra::CPUI_INT_RIGHT:
+		return true;
+	case ghidra::CPUI_LOAD:
+	{
+		ghidra::Varnode* vn = defOp->getIn(1);
+		ghidra::PcodeOp* storeOp = nullptr;
+		if (!FindReachingStore(defOp, vn, storeOp)) {
+			return false;
 		}
-		if (vOut->getSize() != vn->getSize()) {
-			//To do...
+		if (storeOp) {
+			outInputs.push_back(OpInput{ storeOp, storeOp->getIn(2) });
+			return true;
 		}
-		return EvaluatePcodeOp(ctx, curOp);
-	}
-	return ctx.bv_val(0x0, 32);
-}
-
-z3::expr VmpBranchAnalyzer::EvaluateVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn)
-{
-	ghidra::PcodeOp* defOp = vn->getDef();
-	if (defOp) {
-		return EvaluatePcodeOp(ctx, defOp);
-	}
-	if (vn->isConstant()) {
-		return ctx.bv_val(vn->getAddr().getOffset(), 32);
-	}
-	std::string regName = GhidraHelper::GetVarnodeRegName(vn);
-	if (!regName.empty()) {
-		if (vn->isInput()) {
-			return ctx.bv_const(regName.c_str(), 32);
+		//too much esp load
+		if (bLoaded) {
+			return false;
 		}
+		bLoaded = true;
+		bEntryState = true;
+		outInputs.push_back(OpInput{ defOp, vn });
+		return true;
 	}
-	if (vn->getSpace()->getName() == "stack") {
-		return EvalutaeStackVarnode(ctx, op, vn);
+	default:
+		break;
 	}
-	throw Exception("bad varnode");
+	return false;
 }
 
-z3::expr VmpBranchAnalyzer::EvaluatePcodeOp(z3::context& ctx, ghidra::PcodeOp* defOp)
+bool VmpBranchAnalyzer::EvaluateSpecialOp(ghidra::PcodeOp* defOp, const std::vector<z3::expr>& inputs, z3::expr& out)
 {
-	if (!defOp) {
-		return ctx.bv_const("empty", 32);
-	}
 	switch (defOp->code())
 	{
-	case ghidra::CPUI_INT_ADD:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) + EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_INT_SUB:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) - EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_COPY:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0));
-	case ghidra::CPUI_INT_AND:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) & EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_INT_OR:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) | EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_INT_NEGATE:
-		return ~EvaluateVarnode(ctx, defOp, defOp->getIn(0));
 	case ghidra::CPUI_INT_LEFT:
 	case ghidra::CPUI_INT_RIGHT:
 		//һǴflag
-		return ctx.bv_const("flag", 32);
+		out = Z3Context().bv_const("flag", 32);
+		return true;
 	case ghidra::CPUI_LOAD:
-		return EvaluateLoadVarnode(ctx, defOp, defOp->getIn(1));
+		out = inputs[0];
+		return true;
 	default:
 		break;
 	}
-	throw Exception("bad defcode");
+	return false;
+}
+
+bool VmpBranchAnalyzer::ResolveStackVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, StackSource& out)
+{
+	ghidra::PcodeOp* writer = nullptr;
+	if (!FindStackWriter(op, vn, writer)) {
+		return false;
+	}
+	if (!writer) {
+		bEntryState = true;
+	}
+	out = writer ? StackSource::FromWriter(writer) : StackSource::FromConst(0x0);
+	return true;
 }
 
 std::vector<size_t> VmpBranchAnalyzer::guessConditionalBranch(z3::expr& formula)
@@ -591,8 +1125,7 @@ bool VmpExitCallAnalyzer::getEndStackOffset(int& outOffset)
 	ghidra::PcodeOp* defOp = nullptr;
 	for (unsigned int n = 0; n < retOp->numInput(); ++n) {
 		ghidra::Varnode* vn = retOp->getIn(n);
-		std::string retRegName = fd->getArch()->translate->getRegisterName(vn->getSpace(), vn->getOffset(), vn->getSize());
-		if (retRegName != "ESP") {
+		if (GhidraHelper::GetVarnodeRegId(vn) != VmpRegister::REG_ESP) {
 			continue;
 		}
 		defOp = vn->getDef();
@@ -600,114 +1133,64 @@ bool VmpExitCallAnalyzer::getEndStackOffset(int& outOffset)
 	if (!defOp) {
 		return false;
 	}
-	z3::context ctx;
-	z3::expr formula(ctx);
-	try {
-		formula = EvaluatePcodeOp(ctx, defOp);
+	LinearExpr espExpr;
+	if (SimplifyPcodeOp(defOp, espExpr)) {
+		if (!espExpr.IsRegOffset(VmpRegister::REG_ESP)) {
+			return false;
+		}
+		outOffset = int(espExpr.offset);
+		return true;
 	}
-	catch (Exception& ex) {
+	z3::expr formula(Z3Context());
+	if (!EvaluatePcodeOp(defOp, formula)) {
 		return false;
 	}
-	z3::params params(ctx);
+	z3::params params(Z3Context());
 	params.set("bv_not_simpl", true);
 	formula = formula.simplify(params);
-	std::string ss2 = formula.to_string();
 	if (formula.is_app() && formula.decl().decl_kind() == Z3_OP_BADD) {
 		z3::expr arg1 = formula.arg(0);
 		z3::expr arg2 = formula.arg(1);
-		if (arg1.is_numeral() && arg2.decl().name().str() == "ESP") {
+		if (arg1.is_numeral() && IsRegConst(arg2, VmpRegister::REG_ESP)) {
 			outOffset = arg1.as_int64();
 			return true;
 		}
 	}
-	else if (formula.is_const() && formula.decl().name().str() == "ESP") {
+	else if (IsRegConst(formula, VmpRegister::REG_ESP)) {
 		outOffset = 0x0;
 		return true;
 	}
 	return false;
 }
 
-z3::expr VmpExitCallAnalyzer::EvaluatePcodeOp(z3::context& ctx, ghidra::PcodeOp* defOp)
+bool VmpExitCallAnalyzer::CollectSpecialInputs(ghidra::PcodeOp* defOp, std::vector<OpInput>& outInputs)
+{
+	return defOp->code() == ghidra::CPUI_INT_LEFT || defOp->code() == ghidra::CPUI_INT_RIGHT;
+}
+
+bool VmpExitCallAnalyzer::EvaluateSpecialOp(ghidra::PcodeOp* defOp, const std::vector<z3::expr>& inputs, z3::expr& out)
 {
-	if (!defOp) {
-		return ctx.bv_const("empty", 32);
-	}
 	switch (defOp->code())
 	{
-	case ghidra::CPUI_INT_ADD:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) + EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_INT_SUB:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) - EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_COPY:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0));
-	case ghidra::CPUI_INT_AND:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) & EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_INT_OR:
-		return EvaluateVarnode(ctx, defOp, defOp->getIn(0)) | EvaluateVarnode(ctx, defOp, defOp->getIn(1));
-	case ghidra::CPUI_INT_NEGATE:
-		return ~EvaluateVarnode(ctx, defOp, defOp->getIn(0));
 	case ghidra::CPUI_INT_LEFT:
 	case ghidra::CPUI_INT_RIGHT:
 		//һǴflag
-		return ctx.bv_const("flag", 32);
+		out = Z3Context().bv_const("flag", 32);
+		return true;
 	default:
 		break;
 	}
-	throw Exception("bad defcode");
-}
-
-z3::expr VmpExitCallAnalyzer::EvaluateVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn)
-{
-	ghidra::PcodeOp* defOp = vn->getDef();
-	if (defOp) {
-		return EvaluatePcodeOp(ctx, defOp);
-	}
-	if (vn->isConstant()) {
-		return ctx.bv_val(vn->getAddr().getOffset(), 32);
-	}
-	std::string regName = GhidraHelper::GetVarnodeRegName(vn);
-	if (!regName.empty()) {
-		if (vn->isInput()) {
-			return ctx.bv_const(regName.c_str(), 32);
-		}
-	}
-	if (vn->getSpace()->getName() == "stack") {
-		return EvalutaeStackVarnode(ctx, op, vn);
-	}
-	throw Exception("bad varnode");
+	return false;
 }
 
-z3::expr VmpExitCallAnalyzer::EvalutaeStackVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn)
+bool VmpExitCallAnalyzer::ResolveStackVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, StackSource& out)
 {
-	//λԭʼop
-	std::list<ghidra::PcodeOp*>::iterator it = bb->endOp();
-	auto itBegin = bb->beginOp();
-	while (it != bb->beginOp()) {
-		--it;
-		ghidra::PcodeOp* curOp = *it;
-		if (curOp == op) {
-			break;
-		}
-	}
-	while (it != itBegin) {
-		--it;
-		ghidra::PcodeOp* curOp = *it;
-		ghidra::Varnode* vOut = curOp->getOut();
-		if (!vOut) {
-			continue;
-		}
-		if (vOut->getSpace() != vn->getSpace()) {
-			continue;
-		}
-		if (vOut->getOffset() != vn->getOffset()) {
-			continue;
-		}
-		if (vOut->getSize() != vn->getSize()) {
-			//To do...
-		}
-		return EvaluatePcodeOp(ctx, curOp);
+	ghidra::PcodeOp* writer = nullptr;
+	if (!FindStackWriter(op, vn, writer)) {
+		return false;
 	}
-	return ctx.bv_val(0x0, 32);
+	out = writer ? StackSource::FromWriter(writer) : StackSource::FromConst(0x0);
+	return true;
 }
 
 
@@ -752,15 +1235,14 @@ size_t VmpExitCallAnalyzer::GuessExitCallAddr(ghidra::Funcdata* func)
 	if (!vExitNode) {
 		return 0x0;
 	}
-	z3::context ctx;
-	z3::expr formula(ctx);
-	try {
-		formula = EvaluateVarnode(ctx, curOp, vExitNode);
+	LinearExpr exitExpr;
+	if (SimplifyVarnode(curOp, vExitNode, exitExpr)) {
+		return exitExpr.IsConst() ? exitExpr.offset : 0x0;
 	}
-	catch (Exception& ex) {
+	z3::expr formula(Z3Context());
+	if (!EvaluateVarnode(curOp, vExitNode, formula)) {
 		return 0x0;
 	}
-	std::string formulaExpr = formula.to_string();
 	formula = formula.simplify();
 	if (formula.is_numeral()) {
 		size_t endAddr = formula.as_uint64();
@@ -783,8 +1265,7 @@ std::vector<size_t> VmpBranchAnalyzer::GuessVmpBranch()
 	ghidra::Varnode* vEIP = nullptr;
 	for (unsigned int n = 0; n < retOp->numInput(); ++n) {
 		ghidra::Varnode* vn = retOp->getIn(n);
-		std::string retRegName = fd->getArch()->translate->getRegisterName(vn->getSpace(), vn->getOffset(), vn->getSize());
-		if (retRegName != "EIP") {
+		if (GhidraHelper::GetVarnodeRegId(vn) != VmpRegister::REG_EIP) {
 			continue;
 		}
 		vEIP = vn;
@@ -793,15 +1274,20 @@ std::vector<size_t> VmpBranchAnalyzer::GuessVmpBranch()
 	if (!vEIP) {
 		return retList;
 	}
-	z3::context ctx;
-	z3::expr formula(ctx);
-	try {
-		formula = EvaluateVarnode(ctx, retOp, vEIP);
+	//a fixed target or a select between two constants needs no solver, anything else is left to z3
+	LinearExpr eipExpr;
+	if (SimplifyVarnode(retOp, vEIP, eipExpr) && eipExpr.IsConst()) {
+		retList.push_back(eipExpr.offset);
+		return retList;
+	}
+	if (CollectNegatedConsts(retOp, vEIP, retList) && retList.size() == 2) {
+		return retList;
 	}
-	catch (Exception& ex) {
+	retList.clear();
+	z3::expr formula(Z3Context());
+	if (!EvaluateVarnode(retOp, vEIP, formula)) {
 		return retList;
 	}
-	std::string formulaExpr = formula.to_string();
 	if (formula.is_numeral()) {
 		size_t endAddr = formula.as_uint64();
 		retList.push_back(endAddr);
@@ -1,7 +1,11 @@
 #pragma once
 #include <vector>
 #include <map>
+#include <memory>
+#include <unordered_map>
+#include <functional>
 #include <z3++.h>
+#include "VmpRegister.h"
 
 namespace ghidra
 {
@@ -9,26 +13,161 @@ namespace ghidra
 	class Varnode;
 	class PcodeOp;
 	class BlockBasic;
+	class AddrSpace;
 }
 
 struct VmpRotateContext;
 
-class DeepStackFix
+//outputs of a basic block indexed by storage, built once per analysis
+//answers the last writer before an op in O(log n) instead of walking the block
+class BlockWriterIndex
+{
+public:
+	BlockWriterIndex() {};
+	~BlockWriterIndex() {};
+	void Build(ghidra::BlockBasic* block);
+	void Clear();
+	bool IsBuilt(ghidra::BlockBasic* block) const { return bb == block; }
+	//last op before op whose output overlaps vn, nullptr if there is none
+	ghidra::PcodeOp* FindWriter(ghidra::PcodeOp* op, ghidra::Varnode* vn) const;
+	//last STORE before op through a pointer held in the storage of ptr, nullptr if there is none
+	ghidra::PcodeOp* FindStore(ghidra::PcodeOp* op, ghidra::Varnode* ptr) const;
+private:
+	struct Writer
+	{
+		int pos;
+		ghidra::PcodeOp* op;
+	};
+	ghidra::BlockBasic* bb = nullptr;
+	std::unordered_map<ghidra::PcodeOp*, int> opPos;
+	//writers grouped by start offset, sorted by position in the block
+	std::map<std::pair<ghidra::AddrSpace*, std::uint64_t>, std::vector<Writer>> writerMap;
+	//STORE ops grouped by the storage of their pointer, sorted by position in the block
+	std::map<std::pair<ghidra::AddrSpace*, std::uint64_t>, std::vector<Writer>> storeMap;
+	//widest output per space, bounds the offsets that can overlap a read
+	std::map<ghidra::AddrSpace*, int> maxSize;
+};
+
+//symbolic evaluation of the entry block pcode with one z3 context per analysis
+//results are memoised per op, dataflow shared by several users stays a dag
+//linear expressions are simplified natively, z3 is only needed for the rest
+//unsupported shapes are reported by returning false, nothing is thrown
+class PcodeExprEvaluator
+{
+public:
+	//value = coef * reg + offset on 32 bits
+	struct LinearExpr
+	{
+		VmpRegId reg = VmpRegister::REG_NONE;
+		std::uint32_t coef = 0x0;
+		std::uint32_t offset = 0x0;
+		bool IsConst() const { return coef == 0x0; }
+		//reg + offset with a unit coefficient
+		bool IsRegOffset(VmpRegId r) const { return reg == r && coef == 0x1; }
+		bool operator==(const LinearExpr& other) const {
+			return reg == other.reg && coef == other.coef && offset == other.offset;
+		}
+	};
+	//where an input gets its value from
+	struct StackSource
+	{
+		//op writing the slot, nullptr when the value is known on entry
+		ghidra::PcodeOp* writer = nullptr;
+		//register held by the slot on entry, REG_NONE for a constant
+		VmpRegId reg = VmpRegister::REG_NONE;
+		std::uint64_t value = 0x0;
+		static StackSource FromWriter(ghidra::PcodeOp* op) { StackSource src; src.writer = op; return src; }
+		static StackSource FromReg(VmpRegId r) { StackSource src; src.reg = r; return src; }
+		static StackSource FromConst(std::uint64_t v) { StackSource src; src.value = v; return src; }
+	};
+	//an input varnode read at a given op
+	struct OpInput
+	{
+		ghidra::PcodeOp* reader;
+		ghidra::Varnode* vn;
+	};
+public:
+	PcodeExprEvaluator() {};
+	virtual ~PcodeExprEvaluator() {};
+	//the result used a stack slot or a load the lifted ops did not write
+	bool ReadsEntryState() const { return bEntryState; }
+protected:
+	bool EvaluateVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, z3::expr& out);
+	bool EvaluatePcodeOp(ghidra::PcodeOp* defOp, z3::expr& out);
+	//native simplification, false when the value is not linear and z3 has to decide
+	bool SimplifyVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, LinearExpr& out);
+	bool SimplifyPcodeOp(ghidra::PcodeOp* defOp, LinearExpr& out);
+	//constants negated inside the value of vn, a vmp two way branch selects between two of them
+	//must run after SimplifyVarnode on the same value, false when it is not fully resolved
+	bool CollectNegatedConsts(ghidra::PcodeOp* op, ghidra::Varnode* vn, std::vector<size_t>& outList);
+	//inputs of ops beyond add/sub/copy/and/or/negate, unsupported by default
+	virtual bool CollectSpecialInputs(ghidra::PcodeOp* defOp, std::vector<OpInput>& outInputs);
+	//value of such an op from its evaluated inputs
+	virtual bool EvaluateSpecialOp(ghidra::PcodeOp* defOp, const std::vector<z3::expr>& inputs, z3::expr& out);
+	//native counterpart of EvaluateSpecialOp, undecided by default
+	virtual bool SimplifySpecialOp(ghidra::PcodeOp* defOp, const std::vector<LinearExpr>& inputs, LinearExpr& out);
+	//stack varnodes without a defining op, resolved from the writes before op
+	virtual bool ResolveStackVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, StackSource& out) = 0;
+	//write reaching vn at op, nullptr if none, false if it only covers part of vn
+	bool FindStackWriter(ghidra::PcodeOp* op, ghidra::Varnode* vn, ghidra::PcodeOp*& outWriter);
+	//store reaching the LOAD op through ptr, nullptr if none, false if its size differs from the load
+	bool FindReachingStore(ghidra::PcodeOp* op, ghidra::Varnode* ptr, ghidra::PcodeOp*& outStore);
+	//must be called whenever the pcode of the block changes
+	void ClearMemo();
+	//e is the register itself, z3 shares the ast of equal consts
+	bool IsRegConst(const z3::expr& e, VmpRegId reg);
+	//created on the first z3 fallback, most blocks simplify natively
+	z3::context& Z3Context();
+private:
+	//resolved inputs of an op, shared by the z3 and the native evaluation
+	struct OpNode
+	{
+		bool bSupported = false;
+		std::vector<StackSource> inputs;
+	};
+	bool resolveInput(const OpInput& input, StackSource& out);
+	const OpNode& opNode(ghidra::PcodeOp* defOp);
+	//ops needed by root in post order, skipping the ones isDone accepts
+	bool buildEvalOrder(ghidra::PcodeOp* root, const std::function<bool(ghidra::PcodeOp*)>& isDone, std::vector<ghidra::PcodeOp*>& outOrder);
+	z3::expr sourceExpr(const StackSource& src);
+	bool evaluateOp(ghidra::PcodeOp* defOp, const std::vector<z3::expr>& inputs, z3::expr& out);
+	bool linearOp(ghidra::PcodeOp* defOp, const std::vector<LinearExpr>& inputs, LinearExpr& out);
+	//linear value of an input, false when its writer did not simplify
+	bool linearSource(const StackSource& src, LinearExpr& out);
+	//add whose operands are only linear once the mba identities are applied
+	bool linearMba(ghidra::PcodeOp* defOp, LinearExpr& out);
+protected:
+	ghidra::BlockBasic* bb = nullptr;
+	//set by stack slots and loads resolved from the block entry, register inputs do not count
+	bool bEntryState = false;
+private:
+	//declared before the memo so the cached exprs are released first
+	std::unique_ptr<z3::context> z3Ctx;
+	BlockWriterIndex writerIndex;
+	std::unordered_map<ghidra::PcodeOp*, OpNode> opGraph;
+	std::unordered_map<ghidra::PcodeOp*, z3::expr> opMemo;
+	//failed simplifications are cached too, first is false for them
+	std::unordered_map<ghidra::PcodeOp*, std::pair<bool, LinearExpr>> linearMemo;
+};
+
+class DeepStackFix :public PcodeExprEvaluator
 {
 public:
 	int FixAllRam(ghidra::Funcdata* fd);
 private:
 	bool FixStoreRam(ghidra::PcodeOp* curOp);
 	bool FixLoadRam(ghidra::PcodeOp* curOp);
-	z3::expr EvaluateVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn);
-	z3::expr EvaluatePcodeOp(z3::context& ctx, ghidra::PcodeOp* defOp);
-	z3::expr EvalutaeStackVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn);
+	void rewriteLoadToStack(ghidra::PcodeOp* curOp, std::uint32_t stackOffset);
+	void rewriteStoreToStack(ghidra::PcodeOp* curOp, std::uint32_t stackOffset);
+	bool CollectSpecialInputs(ghidra::PcodeOp* defOp, std::vector<OpInput>& outInputs) override;
+	bool EvaluateSpecialOp(ghidra::PcodeOp* defOp, const std::vector<z3::expr>& inputs, z3::expr& out) override;
+	bool SimplifySpecialOp(ghidra::PcodeOp* defOp, const std::vector<LinearExpr>& inputs, LinearExpr& out) override;
+	bool ResolveStackVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, StackSource& out) override;
 protected:
 	ghidra::Funcdata* fd = nullptr;
-	ghidra::BlockBasic* bb = nullptr;
 };
 
-class RotateContextAnalyzer
+class RotateContextAnalyzer :public PcodeExprEvaluator
 {
 public:
 	RotateContextAnalyzer(ghidra::Funcdata* func) {
@@ -37,16 +176,16 @@ public:
 	bool UpdateRotateContext(VmpRotateContext& old_ctx, VmpRotateContext& new_ctx);
 private:
 	bool getEndStackOffset(int& outOffset);
-	z3::expr EvaluateVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn);
-	z3::expr EvaluatePcodeOp(z3::context& ctx, ghidra::PcodeOp* defOp);
-	z3::expr EvalutaeStackVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn);
+	bool CollectSpecialInputs(ghidra::PcodeOp* defOp, std::vector<OpInput>& outInputs) override;
+	bool EvaluateSpecialOp(ghidra::PcodeOp* defOp, const std::vector<z3::expr>& inputs, z3::expr& out) override;
+	bool SimplifySpecialOp(ghidra::PcodeOp* defOp, const std::vector<LinearExpr>& inputs, LinearExpr& out) override;
+	bool ResolveStackVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, StackSource& out) override;
 private:
 	VmpRotateContext* oldCtx = nullptr;
 	ghidra::Funcdata* fd = nullptr;
-	ghidra::BlockBasic* bb = nullptr;
 };
 
-class VmpBranchAnalyzer
+class VmpBranchAnalyzer :public PcodeExprEvaluator
 {
 public:
 	VmpBranchAnalyzer(ghidra::Funcdata* func) {
@@ -56,28 +195,25 @@ public:
 private:
 	std::vector<size_t> guessConditionalBranch(z3::expr& expr);
 private:
-	z3::expr EvaluatePcodeOp(z3::context& ctx, ghidra::PcodeOp* defOp);
-	z3::expr EvaluateLoadVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn);
-	z3::expr EvaluateVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn);
-	z3::expr EvalutaeStackVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn);
+	bool CollectSpecialInputs(ghidra::PcodeOp* defOp, std::vector<OpInput>& outInputs) override;
+	bool EvaluateSpecialOp(ghidra::PcodeOp* defOp, const std::vector<z3::expr>& inputs, z3::expr& out) override;
+	bool ResolveStackVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, StackSource& out) override;
 private:
 	ghidra::Funcdata* fd = nullptr;
-	ghidra::BlockBasic* bb = nullptr;
 public:
 	bool bLoaded = false;
 };
 
-class VmpExitCallAnalyzer
+class VmpExitCallAnalyzer :public PcodeExprEvaluator
 {
 public:
 	VmpExitCallAnalyzer() {};
 	size_t GuessExitCallAddr(ghidra::Funcdata* fd);
 private:
 	bool getEndStackOffset(int& outOffset);
-	z3::expr EvaluatePcodeOp(z3::context& ctx, ghidra::PcodeOp* defOp);
-	z3::expr EvaluateVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn);
-	z3::expr EvalutaeStackVarnode(z3::context& ctx, ghidra::PcodeOp* op, ghidra::Varnode* vn);
+	bool CollectSpecialInputs(ghidra::PcodeOp* defOp, std::vector<OpInput>& outInputs) override;
+	bool EvaluateSpecialOp(ghidra::PcodeOp* defOp, const std::vector<z3::expr>& inputs, z3::expr& out) override;
+	bool ResolveStackVarnode(ghidra::PcodeOp* op, ghidra::Varnode* vn, StackSource& out) override;
 private:
 	ghidra::Funcdata* fd = nullptr;
-	ghidra::BlockBasic* bb = nullptr;
 };
\ No newline at end of file
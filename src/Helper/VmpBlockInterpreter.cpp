@@ -0,0 +1,571 @@
+#include "VmpBlockInterpreter.h"
+#include "../GhidraExtension/VmpInstruction.h"
+#include "../GhidraExtension/VmpControlFlow.h"
+
+#ifdef DeveloperMode
+#pragma optimize("", off)
+#endif
+
+static const std::uint32_t FlagCF = 0x1;
+static const std::uint32_t FlagPF = 0x4;
+static const std::uint32_t FlagAF = 0x10;
+static const std::uint32_t FlagZF = 0x40;
+static const std::uint32_t FlagSF = 0x80;
+static const std::uint32_t FlagOF = 0x800;
+
+static std::uint32_t sizeMask(std::uint32_t size)
+{
+	if (size >= 0x4) {
+		return 0xFFFFFFFF;
+	}
+	return (1u << (size * 8)) - 1;
+}
+
+//operand of an arithmetic op, a VSP value is only known relative to the entry
+static VmValue bitsOf(const VmValue& val, std::uint32_t size)
+{
+	VmValue ret;
+	if (val.bVsp) {
+		return ret;
+	}
+	ret.known = val.known | ~sizeMask(size);
+	ret.value = val.value & val.known & sizeMask(size);
+	return ret;
+}
+
+static VmValue truncValue(const VmValue& val, std::uint32_t size)
+{
+	VmValue ret;
+	ret.known = val.known & sizeMask(size);
+	ret.value = val.value & ret.known;
+	return ret;
+}
+
+static VmValue notValue(const VmValue& val)
+{
+	VmValue ret;
+	ret.known = val.known;
+	ret.value = ~val.value & val.known;
+	return ret;
+}
+
+static VmValue andValue(const VmValue& v1, const VmValue& v2)
+{
+	VmValue ret;
+	std::uint32_t zero1 = v1.known & ~v1.value;
+	std::uint32_t zero2 = v2.known & ~v2.value;
+	ret.known = (v1.known & v2.known) | zero1 | zero2;
+	ret.value = v1.value & v2.value & ret.known;
+	return ret;
+}
+
+static VmValue orValue(const VmValue& v1, const VmValue& v2)
+{
+	return notValue(andValue(notValue(v1), notValue(v2)));
+}
+
+static bool evenParity(std::uint32_t val)
+{
+	val = val & 0xFF;
+	val ^= val >> 4;
+	val ^= val >> 2;
+	val ^= val >> 1;
+	return (val & 0x1) == 0x0;
+}
+
+//ZF, SF and PF of a result, the other flags stay unknown
+static VmValue resultFlags(const VmValue& result, std::uint32_t size)
+{
+	VmValue flags;
+	std::uint32_t mask = sizeMask(size);
+	if ((result.known & mask) != mask) {
+		return flags;
+	}
+	std::uint32_t signBit = 1u << (size * 8 - 1);
+	flags.known = FlagZF | FlagSF | FlagPF;
+	if ((result.value & mask) == 0x0) {
+		flags.value |= FlagZF;
+	}
+	if (result.value & signBit) {
+		flags.value |= FlagSF;
+	}
+	if (evenParity(result.value)) {
+		flags.value |= FlagPF;
+	}
+	return flags;
+}
+
+VmValue VmValue::Const(std::uint32_t val)
+{
+	VmValue ret;
+	ret.known = 0xFFFFFFFF;
+	ret.value = val;
+	return ret;
+}
+
+VmValue VmValue::Vsp(std::uint32_t delta)
+{
+	VmValue ret;
+	ret.value = delta;
+	ret.bVsp = true;
+	return ret;
+}
+
+VmValue VmByteMemory::Read(std::uint32_t addr, int size) const
+{
+	VmValue ret;
+	if (size == 0x4) {
+		auto it = cells.find(addr);
+		if (it != cells.end() && it->second.vspPart == 0x0) {
+			std::uint32_t delta = it->second.vspDelta;
+			int n = 0x1;
+			for (; n < size; ++n) {
+				auto itPart = cells.find(addr + n);
+				if (itPart == cells.end() || itPart->second.vspPart != n || itPart->second.vspDelta != delta) {
+					break;
+				}
+			}
+			if (n == size) {
+				return VmValue::Vsp(delta);
+			}
+		}
+	}
+	for (int n = 0; n < size; ++n) {
+		auto it = cells.find(addr + n);
+		if (it == cells.end() || it->second.vspPart >= 0x0) {
+			continue;
+		}
+		ret.known |= std::uint32_t(it->second.known) << (n * 8);
+		ret.value |= std::uint32_t(it->second.value) << (n * 8);
+	}
+	return ret;
+}
+
+void VmByteMemory::Write(std::uint32_t addr, int size, const VmValue& val)
+{
+	for (int n = 0; n < size; ++n) {
+		ByteCell& cell = cells[addr + n];
+		cell.vspPart = -1;
+		cell.vspDelta = 0x0;
+		if (val.bVsp) {
+			//a truncated VSP value is unknown
+			cell.known = 0x0;
+			cell.value = 0x0;
+			if (size == 0x4) {
+				cell.vspPart = n;
+				cell.vspDelta = val.value;
+			}
+			continue;
+		}
+		cell.known = (val.known >> (n * 8)) & 0xFF;
+		cell.value = (val.value >> (n * 8)) & cell.known;
+	}
+}
+
+void VmpBlockInterpreter::moveVsp(VmState& state, std::uint32_t delta)
+{
+	state.vsp.value += delta;
+}
+
+void VmpBlockInterpreter::pushResult(VmState& state, std::uint32_t size, const VmValue& result, const VmValue& flags)
+{
+	state.stack.Write(state.vsp.value + 0x4, size, result);
+	state.stack.Write(state.vsp.value, 0x4, flags);
+	state.flags = flags;
+}
+
+bool VmpBlockInterpreter::opInit(VmState& state, const CompiledOp& op)
+{
+	for (const auto& push : op.pushList) {
+		moveVsp(state, std::uint32_t(-0x4));
+		state.stack.Write(state.vsp.value, push.first, push.second);
+	}
+	return true;
+}
+
+bool VmpBlockInterpreter::opPushImm(VmState& state, const CompiledOp& op)
+{
+	moveVsp(state, op.size == 0x4 ? std::uint32_t(-0x4) : std::uint32_t(-0x2));
+	state.stack.Write(state.vsp.value, op.size, VmValue::Const(op.operand));
+	return true;
+}
+
+bool VmpBlockInterpreter::opPushReg(VmState& state, const CompiledOp& op)
+{
+	VmValue val = state.context.Read(op.operand, op.size);
+	moveVsp(state, op.size == 0x4 ? std::uint32_t(-0x4) : std::uint32_t(-0x2));
+	state.stack.Write(state.vsp.value, op.size, val);
+	return true;
+}
+
+bool VmpBlockInterpreter::opPopReg(VmState& state, const CompiledOp& op)
+{
+	VmValue val = state.stack.Read(state.vsp.value, op.size);
+	state.context.Write(op.operand, op.size, val);
+	moveVsp(state, op.size == 0x4 ? 0x4 : 0x2);
+	return true;
+}
+
+bool VmpBlockInterpreter::opPushVsp(VmState& state, const CompiledOp& op)
+{
+	VmValue oldVsp = state.vsp;
+	moveVsp(state, std::uint32_t(-0x4));
+	state.stack.Write(state.vsp.value, 0x4, oldVsp);
+	return true;
+}
+
+bool VmpBlockInterpreter::opWriteVsp(VmState& state, const CompiledOp& op)
+{
+	VmValue newVsp = state.stack.Read(state.vsp.value, 0x4);
+	if (!newVsp.bVsp) {
+		return false;
+	}
+	state.vsp = newVsp;
+	return true;
+}
+
+bool VmpBlockInterpreter::opReadMem(VmState& state, const CompiledOp& op)
+{
+	VmValue readAddr = state.stack.Read(state.vsp.value, 0x4);
+	VmValue readVal;
+	if (readAddr.bVsp) {
+		readVal = state.stack.Read(readAddr.value, op.size);
+	}
+	if (op.size != 0x4) {
+		moveVsp(state, 0x2);
+	}
+	state.stack.Write(state.vsp.value, op.size, readVal);
+	return true;
+}
+
+bool VmpBlockInterpreter::opWriteMem(VmState& state, const CompiledOp& op)
+{
+	VmValue writeAddr = state.stack.Read(state.vsp.value, 0x4);
+	moveVsp(state, 0x4);
+	VmValue writeVal = state.stack.Read(state.vsp.value, op.size);
+	if (writeAddr.bVsp) {
+		state.stack.Write(writeAddr.value, op.size, writeVal);
+	}
+	else if (!writeAddr.IsConst()) {
+		//a store through an unknown pointer may hit the vm stack or the vm context
+		state.stack.Clear();
+		state.context.Clear();
+	}
+	moveVsp(state, op.size == 0x4 ? 0x4 : 0x2);
+	return true;
+}
+
+bool VmpBlockInterpreter::opAdd(VmState& state, const CompiledOp& op)
+{
+	std::uint32_t off = op.size == 0x4 ? 0x4 : 0x2;
+	VmValue u1 = state.stack.Read(state.vsp.value, op.size);
+	VmValue u2 = state.stack.Read(state.vsp.value + off, op.size);
+	if (op.size != 0x4) {
+		moveVsp(state, std::uint32_t(-0x2));
+	}
+	VmValue result;
+	VmValue flags;
+	std::uint32_t mask = sizeMask(op.size);
+	if (op.size == 0x4 && (u1.bVsp != u2.bVsp) && (u1.IsConst() || u2.IsConst())) {
+		//VSP plus a constant, the flags depend on the entry VSP
+		result = VmValue::Vsp(u1.value + u2.value);
+		pushResult(state, op.size, result, flags);
+		return true;
+	}
+	VmValue v1 = bitsOf(u1, op.size);
+	VmValue v2 = bitsOf(u2, op.size);
+	std::uint32_t unknownBits = ~(v1.known & v2.known) & mask;
+	std::uint32_t sum = (v1.value + v2.value) & mask;
+	if (unknownBits) {
+		//carries only move up, the bits below the first unknown one are known
+		std::uint32_t lowMask = (unknownBits & (0x0 - unknownBits)) - 1;
+		result.known = lowMask;
+		result.value = sum & lowMask;
+		pushResult(state, op.size, result, flags);
+		return true;
+	}
+	result = truncValue(VmValue::Const(sum), op.size);
+	flags = resultFlags(result, op.size);
+	std::uint32_t signBit = 1u << (op.size * 8 - 1);
+	flags.known |= FlagCF | FlagAF | FlagOF;
+	if (sum < (v1.value & mask)) {
+		flags.value |= FlagCF;
+	}
+	if ((v1.value ^ v2.value ^ sum) & 0x10) {
+		flags.value |= FlagAF;
+	}
+	if (~(v1.value ^ v2.value) & (v1.value ^ sum) & signBit) {
+		flags.value |= FlagOF;
+	}
+	pushResult(state, op.size, result, flags);
+	return true;
+}
+
+bool VmpBlockInterpreter::opNand(VmState& state, const CompiledOp& op)
+{
+	std::uint32_t off = op.size == 0x4 ? 0x4 : 0x2;
+	VmValue u1 = bitsOf(state.stack.Read(state.vsp.value, op.size), op.size);
+	VmValue u2 = bitsOf(state.stack.Read(state.vsp.value + off, op.size), op.size);
+	if (op.size != 0x4) {
+		moveVsp(state, std::uint32_t(-0x2));
+	}
+	VmValue result = truncValue(orValue(notValue(u1), notValue(u2)), op.size);
+	//or clears CF and OF, AF is undefined
+	VmValue flags = resultFlags(result, op.size);
+	flags.known |= FlagCF | FlagOF;
+	pushResult(state, op.size, result, flags);
+	return true;
+}
+
+bool VmpBlockInterpreter::opNor(VmState& state, const CompiledOp& op)
+{
+	std::uint32_t off = op.size == 0x4 ? 0x4 : 0x2;
+	VmValue u1 = bitsOf(state.stack.Read(state.vsp.value, op.size), op.size);
+	VmValue u2 = bitsOf(state.stack.Read(state.vsp.value + off, op.size), op.size);
+	if (op.size != 0x4) {
+		moveVsp(state, std::uint32_t(-0x2));
+	}
+	VmValue result = truncValue(andValue(notValue(u1), notValue(u2)), op.size);
+	VmValue flags = resultFlags(result, op.size);
+	flags.known |= FlagCF | FlagOF;
+	pushResult(state, op.size, result, flags);
+	return true;
+}
+
+bool VmpBlockInterpreter::opShr(VmState& state, const CompiledOp& op)
+{
+	std::uint32_t off = op.size == 0x4 ? 0x4 : 0x2;
+	VmValue u1 = bitsOf(state.stack.Read(state.vsp.value, op.size), op.size);
+	VmValue uCL = state.stack.Read(state.vsp.value + off, 0x1);
+	moveVsp(state, std::uint32_t(-0x2));
+	VmValue result;
+	VmValue flags;
+	//the cpu masks the count to 5 bits
+	if (!uCL.bVsp && (uCL.known & 0x1F) == 0x1F) {
+		std::uint32_t count = uCL.value & 0x1F;
+		std::uint32_t mask = sizeMask(op.size);
+		result.known = ((u1.known & mask) >> count) | (~(mask >> count) & mask);
+		result.value = ((u1.value & mask) >> count) & result.known;
+		//a zero count keeps the flags of the native code
+		if (count) {
+			flags = resultFlags(result, op.size);
+		}
+	}
+	pushResult(state, op.size, result, flags);
+	return true;
+}
+
+bool VmpBlockInterpreter::opShl(VmState& state, const CompiledOp& op)
+{
+	std::uint32_t off = op.size == 0x4 ? 0x4 : 0x2;
+	VmValue u1 = bitsOf(state.stack.Read(state.vsp.value, op.size), op.size);
+	VmValue uCL = state.stack.Read(state.vsp.value + off, 0x1);
+	moveVsp(state, std::uint32_t(-0x2));
+	VmValue result;
+	VmValue flags;
+	if (!uCL.bVsp && (uCL.known & 0x1F) == 0x1F) {
+		std::uint32_t count = uCL.value & 0x1F;
+		std::uint32_t mask = sizeMask(op.size);
+		result.known = ((u1.known << count) | ((1u << count) - 1)) & mask;
+		result.value = (u1.value << count) & result.known;
+		if (count) {
+			flags = resultFlags(result, op.size);
+		}
+	}
+	pushResult(state, op.size, result, flags);
+	return true;
+}
+
+bool VmpBlockInterpreter::opClobber(VmState& state, const CompiledOp& op)
+{
+	moveVsp(state, op.operand);
+	state.stack.Write(state.vsp.value, op.size, VmValue());
+	state.flags = VmValue();
+	return true;
+}
+
+bool VmpBlockInterpreter::opNop(VmState& state, const CompiledOp& op)
+{
+	return true;
+}
+
+bool VmpBlockInterpreter::opJmp(VmState& state, const CompiledOp& op)
+{
+	state.target = state.stack.Read(state.vsp.value, 0x4);
+	moveVsp(state, 0x4);
+	return true;
+}
+
+bool VmpBlockInterpreter::opJmpConst(VmState& state, const CompiledOp& op)
+{
+	state.target = VmValue::Const(op.operand);
+	return true;
+}
+
+bool VmpBlockInterpreter::opExit(VmState& state, const CompiledOp& op)
+{
+	moveVsp(state, op.operand * 0x4);
+	state.target = op.size ? VmValue::Const(op.size) : VmValue();
+	state.bExit = true;
+	return true;
+}
+
+bool VmpBlockInterpreter::opExitCall(VmState& state, const CompiledOp& op)
+{
+	moveVsp(state, 0x4);
+	state.target = op.size ? VmValue::Const(op.size) : VmValue();
+	state.bExit = true;
+	return true;
+}
+
+bool VmpBlockInterpreter::Compile(VmpBasicBlock* block)
+{
+	opList.clear();
+	for (unsigned int n = 0; n < block->insList.size(); ++n) {
+		vm_inst* raw = block->insList[n].get();
+		if (raw->IsRawInstruction()) {
+			return false;
+		}
+		VmpInstruction* vmInst = (VmpInstruction*)raw;
+		CompiledOp op;
+		op.handler = nullptr;
+		op.size = (std::uint32_t)vmInst->opSize;
+		op.operand = 0x0;
+		switch (vmInst->opType)
+		{
+		case VM_INIT:
+			op.handler = opInit;
+			for (const auto& store : ((VmpOpInit*)vmInst)->storeContext) {
+				if (store.space == "const") {
+					op.pushList.push_back(std::make_pair(0x4, VmValue::Const((std::uint32_t)store.offset)));
+				}
+				else if (store.space == "register") {
+					op.pushList.push_back(std::make_pair(store.size, VmValue()));
+				}
+			}
+			break;
+		case VM_PUSH_IMM:
+			op.handler = opPushImm;
+			op.operand = (std::uint32_t)((VmpOpPushImm*)vmInst)->immVal;
+			break;
+		case VM_PUSH_REG:
+			op.handler = opPushReg;
+			op.operand = ((VmpOpPushReg*)vmInst)->vmRegOffset;
+			break;
+		case VM_POP_REG:
+			op.handler = opPopReg;
+			op.operand = ((VmpOpPopReg*)vmInst)->vmRegOffset;
+			break;
+		case VM_PUSH_VSP:
+			op.handler = opPushVsp;
+			break;
+		case VM_WRITE_VSP:
+			op.handler = opWriteVsp;
+			break;
+		case VM_READ_MEM:
+			op.handler = opReadMem;
+			break;
+		case VM_WRITE_MEM:
+			op.handler = opWriteMem;
+			break;
+		case VM_ADD:
+			op.handler = opAdd;
+			break;
+		case VM_NAND:
+			op.handler = opNand;
+			break;
+		case VM_NOR:
+			op.handler = opNor;
+			break;
+		case VM_SHR:
+			op.handler = opShr;
+			break;
+		case VM_SHL:
+			op.handler = opShl;
+			break;
+		//the stack moves like the native handler, the values it writes are unknown
+		case VM_CPUID:
+			op.handler = opClobber;
+			op.operand = std::uint32_t(-0xC);
+			op.size = 0x10;
+			break;
+		case VM_RDTSC:
+			op.handler = opClobber;
+			op.operand = std::uint32_t(-0x8);
+			op.size = 0x8;
+			break;
+		case VM_SHLD:
+		case VM_SHRD:
+			op.handler = opClobber;
+			op.operand = 0x2;
+			op.size = 0x8;
+			break;
+		case VM_MUL:
+			op.handler = opClobber;
+			op.operand = std::uint32_t(-0x4);
+			op.size = 0xC;
+			break;
+		case VM_DIV:
+			op.handler = opClobber;
+			op.operand = 0x0;
+			op.size = 0xC;
+			break;
+		case VM_POPFD:
+			op.handler = opClobber;
+			op.operand = 0x4;
+			op.size = 0x0;
+			break;
+		case VM_CHECK_ESP:
+		case USER_CONNECT:
+			op.handler = opNop;
+			break;
+		case VM_JMP:
+			op.handler = opJmp;
+			break;
+		case VM_JMP_CONST:
+			op.handler = opJmpConst;
+			op.operand = (std::uint32_t)((VmpOpJmpConst*)vmInst)->targetAddr;
+			break;
+		case VM_EXIT:
+		{
+			VmpOpExit* vExit = (VmpOpExit*)vmInst;
+			op.handler = opExit;
+			for (const std::string& regName : vExit->exitContext) {
+				if (regName != "ESP") {
+					op.operand++;
+				}
+			}
+			op.size = (std::uint32_t)vExit->exitAddress;
+			break;
+		}
+		case VM_EXIT_CALL:
+			op.handler = opExitCall;
+			op.size = (std::uint32_t)((VmpOpExitCall*)vmInst)->exitAddress;
+			break;
+		default:
+			break;
+		}
+		if (!op.handler) {
+			return false;
+		}
+		opList.push_back(std::move(op));
+	}
+	return true;
+}
+
+bool VmpBlockInterpreter::Run(VmState& state) const
+{
+	for (const CompiledOp& op : opList) {
+		if (!state.vsp.bVsp) {
+			return false;
+		}
+		if (!op.handler(state, op)) {
+			return false;
+		}
+	}
+	return state.vsp.bVsp;
+}
+
+#ifdef DeveloperMode
+#pragma optimize("", on)
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+
+class VmpBasicBlock;
+
+//value of the vm state, a value relative to the entry VSP is known as a whole
+struct VmValue
+{
+	//bits of value that are known
+	std::uint32_t known = 0x0;
+	std::uint32_t value = 0x0;
+	bool bVsp = false;
+	bool IsConst() const { return !bVsp && known == 0xFFFFFFFF; };
+	static VmValue Const(std::uint32_t val);
+	static VmValue Vsp(std::uint32_t delta);
+};
+
+//vm stack or vm context kept byte by byte, bytes never written in the block are unknown
+class VmByteMemory
+{
+public:
+	VmValue Read(std::uint32_t addr, int size) const;
+	void Write(std::uint32_t addr, int size, const VmValue& val);
+	void Clear() { cells.clear(); };
+private:
+	struct ByteCell
+	{
+		std::uint8_t known;
+		std::uint8_t value;
+		//byte index inside a VSP value, value holds its low byte only
+		std::int8_t vspPart;
+		std::uint32_t vspDelta;
+	};
+	std::unordered_map<std::uint32_t, ByteCell> cells;
+};
+
+//vm level state of one block, VSP starts at the entry VSP
+struct VmState
+{
+	VmValue vsp = VmValue::Vsp(0x0);
+	VmByteMemory stack;
+	//vm registers keyed by their context offset
+	VmByteMemory context;
+	//eflags pushed by the last arithmetic op
+	VmValue flags;
+	//jump target of vJmp, vJmpConst or the exit address
+	VmValue target;
+	bool bExit = false;
+};
+
+//direct threaded interpreter over the vm instructions of a block
+//the semantics are the ones VmpInstructionBuilder lifts for the decompiler, so both agree on the result
+//an op without vm level semantics stops the compile, the caller falls back to the decompiler
+
+class VmpBlockInterpreter
+{
+public:
+	VmpBlockInterpreter() {};
+	~VmpBlockInterpreter() {};
+	bool Compile(VmpBasicBlock* block);
+	//false when VSP is lost or an op can not be run on the state
+	bool Run(VmState& state) const;
+private:
+	struct CompiledOp;
+	typedef bool(*OpHandler)(VmState& state, const CompiledOp& op);
+	struct CompiledOp
+	{
+		OpHandler handler;
+		std::uint32_t size;
+		std::uint32_t operand;
+		//values pushed by vInit, the native registers are unknown
+		std::vector<std::pair<int, VmValue>> pushList;
+	};
+	static bool opInit(VmState& state, const CompiledOp& op);
+	static bool opPushImm(VmState& state, const CompiledOp& op);
+	static bool opPushReg(VmState& state, const CompiledOp& op);
+	static bool opPopReg(VmState& state, const CompiledOp& op);
+	static bool opPushVsp(VmState& state, const CompiledOp& op);
+	static bool opWriteVsp(VmState& state, const CompiledOp& op);
+	static bool opReadMem(VmState& state, const CompiledOp& op);
+	static bool opWriteMem(VmState& state, const CompiledOp& op);
+	static bool opAdd(VmState& state, const CompiledOp& op);
+	static bool opNand(VmState& state, const CompiledOp& op);
+	static bool opNor(VmState& state, const CompiledOp& op);
+	static bool opShr(VmState& state, const CompiledOp& op);
+	static bool opShl(VmState& state, const CompiledOp& op);
+	//ops whose results are not modelled, only the stack they touch is
+	static bool opClobber(VmState& state, const CompiledOp& op);
+	static bool opNop(VmState& state, const CompiledOp& op);
+	static bool opJmp(VmState& state, const CompiledOp& op);
+	static bool opJmpConst(VmState& state, const CompiledOp& op);
+	static bool opExit(VmState& state, const CompiledOp& op);
+	static bool opExitCall(VmState& state, const CompiledOp& op);
+	static void moveVsp(VmState& state, std::uint32_t delta);
+	static void pushResult(VmState& state, std::uint32_t size, const VmValue& result, const VmValue& flags);
+private:
+	std::vector<CompiledOp> opList;
+};
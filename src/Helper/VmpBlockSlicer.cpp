@@ -0,0 +1,377 @@
+#include "VmpBlockSlicer.h"
+#include "../Ghidra/funcdata.hh"
+#include <algorithm>
+
+#ifdef DeveloperMode
+#pragma optimize("", off)
+#endif
+
+size_t VmpBlockSlice::KeptCount() const
+{
+	return std::count(keepList.begin(), keepList.end(), true);
+}
+
+bool VmpBlockSlicer::isEsp(ghidra::Varnode* vn)
+{
+	return vn->getSpace() == espSpace && vn->getOffset() == espOffset && vn->getSize() == espSize;
+}
+
+bool VmpBlockSlicer::overlapsEsp(ghidra::Varnode* vn)
+{
+	if (vn->getSpace() != espSpace) {
+		return false;
+	}
+	return vn->getOffset() < espOffset + espSize && espOffset < vn->getOffset() + vn->getSize();
+}
+
+void VmpBlockSlicer::readStorage(ghidra::Varnode* vn, std::vector<int>& deps)
+{
+	for (int n = 0; n < vn->getSize(); ++n) {
+		auto it = storageWriter.find(StorageKey(vn->getSpace(), vn->getOffset() + n));
+		if (it != storageWriter.end()) {
+			deps.push_back(it->second);
+		}
+	}
+}
+
+void VmpBlockSlicer::writeStorage(ghidra::Varnode* vn, int pos)
+{
+	for (int n = 0; n < vn->getSize(); ++n) {
+		storageWriter[StorageKey(vn->getSpace(), vn->getOffset() + n)] = pos;
+	}
+}
+
+void VmpBlockSlicer::readFrame(std::uint32_t offset, int size, std::vector<int>& deps)
+{
+	for (int n = 0; n < size; ++n) {
+		auto it = frameWriter.find(offset + n);
+		if (it != frameWriter.end()) {
+			deps.push_back(it->second);
+		}
+	}
+	//a store through an unknown pointer may have hit the frame
+	if (lastWild >= 0) {
+		deps.push_back(lastWild);
+	}
+}
+
+void VmpBlockSlicer::writeFrame(std::uint32_t offset, int size, int pos)
+{
+	for (int n = 0; n < size; ++n) {
+		frameWriter[offset + n] = pos;
+	}
+}
+
+void VmpBlockSlicer::readGlobal(std::uint32_t addr, int size, std::vector<int>& deps)
+{
+	for (int n = 0; n < size; ++n) {
+		auto it = globalWriter.find(addr + n);
+		if (it != globalWriter.end()) {
+			deps.push_back(it->second);
+		}
+	}
+	if (lastWild >= 0) {
+		deps.push_back(lastWild);
+	}
+}
+
+void VmpBlockSlicer::writeGlobal(std::uint32_t addr, int size, int pos)
+{
+	for (int n = 0; n < size; ++n) {
+		globalWriter[addr + n] = pos;
+	}
+}
+
+void VmpBlockSlicer::readAnyMemory(std::vector<int>& deps)
+{
+	for (const auto& eWriter : frameWriter) {
+		deps.push_back(eWriter.second);
+	}
+	for (const auto& eWriter : globalWriter) {
+		deps.push_back(eWriter.second);
+	}
+	if (lastWild >= 0) {
+		deps.push_back(lastWild);
+	}
+}
+
+void VmpBlockSlicer::writeAnyMemory(int pos, std::vector<int>& deps)
+{
+	//unknown stores are chained, depending on the last one pulls in all of them
+	if (lastWild >= 0) {
+		deps.push_back(lastWild);
+	}
+	lastWild = pos;
+}
+
+bool VmpBlockSlicer::frameKnownValue(std::uint32_t offset, int size, KnownValue& out)
+{
+	auto it = frameValue.find(offset);
+	if (it == frameValue.end() || it->second.val.size != size) {
+		return false;
+	}
+	//every byte still has to come from the same write
+	for (int n = 0; n < size; ++n) {
+		auto itWriter = frameWriter.find(offset + n);
+		if (itWriter == frameWriter.end() || itWriter->second != it->second.writer) {
+			return false;
+		}
+	}
+	if (lastWild > it->second.writer) {
+		return false;
+	}
+	out = it->second.val;
+	return true;
+}
+
+bool VmpBlockSlicer::knownValue(ghidra::Varnode* vn, KnownValue& out)
+{
+	if (vn->isConstant()) {
+		out.bEsp = false;
+		out.value = std::uint32_t(vn->getOffset());
+		out.size = vn->getSize();
+		return true;
+	}
+	if (isEsp(vn)) {
+		out.bEsp = true;
+		out.value = curEsp;
+		out.size = espSize;
+		return true;
+	}
+	if (vn->getSpace() == stackSpace) {
+		return frameKnownValue(std::uint32_t(vn->getOffset()), vn->getSize(), out);
+	}
+	auto it = storageValue.find(StorageKey(vn->getSpace(), vn->getOffset()));
+	if (it == storageValue.end() || it->second.val.size != vn->getSize()) {
+		return false;
+	}
+	for (int n = 0; n < vn->getSize(); ++n) {
+		auto itWriter = storageWriter.find(StorageKey(vn->getSpace(), vn->getOffset() + n));
+		if (itWriter == storageWriter.end() || itWriter->second != it->second.writer) {
+			return false;
+		}
+	}
+	out = it->second.val;
+	return true;
+}
+
+bool VmpBlockSlicer::evalOutput(ghidra::PcodeOp* op, KnownValue& out)
+{
+	KnownValue in0, in1;
+	switch (op->code())
+	{
+	case ghidra::CPUI_COPY:
+		if (!knownValue(op->getIn(0), out)) {
+			return false;
+		}
+		break;
+	case ghidra::CPUI_INT_ADD:
+		if (!knownValue(op->getIn(0), in0) || !knownValue(op->getIn(1), in1)) {
+			return false;
+		}
+		if (in0.bEsp && in1.bEsp) {
+			return false;
+		}
+		out.bEsp = in0.bEsp || in1.bEsp;
+		out.value = in0.value + in1.value;
+		break;
+	case ghidra::CPUI_INT_SUB:
+		if (!knownValue(op->getIn(0), in0) || !knownValue(op->getIn(1), in1)) {
+			return false;
+		}
+		if (in1.bEsp) {
+			return false;
+		}
+		out.bEsp = in0.bEsp;
+		out.value = in0.value - in1.value;
+		break;
+	case ghidra::CPUI_LOAD:
+		if (!knownValue(op->getIn(1), in0) || !in0.bEsp) {
+			return false;
+		}
+		if (!frameKnownValue(in0.value, op->getOut()->getSize(), out)) {
+			return false;
+		}
+		break;
+	default:
+		return false;
+	}
+	out.size = op->getOut()->getSize();
+	return true;
+}
+
+bool VmpBlockSlicer::processOp(int pos, ghidra::PcodeOp* op, std::vector<int>& deps)
+{
+	ghidra::OpCode opc = op->code();
+	for (int n = 0; n < op->numInput(); ++n) {
+		ghidra::Varnode* vn = op->getIn(n);
+		//esp is rebuilt from the kept changes, reading it adds no writer
+		if (vn->isConstant() || isEsp(vn)) {
+			continue;
+		}
+		//branch destinations are addresses, not reads
+		if (n == 0x0 && (opc == ghidra::CPUI_BRANCH || opc == ghidra::CPUI_CBRANCH || opc == ghidra::CPUI_CALL)) {
+			continue;
+		}
+		if (vn->getSpace() == stackSpace) {
+			readFrame(std::uint32_t(vn->getOffset()), vn->getSize(), deps);
+		}
+		else if (vn->getSpace() == ramSpace) {
+			readGlobal(std::uint32_t(vn->getOffset()), vn->getSize(), deps);
+		}
+		else {
+			readStorage(vn, deps);
+		}
+	}
+	KnownValue ptr;
+	switch (opc)
+	{
+	case ghidra::CPUI_LOAD:
+		if (!knownValue(op->getIn(1), ptr)) {
+			readAnyMemory(deps);
+		}
+		else if (ptr.bEsp) {
+			readFrame(ptr.value, op->getOut()->getSize(), deps);
+		}
+		else {
+			readGlobal(ptr.value, op->getOut()->getSize(), deps);
+		}
+		break;
+	case ghidra::CPUI_STORE:
+	{
+		ghidra::Varnode* vStoreVal = op->getIn(2);
+		if (!knownValue(op->getIn(1), ptr)) {
+			writeAnyMemory(pos, deps);
+		}
+		else if (ptr.bEsp) {
+			writeFrame(ptr.value, vStoreVal->getSize(), pos);
+			WrittenValue storeVal;
+			storeVal.writer = pos;
+			if (knownValue(vStoreVal, storeVal.val)) {
+				frameValue[ptr.value] = storeVal;
+			}
+		}
+		else {
+			writeGlobal(ptr.value, vStoreVal->getSize(), pos);
+		}
+		break;
+	}
+	case ghidra::CPUI_CALL:
+	case ghidra::CPUI_CALLIND:
+	case ghidra::CPUI_CALLOTHER:
+		readAnyMemory(deps);
+		writeAnyMemory(pos, deps);
+		break;
+	default:
+		break;
+	}
+	ghidra::Varnode* vOut = op->getOut();
+	if (!vOut) {
+		return true;
+	}
+	WrittenValue outVal;
+	outVal.writer = pos;
+	bool bKnown = evalOutput(op, outVal.val);
+	if (overlapsEsp(vOut)) {
+		//esp has to stay entry esp plus a constant, the kept changes depend on it
+		if (!isEsp(vOut) || !bKnown || !outVal.val.bEsp) {
+			return false;
+		}
+		curEsp = outVal.val.value;
+		return true;
+	}
+	if (vOut->getSpace() == stackSpace) {
+		writeFrame(std::uint32_t(vOut->getOffset()), vOut->getSize(), pos);
+		if (bKnown) {
+			frameValue[std::uint32_t(vOut->getOffset())] = outVal;
+		}
+	}
+	else if (vOut->getSpace() == ramSpace) {
+		writeGlobal(std::uint32_t(vOut->getOffset()), vOut->getSize(), pos);
+	}
+	else {
+		writeStorage(vOut, pos);
+		if (bKnown) {
+			storageValue[StorageKey(vOut->getSpace(), vOut->getOffset())] = outVal;
+		}
+	}
+	return true;
+}
+
+bool VmpBlockSlicer::BuildSlice(VmpBlockSlice& outSlice)
+{
+	const std::vector<ghidra::uintm>& insStart = fd->vm_insStart;
+	if (fd->vm_blockStart != 0x0 || fd->vm_blockSlice || insStart.size() < 2) {
+		return false;
+	}
+	size_t insCount = insStart.size() - 1;
+	ghidra::Architecture* glb = fd->getArch();
+	stackSpace = glb->getStackSpace();
+	ramSpace = glb->getSpaceByName("ram");
+	const ghidra::VarnodeData& regESP = glb->translate->getRegister("ESP");
+	espSpace = regESP.space;
+	espOffset = regESP.offset;
+	espSize = regESP.size;
+
+	//ops in the order they were lifted
+	std::vector<ghidra::PcodeOp*> opList;
+	for (auto it = fd->beginOpAll(); it != fd->endOpAll(); ++it) {
+		opList.push_back(it->second);
+	}
+	std::sort(opList.begin(), opList.end(), [](ghidra::PcodeOp* a, ghidra::PcodeOp* b) {
+		return a->getTime() < b->getTime();
+	});
+	std::vector<std::vector<int>> depList(opList.size());
+	std::vector<size_t> ownerList(opList.size());
+	outSlice.keepList.assign(insCount, false);
+	outSlice.espDelta.assign(insCount, 0x0);
+	for (size_t pos = 0; pos < opList.size(); ++pos) {
+		ghidra::PcodeOp* curOp = opList[pos];
+		size_t owner = std::upper_bound(insStart.begin(), insStart.end(), curOp->getTime()) - insStart.begin();
+		owner = owner ? owner - 1 : 0x0;
+		ownerList[pos] = owner;
+		std::uint32_t oldEsp = curEsp;
+		if (!processOp(int(pos), curOp, depList[pos])) {
+			return false;
+		}
+		if (curEsp != oldEsp) {
+			//the return built after the block must not move esp
+			if (owner >= insCount) {
+				return false;
+			}
+			outSlice.espDelta[owner] += int(curEsp - oldEsp);
+		}
+	}
+
+	//the jump target and the slot at the final esp
+	std::vector<int> rootList;
+	const ghidra::VarnodeData& regEIP = glb->translate->getRegister("EIP");
+	for (unsigned int n = 0; n < regEIP.size; ++n) {
+		auto it = storageWriter.find(StorageKey(regEIP.space, regEIP.offset + n));
+		if (it != storageWriter.end()) {
+			rootList.push_back(it->second);
+		}
+	}
+	readFrame(curEsp, 0x4, rootList);
+
+	std::vector<bool> visited(opList.size(), false);
+	while (!rootList.empty()) {
+		int pos = rootList.back();
+		rootList.pop_back();
+		if (visited[pos]) {
+			continue;
+		}
+		visited[pos] = true;
+		if (ownerList[pos] < insCount) {
+			outSlice.keepList[ownerList[pos]] = true;
+		}
+		rootList.insert(rootList.end(), depList[pos].begin(), depList[pos].end());
+	}
+	//the instruction ending the block is always lifted
+	outSlice.keepList[insCount - 1] = true;
+	return true;
+}
+
+#ifdef DeveloperMode
+#pragma optimize("", on)
+#endif
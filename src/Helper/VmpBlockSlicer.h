@@ -0,0 +1,90 @@
+#pragma once
+#include <map>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+
+namespace ghidra
+{
+	class Funcdata;
+	class Varnode;
+	class PcodeOp;
+	class AddrSpace;
+}
+
+//instructions of a vm block that the end of the block depends on
+class VmpBlockSlice
+{
+public:
+	bool IsKept(size_t idx) const { return keepList[idx]; }
+	int EspDelta(size_t idx) const { return espDelta[idx]; }
+	size_t KeptCount() const;
+public:
+	std::vector<bool> keepList;
+	//change of esp made by every instruction, a dropped instruction is lifted as this change only
+	std::vector<int> espDelta;
+};
+
+//backward slice over the raw pcode of a vm block
+//registers, temporaries and the entry frame are followed byte by byte, values passed through
+//the vm stack or the vm context keep their writers, so does esp saved on the vm stack
+//the roots are the jump target and the slot at the final esp, the inputs of the branch analyzers
+
+class VmpBlockSlicer
+{
+public:
+	VmpBlockSlicer(ghidra::Funcdata* func) :fd(func) {};
+	~VmpBlockSlicer() {};
+	//false when esp leaves the entry frame or the block was not lifted as a whole
+	bool BuildSlice(VmpBlockSlice& outSlice);
+private:
+	typedef std::pair<ghidra::AddrSpace*, std::uint64_t> StorageKey;
+	//esp on entry plus value, or the constant value
+	struct KnownValue
+	{
+		bool bEsp = false;
+		std::uint32_t value = 0x0;
+		int size = 0x0;
+	};
+	//known value and the op writing it, stale once any byte has another writer
+	struct WrittenValue
+	{
+		int writer;
+		KnownValue val;
+	};
+	bool processOp(int pos, ghidra::PcodeOp* op, std::vector<int>& deps);
+	void readStorage(ghidra::Varnode* vn, std::vector<int>& deps);
+	void writeStorage(ghidra::Varnode* vn, int pos);
+	void readFrame(std::uint32_t offset, int size, std::vector<int>& deps);
+	void writeFrame(std::uint32_t offset, int size, int pos);
+	void readGlobal(std::uint32_t addr, int size, std::vector<int>& deps);
+	void writeGlobal(std::uint32_t addr, int size, int pos);
+	void readAnyMemory(std::vector<int>& deps);
+	void writeAnyMemory(int pos, std::vector<int>& deps);
+	bool frameKnownValue(std::uint32_t offset, int size, KnownValue& out);
+	bool knownValue(ghidra::Varnode* vn, KnownValue& out);
+	bool evalOutput(ghidra::PcodeOp* op, KnownValue& out);
+	bool isEsp(ghidra::Varnode* vn);
+	bool overlapsEsp(ghidra::Varnode* vn);
+private:
+	ghidra::Funcdata* fd;
+	ghidra::AddrSpace* stackSpace = nullptr;
+	ghidra::AddrSpace* ramSpace = nullptr;
+	ghidra::AddrSpace* espSpace = nullptr;
+	std::uint64_t espOffset = 0x0;
+	int espSize = 0x0;
+	//esp relative to the entry esp
+	std::uint32_t curEsp = 0x0;
+	//last writer of every register and temporary byte
+	std::map<StorageKey, int> storageWriter;
+	//registers and temporaries holding a known value, keyed by their first byte
+	std::map<StorageKey, WrittenValue> storageValue;
+	//last writer of every byte of the entry frame, offsets are relative to the entry esp
+	std::unordered_map<std::uint32_t, int> frameWriter;
+	std::unordered_map<std::uint32_t, WrittenValue> frameValue;
+	//last writer of every byte stored to a constant address
+	std::unordered_map<std::uint32_t, int> globalWriter;
+	//last store through an unknown pointer, -1 if none
+	int lastWild = -1;
+};
@@ -0,0 +1,247 @@
+#include "VmpHandlerFeature.h"
+#include "../Ghidra/funcdata.hh"
+
+#ifdef DeveloperMode
+#pragma optimize("", off)
+#endif
+
+ghidra::OpCode CheckLogicPattern(ghidra::PcodeOp* startOP)
+{
+	std::vector<ghidra::PcodeOp*> checkList;
+	checkList.push_back(startOP);
+	while (!checkList.empty()) {
+		ghidra::PcodeOp* curOp = checkList.back();
+		checkList.pop_back();
+		if (curOp == nullptr) {
+			continue;
+		}
+		//ݹģ
+		switch (curOp->code()) {
+		case ghidra::CPUI_INT_ZEXT:
+		case ghidra::CPUI_SUBPIECE:
+			checkList.push_back(curOp->getIn(0)->getDef());
+			break;
+		case ghidra::CPUI_PIECE:
+			checkList.push_back(curOp->getIn(0)->getDef());
+			checkList.push_back(curOp->getIn(1)->getDef());
+			break;
+		}
+		//ƥģ
+		if (curOp->code() == ghidra::CPUI_INT_LEFT) {
+			ghidra::PcodeOp* defOp1 = curOp->getIn(0)->getDef();
+			if (defOp1 && defOp1->code() == ghidra::CPUI_LOAD) {
+				return ghidra::CPUI_INT_LEFT;
+			}
+		}
+		else if (curOp->code() == ghidra::CPUI_INT_RIGHT) {
+			ghidra::PcodeOp* defOp1 = curOp->getIn(0)->getDef();
+			if (defOp1 && defOp1->code() == ghidra::CPUI_LOAD) {
+				return ghidra::CPUI_INT_RIGHT;
+			}
+		}
+		else if (curOp->code() == ghidra::CPUI_INT_ADD) {
+			ghidra::PcodeOp* defOp1 = curOp->getIn(0)->getDef();
+			ghidra::PcodeOp* defOp2 = curOp->getIn(1)->getDef();
+			if (defOp1 && defOp2 && defOp1->code() == ghidra::CPUI_LOAD && defOp2->code() == ghidra::CPUI_LOAD) {
+				return ghidra::CPUI_INT_ADD;
+			}
+		}
+		else if (curOp->code() == ghidra::CPUI_INT_AND) {
+			if (curOp->getIn(1)->isConstant()) {
+				checkList.push_back(curOp->getIn(0)->getDef());
+				continue;
+			}
+			ghidra::PcodeOp* defOp1 = curOp->getIn(0)->getDef();
+			ghidra::PcodeOp* defOp2 = curOp->getIn(1)->getDef();
+			if (defOp1 && defOp2 && defOp1->code() == ghidra::CPUI_INT_NEGATE && defOp2->code() == ghidra::CPUI_INT_NEGATE) {
+				return ghidra::CPUI_INT_AND;
+			}
+		}
+		else if (curOp->code() == ghidra::CPUI_INT_OR) {
+			ghidra::PcodeOp* defOp1 = curOp->getIn(0)->getDef();
+			ghidra::PcodeOp* defOp2 = curOp->getIn(1)->getDef();
+			if (defOp1 && defOp2 && defOp1->code() == ghidra::CPUI_INT_NEGATE && defOp2->code() == ghidra::CPUI_INT_NEGATE) {
+				return ghidra::CPUI_INT_OR;
+			}
+		}
+	}
+	return ghidra::OpCode(0x0);
+}
+
+
+VmpHandlerFeature::VmpHandlerFeature(ghidra::Funcdata* fd)
+{
+	GhidraHelper::PcodeTraceSummary traceSummary(fd);
+	extractMemAccess(fd, traceSummary);
+	//the feature outlives fd, so the return registers can not be traced on lookup
+	//only the jmp and write-vsp matchers read them, both take handlers without stores and at most two loads
+	if (storeList.empty() && loadList.size() <= 2) {
+		extractRetRegs(fd, traceSummary);
+	}
+	extractOpCode(fd);
+	extractExitContext(fd);
+}
+
+void VmpHandlerFeature::extractRetRegs(ghidra::Funcdata* fd, GhidraHelper::PcodeTraceSummary& summary)
+{
+	ghidra::PcodeOp* retOp = fd->getFirstReturnOp();
+	if (!retOp) {
+		return;
+	}
+	for (int n = 0; n < retOp->numInput(); ++n) {
+		VmpRegId reg = GhidraHelper::GetVarnodeRegId(retOp->getIn(n));
+		if (reg == VmpRegister::REG_NONE || retTraces.count(reg)) {
+			continue;
+		}
+		GhidraHelper::PcodeOpTracer opTracer(summary);
+		retTraces[reg] = opTracer.TraceInput(retOp->getAddr().getOffset(), retOp->getIn(n));
+	}
+}
+
+void VmpHandlerFeature::extractMemAccess(ghidra::Funcdata* fd, GhidraHelper::PcodeTraceSummary& summary)
+{
+	storeList.reserve(fd->obank.storelist.size());
+	for (auto it = fd->obank.storelist.begin(); it != fd->obank.storelist.end(); ++it) {
+		ghidra::PcodeOp* storeOp = *it;
+		StoreTrace trace;
+		trace.addr = storeOp->getAddr().getOffset();
+		ghidra::PcodeOp* valueDef = storeOp->getIn(2)->getDef();
+		if (valueDef) {
+			trace.valueDefAddr = valueDef->getAddr().getOffset();
+			trace.logicCode = CheckLogicPattern(valueDef);
+		}
+		//keep one tracer per store, src results are filtered against dst
+		GhidraHelper::PcodeOpTracer opTracer(summary);
+		trace.dst = opTracer.TraceInput(trace.addr, storeOp->getIn(1));
+		trace.src = opTracer.TraceInput(trace.addr, storeOp->getIn(2));
+		storeList.push_back(std::move(trace));
+	}
+	loadList.reserve(fd->obank.loadlist.size());
+	for (auto it = fd->obank.loadlist.begin(); it != fd->obank.loadlist.end(); ++it) {
+		ghidra::PcodeOp* loadOp = *it;
+		ghidra::Varnode* vLoadReg = loadOp->getIn(1);
+		LoadTrace trace;
+		trace.addr = loadOp->getAddr().getOffset();
+		trace.ptrReg = GhidraHelper::GetVarnodeRegId(vLoadReg);
+		GhidraHelper::PcodeOpTracer opTracer(summary);
+		trace.ptr = opTracer.TraceInput(trace.addr, vLoadReg);
+		loadList.push_back(std::move(trace));
+	}
+	if (!fd->obank.loadlist.empty()) {
+		ghidra::Varnode* vOut = (*fd->obank.loadlist.begin())->getOut();
+		for (auto it = vOut->beginDescend(); it != vOut->endDescend(); ++it) {
+			ghidra::PcodeOp* useOp = *it;
+			if (useOp->code() != ghidra::CPUI_COPY) {
+				continue;
+			}
+			if (GhidraHelper::GetVarnodeRegId(useOp->getOut()) == VmpRegister::REG_EFLAGS) {
+				bLoadToEflags = true;
+				break;
+			}
+		}
+	}
+}
+
+void VmpHandlerFeature::extractOpCode(ghidra::Funcdata* fd)
+{
+	for (auto it = fd->beginOpAll(); it != fd->endOpAll(); ++it) {
+		ghidra::PcodeOp* curOp = it->second;
+		ghidra::OpCode opc = curOp->code();
+		opCodes.set(opc);
+		if (opc == ghidra::CPUI_CALLOTHER) {
+			ghidra::UserPcodeOp* userOp = fd->getArch()->userops.getOp(curOp->getIn(0)->getOffset());
+			if (userOp) {
+				userOps.insert(userOp->getOperatorName(curOp));
+			}
+		}
+		else if (opc == ghidra::CPUI_PTRSUB && !bEspPtrSub) {
+			ghidra::Varnode* firstVn = curOp->getIn(0);
+			if (firstVn->isInput() && GhidraHelper::GetVarnodeRegId(firstVn) == VmpRegister::REG_ESP) {
+				bEspPtrSub = true;
+			}
+		}
+	}
+}
+
+void VmpHandlerFeature::extractExitContext(ghidra::Funcdata* fd)
+{
+	//vExit pops all the registers back from the vm stack
+	ghidra::PcodeOp* retOp = fd->getFirstReturnOp();
+	if (loadList.size() < 7 || !retOp) {
+		return;
+	}
+	std::map<int, ghidra::VarnodeData> exitContextMap;
+	for (int n = 0; n < retOp->numInput(); ++n) {
+		ghidra::Varnode* vnReg = retOp->getIn(n);
+		if (vnReg->getSpace()->getName() != "register") {
+			continue;
+		}
+		ghidra::PcodeOp* defOp = vnReg->getDef();
+		if (!defOp) {
+			continue;
+		}
+		if (defOp->code() == ghidra::CPUI_LOAD) {
+			if (!defOp->getIn(1)->isInput()) {
+				defOp = defOp->getIn(1)->getDef();
+			}
+		}
+		if (!defOp) {
+			continue;
+		}
+		ghidra::VarnodeData tmpData;
+		if (defOp->code() == ghidra::CPUI_LOAD) {
+			tmpData.space = vnReg->getSpace();
+			tmpData.offset = vnReg->getOffset();
+			tmpData.size = vnReg->getSize();
+			exitContextMap[0x0] = tmpData;
+		}
+		else if (defOp->code() == ghidra::CPUI_PTRADD) {
+			if (defOp->getIn(2)->isConstant() && defOp->getIn(2)->getOffset() == 0x4) {
+				if (defOp->getIn(1)->isConstant()) {
+					tmpData.space = vnReg->getSpace();
+					tmpData.offset = vnReg->getOffset();
+					tmpData.size = vnReg->getSize();
+					exitContextMap[defOp->getIn(1)->getOffset()] = tmpData;
+				}
+			}
+		}
+	}
+	std::vector<VmpRegId> regList;
+	for (int base = 0; base < 10; ++base) {
+		auto it = exitContextMap.find(base);
+		if (it == exitContextMap.end()) {
+			return;
+		}
+		regList.push_back(VmpRegister::FromVarnode(it->second.space, it->second.offset, it->second.size));
+	}
+	exitRegs = std::move(regList);
+}
+
+bool VmpHandlerFeature::HasOpCode(int opc) const
+{
+	return opCodes.test(opc);
+}
+
+bool VmpHandlerFeature::HasUserOp(const std::string& name) const
+{
+	return userOps.count(name) != 0;
+}
+
+bool VmpHandlerFeature::HasRetReg(VmpRegId reg) const
+{
+	return retTraces.count(reg) != 0;
+}
+
+const std::vector<GhidraHelper::TraceResult>& VmpHandlerFeature::TraceRetReg(VmpRegId reg) const
+{
+	static const std::vector<GhidraHelper::TraceResult> emptyResult;
+	auto it = retTraces.find(reg);
+	if (it == retTraces.end()) {
+		return emptyResult;
+	}
+	return it->second;
+}
+
+#ifdef DeveloperMode
+#pragma optimize("", on)
+#endif
@@ -0,0 +1,69 @@
+#pragma once
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <bitset>
+#include "GhidraHelper.h"
+#include "../Ghidra/opcodes.hh"
+
+//features of a single vm handler, extracted in one walk over its pcode
+//the result does not reference the funcdata, it can outlive the analysis
+
+class VmpHandlerFeature
+{
+public:
+	struct StoreTrace
+	{
+		//address of the store op
+		size_t addr = 0x0;
+		//address of the op defining the stored value, 0 if none
+		size_t valueDefAddr = 0x0;
+		//logic pattern of the stored value, see CheckLogicPattern
+		ghidra::OpCode logicCode = ghidra::OpCode(0x0);
+		//sources of the store pointer
+		std::vector<GhidraHelper::TraceResult> dst;
+		//sources of the stored value
+		std::vector<GhidraHelper::TraceResult> src;
+	};
+	struct LoadTrace
+	{
+		//address of the load op
+		size_t addr = 0x0;
+		//register of the load pointer
+		VmpRegId ptrReg = VmpRegister::REG_NONE;
+		//sources of the load pointer
+		std::vector<GhidraHelper::TraceResult> ptr;
+	};
+public:
+	VmpHandlerFeature(ghidra::Funcdata* fd);
+	~VmpHandlerFeature() {};
+public:
+	bool HasOpCode(int opc) const;
+	bool HasUserOp(const std::string& name) const;
+	//return registers are only traced for handlers without stores and at most two loads
+	bool HasRetReg(VmpRegId reg) const;
+	//sources of a register at the return op
+	const std::vector<GhidraHelper::TraceResult>& TraceRetReg(VmpRegId reg) const;
+private:
+	void extractRetRegs(ghidra::Funcdata* fd, GhidraHelper::PcodeTraceSummary& summary);
+	void extractMemAccess(ghidra::Funcdata* fd, GhidraHelper::PcodeTraceSummary& summary);
+	void extractOpCode(ghidra::Funcdata* fd);
+	void extractExitContext(ghidra::Funcdata* fd);
+public:
+	std::vector<StoreTrace> storeList;
+	std::vector<LoadTrace> loadList;
+	std::set<std::string> userOps;
+	//registers restored from the vm stack, in pop order
+	std::vector<VmpRegId> exitRegs;
+	//some op reads input ESP through PTRSUB
+	bool bEspPtrSub = false;
+	//the first load is copied into eflags
+	bool bLoadToEflags = false;
+private:
+	std::bitset<128> opCodes;
+	std::map<VmpRegId, std::vector<GhidraHelper::TraceResult>> retTraces;
+};
+
+//return the logic operation behind a stored vm value
+ghidra::OpCode CheckLogicPattern(ghidra::PcodeOp* startOP);
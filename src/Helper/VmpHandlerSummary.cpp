@@ -0,0 +1,626 @@
+#include "VmpHandlerSummary.h"
+#include "../Ghidra/translate.hh"
+#include "../GhidraExtension/VmpArch.h"
+#include "../GhidraExtension/VmpNode.h"
+#include "../Manager/DisasmManager.h"
+#include "../Manager/SectionManager.h"
+#include <algorithm>
+#include <string.h>
+
+#ifdef DeveloperMode
+#pragma optimize("", off)
+#endif
+
+//register space is indexed directly, larger offsets belong to registers a handler never uses
+static const size_t MaxRegisterSpan = 0x2000;
+
+//collects the raw pcode of one instruction
+class SummaryEmit :public ghidra::PcodeEmit
+{
+public:
+	struct RawOp
+	{
+		ghidra::OpCode opc;
+		bool bHasOut;
+		ghidra::VarnodeData outVar;
+		std::vector<ghidra::VarnodeData> inVars;
+	};
+	SummaryEmit(std::vector<RawOp>& out) :opList(out) {};
+	void dump(const ghidra::Address& addr, ghidra::OpCode opc, ghidra::VarnodeData* outvar, ghidra::VarnodeData* vars, ghidra::int4 isize) override
+	{
+		RawOp rawOp;
+		rawOp.opc = opc;
+		rawOp.bHasOut = (outvar != nullptr);
+		if (outvar) {
+			rawOp.outVar = *outvar;
+		}
+		rawOp.inVars.assign(vars, vars + isize);
+		opList.push_back(std::move(rawOp));
+	}
+private:
+	std::vector<RawOp>& opList;
+};
+
+//native instruction of a handler, pop [esp] is built by hand like BuildPopIns
+struct SummaryIns
+{
+	size_t addr = 0x0;
+	bool bPopEsp = false;
+	int popDisp = 0x0;
+	std::vector<SummaryEmit::RawOp> opList;
+};
+
+static bool isSupportedOpCode(ghidra::OpCode opc)
+{
+	switch (opc) {
+	case ghidra::CPUI_COPY:
+	case ghidra::CPUI_LOAD:
+	case ghidra::CPUI_STORE:
+	case ghidra::CPUI_INT_EQUAL:
+	case ghidra::CPUI_INT_NOTEQUAL:
+	case ghidra::CPUI_INT_SLESS:
+	case ghidra::CPUI_INT_SLESSEQUAL:
+	case ghidra::CPUI_INT_LESS:
+	case ghidra::CPUI_INT_LESSEQUAL:
+	case ghidra::CPUI_INT_ZEXT:
+	case ghidra::CPUI_INT_SEXT:
+	case ghidra::CPUI_INT_ADD:
+	case ghidra::CPUI_INT_SUB:
+	case ghidra::CPUI_INT_CARRY:
+	case ghidra::CPUI_INT_SCARRY:
+	case ghidra::CPUI_INT_SBORROW:
+	case ghidra::CPUI_INT_2COMP:
+	case ghidra::CPUI_INT_NEGATE:
+	case ghidra::CPUI_INT_XOR:
+	case ghidra::CPUI_INT_AND:
+	case ghidra::CPUI_INT_OR:
+	case ghidra::CPUI_INT_LEFT:
+	case ghidra::CPUI_INT_RIGHT:
+	case ghidra::CPUI_INT_SRIGHT:
+	case ghidra::CPUI_INT_MULT:
+	case ghidra::CPUI_INT_DIV:
+	case ghidra::CPUI_INT_SDIV:
+	case ghidra::CPUI_INT_REM:
+	case ghidra::CPUI_INT_SREM:
+	case ghidra::CPUI_BOOL_NEGATE:
+	case ghidra::CPUI_BOOL_XOR:
+	case ghidra::CPUI_BOOL_AND:
+	case ghidra::CPUI_BOOL_OR:
+	case ghidra::CPUI_PIECE:
+	case ghidra::CPUI_SUBPIECE:
+	case ghidra::CPUI_POPCOUNT:
+	case ghidra::CPUI_LZCOUNT:
+		return true;
+	default:
+		break;
+	}
+	return false;
+}
+
+std::unique_ptr<VmpHandlerSummary> VmpHandlerSummary::Build(VmpArchitecture* arch, const VmpNode& node, const std::vector<size_t>& probeList)
+{
+	if (node.addrList.empty()) {
+		return nullptr;
+	}
+	ghidra::AddrSpace* constSpace = arch->getConstantSpace();
+	ghidra::AddrSpace* uniqSpace = arch->getUniqueSpace();
+	ghidra::AddrSpace* ramSpace = arch->getDefaultDataSpace();
+	std::unique_ptr<VmpHandlerSummary> summary = std::make_unique<VmpHandlerSummary>();
+	summary->addrList = node.addrList;
+	const char* gprNames[8] = { "EAX", "ECX", "EDX", "EBX", "ESP", "EBP", "ESI", "EDI" };
+	ghidra::AddrSpace* regSpace = nullptr;
+	size_t regEnd = 0x0;
+	for (unsigned int n = 0; n < 8; ++n) {
+		const ghidra::VarnodeData& regData = arch->translate->getRegister(gprNames[n]);
+		regSpace = regData.space;
+		summary->gprPos[n] = regData.offset;
+		regEnd = std::max<size_t>(regEnd, regData.offset + regData.size);
+	}
+	//eflags bits kept in their own registers by sleigh
+	struct FlagName
+	{
+		const char* name;
+		int bit;
+		std::uint32_t mask;
+	};
+	const FlagName flagNames[] = {
+		{"CF", 0, 0x1}, {"PF", 2, 0x1}, {"AF", 4, 0x1}, {"ZF", 6, 0x1}, {"SF", 7, 0x1}, {"TF", 8, 0x1},
+		{"IF", 9, 0x1}, {"DF", 10, 0x1}, {"OF", 11, 0x1}, {"IOPL", 12, 0x3}, {"NT", 14, 0x1}, {"RF", 16, 0x1},
+		{"VM", 17, 0x1}, {"AC", 18, 0x1}, {"VIF", 19, 0x1}, {"VIP", 20, 0x1}, {"ID", 21, 0x1},
+	};
+	for (const FlagName& flag : flagNames) {
+		try {
+			const ghidra::VarnodeData& regData = arch->translate->getRegister(flag.name);
+			if (regData.space != regSpace || regData.size != 0x1) {
+				continue;
+			}
+			summary->flagList.push_back(FlagSlot{ (std::uint32_t)regData.offset, flag.bit, flag.mask });
+			regEnd = std::max<size_t>(regEnd, regData.offset + 0x1);
+		}
+		catch (ghidra::LowlevelError&) {
+			continue;
+		}
+	}
+	//raw pcode of every instruction, the walk has to follow the traced path
+	std::vector<SummaryIns> insList(node.addrList.size());
+	std::vector<std::pair<std::uint64_t, std::uint64_t>> uniqRanges;
+	for (unsigned int n = 0; n < node.addrList.size(); ++n) {
+		SummaryIns& ins = insList[n];
+		ins.addr = node.addrList[n];
+		auto asmData = DisasmManager::Main().DecodeInstruction(ins.addr);
+		if (!asmData) {
+			return nullptr;
+		}
+		if (asmData->raw->id == X86_INS_POP && asmData->raw->detail->x86.operands[0].type == X86_OP_MEM && asmData->raw->detail->x86.operands[0].mem.base == X86_REG_ESP) {
+			const cs_x86_op& op0 = asmData->raw->detail->x86.operands[0];
+			if (op0.size != 0x4 || op0.mem.index != X86_REG_INVALID) {
+				return nullptr;
+			}
+			ins.bPopEsp = true;
+			ins.popDisp = (int)op0.mem.disp;
+			continue;
+		}
+		SummaryEmit emit(ins.opList);
+		ghidra::Address curAddr(arch->getDefaultCodeSpace(), ins.addr);
+		arch->PcodeCache().OneInstruction(emit, curAddr);
+		for (const SummaryEmit::RawOp& rawOp : ins.opList) {
+			std::vector<const ghidra::VarnodeData*> varList;
+			if (rawOp.bHasOut) {
+				varList.push_back(&rawOp.outVar);
+			}
+			for (const ghidra::VarnodeData& vn : rawOp.inVars) {
+				varList.push_back(&vn);
+			}
+			for (const ghidra::VarnodeData* vn : varList) {
+				if (vn->space == uniqSpace) {
+					uniqRanges.emplace_back(vn->offset, vn->offset + vn->size);
+				}
+				else if (vn->space == regSpace) {
+					if (vn->offset + vn->size > MaxRegisterSpan) {
+						return nullptr;
+					}
+					regEnd = std::max<size_t>(regEnd, vn->offset + vn->size);
+				}
+			}
+		}
+	}
+	//temporaries are packed behind the registers, overlapping ones share their bytes
+	std::sort(uniqRanges.begin(), uniqRanges.end());
+	struct UniqBlock
+	{
+		std::uint64_t start;
+		std::uint64_t end;
+		std::uint32_t pos;
+	};
+	std::vector<UniqBlock> uniqBlocks;
+	size_t slotEnd = regEnd;
+	for (const auto& range : uniqRanges) {
+		if (!uniqBlocks.empty() && range.first < uniqBlocks.back().end) {
+			uniqBlocks.back().end = std::max(uniqBlocks.back().end, range.second);
+			continue;
+		}
+		if (!uniqBlocks.empty()) {
+			slotEnd += uniqBlocks.back().end - uniqBlocks.back().start;
+		}
+		uniqBlocks.push_back(UniqBlock{ range.first, range.second, (std::uint32_t)slotEnd });
+	}
+	if (!uniqBlocks.empty()) {
+		slotEnd += uniqBlocks.back().end - uniqBlocks.back().start;
+	}
+	//scratch slots of the hand built pop [esp]
+	std::uint32_t popValuePos = (std::uint32_t)slotEnd;
+	std::uint32_t popPtrPos = popValuePos + 0x4;
+	slotEnd += 0x8;
+	summary->slotSize = slotEnd;
+
+	auto makeOperand = [&](const ghidra::VarnodeData& vn, Operand& out) -> bool {
+		if (vn.size <= 0 || vn.size > 8) {
+			return false;
+		}
+		out.size = vn.size;
+		if (vn.space == constSpace) {
+			out.kind = OPERAND_CONST;
+			out.value = vn.offset & ghidra::calc_mask(vn.size);
+			return true;
+		}
+		if (vn.space == regSpace) {
+			out.kind = OPERAND_SLOT;
+			out.pos = (std::uint32_t)vn.offset;
+			return true;
+		}
+		if (vn.space == uniqSpace) {
+			auto it = std::upper_bound(uniqBlocks.begin(), uniqBlocks.end(), vn.offset, [](std::uint64_t off, const UniqBlock& block) {
+				return off < block.start;
+			});
+			if (it == uniqBlocks.begin()) {
+				return false;
+			}
+			--it;
+			out.kind = OPERAND_SLOT;
+			out.pos = it->pos + (std::uint32_t)(vn.offset - it->start);
+			return true;
+		}
+		return false;
+	};
+	auto slotOperand = [](std::uint32_t pos, int size) {
+		Operand operand;
+		operand.kind = OPERAND_SLOT;
+		operand.pos = pos;
+		operand.size = size;
+		return operand;
+	};
+	auto constOperand = [](std::uint64_t value, int size) {
+		Operand operand;
+		operand.kind = OPERAND_CONST;
+		operand.value = value & ghidra::calc_mask(size);
+		operand.size = size;
+		return operand;
+	};
+
+	for (unsigned int n = 0; n < insList.size(); ++n) {
+		const SummaryIns& ins = insList[n];
+		bool bLastIns = (n == insList.size() - 1);
+		if (std::find(probeList.begin(), probeList.end(), ins.addr) != probeList.end()) {
+			summary->probePoints.push_back(ProbePoint{ summary->opList.size(), ins.addr });
+		}
+		if (ins.bPopEsp) {
+			//the destination is addressed with esp after the pop
+			Operand espOperand = slotOperand(summary->gprPos[4], 0x4);
+			SummaryOp loadOp;
+			loadOp.opc = ghidra::CPUI_LOAD;
+			loadOp.out = slotOperand(popValuePos, 0x4);
+			loadOp.in[0] = espOperand;
+			summary->opList.push_back(loadOp);
+			SummaryOp addOp;
+			addOp.opc = ghidra::CPUI_INT_ADD;
+			addOp.out = espOperand;
+			addOp.in[0] = espOperand;
+			addOp.in[1] = constOperand(0x4, 0x4);
+			summary->opList.push_back(addOp);
+			SummaryOp ptrOp;
+			ptrOp.opc = ghidra::CPUI_INT_ADD;
+			ptrOp.out = slotOperand(popPtrPos, 0x4);
+			ptrOp.in[0] = espOperand;
+			ptrOp.in[1] = constOperand((std::uint64_t)(std::int64_t)ins.popDisp, 0x4);
+			summary->opList.push_back(ptrOp);
+			SummaryOp storeOp;
+			storeOp.opc = ghidra::CPUI_STORE;
+			storeOp.in[0] = slotOperand(popPtrPos, 0x4);
+			storeOp.in[1] = slotOperand(popValuePos, 0x4);
+			summary->opList.push_back(storeOp);
+			if (bLastIns) {
+				return nullptr;
+			}
+			continue;
+		}
+		for (unsigned int i = 0; i < ins.opList.size(); ++i) {
+			const SummaryEmit::RawOp& rawOp = ins.opList[i];
+			bool bLastOp = bLastIns && (i == ins.opList.size() - 1);
+			SummaryOp newOp;
+			newOp.opc = rawOp.opc;
+			switch (rawOp.opc) {
+			case ghidra::CPUI_BRANCH:
+				//a relative branch means a loop inside the instruction
+				if (rawOp.inVars[0].space == constSpace) {
+					return nullptr;
+				}
+				if (!bLastOp) {
+					continue;
+				}
+				newOp.opc = ghidra::CPUI_BRANCHIND;
+				newOp.in[0] = constOperand(rawOp.inVars[0].offset, 0x4);
+				break;
+			case ghidra::CPUI_BRANCHIND:
+			case ghidra::CPUI_RETURN:
+				if (!bLastOp || !makeOperand(rawOp.inVars[0], newOp.in[0])) {
+					return nullptr;
+				}
+				newOp.opc = ghidra::CPUI_BRANCHIND;
+				break;
+			case ghidra::CPUI_LOAD:
+				if (rawOp.inVars[0].getSpaceFromConst() != ramSpace) {
+					return nullptr;
+				}
+				if (!makeOperand(rawOp.inVars[1], newOp.in[0]) || !makeOperand(rawOp.outVar, newOp.out)) {
+					return nullptr;
+				}
+				break;
+			case ghidra::CPUI_STORE:
+				if (rawOp.inVars[0].getSpaceFromConst() != ramSpace) {
+					return nullptr;
+				}
+				if (!makeOperand(rawOp.inVars[1], newOp.in[0]) || !makeOperand(rawOp.inVars[2], newOp.in[1])) {
+					return nullptr;
+				}
+				break;
+			default:
+				if (!isSupportedOpCode(rawOp.opc) || !rawOp.bHasOut || rawOp.inVars.size() > 2) {
+					return nullptr;
+				}
+				if (!makeOperand(rawOp.outVar, newOp.out)) {
+					return nullptr;
+				}
+				for (unsigned int k = 0; k < rawOp.inVars.size(); ++k) {
+					if (!makeOperand(rawOp.inVars[k], newOp.in[k])) {
+						return nullptr;
+					}
+				}
+				break;
+			}
+			summary->opList.push_back(newOp);
+		}
+	}
+	//the next handler has to come out of the last instruction
+	if (summary->opList.empty() || summary->opList.back().opc != ghidra::CPUI_BRANCHIND) {
+		return nullptr;
+	}
+	return summary;
+}
+
+std::uint64_t VmpHandlerSummary::readSlot(const std::vector<std::uint8_t>& slots, std::uint32_t pos, int size)
+{
+	std::uint64_t value = 0x0;
+	for (int n = size - 1; n >= 0; --n) {
+		value = (value << 8) | slots[pos + n];
+	}
+	return value;
+}
+
+void VmpHandlerSummary::writeSlot(std::vector<std::uint8_t>& slots, std::uint32_t pos, int size, std::uint64_t value)
+{
+	for (int n = 0; n < size; ++n) {
+		slots[pos + n] = (std::uint8_t)(value >> (n * 8));
+	}
+}
+
+bool VmpHandlerSummary::readMemory(const MachineState& state, size_t addr, int size, std::uint64_t& outValue)
+{
+	std::uint8_t buf[8];
+	if (state.stack && addr >= state.stackBase && addr + size <= state.stackBase + state.stack->size()) {
+		memcpy(buf, state.stack->data() + (addr - state.stackBase), size);
+	}
+	else if (SectionManager::Main().ReadBytes(buf, size, addr) != size) {
+		return false;
+	}
+	outValue = 0x0;
+	for (int n = size - 1; n >= 0; --n) {
+		outValue = (outValue << 8) | buf[n];
+	}
+	return true;
+}
+
+bool VmpHandlerSummary::writeMemory(MachineState& state, size_t addr, int size, std::uint64_t value, std::vector<StackWrite>& undoList)
+{
+	//only the stack is private to the walk, unicorn takes over for anything else
+	if (!state.stack || addr < state.stackBase || addr + size > state.stackBase + state.stack->size()) {
+		return false;
+	}
+	size_t offset = addr - state.stackBase;
+	std::uint8_t* dst = state.stack->data() + offset;
+	StackWrite oldData;
+	oldData.offset = offset;
+	oldData.size = size;
+	oldData.oldValue = 0x0;
+	for (int n = size - 1; n >= 0; --n) {
+		oldData.oldValue = (oldData.oldValue << 8) | dst[n];
+	}
+	undoList.push_back(oldData);
+	for (int n = 0; n < size; ++n) {
+		dst[n] = (std::uint8_t)(value >> (n * 8));
+	}
+	return true;
+}
+
+void VmpHandlerSummary::snapshotRegs(const std::vector<std::uint8_t>& slots, reg_context& outRegs) const
+{
+	std::uint32_t* pRegAddr = &outRegs.EAX;
+	for (unsigned int n = 0; n < 8; ++n) {
+		pRegAddr[n] = (std::uint32_t)readSlot(slots, gprPos[n], 0x4);
+	}
+	for (const FlagSlot& flag : flagList) {
+		outRegs.EFLAGS &= ~(flag.mask << flag.bit);
+		outRegs.EFLAGS |= (slots[flag.pos] & flag.mask) << flag.bit;
+	}
+}
+
+bool VmpHandlerSummary::runOp(const SummaryOp& op, std::vector<std::uint8_t>& slots, MachineState& state, std::vector<StackWrite>& undoList, std::uint64_t& nextEip) const
+{
+	std::uint64_t in0 = op.in[0].kind == OPERAND_SLOT ? readSlot(slots, op.in[0].pos, op.in[0].size) : op.in[0].value;
+	std::uint64_t in1 = op.in[1].kind == OPERAND_SLOT ? readSlot(slots, op.in[1].pos, op.in[1].size) : op.in[1].value;
+	int inSize = op.in[0].size;
+	int inBits = inSize * 8;
+	std::uint64_t inMask = ghidra::calc_mask(inSize);
+	std::uint64_t res = 0x0;
+	switch (op.opc) {
+	case ghidra::CPUI_BRANCHIND:
+		nextEip = in0;
+		return true;
+	case ghidra::CPUI_STORE:
+		return writeMemory(state, (size_t)in0, op.in[1].size, in1, undoList);
+	case ghidra::CPUI_LOAD:
+		if (!readMemory(state, (size_t)in0, op.out.size, res)) {
+			return false;
+		}
+		break;
+	case ghidra::CPUI_COPY:
+	case ghidra::CPUI_INT_ZEXT:
+		res = in0;
+		break;
+	case ghidra::CPUI_INT_SEXT:
+		res = ghidra::sign_extend(in0, inSize, op.out.size);
+		break;
+	case ghidra::CPUI_INT_EQUAL:
+		res = (in0 == in1);
+		break;
+	case ghidra::CPUI_INT_NOTEQUAL:
+		res = (in0 != in1);
+		break;
+	case ghidra::CPUI_INT_LESS:
+		res = (in0 < in1);
+		break;
+	case ghidra::CPUI_INT_LESSEQUAL:
+		res = (in0 <= in1);
+		break;
+	case ghidra::CPUI_INT_SLESS:
+		res = ((std::int64_t)ghidra::sign_extend(in0, inSize, 8) < (std::int64_t)ghidra::sign_extend(in1, inSize, 8));
+		break;
+	case ghidra::CPUI_INT_SLESSEQUAL:
+		res = ((std::int64_t)ghidra::sign_extend(in0, inSize, 8) <= (std::int64_t)ghidra::sign_extend(in1, inSize, 8));
+		break;
+	case ghidra::CPUI_INT_ADD:
+		res = in0 + in1;
+		break;
+	case ghidra::CPUI_INT_SUB:
+		res = in0 - in1;
+		break;
+	case ghidra::CPUI_INT_CARRY:
+		res = (((in0 + in1) & inMask) < in0);
+		break;
+	case ghidra::CPUI_INT_SCARRY:
+	{
+		std::uint64_t sum = in0 + in1;
+		res = (((in0 ^ sum) & (in1 ^ sum)) >> (inBits - 1)) & 0x1;
+		break;
+	}
+	case ghidra::CPUI_INT_SBORROW:
+	{
+		std::uint64_t diff = in0 - in1;
+		res = (((in0 ^ in1) & (in0 ^ diff)) >> (inBits - 1)) & 0x1;
+		break;
+	}
+	case ghidra::CPUI_INT_2COMP:
+		res = 0x0 - in0;
+		break;
+	case ghidra::CPUI_INT_NEGATE:
+		res = ~in0;
+		break;
+	case ghidra::CPUI_INT_XOR:
+		res = in0 ^ in1;
+		break;
+	case ghidra::CPUI_INT_AND:
+		res = in0 & in1;
+		break;
+	case ghidra::CPUI_INT_OR:
+		res = in0 | in1;
+		break;
+	case ghidra::CPUI_INT_LEFT:
+		res = in1 >= (std::uint64_t)inBits ? 0x0 : in0 << in1;
+		break;
+	case ghidra::CPUI_INT_RIGHT:
+		res = in1 >= (std::uint64_t)inBits ? 0x0 : in0 >> in1;
+		break;
+	case ghidra::CPUI_INT_SRIGHT:
+	{
+		std::int64_t val = (std::int64_t)ghidra::sign_extend(in0, inSize, 8);
+		res = (std::uint64_t)(val >> (in1 >= 63 ? 63 : in1));
+		break;
+	}
+	case ghidra::CPUI_INT_MULT:
+		res = in0 * in1;
+		break;
+	case ghidra::CPUI_INT_DIV:
+		if (in1 == 0x0) {
+			return false;
+		}
+		res = in0 / in1;
+		break;
+	case ghidra::CPUI_INT_REM:
+		if (in1 == 0x0) {
+			return false;
+		}
+		res = in0 % in1;
+		break;
+	case ghidra::CPUI_INT_SDIV:
+	case ghidra::CPUI_INT_SREM:
+	{
+		std::int64_t num = (std::int64_t)ghidra::sign_extend(in0, inSize, 8);
+		std::int64_t den = (std::int64_t)ghidra::sign_extend(in1, inSize, 8);
+		//the overflowing quotient faults on x86 as well
+		if (den == 0x0 || (den == -1 && num == INT64_MIN)) {
+			return false;
+		}
+		res = (std::uint64_t)(op.opc == ghidra::CPUI_INT_SDIV ? num / den : num % den);
+		break;
+	}
+	case ghidra::CPUI_BOOL_NEGATE:
+		res = (in0 == 0x0);
+		break;
+	case ghidra::CPUI_BOOL_XOR:
+		res = (in0 ^ in1) & 0x1;
+		break;
+	case ghidra::CPUI_BOOL_AND:
+		res = (in0 & in1) & 0x1;
+		break;
+	case ghidra::CPUI_BOOL_OR:
+		res = (in0 | in1) & 0x1;
+		break;
+	case ghidra::CPUI_PIECE:
+		res = (in0 << (op.in[1].size * 8)) | in1;
+		break;
+	case ghidra::CPUI_SUBPIECE:
+		res = in1 >= 8 ? 0x0 : in0 >> (in1 * 8);
+		break;
+	case ghidra::CPUI_POPCOUNT:
+		while (in0) {
+			res += in0 & 0x1;
+			in0 >>= 1;
+		}
+		break;
+	case ghidra::CPUI_LZCOUNT:
+		res = inBits;
+		while (in0) {
+			res--;
+			in0 >>= 1;
+		}
+		break;
+	default:
+		return false;
+	}
+	writeSlot(slots, op.out.pos, op.out.size, res & ghidra::calc_mask(op.out.size));
+	return true;
+}
+
+bool VmpHandlerSummary::Execute(MachineState& state, VmpNode& outNode) const
+{
+	std::vector<std::uint8_t> slots(slotSize, 0x0);
+	const std::uint32_t* pRegAddr = &state.regs.EAX;
+	for (unsigned int n = 0; n < 8; ++n) {
+		writeSlot(slots, gprPos[n], 0x4, pRegAddr[n]);
+	}
+	for (const FlagSlot& flag : flagList) {
+		slots[flag.pos] = (state.regs.EFLAGS >> flag.bit) & flag.mask;
+	}
+	outNode.addrList = addrList;
+	outNode.contextList.clear();
+	outNode.contextList.push_back(state.regs);
+	std::vector<StackWrite> undoList;
+	std::uint64_t nextEip = 0x0;
+	size_t probeIndex = 0x0;
+	for (size_t n = 0; n < opList.size(); ++n) {
+		while (probeIndex < probePoints.size() && probePoints[probeIndex].opIndex == n) {
+			reg_context probeRegs = state.regs;
+			snapshotRegs(slots, probeRegs);
+			probeRegs.EIP = (std::uint32_t)probePoints[probeIndex].addr;
+			outNode.contextList.push_back(probeRegs);
+			probeIndex++;
+		}
+		if (runOp(opList[n], slots, state, undoList, nextEip)) {
+			continue;
+		}
+		for (auto it = undoList.rbegin(); it != undoList.rend(); ++it) {
+			std::uint8_t* dst = state.stack->data() + it->offset;
+			for (int k = 0; k < it->size; ++k) {
+				dst[k] = (std::uint8_t)(it->oldValue >> (k * 8));
+			}
+		}
+		outNode.clear();
+		return false;
+	}
+	snapshotRegs(slots, state.regs);
+	state.regs.EIP = (std::uint32_t)nextEip;
+	return true;
+}
+
+#ifdef DeveloperMode
+#pragma optimize("", on)
+#endif
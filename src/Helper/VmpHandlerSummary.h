@@ -0,0 +1,88 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include "UnicornHelper.h"
+#include "../Ghidra/opcodes.hh"
+
+class VmpArchitecture;
+class VmpNode;
+
+//native code of a classified handler compiled once from its raw pcode
+//running it moves the walk to the next handler without unicorn, the path through the handler is fixed
+//handlers with branches, calls or user ops are not summarised
+
+class VmpHandlerSummary
+{
+public:
+	//machine state shared by the summaries of one walk, the stack is written in place
+	struct MachineState
+	{
+		reg_context regs;
+		size_t stackBase = 0x0;
+		std::vector<unsigned char>* stack = nullptr;
+	};
+public:
+	VmpHandlerSummary() {};
+	~VmpHandlerSummary() {};
+	//nullptr when the handler can not be summarised
+	//probeList are the instructions whose register context MakeInstruction reads
+	static std::unique_ptr<VmpHandlerSummary> Build(VmpArchitecture* arch, const VmpNode& node, const std::vector<size_t>& probeList);
+	//run the handler and fill outNode like a traced node, false leaves the state untouched
+	bool Execute(MachineState& state, VmpNode& outNode) const;
+public:
+	std::vector<size_t> addrList;
+private:
+	enum OperandKind {
+		OPERAND_NONE = 0x0,
+		OPERAND_SLOT,
+		OPERAND_CONST,
+	};
+	struct Operand
+	{
+		OperandKind kind = OPERAND_NONE;
+		int size = 0x0;
+		//offset in the slot buffer
+		std::uint32_t pos = 0x0;
+		std::uint64_t value = 0x0;
+	};
+	struct SummaryOp
+	{
+		ghidra::OpCode opc;
+		Operand out;
+		Operand in[2];
+	};
+	struct FlagSlot
+	{
+		std::uint32_t pos;
+		int bit;
+		std::uint32_t mask;
+	};
+	struct ProbePoint
+	{
+		//the snapshot is taken before this op runs
+		size_t opIndex;
+		size_t addr;
+	};
+	//undo log of the stack writes
+	struct StackWrite
+	{
+		size_t offset;
+		int size;
+		std::uint64_t oldValue;
+	};
+	bool runOp(const SummaryOp& op, std::vector<std::uint8_t>& slots, MachineState& state, std::vector<StackWrite>& undoList, std::uint64_t& nextEip) const;
+	void snapshotRegs(const std::vector<std::uint8_t>& slots, reg_context& outRegs) const;
+	static std::uint64_t readSlot(const std::vector<std::uint8_t>& slots, std::uint32_t pos, int size);
+	static void writeSlot(std::vector<std::uint8_t>& slots, std::uint32_t pos, int size, std::uint64_t value);
+	static bool readMemory(const MachineState& state, size_t addr, int size, std::uint64_t& outValue);
+	static bool writeMemory(MachineState& state, size_t addr, int size, std::uint64_t value, std::vector<StackWrite>& undoList);
+private:
+	std::vector<SummaryOp> opList;
+	std::vector<ProbePoint> probePoints;
+	//slot positions of EAX to EDI in reg_context order
+	std::uint32_t gprPos[8] = { 0x0 };
+	std::vector<FlagSlot> flagList;
+	size_t slotSize = 0x0;
+};
@@ -0,0 +1,173 @@
+#include "VmpRegister.h"
+#include <map>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include "../Ghidra/translate.hh"
+
+namespace
+{
+	class RegisterTable
+	{
+	public:
+		RegisterTable() {
+			const char* fixedNames[VmpRegister::REG_FIXED_COUNT] = {
+				"", "EAX", "ECX", "EDX", "EBX", "ESP", "EBP", "ESI", "EDI", "EIP", "eflags",
+				"AL", "CL", "DL", "BL", "AH", "CH", "DH", "BH",
+				"AX", "CX", "DX", "BX", "SP", "BP", "SI", "DI",
+				"FS_OFFSET",
+			};
+			for (unsigned int n = 0; n < VmpRegister::REG_FIXED_COUNT; ++n) {
+				nameTable.push_back(fixedNames[n]);
+				nameIndex[fixedNames[n]] = n;
+			}
+		}
+		VmpRegId Intern(const std::string& name) {
+			std::lock_guard<std::mutex> lock(tableMutex);
+			auto it = nameIndex.find(name);
+			if (it != nameIndex.end()) {
+				return it->second;
+			}
+			VmpRegId regId = nameTable.size();
+			nameTable.push_back(name);
+			nameIndex[name] = regId;
+			return regId;
+		}
+		const std::string& Name(VmpRegId regId) {
+			std::lock_guard<std::mutex> lock(tableMutex);
+			if (regId >= nameTable.size()) {
+				return nameTable[VmpRegister::REG_NONE];
+			}
+			return nameTable[regId];
+		}
+	private:
+		std::mutex tableMutex;
+		//deque keeps the returned names valid while the table grows
+		std::deque<std::string> nameTable;
+		std::unordered_map<std::string, VmpRegId> nameIndex;
+	};
+
+	RegisterTable& Table()
+	{
+		static RegisterTable table;
+		return table;
+	}
+
+	//register ranges to ids, every architecture of a session uses the same sleigh language so the first one fills it
+	class VarnodeTable
+	{
+	public:
+		void Build(const ghidra::Translate* trans) {
+			std::lock_guard<std::mutex> lock(buildMutex);
+			std::map<ghidra::VarnodeData, std::string> regList;
+			trans->getAllRegisters(regList);
+			if (bBuilt) {
+				//another language, every lookup takes the slow path
+				if (regList.size() != regCount) {
+					bReady = false;
+				}
+				return;
+			}
+			ghidra::AddrSpace* regSpace = trans->getSpaceByName("register");
+			if (!regSpace) {
+				return;
+			}
+			const int pieceSize[] = { 0x1, 0x2, 0x4, 0x8 };
+			for (auto it = regList.begin(); it != regList.end(); ++it) {
+				const ghidra::VarnodeData& reg = it->first;
+				if (reg.space != regSpace) {
+					continue;
+				}
+				addRange(trans, regSpace, reg.offset, reg.size);
+				if (reg.size > 0x10) {
+					continue;
+				}
+				for (unsigned int off = 0; off < reg.size; ++off) {
+					for (int size : pieceSize) {
+						if (off + size <= reg.size) {
+							addRange(trans, regSpace, reg.offset + off, size);
+						}
+					}
+				}
+			}
+			regSpaceIndex = regSpace->getIndex();
+			regCount = regList.size();
+			bBuilt = true;
+			bReady = true;
+		}
+		bool Find(ghidra::AddrSpace* space, std::uint64_t offset, int size, VmpRegId& outId) const {
+			if (!bReady) {
+				return false;
+			}
+			if (space->getIndex() != regSpaceIndex) {
+				outId = VmpRegister::REG_NONE;
+				return true;
+			}
+			auto it = idMap.find(rangeKey(offset, size));
+			if (it == idMap.end()) {
+				return false;
+			}
+			outId = it->second;
+			return true;
+		}
+	private:
+		static std::uint64_t rangeKey(std::uint64_t offset, int size) {
+			return (offset << 8) | (std::uint64_t)(size & 0xFF);
+		}
+		void addRange(const ghidra::Translate* trans, ghidra::AddrSpace* regSpace, std::uint64_t offset, int size) {
+			std::uint64_t key = rangeKey(offset, size);
+			if (idMap.count(key)) {
+				return;
+			}
+			//the same name getRegisterName gives, a piece maps to the register holding it
+			idMap[key] = Table().Intern(trans->getRegisterName(regSpace, offset, size));
+		}
+	private:
+		std::mutex buildMutex;
+		//set once the table is complete, lookups read it without the lock
+		std::atomic<bool> bReady{ false };
+		bool bBuilt = false;
+		int regSpaceIndex = -1;
+		size_t regCount = 0x0;
+		std::unordered_map<std::uint64_t, VmpRegId> idMap;
+	};
+
+	VarnodeTable& Varnodes()
+	{
+		static VarnodeTable table;
+		return table;
+	}
+}
+
+VmpRegId VmpRegister::Intern(const std::string& name)
+{
+	return Table().Intern(name);
+}
+
+const std::string& VmpRegister::Name(VmpRegId regId)
+{
+	return Table().Name(regId);
+}
+
+void VmpRegister::InternTranslator(const ghidra::Translate* trans)
+{
+	std::map<ghidra::VarnodeData, std::string> regList;
+	trans->getAllRegisters(regList);
+	for (auto it = regList.begin(); it != regList.end(); ++it) {
+		Table().Intern(it->second);
+	}
+	Varnodes().Build(trans);
+}
+
+VmpRegId VmpRegister::FromVarnode(ghidra::AddrSpace* space, std::uint64_t offset, int size)
+{
+	VmpRegId regId;
+	if (Varnodes().Find(space, offset, size, regId)) {
+		return regId;
+	}
+	if (space->getName() != "register") {
+		return VmpRegister::REG_NONE;
+	}
+	return Table().Intern(space->getTrans()->getRegisterName(space, offset, size));
+}
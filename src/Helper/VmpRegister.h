@@ -0,0 +1,57 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+namespace ghidra
+{
+	class Translate;
+	class AddrSpace;
+}
+
+//interned register identifier, the matchers compare ids instead of names
+typedef unsigned short VmpRegId;
+
+namespace VmpRegister
+{
+	//ids of the registers used by the vm, other names are appended on first use
+	enum FixedReg :VmpRegId {
+		REG_NONE = 0x0,
+		REG_EAX,
+		REG_ECX,
+		REG_EDX,
+		REG_EBX,
+		REG_ESP,
+		REG_EBP,
+		REG_ESI,
+		REG_EDI,
+		REG_EIP,
+		REG_EFLAGS,
+		REG_AL,
+		REG_CL,
+		REG_DL,
+		REG_BL,
+		REG_AH,
+		REG_CH,
+		REG_DH,
+		REG_BH,
+		REG_AX,
+		REG_CX,
+		REG_DX,
+		REG_BX,
+		REG_SP,
+		REG_BP,
+		REG_SI,
+		REG_DI,
+		REG_FS_OFFSET,
+		REG_FIXED_COUNT,
+	};
+
+	VmpRegId Intern(const std::string& name);
+	//only for printing
+	const std::string& Name(VmpRegId regId);
+	//intern every register of a sleigh language and build the varnode table, called once at architecture init
+	void InternTranslator(const ghidra::Translate* trans);
+	//id of the register holding the range, REG_NONE outside the register space
+	//registers and their 1, 2, 4 and 8 byte pieces are read from the table without a lock
+	VmpRegId FromVarnode(ghidra::AddrSpace* space, std::uint64_t offset, int size);
+}
@@ -2,11 +2,15 @@
 #include "./Common/StringUtils.h"
 #include "./VmpCore/VmpReEngine.h"
 #include "./Manager/VmpVersionManager.h"
+#include "./GhidraExtension/VmpArch.h"
 
 #define ACTION_MarkVmpEntry "Revampire::MarkVmpEntry"
+#define ACTION_UnmarkVmpEntry "Revampire::UnmarkVmpEntry"
 #define ACTION_VMP350		"Revampire::VMP350"
+#define ACTION_REANALYSE	"Revampire::Reanalyse"
 #define ACTION_DECOMPILE    "Revampire::Decompile"
 #define ACTION_DECOMPILE_IDA    "Revampire::DecompileIDA"
+#define ACTION_PROFILE		"Revampire::ActionProfile"
 
 #ifdef DeveloperMode
 #pragma optimize("", off) 
@@ -19,17 +23,32 @@ int MenuRevampire::activate(action_activation_ctx_t* ctx)
 		VmpReEngine::Instance().MarkVmpEntry(get_screen_ea());
 		return 0x0;
 	}
+	if (actionName == ACTION_UnmarkVmpEntry) {
+		VmpReEngine::Instance().UnmarkVmpEntry(get_screen_ea());
+		return 0x0;
+	}
 	if (actionName == ACTION_VMP350) {
 		VmpVersionManager::SetVmpVersion(VmpVersionManager::VMP_350);
 		VmpReEngine::Instance().PrintGraph(get_screen_ea());
 		return 0x0;
 	}
+	if (actionName == ACTION_REANALYSE) {
+		VmpVersionManager::SetVmpVersion(VmpVersionManager::VMP_350);
+		VmpReEngine::Instance().PrintGraph(get_screen_ea(), true);
+		return 0x0;
+	}
 	if (actionName == ACTION_DECOMPILE) {
 		qstring strStartAddr = ctx->widget_title.substr(4);
 		size_t startAddr = std::stoull(strStartAddr.c_str(), 0, 16);
 		VmpReEngine::Instance().Decompile(startAddr);
 		return 0x0;
 	}
+	if (actionName == ACTION_PROFILE) {
+		bool bEnable = !VmpArchitecture::IsActionProfileEnabled();
+		VmpArchitecture::EnableActionProfile(bEnable);
+		msg("[Revampire] action profile %s\n", bEnable ? "enabled" : "disabled");
+		return 0x0;
+	}
 	if (actionName == ACTION_DECOMPILE_IDA) {
 		qstring strStartAddr = ctx->widget_title.substr(4);
 		size_t startAddr = std::stoull(strStartAddr.c_str(), 0, 16);
@@ -48,11 +67,21 @@ sizeof(action_desc_t),ACTION_MarkVmpEntry,"Mark as VmEntry",this,
 ida,nullptr,nullptr,0,ADF_OT_PLUGMOD };
 	register_action(actMarkVmpEntry);
 
+	const action_desc_t actUnmarkVmpEntry = {
+sizeof(action_desc_t),ACTION_UnmarkVmpEntry,"Unmark VmEntry",this,
+ida,nullptr,nullptr,0,ADF_OT_PLUGMOD };
+	register_action(actUnmarkVmpEntry);
+
 	const action_desc_t actExecuteVmp350 = {
 	sizeof(action_desc_t),ACTION_VMP350,"Execute Vmp 3.5.0",this,
 	ida,nullptr,nullptr,0,ADF_OT_PLUGMOD };
 	register_action(actExecuteVmp350);
 
+	const action_desc_t actReanalyseVmp = {
+	sizeof(action_desc_t),ACTION_REANALYSE,"Re-analyse Vmp 3.5.0",this,
+	ida,nullptr,nullptr,0,ADF_OT_PLUGMOD };
+	register_action(actReanalyseVmp);
+
 	const action_desc_t actDecompileVmp = {
 sizeof(action_desc_t),ACTION_DECOMPILE,"Decompile",this,
 ida,nullptr,nullptr,0,ADF_OT_PLUGMOD };
@@ -62,20 +91,31 @@ ida,nullptr,nullptr,0,ADF_OT_PLUGMOD };
 sizeof(action_desc_t),ACTION_DECOMPILE_IDA,"Decompile_IDA",this,
 ida,nullptr,nullptr,0,ADF_OT_PLUGMOD };
 	register_action(actDecompileIDA);
+
+	const action_desc_t actProfile = {
+sizeof(action_desc_t),ACTION_PROFILE,"Toggle Action Profile",this,
+ida,nullptr,nullptr,0,ADF_OT_PLUGMOD };
+	register_action(actProfile);
 }
 
 MenuRevampire::~MenuRevampire()
 {
 	unregister_action(ACTION_VMP350);
+	unregister_action(ACTION_REANALYSE);
 	unregister_action(ACTION_MarkVmpEntry);
+	unregister_action(ACTION_UnmarkVmpEntry);
 	unregister_action(ACTION_DECOMPILE);
 	unregister_action(ACTION_DECOMPILE_IDA);
+	unregister_action(ACTION_PROFILE);
 }
 
 void MenuRevampire::AttachMainMenu(TWidget* view, TPopupMenu* p)
 {
 	attach_action_to_popup(view, p, ACTION_MarkVmpEntry, "Revampire/", SETMENU_INS);
+	attach_action_to_popup(view, p, ACTION_UnmarkVmpEntry, "Revampire/", SETMENU_INS);
 	attach_action_to_popup(view, p, ACTION_VMP350, "Revampire/", SETMENU_INS);
+	attach_action_to_popup(view, p, ACTION_REANALYSE, "Revampire/", SETMENU_INS);
+	attach_action_to_popup(view, p, ACTION_PROFILE, "Revampire/", SETMENU_INS);
 }
 
 void MenuRevampire::AttachGraphMenu(TWidget* view, TPopupMenu* p)
@@ -113,16 +153,27 @@ ssize_t PluginUI_Callback(void* ud, int notification_code, va_list va)
 	return 0;
 }
 
+ssize_t PluginIDB_Callback(void* ud, int notification_code, va_list va)
+{
+	//a patched instruction has to be decoded again
+	if (notification_code == idb_event::byte_patched && VmpReEngine::IsStarted()) {
+		VmpReEngine::Instance().OnBytesPatched();
+	}
+	return 0;
+}
+
 IDAPlugin::IDAPlugin() :gMenu_Revampire(this)
 {
     msg("[Revampire] plugin 0.21 loaded\n");
     msg("[Revampire] https://github.com/fjqisba/VmpHelper\n");
     hook_to_notification_point(HT_UI, PluginUI_Callback, this);
+    hook_to_notification_point(HT_IDB, PluginIDB_Callback, this);
 }
 
 IDAPlugin::~IDAPlugin()
 {
 	unhook_from_notification_point(HT_UI, PluginUI_Callback, this);
+	unhook_from_notification_point(HT_IDB, PluginIDB_Callback, this);
 }
 
 bool idaapi IDAPlugin::run(size_t)
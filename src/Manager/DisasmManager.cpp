@@ -3,8 +3,11 @@
 #include "../Helper/IDAWrapper.h"
 #include "exceptions.h"
 #include <sstream>
+#include <mutex>
 
 csh DisasmManager::handle;
+//the capstone handle is shared by handler analysis workers
+static std::mutex disasmMutex;
 
 RawInstruction::RawInstruction()
 {
@@ -59,6 +62,7 @@ std::unique_ptr<RawInstruction> DisasmManager::DecodeInstruction(size_t addr)
 	IDAWrapper::get_bytes(tmpInsBuffer, 16, addr, 0x1);
 	size_t maxInsLen = 16;
 	unsigned char* pInsBuf = tmpInsBuffer;
+	std::lock_guard<std::mutex> lock(disasmMutex);
 	if (cs_disasm_iter(DisasmManager::handle, (const uint8_t**)&pInsBuf, &maxInsLen, (uint64_t*)&addr, retIns->raw)) {
 		return retIns;
 	}
@@ -1,6 +1,7 @@
 #include "SectionManager.h"
 #include <segment.hpp>
 #include <bytes.hpp>
+#include <string.h>
 
 static size_t AlignByMemory(size_t originValue, size_t alignment)
 {
@@ -71,4 +72,25 @@ int SectionManager::SectionIndex(size_t addr)
 		}
 	}
 	return -1;
+}
+
+int SectionManager::ReadBytes(void* buf, size_t size, size_t addr) const
+{
+	unsigned char* outBuf = (unsigned char*)buf;
+	int readCount = 0x0;
+	for (size_t n = 0; n < size; ++n) {
+		outBuf[n] = 0xFF;
+	}
+	for (unsigned int n = 0; n < segList.size(); ++n) {
+		const SegmentInfomation& seg = segList[n];
+		size_t segEnd = seg.segStart + seg.segSize;
+		size_t copyStart = addr > seg.segStart ? addr : seg.segStart;
+		size_t copyEnd = addr + size < segEnd ? addr + size : segEnd;
+		if (copyStart >= copyEnd) {
+			continue;
+		}
+		memcpy(outBuf + (copyStart - addr), &seg.segData[copyStart - seg.segStart], copyEnd - copyStart);
+		readCount += copyEnd - copyStart;
+	}
+	return readCount;
 }
\ No newline at end of file
@@ -20,6 +20,8 @@ public:
 	unsigned char* LinearAddrToVirtualAddr(size_t LinerAddr);
 	//жϵǰַĸ
 	int SectionIndex(size_t addr);
+	//copy bytes out of the snapshot, unmapped bytes are filled with 0xFF
+	int ReadBytes(void* buf, size_t size, size_t addr) const;
 public:
 	std::vector<SegmentInfomation> segList;
 	//洢һе,ڼٷ
@@ -3,17 +3,24 @@
 #include "../GhidraExtension/VmpControlFlow.h"
 #include "../GhidraExtension/VmpArch.h"
 #include "../Helper/GhidraHelper.h"
-#include "../Helper/IDAWrapper.h"
 #include "../Helper/AsmBuilder.h"
 #include "../Helper/VmpBlockAnalyzer.h"
+#include "../Helper/VmpBlockInterpreter.h"
+#include "../Helper/VmpBlockSlicer.h"
+#include "../Helper/VmpHandlerFeature.h"
+#include "../Helper/VmpHandlerSummary.h"
 #include "../Manager/exceptions.h"
 #include "../VmpCore/VmpReEngine.h"
 #include <sstream>
+#include <set>
 
 #ifdef DeveloperMode
 #pragma optimize("", off) 
 #endif
 
+//vm instructions lifted by the first try of guessJmpBranch
+static const size_t BranchSliceWindow = 0x20;
+
 size_t GetMemAccessSize(size_t addr)
 {
 	auto asmData = DisasmManager::Main().DecodeInstruction(addr);
@@ -80,9 +87,71 @@ std::vector<ghidra::VarnodeData> ExtractVmStoreContext(ghidra::Funcdata* fd)
 	return retContext;
 }
 
-void VmpBlockWalker::StartWalk(VmpUnicornContext& startCtx, size_t walkSize)
+void VmpBlockWalker::StartWalk(VmpUnicornContext& startCtx, size_t walkSize, Vmp3xHandlerFactory* summaryCache)
+{
+	splitNodes.clear();
+	bSplit = false;
+	fastNodes.clear();
+	fastNativeIndex.clear();
+	fastNativeCount = 0x0;
+	if (!summaryCache) {
+		unicorn.StartVmpTrace(startCtx, walkSize);
+		return;
+	}
+	VmpUnicornContext walkCtx = startCtx;
+	fastWalk(walkCtx, walkSize, *summaryCache);
+	if (fastNativeCount < walkSize) {
+		unicorn.StartVmpTrace(walkCtx, walkSize - fastNativeCount);
+	}
+	else {
+		unicorn.traceList.clear();
+	}
+}
+
+void VmpBlockWalker::fastWalk(VmpUnicornContext& ctx, size_t walkSize, Vmp3xHandlerFactory& summaryCache)
+{
+	VmpHandlerSummary::MachineState state;
+	state.regs = ctx.context;
+	state.stackBase = ctx.stackCodeBase;
+	state.stack = &ctx.stackBuffer;
+	while (fastNativeCount < walkSize) {
+		const VmpHandlerSummary* summary = summaryCache.FindSummary(state.regs.EIP);
+		if (!summary) {
+			break;
+		}
+		VmpNode node;
+		if (!summary->Execute(state, node)) {
+			break;
+		}
+		fastNativeIndex.push_back(fastNativeCount);
+		fastNativeCount += summary->addrList.size();
+		fastNodes.push_back(std::move(node));
+	}
+	ctx.context = state.regs;
+}
+
+void VmpBlockWalker::SplitNodes()
 {
-	unicorn.StartVmpTrace(startCtx, walkSize);
+	splitNodes.clear();
+	bSplit = false;
+	size_t saveIdx = idx;
+	size_t saveNodeSize = curNodeSize;
+	//nodes of the fast walk are already split
+	if (idx < fastNodes.size()) {
+		idx = fastNodes.size();
+		curNodeSize = 0x0;
+	}
+	while (!IsWalkToEnd()) {
+		VmpNode node = GetNextNode();
+		if (!node.addrList.size() || !curNodeSize) {
+			break;
+		}
+		splitNodes[idx] = std::move(node);
+		MoveToNext();
+	}
+	idx = saveIdx;
+	curNodeSize = saveNodeSize;
+	bSplit = true;
 }
 
 const std::vector<reg_context>& VmpBlockWalker::GetTraceList()
@@ -92,7 +161,7 @@ const std::vector<reg_context>& VmpBlockWalker::GetTraceList()
 
 bool VmpBlockWalker::IsWalkToEnd()
 {
-	return idx >= unicorn.traceList.size();
+	return idx >= fastNodes.size() + unicorn.traceList.size();
 }
 
 void VmpBlockWalker::MoveToNext()
@@ -103,13 +172,29 @@ void VmpBlockWalker::MoveToNext()
 
 size_t VmpBlockWalker::CurrentIndex()
 {
-	return idx;
+	if (idx < fastNodes.size()) {
+		return fastNativeIndex[idx];
+	}
+	return fastNativeCount + idx - fastNodes.size();
 }
 
 VmpNode VmpBlockWalker::GetNextNode()
 {
 	VmpNode retNode;
-	size_t curAddr = unicorn.traceList[idx].EIP;
+	if (idx < fastNodes.size()) {
+		curNodeSize = 0x1;
+		return fastNodes[idx];
+	}
+	if (bSplit) {
+		auto itNode = splitNodes.find(idx);
+		if (itNode == splitNodes.end()) {
+			return retNode;
+		}
+		curNodeSize = itNode->second.contextList.size();
+		return itNode->second;
+	}
+	size_t traceIdx = idx - fastNodes.size();
+	size_t curAddr = unicorn.traceList[traceIdx].EIP;
 	VmpTraceFlowNodeIndex& nodeIdx = tfg.instructionToNodeMap[curAddr];
 	if (!nodeIdx.vmNode) {
 		return retNode;
@@ -118,58 +203,73 @@ VmpNode VmpBlockWalker::GetNextNode()
 	size_t lastEip = 0x0;
 	unsigned int contextSize = retNode.addrList.size();
 	for (int n = 0; n < contextSize; n++) {
-		if (lastEip == unicorn.traceList[idx + n].EIP) {
+		if (traceIdx + n >= unicorn.traceList.size()) {
+			break;
+		}
+		if (lastEip == unicorn.traceList[traceIdx + n].EIP) {
 			contextSize++;
 		}
 		else {
-			lastEip = unicorn.traceList[idx + n].EIP;
+			lastEip = unicorn.traceList[traceIdx + n].EIP;
 		}
-		retNode.contextList.push_back(unicorn.traceList[idx + n]);
+		retNode.contextList.push_back(unicorn.traceList[traceIdx + n]);
 	}
 	curNodeSize = retNode.contextList.size();
 	return retNode;
 }
 
+std::vector<VmpNode> VmpBlockWalker::PeekAllNodes()
+{
+	std::vector<VmpNode> retList;
+	size_t saveIdx = idx;
+	size_t saveNodeSize = curNodeSize;
+	while (!IsWalkToEnd()) {
+		VmpNode node = GetNextNode();
+		if (!node.addrList.size() || !curNodeSize) {
+			break;
+		}
+		retList.push_back(std::move(node));
+		MoveToNext();
+	}
+	idx = saveIdx;
+	curNodeSize = saveNodeSize;
+	return retList;
+}
+
 VmpBlockBuilder::VmpBlockBuilder(VmpControlFlowBuilder& cfg) :flow(cfg), walker(cfg.tfg)
 {
 	curBlock = nullptr;
 	buildCtx = nullptr;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vPushReg(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vPushReg(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount != 1 || loadCount < 3) {
-		return false;
+	if (feature.storeList.size() != 1 || feature.loadList.size() < 3) {
+		return nullptr;
 	}
-	auto itStore = fd->obank.storelist.begin();
-	auto itLoad = fd->obank.loadlist.begin();
-	ghidra::PcodeOp* storeOp = *itStore;
-	GhidraHelper::PcodeOpTracer opTracer(fd);
-	auto dstResult = opTracer.TraceInput(storeOp->getAddr().getOffset(), storeOp->getIn(1));
-	auto srcResult = opTracer.TraceInput(storeOp->getAddr().getOffset(), storeOp->getIn(2));
+	const auto& dstResult = feature.storeList[0].dst;
+	const auto& srcResult = feature.storeList[0].src;
 	//dstResultԴvmStack
 	if (dstResult.size() != 1) {
-		return false;
+		return nullptr;
 	}
 	if (dstResult[0].bAccessMem) {
-		return false;
+		return nullptr;
 	}
 	bool bContainEsp = false;
 	bool bContainVmCode = false;
 	size_t loadEspAddr = 0x0;
 	for (unsigned int n = 0; n < srcResult.size(); ++n) {
-		if (srcResult[n].name == "ESP" && srcResult[n].bAccessMem) {
+		if (srcResult[n].reg == VmpRegister::REG_ESP && srcResult[n].bAccessMem) {
 			bContainEsp = true;
 			loadEspAddr = srcResult[n].addr;
 		}
-		else if (srcResult[n].name == buildCtx->vmreg.reg_code && srcResult[n].bAccessMem) {
+		else if (srcResult[n].reg == buildCtx->vmreg.reg_code && srcResult[n].bAccessMem) {
 			bContainVmCode = true;
 		}
 	}
 	if (!bContainEsp || !bContainVmCode) {
-		return false;
+		return nullptr;
 	}
 	std::unique_ptr<VmpOpPushReg> vPushRegOp = std::make_unique<VmpOpPushReg>();
 	vPushRegOp->opSize = GetMemAccessSize(loadEspAddr);
@@ -178,140 +278,117 @@ std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vPushReg(ghidra::Funcd
 }
 
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vPushImm(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vPushImm(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount != 1 || loadCount < 2) {
-		return false;
+	if (feature.storeList.size() != 1 || feature.loadList.size() < 2) {
+		return nullptr;
 	}
-	auto itStore = fd->obank.storelist.begin();
-	auto itLoad = fd->obank.loadlist.begin();
-	ghidra::PcodeOp* storeOp = *itStore;
-	GhidraHelper::PcodeOpTracer opTracer(fd);
-	auto dstResult = opTracer.TraceInput(storeOp->getAddr().getOffset(), storeOp->getIn(1));
-	auto srcResult = opTracer.TraceInput(storeOp->getAddr().getOffset(), storeOp->getIn(2));
+	const auto& dstResult = feature.storeList[0].dst;
+	const auto& srcResult = feature.storeList[0].src;
 	//dstResultԴvmStack
 	if (dstResult.size() != 1) {
-		return false;
+		return nullptr;
 	}
 	if (dstResult[0].bAccessMem) {
-		return false;
+		return nullptr;
 	}
-	const std::string& vmStackReg = dstResult[0].name;
+	VmpRegId vmStackReg = dstResult[0].reg;
 	if (buildCtx->vmreg.reg_stack != vmStackReg) {
-		return false;
+		return nullptr;
 	}
 	bool bOnlyFromVmCode = true;
 	for (unsigned int n = 0; n < srcResult.size(); ++n) {
 		if (srcResult[n].bAccessMem) {
-			if (srcResult[n].name != buildCtx->vmreg.reg_code) {
+			if (srcResult[n].reg != buildCtx->vmreg.reg_code) {
 				bOnlyFromVmCode = false;
 				break;
 			}
 		}
 	}
 	if (!bOnlyFromVmCode) {
-		return false;
+		return nullptr;
 	}
-	ghidra::PcodeOp* loadOp = *itLoad;
 	std::unique_ptr<VmpOpPushImm> vPushImm = std::make_unique<VmpOpPushImm>();
-	vPushImm->loadAddr = loadOp->getAddr().getOffset();
+	vPushImm->loadAddr = feature.loadList[0].addr;
 	vPushImm->opSize = GetMemAccessSize(vPushImm->loadAddr);
-	vPushImm->storeAddr = storeOp->getAddr().getOffset();
+	vPushImm->storeAddr = feature.storeList[0].addr;
 	return vPushImm;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vJmpConst(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vJmpConst(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount != 0 || !loadCount) {
+	if (feature.storeList.size() != 0 || feature.loadList.size() != 0x1) {
 		return nullptr;
 	}
-	auto itLoad = fd->obank.loadlist.begin();
-	if (loadCount != 0x1) {
+	if (!feature.HasRetReg(VmpRegister::REG_EIP)) {
 		return nullptr;
 	}
-	ghidra::PcodeOp* retOp = fd->getFirstReturnOp();
-	for (unsigned int n = 0; n < retOp->numInput(); ++n) {
-		ghidra::Varnode* vn = retOp->getIn(n);
-		std::string retRegName = fd->getArch()->translate->getRegisterName(vn->getSpace(), vn->getOffset(), vn->getSize());
-		if (retRegName != "EIP") {
-			continue;
-		}
-		GhidraHelper::PcodeOpTracer opTracer(fd);
-		auto eipResult = opTracer.TraceInput(retOp->getAddr().getOffset(), vn);
-		if (eipResult.size() != 2) {
-			return false;
-		}
-		if (eipResult[0].bAccessMem ^ eipResult[1].bAccessMem) {
-			std::unique_ptr<VmpOpJmpConst> vOpJmpConst = std::make_unique<VmpOpJmpConst>();
-			return vOpJmpConst;
-		}
+	const auto& eipResult = feature.TraceRetReg(VmpRegister::REG_EIP);
+	if (eipResult.size() != 2) {
 		return nullptr;
 	}
+	if (eipResult[0].bAccessMem ^ eipResult[1].bAccessMem) {
+		std::unique_ptr<VmpOpJmpConst> vOpJmpConst = std::make_unique<VmpOpJmpConst>();
+		return vOpJmpConst;
+	}
 	return nullptr;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_Div(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_Div(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount != 3 || loadCount != 4) {
+	if (feature.storeList.size() != 3 || feature.loadList.size() != 4) {
 		return nullptr;
 	}
-	auto itStore = fd->obank.storelist.begin();
-	auto itLoad = fd->obank.loadlist.begin();
 	for (unsigned int n = 0; n < 2; ++n) {
-		ghidra::PcodeOp* storeOp = *itStore++;
-		GhidraHelper::PcodeOpTracer opTracer(fd);
-		auto dstResult = opTracer.TraceInput(storeOp->getAddr().getOffset(), storeOp->getIn(1));
-		auto srcResult = opTracer.TraceInput(storeOp->getAddr().getOffset(), storeOp->getIn(2));
+		const auto& dstResult = feature.storeList[n].dst;
 		if(dstResult.size() != 1){
-			return false;
+			return nullptr;
 		}
-		if (dstResult[0].name != buildCtx->vmreg.reg_stack || dstResult[0].bAccessMem) {
-			return false;
+		if (dstResult[0].reg != buildCtx->vmreg.reg_stack || dstResult[0].bAccessMem) {
+			return nullptr;
+		}
+		size_t mathOpAddr = feature.storeList[n].valueDefAddr;
+		if (!mathOpAddr) {
+			return nullptr;
 		}
-		size_t mathOpAddr = storeOp->getIn(2)->getDef()->getAddr().getOffset();
 		auto asmData = DisasmManager::Main().DecodeInstruction(mathOpAddr);
-		if (asmData->raw->id != X86_INS_DIV) {
-			return false;
+		if (!asmData || asmData->raw->id != X86_INS_DIV) {
+			return nullptr;
 		}
 	}
 	std::unique_ptr<VmpOpDiv> vOpDiv = std::make_unique<VmpOpDiv>();
 	return vOpDiv;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_Mul(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_Mul(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount != 3 || loadCount != 3) {
+	if (feature.storeList.size() != 3 || feature.loadList.size() != 3) {
 		return nullptr;
 	}
-	auto itStore = fd->obank.storelist.begin();
-	ghidra::PcodeOp* storeOp1 = *itStore++;
-	GhidraHelper::PcodeOpTracer opTracer(fd);
-	auto dstResult = opTracer.TraceInput(storeOp1->getAddr().getOffset(), storeOp1->getIn(1));
-	auto srcResult = opTracer.TraceInput(storeOp1->getAddr().getOffset(), storeOp1->getIn(2));
+	const auto& dstResult = feature.storeList[0].dst;
+	const auto& srcResult = feature.storeList[0].src;
 	if (dstResult.size() != 1 || srcResult.size() != 2) {
 		return nullptr;
 	}
-	if (dstResult[0].name != buildCtx->vmreg.reg_stack) {
+	if (dstResult[0].reg != buildCtx->vmreg.reg_stack) {
 		return nullptr;
 	}
 	for (unsigned int n = 0; n < srcResult.size(); ++n) {
-		if (srcResult[n].name != buildCtx->vmreg.reg_stack) {
+		if (srcResult[n].reg != buildCtx->vmreg.reg_stack) {
 			return nullptr;
 		}
 		if (!srcResult[n].bAccessMem) {
 			return nullptr;
 		}
 	}
-	size_t mathOpAddr = storeOp1->getIn(2)->getDef()->getAddr().getOffset();
+	size_t mathOpAddr = feature.storeList[0].valueDefAddr;
+	if (!mathOpAddr) {
+		return nullptr;
+	}
 	auto asmData = DisasmManager::Main().DecodeInstruction(mathOpAddr);
+	if (!asmData) {
+		return nullptr;
+	}
 	if(asmData->raw->id == X86_INS_IMUL) {
 		std::unique_ptr<VmpOpImul> vOpImul = std::make_unique<VmpOpImul>();
 		//To do... opsize fix
@@ -324,44 +401,28 @@ std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_Mul(ghidra::Funcdata*
 	return nullptr;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vPopfd(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vPopfd(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount != 0 || !loadCount) {
+	if (feature.storeList.size() != 0 || feature.loadList.empty()) {
 		return nullptr;
 	}
-	auto itLoad = fd->obank.loadlist.begin();
-	ghidra::PcodeOp* loadOp1 = *itLoad++;
-	ghidra::Varnode* vLoadReg = loadOp1->getIn(1);
-	std::string loadRegName = fd->getArch()->translate->getRegisterName(vLoadReg->getSpace(), vLoadReg->getOffset(), vLoadReg->getSize());
-	if (loadRegName != buildCtx->vmreg.reg_stack) {
+	if (feature.loadList[0].ptrReg != buildCtx->vmreg.reg_stack) {
 		return nullptr;
 	}
-	auto itBegin = loadOp1->getOut()->beginDescend();
-	auto itEnd = loadOp1->getOut()->endDescend();
-	while (itBegin != itEnd) {
-		ghidra::PcodeOp* useOp = *itBegin++;
-		if (useOp->code() != ghidra::CPUI_COPY) {
-			continue;
-		}
-		if (GhidraHelper::GetVarnodeRegName(useOp->getOut()) == "eflags") {
-			std::unique_ptr<VmpOpPopfd> vOpPopfd = std::make_unique<VmpOpPopfd>();
-			vOpPopfd->addr = nodeInput.readVmAddress(buildCtx->vmreg.reg_code);
-			return vOpPopfd;
-		}
+	if (feature.bLoadToEflags) {
+		std::unique_ptr<VmpOpPopfd> vOpPopfd = std::make_unique<VmpOpPopfd>();
+		vOpPopfd->addr = nodeInput.readVmAddress(buildCtx->vmreg.reg_code);
+		return vOpPopfd;
 	}
 	return nullptr;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vJmp(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vJmp(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount != 0 || !loadCount) {
+	size_t loadCount = feature.loadList.size();
+	if (feature.storeList.size() != 0 || !loadCount) {
 		return nullptr;
 	}
-	auto itLoad = fd->obank.loadlist.begin();
 	//vJmp
 	//0 : u0x00007a00(0x004ad3c2:0) = *(ram, EBP(i))
 	//1 : EDX(0x004ad3c2:1) = u0x00007a00(0x004ad3c2:0)
@@ -370,29 +431,21 @@ std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vJmp(ghidra::Funcdata*
 	//4 : EDI(0x004ad3d8:37) = EBP(0x004ad3c9:42)
 	//5 : EIP(0x004bea62:39) = #0x460fe4
 	if (loadCount == 0x1) {
-		ghidra::PcodeOp* loadOp1 = *itLoad++;
-		ghidra::Varnode* vLoadReg = loadOp1->getIn(1);
-		std::string loadRegName = fd->getArch()->translate->getRegisterName(vLoadReg->getSpace(), vLoadReg->getOffset(), vLoadReg->getSize());
-		if (loadRegName != buildCtx->vmreg.reg_stack) {
+		if (feature.loadList[0].ptrReg != buildCtx->vmreg.reg_stack) {
 			return nullptr;
 		}
 		std::unique_ptr<VmpOpJmp> vJmpOp = std::make_unique<VmpOpJmp>();
 		return vJmpOp;
 	}
 	else if (loadCount == 0x2) {
-		ghidra::PcodeOp* loadOp1 = *itLoad++;
-		ghidra::PcodeOp* loadOp2 = *itLoad++;
-		ghidra::Varnode* vLoadReg = loadOp1->getIn(1);
-		std::string loadRegName = fd->getArch()->translate->getRegisterName(vLoadReg->getSpace(), vLoadReg->getOffset(), vLoadReg->getSize());
-		if (loadRegName != buildCtx->vmreg.reg_stack) {
+		if (feature.loadList[0].ptrReg != buildCtx->vmreg.reg_stack) {
 			return nullptr;
 		}
-		GhidraHelper::PcodeOpTracer opTracer(fd);
-		auto srcResult = opTracer.TraceInput(loadOp2->getAddr().getOffset(), loadOp2->getIn(1));
+		const auto& srcResult = feature.loadList[1].ptr;
 		if (srcResult.size() != 1) {
 			return nullptr;
 		}
-		if (!srcResult[0].bAccessMem || srcResult[0].name != buildCtx->vmreg.reg_stack) {
+		if (!srcResult[0].bAccessMem || srcResult[0].reg != buildCtx->vmreg.reg_stack) {
 			return nullptr;
 		}
 		std::unique_ptr<VmpOpJmp> vJmpOp = std::make_unique<VmpOpJmp>();
@@ -418,7 +471,7 @@ bool isVmPushKey(VmpNode& input)
 }
 
 
-bool FastCheckVmpEntry(size_t startAddr)
+bool FastCheckVmpEntry(VmpArchitecture* arch, size_t startAddr)
 {
 	VmpTraceFlowGraph tfg;
 	VmpBlockWalker walker(tfg);
@@ -441,7 +494,7 @@ bool FastCheckVmpEntry(size_t startAddr)
 		nodeInput.append(walker.GetNextNode());
 	}
 	for (unsigned int n = 0; n < 3; ++n) {
-		ghidra::Funcdata* fd = gArch->AnaVmpHandler(&nodeInput);
+		ghidra::Funcdata* fd = arch->AnaVmpHandler(&nodeInput);
 		if (fd == nullptr) {
 			throw GhidraException("ana vmp handler error");
 		}
@@ -475,14 +528,17 @@ bool VmpBlockBuilder::executeVmInit(VmpNode& nodeInput, VmpOpInit* inst)
 	newBuildTask->ctx = std::move(nextContext);
 	newBuildTask->btype = VmpFlowBuildContext::HANDLE_VMP_JMP;
 	newBuildTask->from_addr = inst->addr;
-	flow.anaQueue.push(std::move(newBuildTask));
+	flow.pushTask(std::move(newBuildTask));
 	buildCtx->status = VmpFlowBuildContext::FINISH_MATCH;
 	return true;
 }
 
 bool VmpBlockBuilder::executeVmExit(VmpNode& nodeInput, VmpInstruction* inst)
 {
-	ghidra::Funcdata* fd = flow.Arch()->AnaVmpBasicBlock(curBlock);
+	ghidra::Funcdata* fd = liftBlockSlice();
+	if (!fd) {
+		fd = flow.Arch()->AnaVmpBasicBlock(curBlock);
+	}
 	VmpBranchAnalyzer branchAna(fd);
 	std::vector<size_t> branchList = branchAna.GuessVmpBranch();
 	if (branchList.size() != 1) {
@@ -496,7 +552,7 @@ bool VmpBlockBuilder::executeVmExit(VmpNode& nodeInput, VmpInstruction* inst)
 	}
 	VmpExitCallAnalyzer exitCallAna;
 	size_t vmCallExit = exitCallAna.GuessExitCallAddr(fd);
-	if (vmCallExit && FastCheckVmpEntry(vmCallExit)) {
+	if (vmCallExit && FastCheckVmpEntry(flow.Arch(), vmCallExit)) {
 		std::unique_ptr<VmpOpExitCall> vOpExitCall = std::make_unique<VmpOpExitCall>();
 		vOpExitCall->isLoad = branchAna.bLoaded;
 		vOpExitCall->addr = inst->addr;
@@ -506,16 +562,12 @@ bool VmpBlockBuilder::executeVmExit(VmpNode& nodeInput, VmpInstruction* inst)
 		newBuildTask->btype = VmpFlowBuildContext::HANDLE_VMP_ENTRY;
 		newBuildTask->from_addr = inst->addr;
 		newBuildTask->start_addr = vmCallExit;
-		flow.anaQueue.push(std::move(newBuildTask));
-		buildCtx->status = VmpFlowBuildContext::FINISH_MATCH;
-		return true;
-	}
-	if (!IDAWrapper::isVmpEntry(branchList[0])) {
-		flow.addNormalBuildTask(branchList[0]);
-		flow.linkBlockEdge(inst->addr, branchList[0]);
+		flow.pushTask(std::move(newBuildTask));
 		buildCtx->status = VmpFlowBuildContext::FINISH_MATCH;
 		return true;
 	}
+	//an exit to another vm entry is dropped by the exit task in fallthruVmExit
+	flow.addVmpExitBuildTask(inst->addr, branchList[0]);
 	buildCtx->status = VmpFlowBuildContext::FINISH_MATCH;
 	return true;
 }
@@ -531,7 +583,7 @@ bool VmpBlockBuilder::executeVmJmpConst(VmpNode& nodeInput, VmpOpJmpConst* inst)
 	newBuildTask->ctx = std::move(nextContext);
 	newBuildTask->btype = VmpFlowBuildContext::HANDLE_VMP_JMP;
 	newBuildTask->from_addr = inst->addr;
-	flow.anaQueue.push(std::move(newBuildTask));
+	flow.pushTask(std::move(newBuildTask));
 	buildCtx->status = VmpFlowBuildContext::FINISH_MATCH;
 	return true;
 }
@@ -554,27 +606,84 @@ bool VmpBlockBuilder::updateVmReg(VmpNode& nodeInput, VmpInstruction* inst)
 
 std::unique_ptr<VmpUnicornContext> VmpBlockBuilder::prepareJmpContext(VmpNode& nodeInput, size_t jmpAddr)
 {
-	VmpUnicorn unicornEngine;
 	auto newCtx = VmpUnicornContext::DefaultContext();
 	newCtx->context = nodeInput.contextList[0];
 	newCtx->FixVmJmpVal(buildCtx->vmreg.reg_stack, jmpAddr);
+	//run the summary of the vJmp handler on the new target, unicorn only when it has none
+	Vmp3xHandlerFactory& cache = flow.HandlerCache();
+	const VmpHandlerSummary* summary = cache.bFastWalk ? cache.FindSummary(newCtx->context.EIP) : nullptr;
+	if (summary && summary->addrList.size() == nodeInput.addrList.size()) {
+		VmpHandlerSummary::MachineState state;
+		state.regs = newCtx->context;
+		state.stackBase = newCtx->stackCodeBase;
+		state.stack = &newCtx->stackBuffer;
+		VmpNode jmpNode;
+		if (summary->Execute(state, jmpNode)) {
+			newCtx->context = state.regs;
+			return newCtx;
+		}
+	}
+	VmpUnicorn unicornEngine;
 	unicornEngine.StartVmpTrace(*newCtx, nodeInput.addrList.size() + 1);
 	return unicornEngine.CopyCurrentUnicornContext();
 }
 
-bool VmpBlockBuilder::executeVmJmp(VmpNode& nodeInput, VmpOpJmp* inst)
+ghidra::Funcdata* VmpBlockBuilder::liftBlockSlice()
 {
-	VmpUnicorn unicornEngine;
-	GhidraHelper::VmpBranchExtractor branchExt;
-	ghidra::Funcdata* fd = flow.Arch()->AnaVmpBasicBlock(curBlock);
+	VmpArchitecture* arch = flow.Arch();
+	VmpBlockSlicer slicer(arch->LiftVmpBasicBlock(curBlock));
+	VmpBlockSlice slice;
+	if (!slicer.BuildSlice(slice)) {
+		return nullptr;
+	}
+	return arch->AnaVmpBasicBlock(curBlock, 0x0, &slice);
+}
+
+std::vector<size_t> VmpBlockBuilder::guessJmpBranch()
+{
+	//a target built inside the block needs no decompiler
+	VmpBlockInterpreter interpreter;
+	if (interpreter.Compile(curBlock)) {
+		VmState state;
+		if (interpreter.Run(state) && !state.bExit && state.target.IsConst()) {
+			return std::vector<size_t>{ state.target.value };
+		}
+	}
+	ghidra::Funcdata* sliceFd = liftBlockSlice();
+	if (sliceFd) {
+		VmpBranchAnalyzer branchAna(sliceFd);
+		return branchAna.GuessVmpBranch();
+	}
+	//esp left the entry frame, try a tail of the block and lift it whole when the tail is not enough
+	size_t insCount = curBlock->insList.size();
+	if (insCount > BranchSliceWindow) {
+		ghidra::Funcdata* tailFd = flow.Arch()->AnaVmpBasicBlock(curBlock, insCount - BranchSliceWindow);
+		if (tailFd) {
+			VmpBranchAnalyzer branchAna(tailFd);
+			std::vector<size_t> branchList = branchAna.GuessVmpBranch();
+			//a tail is only trusted when the target is computed inside it
+			if (!branchList.empty() && !branchAna.ReadsEntryState()) {
+				return branchList;
+			}
+		}
+	}
+	ghidra::Funcdata* fd = flow.Arch()->AnaVmpBasicBlock(curBlock, 0x0);
+	if (fd == nullptr) {
+		throw GhidraException("ana vmp block error");
+	}
 	VmpBranchAnalyzer branchAna(fd);
-	std::vector<size_t> branchList = branchAna.GuessVmpBranch();
+	return branchAna.GuessVmpBranch();
+}
+
+bool VmpBlockBuilder::executeVmJmp(VmpNode& nodeInput, VmpOpJmp* inst)
+{
+	std::vector<size_t> branchList = guessJmpBranch();
 	for (unsigned int n = 0; n < branchList.size(); ++n) {
 		auto newBuildTask = std::make_unique<VmpFlowBuildContext>();
 		newBuildTask->ctx = prepareJmpContext(nodeInput, branchList[n]);
 		newBuildTask->btype = VmpFlowBuildContext::HANDLE_VMP_JMP;
 		newBuildTask->from_addr = inst->addr;
-		flow.anaQueue.push(std::move(newBuildTask));
+		flow.pushTask(std::move(newBuildTask));
 	}
 	buildCtx->status = VmpFlowBuildContext::FINISH_MATCH;
 	return true;
@@ -591,12 +700,11 @@ bool VmpBlockBuilder::executeVmpOp(VmpNode& nodeInput,std::unique_ptr<VmpInstruc
 		if (buildCtx->from_addr.raw) {
 			flow.linkBlockEdge(buildCtx->from_addr, vmInst->addr);
 		}
-		if (flow.visited.count(vmInst->addr)) {
+		curBlock = flow.claimNewBlock(vmInst->addr, true);
+		if (!curBlock) {
 			buildCtx->status = VmpFlowBuildContext::FINISH_MATCH;
 			return true;
 		}
-		flow.visited.insert(vmInst->addr);
-		curBlock = flow.createNewBlock(vmInst->addr, true);
 	}
 
 	curBlock->insList.push_back(std::move(inst));
@@ -627,151 +735,80 @@ bool VmpBlockBuilder::executeVmpOp(VmpNode& nodeInput,std::unique_ptr<VmpInstruc
 	return true;
 }
 
-ghidra::OpCode CheckLogicPattern(ghidra::PcodeOp* startOP)
-{
-	std::vector<ghidra::PcodeOp*> checkList;
-	checkList.push_back(startOP);
-	while (!checkList.empty()) {
-		ghidra::PcodeOp* curOp = checkList.back();
-		checkList.pop_back();
-		if (curOp == nullptr) {
-			continue;
-		}
-		//ݹģ
-		switch (curOp->code()) {
-		case ghidra::CPUI_INT_ZEXT:
-		case ghidra::CPUI_SUBPIECE:
-			checkList.push_back(curOp->getIn(0)->getDef());
-			break;
-		case ghidra::CPUI_PIECE:
-			checkList.push_back(curOp->getIn(0)->getDef());
-			checkList.push_back(curOp->getIn(1)->getDef());
-			break;
-		}
-		//ƥģ
-		if (curOp->code() == ghidra::CPUI_INT_LEFT) {
-			ghidra::PcodeOp* defOp1 = curOp->getIn(0)->getDef();
-			if (defOp1 && defOp1->code() == ghidra::CPUI_LOAD) {
-				return ghidra::CPUI_INT_LEFT;
-			}
-		}
-		else if (curOp->code() == ghidra::CPUI_INT_RIGHT) {
-			ghidra::PcodeOp* defOp1 = curOp->getIn(0)->getDef();
-			if (defOp1 && defOp1->code() == ghidra::CPUI_LOAD) {
-				return ghidra::CPUI_INT_RIGHT;
-			}
-		}
-		else if (curOp->code() == ghidra::CPUI_INT_ADD) {
-			ghidra::PcodeOp* defOp1 = curOp->getIn(0)->getDef();
-			ghidra::PcodeOp* defOp2 = curOp->getIn(1)->getDef();
-			if (defOp1 && defOp2 && defOp1->code() == ghidra::CPUI_LOAD && defOp2->code() == ghidra::CPUI_LOAD) {
-				return ghidra::CPUI_INT_ADD;
-			}
-		}
-		else if (curOp->code() == ghidra::CPUI_INT_AND) {
-			if (curOp->getIn(1)->isConstant()) {
-				checkList.push_back(curOp->getIn(0)->getDef());
-				continue;
-			}
-			ghidra::PcodeOp* defOp1 = curOp->getIn(0)->getDef();
-			ghidra::PcodeOp* defOp2 = curOp->getIn(1)->getDef();
-			if (defOp1 && defOp2 && defOp1->code() == ghidra::CPUI_INT_NEGATE && defOp2->code() == ghidra::CPUI_INT_NEGATE) {
-				return ghidra::CPUI_INT_AND;
-			}
-		}
-		else if (curOp->code() == ghidra::CPUI_INT_OR) {
-			ghidra::PcodeOp* defOp1 = curOp->getIn(0)->getDef();
-			ghidra::PcodeOp* defOp2 = curOp->getIn(1)->getDef();
-			if (defOp1 && defOp2 && defOp1->code() == ghidra::CPUI_INT_NEGATE && defOp2->code() == ghidra::CPUI_INT_NEGATE) {
-				return ghidra::CPUI_INT_OR;
-			}
-		}
-	}
-	return ghidra::OpCode(0x0);
-}
-
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vMemAccess(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vMemAccess(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
 	//load vmStack,load vmStack, store vmStack,load vmCode
-	if (storeCount != 1 || loadCount != 3) {
+	if (feature.storeList.size() != 1 || feature.loadList.size() != 3) {
 		return nullptr;
 	}
-	auto itStore = fd->obank.storelist.begin();
-	auto itLoad = fd->obank.loadlist.begin();
-	ghidra::PcodeOp* storeOp = *itStore;
-	GhidraHelper::PcodeOpTracer opTracer(fd);
-	auto dstResult = opTracer.TraceInput(storeOp->getAddr().getOffset(), storeOp->getIn(1));
-	auto srcResult = opTracer.TraceInput(storeOp->getAddr().getOffset(), storeOp->getIn(2));
+	const auto& dstResult = feature.storeList[0].dst;
+	const auto& srcResult = feature.storeList[0].src;
 	//dstResultԴvmStack
 	if (dstResult.size() != 1) {
 		return nullptr;
 	}
-	if (dstResult[0].name != buildCtx->vmreg.reg_stack) {
+	if (dstResult[0].reg != buildCtx->vmreg.reg_stack) {
 		return nullptr;
 	}
 	std::string segReg;
-	std::string stackReg;
 	if (srcResult.size() == 1) {
-		if (srcResult[0].name != buildCtx->vmreg.reg_stack || !srcResult[0].bAccessMem) {
+		if (srcResult[0].reg != buildCtx->vmreg.reg_stack || !srcResult[0].bAccessMem) {
 			return nullptr;
 		}
 	}
 	else if (srcResult.size() == 2) {
-		if (srcResult[0].name == "FS_OFFSET") {
+		if (srcResult[0].reg == VmpRegister::REG_FS_OFFSET) {
 			segReg = "fs";
 		}
-		if (srcResult[1].name != buildCtx->vmreg.reg_stack || !srcResult[1].bAccessMem) {
+		if (srcResult[1].reg != buildCtx->vmreg.reg_stack || !srcResult[1].bAccessMem) {
 			return nullptr;
 		}
 	}
 	else {
 		return nullptr;
 	}
+	size_t memLoadAddr = feature.loadList[1].addr;
 	if (dstResult[0].bAccessMem) {
 		std::unique_ptr<VmpOpWriteMem> vOpWriteMem = std::make_unique<VmpOpWriteMem>();
-		vOpWriteMem->opSize = GetMemAccessSize((*++itLoad)->getAddr().getOffset());
+		vOpWriteMem->opSize = GetMemAccessSize(memLoadAddr);
 		return vOpWriteMem;
 	}
 	else {
 		std::unique_ptr<VmpOpReadMem> vOpReadMem = std::make_unique<VmpOpReadMem>();
-		vOpReadMem->opSize = GetMemAccessSize((*++itLoad)->getAddr().getOffset());
+		vOpReadMem->opSize = GetMemAccessSize(memLoadAddr);
 		vOpReadMem->seg = segReg;
 		return vOpReadMem;
 	}
 	return nullptr;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vLogicalOp2(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vLogicalOp2(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount != 2 || loadCount != 4) {
+	if (feature.storeList.size() != 2 || feature.loadList.size() != 4) {
 		return nullptr;
 	}
-	auto itStore = fd->obank.storelist.begin();
-	auto itLoad = fd->obank.loadlist.begin();
-	ghidra::PcodeOp* storeOp1 = *itStore++;
-	ghidra::PcodeOp* storeOp2 = *itStore++;
-	ghidra::PcodeOp* loadOp1 = *itLoad++;
-	GhidraHelper::PcodeOpTracer opTracer(fd);
-	auto dstResult = opTracer.TraceInput(storeOp1->getAddr().getOffset(), storeOp1->getIn(1));
-	auto srcResult = opTracer.TraceInput(storeOp1->getAddr().getOffset(), storeOp1->getIn(2));
+	const auto& dstResult = feature.storeList[0].dst;
+	const auto& srcResult = feature.storeList[0].src;
 	//dstResultԴvmStack
-	if (dstResult.size() != 1 || dstResult[0].bAccessMem || dstResult[0].name != buildCtx->vmreg.reg_stack) {
-		return false;
+	if (dstResult.size() != 1 || dstResult[0].bAccessMem || dstResult[0].reg != buildCtx->vmreg.reg_stack) {
+		return nullptr;
 	}
 	//srcȫԴstack
 	for (unsigned int n = 0; n < srcResult.size(); ++n) {
 		if (srcResult[n].bAccessMem) {
-			if (srcResult[n].name == buildCtx->vmreg.reg_stack) {
+			if (srcResult[n].reg == buildCtx->vmreg.reg_stack) {
 				continue;
 			}
-			return false;
+			return nullptr;
 		}
 	}
-	auto asmData = DisasmManager::Main().DecodeInstruction(storeOp1->getIn(2)->getDef()->getAddr().getOffset());
+	if (!feature.storeList[0].valueDefAddr) {
+		return nullptr;
+	}
+	auto asmData = DisasmManager::Main().DecodeInstruction(feature.storeList[0].valueDefAddr);
+	if (!asmData) {
+		return nullptr;
+	}
 	if (asmData->raw->id == X86_INS_SHRD) {
 		std::unique_ptr<VmpOpShrd> vOpShrd = std::make_unique<VmpOpShrd>();
 		return vOpShrd;
@@ -783,24 +820,17 @@ std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vLogicalOp2(ghidra::Fu
 	return nullptr;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vLogicalOp(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vLogicalOp(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
 	//,2store,3load
 	//store vmStack,store vmStack
 	//load vmCode,load vmCode
-	if (storeCount != 2 || loadCount != 3) {
+	if (feature.storeList.size() != 2 || feature.loadList.size() != 3) {
 		return nullptr;
 	}
-	auto itStore = fd->obank.storelist.begin();
-	auto itLoad = fd->obank.loadlist.begin();
-	ghidra::PcodeOp* storeOp1 = *itStore++;
-	ghidra::PcodeOp* storeOp2 = *itStore++;
-	ghidra::PcodeOp* loadOp1 = *itLoad++;
-	GhidraHelper::PcodeOpTracer opTracer(fd);
-	auto dstResult = opTracer.TraceInput(storeOp1->getAddr().getOffset(), storeOp1->getIn(1));
-	auto srcResult = opTracer.TraceInput(storeOp1->getAddr().getOffset(), storeOp1->getIn(2));
+	size_t loadAddr = feature.loadList[0].addr;
+	const auto& dstResult = feature.storeList[0].dst;
+	const auto& srcResult = feature.storeList[0].src;
 	//dstResultԴvmStack
 	if (dstResult.size() != 1) {
 		return nullptr;
@@ -808,100 +838,78 @@ std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vLogicalOp(ghidra::Fun
 	if (dstResult[0].bAccessMem) {
 		return nullptr;
 	}
-	if (dstResult[0].name != buildCtx->vmreg.reg_stack) {
+	if (dstResult[0].reg != buildCtx->vmreg.reg_stack) {
 		return nullptr;
 	}
 	//srcȫԴstack
 	for (unsigned int n = 0; n < srcResult.size(); ++n) {
 		if (srcResult[n].bAccessMem) {
-			if (srcResult[n].name == buildCtx->vmreg.reg_stack) {
+			if (srcResult[n].reg == buildCtx->vmreg.reg_stack) {
 				continue;
 			}
 			return nullptr;
 		}
 	}
-	ghidra::OpCode logicCode = CheckLogicPattern(storeOp1->getIn(2)->getDef());
+	ghidra::OpCode logicCode = feature.storeList[0].logicCode;
 	if (logicCode == ghidra::CPUI_INT_ADD) {
 		std::unique_ptr<VmpOpAdd> vAddOp = std::make_unique<VmpOpAdd>();
-		vAddOp->opSize = GetMemAccessSize(loadOp1->getAddr().getOffset());
+		vAddOp->opSize = GetMemAccessSize(loadAddr);
 		return vAddOp;
 	}
 	if (logicCode == ghidra::CPUI_INT_AND) {
 		std::unique_ptr<VmpOpNor> vOpNor = std::make_unique<VmpOpNor>();
-		vOpNor->opSize = GetMemAccessSize(loadOp1->getAddr().getOffset());
+		vOpNor->opSize = GetMemAccessSize(loadAddr);
 		return vOpNor;
 	}
 	else if (logicCode == ghidra::CPUI_INT_OR) {
 		std::unique_ptr<VmpOpNand> vOpNand = std::make_unique<VmpOpNand>();
-		vOpNand->opSize = GetMemAccessSize(loadOp1->getAddr().getOffset());
+		vOpNand->opSize = GetMemAccessSize(loadAddr);
 		return vOpNand;
 	}
 	else if (logicCode == ghidra::CPUI_INT_RIGHT) {
 		std::unique_ptr<VmpOpShr> vOpShr = std::make_unique<VmpOpShr>();
-		vOpShr->opSize = GetMemAccessSize(loadOp1->getAddr().getOffset());
+		vOpShr->opSize = GetMemAccessSize(loadAddr);
 		return vOpShr;
 	}
 	else if (logicCode == ghidra::CPUI_INT_LEFT) {
 		std::unique_ptr<VmpOpShl> vOpShl = std::make_unique<VmpOpShl>();
-		vOpShl->opSize = GetMemAccessSize(loadOp1->getAddr().getOffset());
+		vOpShl->opSize = GetMemAccessSize(loadAddr);
 		return vOpShl;
 	}
 	return nullptr;
 }
 
-bool VmpBlockBuilder::tryMatch_vJunkCode(ghidra::Funcdata* fd, VmpNode& nodeInput)
+bool VmpBlockBuilder::tryMatch_vJunkCode(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (!storeCount && !loadCount) {
+	if (feature.storeList.empty() && feature.loadList.empty()) {
 		return true;
 	}
 	return false;
 }
 
-bool VmpBlockBuilder::tryMatch_vCheckEsp(ghidra::Funcdata* fd, VmpNode& nodeInput)
+bool VmpBlockBuilder::tryMatch_vCheckEsp(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount || loadCount) {
+	if (!feature.storeList.empty() || !feature.loadList.empty()) {
 		return false;
 	}
-	auto itBegin = fd->beginOpAll();
-	auto itEnd = fd->endOpAll();
-	while (itBegin != itEnd) {
-		ghidra::PcodeOp* curOp = itBegin->second;
-		itBegin++;
-		if (curOp->code() == ghidra::CPUI_PTRSUB) {
-			ghidra::Varnode* firstVn = curOp->getIn(0);
-			std::string regName = fd->getArch()->translate->getRegisterName(firstVn->getSpace(), firstVn->getOffset(), firstVn->getSize());
-			if (firstVn->isInput() && regName == "ESP") {
-				//std::unique_ptr<VmpOpCheckEsp> vCheckEsp = std::make_unique<VmpOpCheckEsp>();
-				//vCheckEsp->addr.raw = nodeInput.addrList[0];
-				//vCheckEsp->addr.vmdata = nodeInput.contextList[0].ReadReg(buildCtx->vmreg.reg_code);
-				//executeVmpOp(std::move(vCheckEsp));
-				return true;
-			}
-		}
-	}
-	return false;
+	//std::unique_ptr<VmpOpCheckEsp> vCheckEsp = std::make_unique<VmpOpCheckEsp>();
+	//vCheckEsp->addr.raw = nodeInput.addrList[0];
+	//vCheckEsp->addr.vmdata = nodeInput.contextList[0].ReadReg(buildCtx->vmreg.reg_code);
+	//executeVmpOp(std::move(vCheckEsp));
+	return feature.bEspPtrSub;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vRdtsc(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vRdtsc(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount != 2 || loadCount != 1) {
+	if (feature.storeList.size() != 2 || feature.loadList.size() != 1) {
 		return nullptr;
 	}
-	auto itStore = fd->obank.storelist.begin();
-	while (itStore != fd->obank.storelist.end()) {
-		ghidra::PcodeOp* curStore = *itStore++;
-		GhidraHelper::PcodeOpTracer opTracer(fd);
-		auto srcResult = opTracer.TraceInput(curStore->getAddr().getOffset(), curStore->getIn(2));
+	for (unsigned int n = 0; n < feature.storeList.size(); ++n) {
+		const auto& srcResult = feature.storeList[n].src;
 		if (!srcResult.size()) {
 			return nullptr;
 		}
-		if (srcResult[0].name.find("rdtsc") == -1) {
+		if (VmpRegister::Name(srcResult[0].reg).find("rdtsc") == -1) {
 			return nullptr;
 		}
 	}
@@ -909,22 +917,17 @@ std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vRdtsc(ghidra::Funcdat
 	return vOpRdtsc;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vCpuid(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vCpuid(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	if (storeCount < 4) {
+	if (feature.storeList.size() < 4) {
 		return nullptr;
 	}
-	auto itStoreBegin = fd->obank.storelist.begin();
-	auto itStoreEnd = fd->obank.storelist.end();
-	while (itStoreBegin != itStoreEnd) {
-		ghidra::PcodeOp* curStore = *itStoreBegin++;
-		GhidraHelper::PcodeOpTracer opTracer(fd);
-		auto srcResult = opTracer.TraceInput(curStore->getAddr().getOffset(), curStore->getIn(2));
+	for (unsigned int n = 0; n < feature.storeList.size(); ++n) {
+		const auto& srcResult = feature.storeList[n].src;
 		if (!srcResult.size()) {
 			return nullptr;
 		}
-		if (srcResult[0].name.find("cpuid") == -1) {
+		if (VmpRegister::Name(srcResult[0].reg).find("cpuid") == -1) {
 			return nullptr;
 		}
 	}
@@ -932,18 +935,13 @@ std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vCpuid(ghidra::Funcdat
 	return vOpCpuid;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vPopReg(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vPopReg(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount != 1 || loadCount != 3) {
+	if (feature.storeList.size() != 1 || feature.loadList.size() != 3) {
 		return nullptr;
 	}
-	auto itStore = fd->obank.storelist.begin();
-	ghidra::PcodeOp* opStore = *itStore;
-	GhidraHelper::PcodeOpTracer opTracer(fd);
-	auto dstResult = opTracer.TraceInput(opStore->getAddr().getOffset(), opStore->getIn(1));
-	auto srcResult = opTracer.TraceInput(opStore->getAddr().getOffset(), opStore->getIn(2));
+	const auto& dstResult = feature.storeList[0].dst;
+	const auto& srcResult = feature.storeList[0].src;
 	//srcResultԴvmStack
 	if (srcResult.size() != 1) {
 		return nullptr;
@@ -952,111 +950,97 @@ std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vPopReg(ghidra::Funcda
 	if (!srcResult[0].bAccessMem) {
 		return nullptr;
 	}
-	const std::string& vmStackReg = srcResult[0].name;
+	VmpRegId vmStackReg = srcResult[0].reg;
 	bool bContainEsp = false;
 	GhidraHelper::TraceResult vmCodeTraceResult;
 	for (unsigned int n = 0; n < dstResult.size(); ++n) {
-		if (dstResult[n].name == "ESP" && !dstResult[n].bAccessMem) {
+		if (dstResult[n].reg == VmpRegister::REG_ESP && !dstResult[n].bAccessMem) {
 			bContainEsp = true;
 		}
-		else if (dstResult[n].bAccessMem && dstResult[n].name != vmStackReg) {
+		else if (dstResult[n].bAccessMem && dstResult[n].reg != vmStackReg) {
 			vmCodeTraceResult = dstResult[n];
 		}
 	}
-	if (!bContainEsp || vmCodeTraceResult.name.empty()) {
-		return false;
+	if (!bContainEsp || vmCodeTraceResult.reg == VmpRegister::REG_NONE) {
+		return nullptr;
 	}
 	if (!buildCtx->vmreg.isSelected) {
-		buildCtx->vmreg.reg_code = vmCodeTraceResult.name;
+		buildCtx->vmreg.reg_code = vmCodeTraceResult.reg;
 		buildCtx->vmreg.reg_stack = vmStackReg;
 		buildCtx->vmreg.isSelected = true;
 	}
 	else {
-		if (buildCtx->vmreg.reg_code != vmCodeTraceResult.name) {
-			return false;
+		if (buildCtx->vmreg.reg_code != vmCodeTraceResult.reg) {
+			return nullptr;
 		}
 		if (buildCtx->vmreg.reg_stack != vmStackReg) {
-			return false;
+			return nullptr;
 		}
 	}
 	std::unique_ptr<VmpOpPopReg> vPopRegOp = std::make_unique<VmpOpPopReg>();
 	vPopRegOp->opSize = GetMemAccessSize(srcResult[0].addr);
-	vPopRegOp->storeAddr = opStore->getAddr().getOffset();
+	vPopRegOp->storeAddr = feature.storeList[0].addr;
 	vPopRegOp->reg_code = buildCtx->vmreg.reg_code;
 	vPopRegOp->reg_stack = buildCtx->vmreg.reg_stack;
 	return vPopRegOp;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::AnaVmpPattern(ghidra::Funcdata* fd,VmpNode& input)
+static const size_t any = SIZE_MAX;
+const VmpBlockBuilder::PatternEntry VmpBlockBuilder::patternTable[] = {
+	{1, 1, 3, 3, &VmpBlockBuilder::tryMatch_vPopReg},
+	{1, 1, 3, any, &VmpBlockBuilder::tryMatch_vPushReg},
+	{1, 1, 2, any, &VmpBlockBuilder::tryMatch_vPushImm},
+	{1, 1, 1, 1, &VmpBlockBuilder::tryMatch_vPushVsp},
+	{1, 1, 3, 3, &VmpBlockBuilder::tryMatch_vMemAccess},
+	{2, 2, 3, 3, &VmpBlockBuilder::tryMatch_vLogicalOp},
+	{2, 2, 4, 4, &VmpBlockBuilder::tryMatch_vLogicalOp2},
+	{4, any, 0, any, &VmpBlockBuilder::tryMatch_vCpuid},
+	{2, 2, 1, 1, &VmpBlockBuilder::tryMatch_vRdtsc},
+	{3, 3, 3, 3, &VmpBlockBuilder::tryMatch_Mul},
+	{3, 3, 4, 4, &VmpBlockBuilder::tryMatch_Div},
+	{0, 0, 1, 1, &VmpBlockBuilder::tryMatch_vJmpConst},
+	{0, 0, 1, 2, &VmpBlockBuilder::tryMatch_vJmp},
+	{0, 0, 2, 2, &VmpBlockBuilder::tryMatch_vWriteVsp},
+	{4, any, 4, any, &VmpBlockBuilder::tryMatch_vCopyStack},
+	{0, 0, 1, any, &VmpBlockBuilder::tryMatch_vPopfd},
+	{0, any, 7, any, &VmpBlockBuilder::tryMatch_vExit},
+};
+
+bool VmpBlockBuilder::FitsHandlerShape(const VmpHandlerFeature& feature)
 {
-	std::unique_ptr<VmpInstruction> newPattern;
-	newPattern = tryMatch_vPopReg(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_vPushReg(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_vPushImm(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_vPushVsp(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_vMemAccess(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_vLogicalOp(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_vLogicalOp2(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_vCpuid(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_vRdtsc(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_Mul(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_Div(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_vJmpConst(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_vJmp(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_vWriteVsp(fd, input);
-	if (newPattern) {
-		return newPattern;
-	}
-	newPattern = tryMatch_vCopyStack(fd, input);
-	if (newPattern) {
-		return newPattern;
+	size_t storeCount = feature.storeList.size();
+	size_t loadCount = feature.loadList.size();
+	//junk or check-esp
+	if (!storeCount && !loadCount) {
+		return true;
 	}
-	newPattern = tryMatch_vPopfd(fd, input);
-	if (newPattern) {
-		return newPattern;
+	for (const PatternEntry& entry : patternTable) {
+		if (storeCount < entry.minStore || storeCount > entry.maxStore) {
+			continue;
+		}
+		if (loadCount < entry.minLoad || loadCount > entry.maxLoad) {
+			continue;
+		}
+		return true;
 	}
-	newPattern = tryMatch_vExit(fd, input);
-	if (newPattern) {
-		return newPattern;
+	return false;
+}
+
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::AnaVmpPattern(VmpHandlerFeature& feature, VmpNode& input)
+{
+	size_t storeCount = feature.storeList.size();
+	size_t loadCount = feature.loadList.size();
+	for (const PatternEntry& entry : patternTable) {
+		if (storeCount < entry.minStore || storeCount > entry.maxStore) {
+			continue;
+		}
+		if (loadCount < entry.minLoad || loadCount > entry.maxLoad) {
+			continue;
+		}
+		std::unique_ptr<VmpInstruction> newPattern = (this->*entry.matcher)(feature, input);
+		if (newPattern) {
+			return newPattern;
+		}
 	}
 	return nullptr;
 }
@@ -1073,48 +1057,151 @@ bool VmpBlockBuilder::Execute_FINISH_VM_INIT()
 	//жǷл
 	Vmp3xHandlerFactory& cache = flow.HandlerCache();
 	Vmp3xHandlerFactory::VmpHandlerRange tmpRange(nodeInput.addrList[0], nodeInput.addrList[nodeInput.addrList.size() - 1]);
-	auto it = cache.handlerPatternMap.find(tmpRange);
+	//patterns are never erased while building, the pointer stays valid without the lock
+	VmpInstruction* vmPattern = nullptr;
+	Vmp3xHandlerFactory::VmpHandlerStatus handlerStatus = Vmp3xHandlerFactory::VmpHandlerStatus(0x0);
+	std::unique_ptr<VmpHandlerFeature> feature;
+	{
+		std::lock_guard<std::mutex> lock(cache.cacheMutex);
+		auto it = cache.handlerPatternMap.find(tmpRange);
+		auto itStatus = cache.handlerStatusMap.find(tmpRange);
+		if (it != cache.handlerPatternMap.end()) {
+			vmPattern = it->second.get();
+		}
+		else if (itStatus != cache.handlerStatusMap.end()) {
+			handlerStatus = itStatus->second;
+		}
+		else {
+			auto itFeature = cache.handlerFeatureMap.find(tmpRange);
+			if (itFeature != cache.handlerFeatureMap.end()) {
+				feature = std::move(itFeature->second);
+				cache.handlerFeatureMap.erase(itFeature);
+			}
+		}
+	}
 #ifdef DeveloperMode
 	if (nodeInput.addrList[0] == 0x005dc7d0) {
 		int a = 0;
 	}
 #endif
-	if (it != cache.handlerPatternMap.end()) {
-		std::unique_ptr<VmpInstruction> vmInstruction = it->second->MakeInstruction(buildCtx, nodeInput);
+	if (vmPattern) {
+		summariseHandler(nodeInput, vmPattern);
+		std::unique_ptr<VmpInstruction> vmInstruction = vmPattern->MakeInstruction(buildCtx, nodeInput);
 		if (vmInstruction) {
 			executeVmpOp(nodeInput, std::move(vmInstruction));
 		}
 		return true;
 	}
-	ghidra::Funcdata* fd = flow.Arch()->AnaVmpHandler(&nodeInput);
-	if (fd == nullptr) {
-		throw GhidraException("ana vmp handler error");
+	if (handlerStatus) {
+		if (handlerStatus == Vmp3xHandlerFactory::HANDLER_UNKNOWN) {
+			executeVmpUnknown(nodeInput);
+		}
+		else if (handlerStatus == Vmp3xHandlerFactory::HANDLER_JUNK) {
+			summariseHandler(nodeInput, nullptr);
+		}
+		return true;
 	}
-	std::unique_ptr<VmpInstruction> newVmPattern = AnaVmpPattern(fd, nodeInput);
+	//features of the pool already went through the full group when the slim one missed
+	if (!feature) {
+		feature = VmpHandlerPool::LiftHandler(flow.Arch(), nodeInput);
+		if (!feature) {
+			throw GhidraException("ana vmp handler error");
+		}
+	}
+	std::unique_ptr<VmpInstruction> newVmPattern = AnaVmpPattern(*feature, nodeInput);
 	if (newVmPattern != nullptr) {
 		std::unique_ptr<VmpInstruction> vmInstruction = newVmPattern->MakeInstruction(buildCtx, nodeInput);
-		cache.handlerPatternMap[tmpRange] = std::move(newVmPattern);
+		summariseHandler(nodeInput, newVmPattern.get());
+		{
+			//another worker may have matched the same handler meanwhile, keep the first pattern
+			std::lock_guard<std::mutex> lock(cache.cacheMutex);
+			cache.handlerPatternMap.emplace(tmpRange, std::move(newVmPattern));
 #ifdef DeveloperMode
-		cache.SaveHandlerPattern();
+			cache.SaveHandlerPattern();
 #endif
+		}
 		if (vmInstruction) {
 			executeVmpOp(nodeInput, std::move(vmInstruction));
 		}
 		return true;
 	}
-	if (tryMatch_vCheckEsp(fd, nodeInput)) {
+	if (tryMatch_vCheckEsp(*feature, nodeInput)) {
+		std::lock_guard<std::mutex> lock(cache.cacheMutex);
+		cache.handlerStatusMap[tmpRange] = Vmp3xHandlerFactory::HANDLER_CHECKESP;
 		return true;
 	}
-	if (tryMatch_vJunkCode(fd, nodeInput)) {
+	if (tryMatch_vJunkCode(*feature, nodeInput)) {
+		{
+			std::lock_guard<std::mutex> lock(cache.cacheMutex);
+			cache.handlerStatusMap[tmpRange] = Vmp3xHandlerFactory::HANDLER_JUNK;
+		}
+		summariseHandler(nodeInput, nullptr);
 		return true;
 	}
+	{
+		std::lock_guard<std::mutex> lock(cache.cacheMutex);
+		cache.handlerStatusMap[tmpRange] = Vmp3xHandlerFactory::HANDLER_UNKNOWN;
+	}
+	executeVmpUnknown(nodeInput);
+	return true;
+}
+
+void VmpBlockBuilder::executeVmpUnknown(VmpNode& nodeInput)
+{
 	std::unique_ptr<VmpOpUnknown> vOpUnknown = std::make_unique <VmpOpUnknown>();
 	vOpUnknown->addr = nodeInput.readVmAddress(buildCtx->vmreg.reg_code);
 	executeVmpOp(nodeInput, std::move(vOpUnknown));
 #ifdef DeveloperMode
 	buildCtx->status = VmpFlowBuildContext::MATCH_ERROR;
 #endif
-	return true;
+}
+
+void VmpBlockBuilder::summariseHandler(VmpNode& nodeInput, VmpInstruction* pattern)
+{
+	Vmp3xHandlerFactory& cache = flow.HandlerCache();
+	if (!cache.bFastWalk) {
+		return;
+	}
+	size_t startAddr = nodeInput.addrList[0];
+	{
+		std::lock_guard<std::mutex> lock(cache.cacheMutex);
+		if (cache.handlerSummaryMap.count(startAddr)) {
+			return;
+		}
+	}
+	std::vector<size_t> probeList;
+	if (pattern) {
+		pattern->GetContextProbes(probeList);
+	}
+	std::unique_ptr<VmpHandlerSummary> summary = VmpHandlerSummary::Build(flow.Arch(), nodeInput, probeList);
+	std::lock_guard<std::mutex> lock(cache.cacheMutex);
+	cache.handlerSummaryMap.emplace(startAddr, std::move(summary));
+}
+
+void VmpBlockBuilder::precomputeHandlers()
+{
+	//the pool workers are busy building other blocks
+	if (flow.isParallelBuild()) {
+		return;
+	}
+	Vmp3xHandlerFactory& cache = flow.HandlerCache();
+	std::set<Vmp3xHandlerFactory::VmpHandlerRange> visited;
+	std::vector<VmpNode> anaList;
+	std::vector<VmpNode> nodeList = walker.PeekAllNodes();
+	{
+		std::lock_guard<std::mutex> lock(cache.cacheMutex);
+		for (VmpNode& node : nodeList) {
+			Vmp3xHandlerFactory::VmpHandlerRange tmpRange(node.addrList[0], node.addrList[node.addrList.size() - 1]);
+			if (!visited.insert(tmpRange).second) {
+				continue;
+			}
+			if (cache.handlerPatternMap.count(tmpRange) || cache.handlerStatusMap.count(tmpRange) || cache.handlerFeatureMap.count(tmpRange)) {
+				continue;
+			}
+			anaList.push_back(std::move(node));
+		}
+	}
+	flow.HandlerPool().PrecomputeHandlers(anaList, cache);
 }
 
 bool VmpBlockBuilder::updateVmRegOffset(ghidra::Funcdata* fd)
@@ -1122,7 +1209,7 @@ bool VmpBlockBuilder::updateVmRegOffset(ghidra::Funcdata* fd)
 	ghidra::PcodeOp* retOp = fd->getFirstReturnOp();
 	for (int n = 0; n < retOp->numInput(); ++n) {
 		ghidra::Varnode* vnReg = retOp->getIn(n);
-		if (GhidraHelper::GetVarnodeRegName(vnReg) != "ESP") {
+		if (GhidraHelper::GetVarnodeRegId(vnReg) != VmpRegister::REG_ESP) {
 			continue;
 		}
 		ghidra::PcodeOp* defOp = vnReg->getDef();
@@ -1133,7 +1220,7 @@ bool VmpBlockBuilder::updateVmRegOffset(ghidra::Funcdata* fd)
 			defOp = defOp->getIn(0)->getDef();
 		}
 		if (defOp->code() == ghidra::CPUI_PTRSUB) {
-			if (defOp->getIn(0)->isInput() && GhidraHelper::GetVarnodeRegName(defOp->getIn(0)) == "ESP") {
+			if (defOp->getIn(0)->isInput() && GhidraHelper::GetVarnodeRegId(defOp->getIn(0)) == VmpRegister::REG_ESP) {
 				if (defOp->getIn(1)->isConstant()) {
 					int offset = defOp->getIn(1)->getOffset();
 					//buildCtx->vm_esp_addr = VmpUnicornContext::DefaultEsp() + offset;
@@ -1178,7 +1265,9 @@ bool VmpBlockBuilder::Execute_FIND_VM_INIT()
 		//	return false;
 		//}
 		std::unique_ptr<VmpOpInit> opInitVm = std::make_unique<VmpOpInit>();
-		opInitVm->storeContext = storeContext;
+		for (const auto& context : storeContext) {
+			opInitVm->storeContext.emplace_back(context.space->getName(), context.offset, context.size);
+		}
 		opInitVm->addr = VmAddress(nodeInput.addrList[0], nodeInput.addrList[0]);
 		executeVmpOp(nodeInput, std::move(opInitVm));
 		walker.MoveToNext();
@@ -1187,20 +1276,19 @@ bool VmpBlockBuilder::Execute_FIND_VM_INIT()
 	return false;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vCopyStack(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vCopyStack(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount < 4 || loadCount < 4) {
+	if (feature.storeList.size() < 4 || feature.loadList.size() < 4) {
 		return nullptr;
 	}
-	auto itStore = fd->obank.storelist.begin();
 	bool bSaveEsi = false;
 	bool bSaveEdi = false;
 	bool bRepMov = false;
-	while (itStore != fd->obank.storelist.end()) {
-		ghidra::PcodeOp* storeOp = *itStore++;
-		auto asmData = DisasmManager::Main().DecodeInstruction(storeOp->getAddr().getOffset());
+	for (unsigned int n = 0; n < feature.storeList.size(); ++n) {
+		auto asmData = DisasmManager::Main().DecodeInstruction(feature.storeList[n].addr);
+		if (!asmData) {
+			continue;
+		}
 		if (asmData->raw->id == X86_INS_PUSH && asmData->raw->detail->x86.operands[0].type == X86_OP_REG) {
 			if (asmData->raw->detail->x86.operands[0].reg == X86_REG_ESI) {
 				bSaveEsi = true;
@@ -1223,120 +1311,57 @@ std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vCopyStack(ghidra::Fun
 	return nullptr;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vWriteVsp(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vWriteVsp(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount != 0 || loadCount != 2) {
+	if (feature.storeList.size() != 0 || feature.loadList.size() != 2) {
 		return nullptr;
 	}
-	ghidra::PcodeOp* retOp = fd->getFirstReturnOp();
-	for (unsigned int n = 0; n < retOp->numInput(); ++n) {
-		std::string retReg = GhidraHelper::GetVarnodeRegName(retOp->getIn(n));
-		if (retReg.empty()) {
-			continue;
-		}
-		if (retReg != buildCtx->vmreg.reg_stack) {
-			continue;
-		}
-		GhidraHelper::PcodeOpTracer opTracer(fd);
-		auto inputReg = opTracer.TraceInput(retOp->getAddr().getOffset(), retOp->getIn(n));
-		if (inputReg.size() != 1) {
-			return false;
-		}
-		if (inputReg[0].name != buildCtx->vmreg.reg_stack) {
-			return false;
-		}
-		if (!inputReg[0].bAccessMem) {
-			return false;
-		}
-		std::unique_ptr<VmpOpWriteVSP> vOpWriteVSP = std::make_unique<VmpOpWriteVSP>();
-		return vOpWriteVSP;
+	if (!feature.HasRetReg(buildCtx->vmreg.reg_stack)) {
+		return nullptr;
 	}
-	return nullptr;
+	const auto& inputReg = feature.TraceRetReg(buildCtx->vmreg.reg_stack);
+	if (inputReg.size() != 1) {
+		return nullptr;
+	}
+	if (inputReg[0].reg != buildCtx->vmreg.reg_stack) {
+		return nullptr;
+	}
+	if (!inputReg[0].bAccessMem) {
+		return nullptr;
+	}
+	std::unique_ptr<VmpOpWriteVSP> vOpWriteVSP = std::make_unique<VmpOpWriteVSP>();
+	return vOpWriteVSP;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vPushVsp(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vPushVsp(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (storeCount != 1 || loadCount != 1) {
-		return false;
+	if (feature.storeList.size() != 1 || feature.loadList.size() != 1) {
+		return nullptr;
 	}
-	auto itStore = fd->obank.storelist.begin();
-	ghidra::PcodeOp* storeOp = *itStore++;
-	GhidraHelper::PcodeOpTracer opTracer(fd);
-	auto dstResult = opTracer.TraceInput(storeOp->getAddr().getOffset(), storeOp->getIn(1));
-	auto srcResult = opTracer.TraceInput(storeOp->getAddr().getOffset(), storeOp->getIn(2));
+	const auto& dstResult = feature.storeList[0].dst;
+	const auto& srcResult = feature.storeList[0].src;
 	if (dstResult.size() != 1 || srcResult.size() != 1) {
-		return false;
+		return nullptr;
 	}
-	if (dstResult[0].name != buildCtx->vmreg.reg_stack || dstResult[0].bAccessMem) {
-		return false;
+	if (dstResult[0].reg != buildCtx->vmreg.reg_stack || dstResult[0].bAccessMem) {
+		return nullptr;
 	}
-	if (srcResult[0].name != buildCtx->vmreg.reg_stack || srcResult[0].bAccessMem) {
-		return false;
+	if (srcResult[0].reg != buildCtx->vmreg.reg_stack || srcResult[0].bAccessMem) {
+		return nullptr;
 	}
 	std::unique_ptr<VmpOpPushVSP> vOpPushVSP = std::make_unique<VmpOpPushVSP>();
 	vOpPushVSP->addr = nodeInput.readVmAddress(buildCtx->vmreg.reg_code);
 	return vOpPushVSP;
 }
 
-std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vExit(ghidra::Funcdata* fd, VmpNode& nodeInput)
+std::unique_ptr<VmpInstruction> VmpBlockBuilder::tryMatch_vExit(VmpHandlerFeature& feature, VmpNode& nodeInput)
 {
-	size_t storeCount = fd->obank.storelist.size();
-	size_t loadCount = fd->obank.loadlist.size();
-	if (loadCount < 7) {
+	if (feature.exitRegs.size() != 10) {
 		return nullptr;
 	}
-	std::map<int, ghidra::VarnodeData> exitContextMap;
-	ghidra::PcodeOp* retOp = fd->getFirstReturnOp();
-	for (int n = 0; n < retOp->numInput(); ++n) {
-		ghidra::Varnode* vnReg = retOp->getIn(n);
-		if (vnReg->getSpace()->getName() != "register") {
-			continue;
-		}
-		ghidra::PcodeOp* defOp = vnReg->getDef();
-		if (!defOp) {
-			continue;
-		}
-		if (defOp->code() == ghidra::CPUI_LOAD) {
-			if (!defOp->getIn(1)->isInput()) {
-				defOp = defOp->getIn(1)->getDef();
-			}
-		}
-		if (!defOp) {
-			continue;
-		}
-		ghidra::VarnodeData tmpData;
-		if (defOp->code() == ghidra::CPUI_LOAD) {
-			tmpData.space = vnReg->getSpace();
-			tmpData.offset = vnReg->getOffset();
-			tmpData.size = vnReg->getSize();
-			exitContextMap[0x0] = tmpData;
-		}
-		else if (defOp->code() == ghidra::CPUI_PTRADD) {
-			if (defOp->getIn(2)->isConstant() && defOp->getIn(2)->getOffset() == 0x4) {
-				if (defOp->getIn(1)->isConstant()) {
-					tmpData.space = vnReg->getSpace();
-					tmpData.offset = vnReg->getOffset();
-					tmpData.size = vnReg->getSize();
-					exitContextMap[defOp->getIn(1)->getOffset()] = tmpData;
-				}
-			}
-		}
-	}
 	std::unique_ptr<VmpOpExit> vOpExit = std::make_unique<VmpOpExit>();
-	int base = 0x0;
-	for (unsigned int n = 0; n < 10; ++n) {
-		auto it = exitContextMap.find(base);
-		if (it == exitContextMap.end()) {
-			return nullptr;
-		}
-		else {
-			vOpExit->exitData.push_back(fd->getArch()->translate->getRegisterName(it->second.space, it->second.offset, it->second.size));
-		}
-		base = base + 1;
+	for (VmpRegId reg : feature.exitRegs) {
+		vOpExit->exitData.push_back(VmpRegister::Name(reg));
 	}
 	return vOpExit;
 }
@@ -1354,13 +1379,20 @@ bool VmpBlockBuilder::BuildVmpBlock(VmpFlowBuildContext* ctx)
 		buildCtx->ctx = VmpUnicornContext::DefaultContext();
 		buildCtx->ctx->context.EIP = buildCtx->start_addr.raw;
 	}
-	walker.StartWalk(*(buildCtx->ctx), 0x10000);
-	flow.tfg.AddTraceFlow(walker.GetTraceList());
-	flow.tfg.MergeAllNodes();
-
-	std::stringstream ss;
-	flow.tfg.DumpGraph(ss, true);
-	std::string graphTxt = ss.str();
+	Vmp3xHandlerFactory& cache = flow.HandlerCache();
+	walker.StartWalk(*(buildCtx->ctx), 0x10000, cache.bFastWalk ? &cache : nullptr);
+	{
+		std::lock_guard<std::mutex> lock(flow.tfgMutex);
+		flow.tfg.AddTraceFlow(walker.GetTraceList());
+		flow.tfg.MergeAllNodes();
+		walker.SplitNodes();
+#ifdef DeveloperMode
+		std::stringstream ss;
+		flow.tfg.DumpGraph(ss, true);
+		std::string graphTxt = ss.str();
+#endif
+	}
+	precomputeHandlers();
 
 	if (buildCtx->btype == VmpFlowBuildContext::HANDLE_VMP_ENTRY) {
 		buildCtx->status = VmpFlowBuildContext::FIND_VM_INIT;
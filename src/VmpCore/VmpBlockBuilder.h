@@ -1,5 +1,7 @@
 #pragma once
+#include <map>
 #include "../GhidraExtension/VmpInstruction.h"
+#include "../GhidraExtension/VmpNode.h"
 #include "../Helper/UnicornHelper.h"
 #include "../VmpCore/VmpUnicorn.h"
 
@@ -9,12 +11,14 @@ namespace GhidraHelper
 }
 
 class VmpControlFlowBuilder;
+class VmpHandlerFeature;
 class VmpFlowBuildContext;
 class VmpNode;
 class VmpBasicBlock;
 class VmpTraceFlowGraph;
 class VmpOpJmp;
 class VmpOpJmpConst;
+class Vmp3xHandlerFactory;
 
 class VmpBlockWalker
 {
@@ -22,15 +26,33 @@ public:
 	VmpBlockWalker(VmpTraceFlowGraph& t) :tfg(t) {};
 	~VmpBlockWalker() {};
 public:
-	void StartWalk(VmpUnicornContext& startCtx, size_t walkSize);
+	//summaryCache enables the fast walk, handlers with a summary are not traced
+	void StartWalk(VmpUnicornContext& startCtx, size_t walkSize, Vmp3xHandlerFactory* summaryCache = nullptr);
+	//unicorn part of the walk
 	const std::vector<reg_context>& GetTraceList();
 	bool IsWalkToEnd();
 	VmpNode GetNextNode();
 	void MoveToNext();
+	//native instructions walked before the current node
 	size_t CurrentIndex();
+	//split the remaining trace into nodes without moving the walker
+	std::vector<VmpNode> PeekAllNodes();
+	//split the whole trace with the current graph, later walks no longer read the graph
+	void SplitNodes();
+private:
+	//run the handler summaries from ctx until a handler has none, ctx is left after the last one
+	void fastWalk(VmpUnicornContext& ctx, size_t walkSize, Vmp3xHandlerFactory& summaryCache);
 private:
 	VmpUnicorn unicorn;
 	VmpTraceFlowGraph& tfg;
+	//nodes of the fast walk, they come before the unicorn trace
+	std::vector<VmpNode> fastNodes;
+	//native instructions walked before every fast node
+	std::vector<size_t> fastNativeIndex;
+	size_t fastNativeCount = 0x0;
+	//nodes keyed by their start index in the trace, valid after SplitNodes
+	std::map<size_t, VmpNode> splitNodes;
+	bool bSplit = false;
 	//ǰִеָ˳
 	size_t idx = 0x0;
 	//ǰڵС
@@ -48,34 +70,57 @@ public:
 	~VmpBlockBuilder() {};
 public:
 	bool BuildVmpBlock(VmpFlowBuildContext* task);
+	//store/load counts fit a pattern or the junk and check-esp shape
+	static bool FitsHandlerShape(const VmpHandlerFeature& feature);
+private:
+	typedef std::unique_ptr<VmpInstruction>(VmpBlockBuilder::* PatternMatcher)(VmpHandlerFeature&, VmpNode&);
+	struct PatternEntry
+	{
+		size_t minStore;
+		size_t maxStore;
+		size_t minLoad;
+		size_t maxLoad;
+		PatternMatcher matcher;
+	};
+	//ordered by priority, only matchers whose store/load count fits are tried
+	static const PatternEntry patternTable[];
 private:
 	bool Execute_FIND_VM_INIT();
 	bool Execute_FINISH_VM_INIT();
-	std::unique_ptr<VmpInstruction> AnaVmpPattern(ghidra::Funcdata* fd,VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vPopReg(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vCpuid(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vRdtsc(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vPushImm(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vPushReg(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vLogicalOp(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vLogicalOp2(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vMemAccess(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vJmp(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_Mul(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_Div(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vPushVsp(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vWriteVsp(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vCopyStack(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vJmpConst(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	bool tryMatch_vCheckEsp(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	bool tryMatch_vJunkCode(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vPopfd(ghidra::Funcdata* fd, VmpNode& nodeInput);
-	std::unique_ptr<VmpInstruction> tryMatch_vExit(ghidra::Funcdata* fd, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> AnaVmpPattern(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vPopReg(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vCpuid(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vRdtsc(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vPushImm(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vPushReg(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vLogicalOp(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vLogicalOp2(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vMemAccess(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vJmp(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_Mul(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_Div(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vPushVsp(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vWriteVsp(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vCopyStack(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vJmpConst(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	bool tryMatch_vCheckEsp(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	bool tryMatch_vJunkCode(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vPopfd(VmpHandlerFeature& feature, VmpNode& nodeInput);
+	std::unique_ptr<VmpInstruction> tryMatch_vExit(VmpHandlerFeature& feature, VmpNode& nodeInput);
 private:
 	bool updateVmRegOffset(ghidra::Funcdata* fd);
 	//ִÿopָ
 	bool executeVmpOp(VmpNode& nodeInput, std::unique_ptr<VmpInstruction> inst);
+	void executeVmpUnknown(VmpNode& nodeInput);
+	//compile the handler once for the fast walk, pattern is nullptr for handlers without one
+	void summariseHandler(VmpNode& nodeInput, VmpInstruction* pattern);
+	//analyse the handlers of the current trace ahead of the sequential match
+	void precomputeHandlers();
 	bool executeVmJmp(VmpNode& nodeInput, VmpOpJmp* inst);
+	//targets of the vm jump ending curBlock, from its slice or a growing tail of the block
+	std::vector<size_t> guessJmpBranch();
+	//lift only what the end of curBlock depends on, nullptr if the block can not be sliced
+	ghidra::Funcdata* liftBlockSlice();
 	bool executeVmJmpConst(VmpNode& nodeInput, VmpOpJmpConst* inst);
 	bool updateVmReg(VmpNode& nodeInput, VmpInstruction* inst);
 	bool executeVmInit(VmpNode& nodeInput, VmpOpInit* inst);
@@ -0,0 +1,40 @@
+#include "VmpEntryIndex.h"
+#include <algorithm>
+#include "../Helper/IDAWrapper.h"
+
+#ifdef DeveloperMode
+#pragma optimize("", off) 
+#endif
+
+void VmpEntryIndex::Load()
+{
+	entryList = IDAWrapper::findVmpEntries();
+	std::sort(entryList.begin(), entryList.end());
+}
+
+void VmpEntryIndex::Mark(size_t addr)
+{
+	auto it = std::lower_bound(entryList.begin(), entryList.end(), addr);
+	if (it == entryList.end() || *it != addr) {
+		entryList.insert(it, addr);
+	}
+	IDAWrapper::setVmpEntry(addr, true);
+}
+
+void VmpEntryIndex::Unmark(size_t addr)
+{
+	auto it = std::lower_bound(entryList.begin(), entryList.end(), addr);
+	if (it != entryList.end() && *it == addr) {
+		entryList.erase(it);
+	}
+	IDAWrapper::setVmpEntry(addr, false);
+}
+
+bool VmpEntryIndex::IsVmpEntry(size_t addr) const
+{
+	return std::binary_search(entryList.begin(), entryList.end(), addr);
+}
+
+#ifdef DeveloperMode
+#pragma optimize("", on) 
+#endif
@@ -0,0 +1,21 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+//vm entries marked in the database, the "vmp entry" comment is only how they are saved
+//loaded once on the main thread, marks only change between builds so the build workers read it without a lock
+
+class VmpEntryIndex
+{
+public:
+	VmpEntryIndex() {};
+	~VmpEntryIndex() {};
+	//scan the database comments, main thread only
+	void Load();
+	void Mark(size_t addr);
+	void Unmark(size_t addr);
+	bool IsVmpEntry(size_t addr) const;
+private:
+	//sorted
+	std::vector<size_t> entryList;
+};
@@ -0,0 +1,178 @@
+#include "VmpFlowScheduler.h"
+#include <thread>
+#include "../GhidraExtension/VmpControlFlow.h"
+
+#ifdef DeveloperMode
+#pragma optimize("", off) 
+#endif
+
+//scheduler and queue index of the running task on this thread
+static thread_local VmpFlowScheduler* curScheduler = nullptr;
+static thread_local unsigned int curWorker = 0x0;
+
+VmpFlowScheduler::VmpFlowScheduler(const PinPredicate& isPinned) :pinFilter(isPinned), pendingCount(0), bAbort(false), wakeSeq(0)
+{
+	queues.push_back(std::make_unique<TaskQueue>());
+}
+
+VmpFlowScheduler::~VmpFlowScheduler()
+{
+
+}
+
+void VmpFlowScheduler::Push(Task task)
+{
+	TaskQueue* targetQueue = queues[0].get();
+	if (bParallel && pinFilter(*task)) {
+		targetQueue = &pinnedQueue;
+	}
+	else if (curScheduler == this) {
+		targetQueue = queues[curWorker].get();
+	}
+	pendingCount++;
+	{
+		std::lock_guard<std::mutex> lock(targetQueue->lock);
+		targetQueue->tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> lock(idleLock);
+		wakeSeq++;
+	}
+	//only the main thread can take a pinned task, any idle thread can take the others
+	if (targetQueue == &pinnedQueue) {
+		idleCond.notify_all();
+	}
+	else {
+		idleCond.notify_one();
+	}
+}
+
+bool VmpFlowScheduler::popTask(unsigned int worker, Task& outTask)
+{
+	if (worker == 0x0) {
+		std::lock_guard<std::mutex> lock(pinnedQueue.lock);
+		if (!pinnedQueue.tasks.empty()) {
+			outTask = std::move(pinnedQueue.tasks.front());
+			pinnedQueue.tasks.pop_front();
+			return true;
+		}
+	}
+	{
+		TaskQueue* ownQueue = queues[worker].get();
+		std::lock_guard<std::mutex> lock(ownQueue->lock);
+		if (!ownQueue->tasks.empty()) {
+			outTask = std::move(ownQueue->tasks.front());
+			ownQueue->tasks.pop_front();
+			return true;
+		}
+	}
+	//steal the newest task, the owner keeps working from the other end
+	for (unsigned int n = 1; n < queues.size(); ++n) {
+		TaskQueue* victimQueue = queues[(worker + n) % queues.size()].get();
+		std::lock_guard<std::mutex> lock(victimQueue->lock);
+		if (!victimQueue->tasks.empty()) {
+			outTask = std::move(victimQueue->tasks.back());
+			victimQueue->tasks.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+void VmpFlowScheduler::recordError()
+{
+	std::lock_guard<std::mutex> lock(errorLock);
+	if (!firstError) {
+		firstError = std::current_exception();
+	}
+	bAbort = true;
+	wakeIdle();
+}
+
+void VmpFlowScheduler::wakeIdle()
+{
+	std::lock_guard<std::mutex> lock(idleLock);
+	idleCond.notify_all();
+}
+
+void VmpFlowScheduler::workerLoop(unsigned int worker, const TaskRunner& runner)
+{
+	curScheduler = this;
+	curWorker = worker;
+	while (!bAbort) {
+		//a push after this read changes the sequence, so the wait below can not miss it
+		size_t seenSeq = wakeSeq;
+		Task curTask;
+		if (!popTask(worker, curTask)) {
+			if (pendingCount == 0x0) {
+				break;
+			}
+			std::unique_lock<std::mutex> lock(idleLock);
+			idleCond.wait(lock, [&]() {
+				return bAbort || pendingCount == 0x0 || wakeSeq != seenSeq;
+			});
+			continue;
+		}
+		try {
+			runner(*curTask, worker);
+		}
+		catch (...) {
+			recordError();
+		}
+		curTask.reset();
+		//children were counted before the parent finishes, zero means all done
+		if (--pendingCount == 0x0) {
+			wakeIdle();
+		}
+	}
+	curScheduler = nullptr;
+	curWorker = 0x0;
+}
+
+void VmpFlowScheduler::Run(unsigned int workerCount, const TaskRunner& runner)
+{
+	bAbort = false;
+	firstError = nullptr;
+	while (queues.size() < workerCount + 1) {
+		queues.push_back(std::make_unique<TaskQueue>());
+	}
+	bParallel = (workerCount != 0x0);
+	if (bParallel) {
+		//tasks queued before the start may still need the main thread
+		std::deque<Task>& mainTasks = queues[0]->tasks;
+		for (auto it = mainTasks.begin(); it != mainTasks.end();) {
+			if (pinFilter(**it)) {
+				pinnedQueue.tasks.push_back(std::move(*it));
+				it = mainTasks.erase(it);
+				continue;
+			}
+			++it;
+		}
+	}
+	std::vector<std::thread> threadList;
+	for (unsigned int n = 1; n <= workerCount; ++n) {
+		threadList.emplace_back([this, n, &runner]() {
+			workerLoop(n, runner);
+		});
+	}
+	workerLoop(0x0, runner);
+	for (unsigned int n = 0; n < threadList.size(); ++n) {
+		threadList[n].join();
+	}
+	bParallel = false;
+	//an aborted build leaves tasks behind
+	pinnedQueue.tasks.clear();
+	for (unsigned int n = 0; n < queues.size(); ++n) {
+		queues[n]->tasks.clear();
+	}
+	pendingCount = 0x0;
+	if (firstError) {
+		std::exception_ptr error = firstError;
+		firstError = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+#ifdef DeveloperMode
+#pragma optimize("", on) 
+#endif
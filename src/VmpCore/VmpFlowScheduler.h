@@ -0,0 +1,57 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <condition_variable>
+
+class VmpFlowBuildContext;
+
+//work stealing scheduler for the cfg build tasks
+//every thread owns a deque, it runs its oldest task and steals the newest task of the others
+//pinned tasks only run on the main thread, they are allowed to touch the ida database
+
+class VmpFlowScheduler
+{
+public:
+	typedef std::unique_ptr<VmpFlowBuildContext> Task;
+	//worker 0 is the thread calling Run
+	typedef std::function<void(VmpFlowBuildContext& task, unsigned int worker)> TaskRunner;
+	typedef std::function<bool(const VmpFlowBuildContext& task)> PinPredicate;
+public:
+	VmpFlowScheduler(const PinPredicate& isPinned);
+	~VmpFlowScheduler();
+	//drain every task with workerCount extra threads, rethrows the first task exception
+	void Run(unsigned int workerCount, const TaskRunner& runner);
+	//queue a task, can be called from any task
+	void Push(Task task);
+	bool IsParallel() const { return bParallel; };
+private:
+	struct TaskQueue
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+	bool popTask(unsigned int worker, Task& outTask);
+	void workerLoop(unsigned int worker, const TaskRunner& runner);
+	void recordError();
+	void wakeIdle();
+private:
+	//queues[0] belongs to the main thread
+	std::vector<std::unique_ptr<TaskQueue>> queues;
+	TaskQueue pinnedQueue;
+	PinPredicate pinFilter;
+	//tasks queued or still running
+	std::atomic<size_t> pendingCount;
+	std::atomic<bool> bAbort;
+	//idle threads sleep on idleCond until a push, the end of the build or an abort
+	std::mutex idleLock;
+	std::condition_variable idleCond;
+	std::atomic<size_t> wakeSeq;
+	std::mutex errorLock;
+	std::exception_ptr firstError;
+	bool bParallel = false;
+};
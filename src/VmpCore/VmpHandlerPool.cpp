@@ -0,0 +1,151 @@
+#include "VmpHandlerPool.h"
+#include <thread>
+#include <atomic>
+#include "VmpReEngine.h"
+#include "VmpBlockBuilder.h"
+#include "../GhidraExtension/VmpArch.h"
+#include "../GhidraExtension/VmpNode.h"
+#include "../Helper/VmpHandlerFeature.h"
+#include "../Manager/SectionManager.h"
+#include "../Manager/exceptions.h"
+#include "../Ghidra/funcdata.hh"
+
+#ifdef DeveloperMode
+#pragma optimize("", off) 
+#endif
+
+//every worker keeps a full sleigh translator, so keep the pool small
+static const unsigned int MaxWorkerCount = 4;
+//below this the thread startup costs more than it saves
+static const size_t MinParallelCount = 8;
+
+VmpHandlerPool::VmpHandlerPool()
+{
+
+}
+
+VmpHandlerPool::~VmpHandlerPool()
+{
+
+}
+
+bool VmpHandlerPool::initWorkers()
+{
+	if (bInitFailed) {
+		return false;
+	}
+	if (!workerArchs.empty()) {
+		return true;
+	}
+	unsigned int workerCount = std::thread::hardware_concurrency();
+	if (workerCount > MaxWorkerCount) {
+		workerCount = MaxWorkerCount;
+	}
+	if (workerCount < 2) {
+		bInitFailed = true;
+		return false;
+	}
+	try {
+		for (unsigned int n = 0; n < workerCount; ++n) {
+			workerArchs.push_back(std::make_unique<VmpArchitecture>(true));
+		}
+	}
+	catch (Exception&) {
+		workerArchs.clear();
+		bInitFailed = true;
+		return false;
+	}
+	return true;
+}
+
+void VmpHandlerPool::PrecomputeHandlers(std::vector<VmpNode>& nodeList, Vmp3xHandlerFactory& cache)
+{
+	if (nodeList.size() < MinParallelCount) {
+		return;
+	}
+	if (!initWorkers()) {
+		return;
+	}
+	//workers read bytes from the snapshot, it has to be built on the main thread
+	SectionManager::Main();
+	typedef std::pair<Vmp3xHandlerFactory::VmpHandlerRange, std::unique_ptr<VmpHandlerFeature>> FeatureResult;
+	std::vector<std::vector<FeatureResult>> workerResults(workerArchs.size());
+	std::atomic<size_t> nextIndex(0);
+	std::vector<std::thread> threadList;
+	for (unsigned int n = 0; n < workerArchs.size(); ++n) {
+		threadList.emplace_back([&, n]() {
+			VmpArchitecture* arch = workerArchs[n].get();
+			while (true) {
+				size_t idx = nextIndex++;
+				if (idx >= nodeList.size()) {
+					break;
+				}
+				VmpNode& node = nodeList[idx];
+				Vmp3xHandlerFactory::VmpHandlerRange range(node.addrList[0], node.addrList[node.addrList.size() - 1]);
+				try {
+					std::unique_ptr<VmpHandlerFeature> feature = LiftHandler(arch, node);
+					if (!feature) {
+						continue;
+					}
+					workerResults[n].push_back(FeatureResult(range, std::move(feature)));
+				}
+				catch (...) {
+					//leave the handler to the sequential path
+				}
+			}
+		});
+	}
+	for (unsigned int n = 0; n < threadList.size(); ++n) {
+		threadList[n].join();
+	}
+	//build workers of another function may be reading the cache
+	std::lock_guard<std::mutex> lock(cache.cacheMutex);
+	for (unsigned int n = 0; n < workerResults.size(); ++n) {
+		for (FeatureResult& result : workerResults[n]) {
+			if (cache.handlerFeatureMap.count(result.first)) {
+				continue;
+			}
+			cache.handlerFeatureMap[result.first] = std::move(result.second);
+		}
+	}
+}
+
+std::unique_ptr<VmpHandlerFeature> VmpHandlerPool::LiftHandler(VmpArchitecture* arch, VmpNode& node)
+{
+	arch->SetSlimHandlerAction(true);
+	ghidra::Funcdata* fd = arch->AnaVmpHandler(&node);
+	if (fd == nullptr) {
+		return nullptr;
+	}
+	std::unique_ptr<VmpHandlerFeature> feature = std::make_unique<VmpHandlerFeature>(fd);
+	if (VmpBlockBuilder::FitsHandlerShape(*feature)) {
+		return feature;
+	}
+	feature.reset();
+	arch->SetSlimHandlerAction(false);
+	fd = arch->AnaVmpHandler(&node);
+	arch->SetSlimHandlerAction(true);
+	if (fd == nullptr) {
+		return nullptr;
+	}
+	return std::make_unique<VmpHandlerFeature>(fd);
+}
+
+void VmpHandlerPool::CollectArchs(std::vector<VmpArchitecture*>& archList)
+{
+	for (unsigned int n = 0; n < workerArchs.size(); ++n) {
+		archList.push_back(workerArchs[n].get());
+	}
+}
+
+void VmpHandlerPool::BorrowArchs(std::vector<VmpArchitecture*>& archList)
+{
+	if (!initWorkers()) {
+		return;
+	}
+	CollectArchs(archList);
+}
+
+#ifdef DeveloperMode
+#pragma optimize("", on) 
+#endif
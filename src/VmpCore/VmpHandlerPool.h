@@ -0,0 +1,30 @@
+#pragma once
+#include <vector>
+#include <memory>
+
+class VmpArchitecture;
+class VmpNode;
+class VmpHandlerFeature;
+class Vmp3xHandlerFactory;
+
+//analyse vm handlers concurrently, every worker owns an isolated architecture
+
+class VmpHandlerPool
+{
+public:
+	VmpHandlerPool();
+	~VmpHandlerPool();
+public:
+	//fill the feature cache for handlers that have not been analysed yet
+	void PrecomputeHandlers(std::vector<VmpNode>& nodeList, Vmp3xHandlerFactory& cache);
+	void CollectArchs(std::vector<VmpArchitecture*>& archList);
+	//start the workers if needed and lend their architectures, empty when the pool is unavailable
+	void BorrowArchs(std::vector<VmpArchitecture*>& archList);
+	//lift with the slim group, a feature no matcher can take is lifted again with the full group
+	static std::unique_ptr<VmpHandlerFeature> LiftHandler(VmpArchitecture* arch, VmpNode& node);
+private:
+	bool initWorkers();
+private:
+	std::vector<std::unique_ptr<VmpArchitecture>> workerArchs;
+	bool bInitFailed = false;
+};
@@ -4,13 +4,19 @@
 #include "../GhidraExtension/VmpArch.h"
 #include "../GhidraExtension/VmpFunction.h"
 #include "../Helper/IDAWrapper.h"
+#include "../Helper/VmpHandlerFeature.h"
+#include "../Helper/VmpHandlerSummary.h"
+#include "../Manager/VmpVersionManager.h"
 #include "../Manager/exceptions.h"
 #include "../Common/StringUtils.h"
+#include <cereal/types/set.hpp>
 
 #ifdef DeveloperMode
 #pragma optimize("", off) 
 #endif
 
+static bool engineStarted = false;
+
 VmpReEngine::VmpReEngine()
 {
 	arch = new (std::nothrow)VmpArchitecture();
@@ -20,6 +26,8 @@ VmpReEngine::VmpReEngine()
 	if (!handlerFactory.LoadHandlerPattern()) {
 		throw Exception("VmpReEngine::VmpReEngine(): LoadHandlerPattern failed.");
 	}
+	entryIndex.Load();
+	engineStarted = true;
 }
 
 VmpReEngine::~VmpReEngine()
@@ -35,6 +43,21 @@ VmpReEngine& VmpReEngine::Instance()
 	return globalReEngine;
 }
 
+bool VmpReEngine::IsStarted()
+{
+	return engineStarted;
+}
+
+void VmpReEngine::OnBytesPatched()
+{
+	std::vector<VmpArchitecture*> archList;
+	archList.push_back(arch);
+	handlerPool.CollectArchs(archList);
+	for (VmpArchitecture* curArch : archList) {
+		curArch->PcodeCache().Clear();
+	}
+}
+
 VmpArchitecture* VmpReEngine::Arch()
 {
 	return arch;
@@ -45,6 +68,16 @@ Vmp3xHandlerFactory& VmpReEngine::HandlerCache()
 	return handlerFactory;
 }
 
+VmpHandlerPool& VmpReEngine::HandlerPool()
+{
+	return handlerPool;
+}
+
+VmpEntryIndex& VmpReEngine::EntryIndex()
+{
+	return entryIndex;
+}
+
 Vmp3xHandlerFactory::Vmp3xHandlerFactory()
 {
 	initWorkingDirectory();
@@ -86,22 +119,60 @@ bool Vmp3xHandlerFactory::LoadHandlerPattern()
 	return true;
 }
 
+const VmpHandlerSummary* Vmp3xHandlerFactory::FindSummary(size_t addr)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto it = handlerSummaryMap.find(addr);
+	if (it == handlerSummaryMap.end()) {
+		return nullptr;
+	}
+	return it->second.get();
+}
+
+//bump whenever the cfg builder produces a different graph
+static const unsigned int GraphSnapshotVersion = 0x2;
+//estimated bytes the cached functions may hold before the least recently used are spilled
+static const size_t FuncCacheBudget = 0x20000000;
+
 void VmpReEngine::MarkVmpEntry(size_t startAddr)
 {
-	IDAWrapper::set_cmt(startAddr, "vmp entry", false);
-	clearAllFunction();
+	entryIndex.Mark(startAddr);
+	invalidateEntry(startAddr);
+}
+
+void VmpReEngine::UnmarkVmpEntry(size_t startAddr)
+{
+	entryIndex.Unmark(startAddr);
+	invalidateEntry(startAddr);
+}
+
+void VmpReEngine::invalidateEntry(size_t entryAddr)
+{
+	//only graphs that looked the address up change, they are rebuilt on the next PrintGraph
+	for (auto it = funcCache.begin(); it != funcCache.end(); ++it) {
+		VmpFunction* func = it->get();
+		if (!func->trace.Invalidate(entryAddr)) {
+			continue;
+		}
+		qstring graphTitle;
+		graphTitle.sprnt("vmp_%a", func->startAddr);
+		TWidget* widget = find_widget(graphTitle.c_str());
+		if (widget) {
+			close_widget(widget, 0x0);
+		}
+		func->cfg.Clear();
+		updateFootprint(func);
+	}
+	clearGraphSnapshots(entryAddr);
 }
 
 void VmpReEngine::Decompile(size_t startAddr)
 {
-	auto it = std::find_if(funcCache.begin(), funcCache.end(),
-		[startAddr](const std::unique_ptr<VmpFunction>& func) {
-			return func->startAddr == startAddr;
-	});
-	if (it == funcCache.end()) {
+	VmpFunction* func = findFunction(startAddr);
+	if (!func) {
 		return;
 	}
-	ghidra::Funcdata* fd = arch->AnaVmpFunction(it->get());
+	ghidra::Funcdata* fd = arch->AnaVmpFunction(func);
 	if (!fd) {
 		return;
 	}
@@ -111,18 +182,141 @@ void VmpReEngine::Decompile(size_t startAddr)
 	std::string srcResult = ss.str();
 	msg_clear();
 	msg("%s\n", srcResult.c_str());
+	dumpActionProfile();
 }
 
 void VmpReEngine::Decompile_IDA(size_t startAddr)
 {
-	auto it = std::find_if(funcCache.begin(), funcCache.end(),
-		[startAddr](const std::unique_ptr<VmpFunction>& func) {
-			return func->startAddr == startAddr;
-		});
-	if (it == funcCache.end()) {
+	VmpFunction* func = findFunction(startAddr);
+	if (!func) {
 		return;
 	}
-	//VmpFunction* fd = it->get();
+	//VmpFunction* fd = func;
+}
+
+void VmpReEngine::dumpActionProfile()
+{
+	if (!VmpArchitecture::IsActionProfileEnabled()) {
+		return;
+	}
+	std::vector<VmpArchitecture*> archList;
+	archList.push_back(arch);
+	handlerPool.CollectArchs(archList);
+	std::string filePath = IDAWrapper::idadir("plugins") + "\\Revampire\\" + IDAWrapper::get_input_file_md5() + ".profile";
+	std::ofstream txtFile(filePath + ".txt", std::ios::trunc);
+	std::ofstream jsonFile(filePath + ".json", std::ios::trunc);
+	if (!txtFile.is_open() || !jsonFile.is_open()) {
+		return;
+	}
+	VmpArchitecture::DumpActionProfile(archList, txtFile, jsonFile);
+	msg("[Revampire] action profile saved to %s.txt\n", filePath.c_str());
+	msg("[Revampire] function cache %llu KB, peak %llu KB\n", (unsigned long long)(CacheFootprint() / 1024), (unsigned long long)(PeakCacheFootprint() / 1024));
+}
+
+std::string VmpReEngine::graphSnapshotPath(size_t startAddr)
+{
+	std::stringstream ss;
+	ss << IDAWrapper::idadir("plugins") << "\\Revampire\\" << IDAWrapper::get_input_file_md5() << "_" << std::hex << startAddr << ".vmcfg";
+	return ss.str();
+}
+
+bool VmpReEngine::loadGraphSnapshot(VmpFunction* fd, size_t startAddr)
+{
+	//an invalidated function in memory replays its previous build instead
+	if (!fd->trace.records.empty()) {
+		return false;
+	}
+	std::ifstream file(graphSnapshotPath(startAddr), std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	unsigned int version = 0x0;
+	size_t savedAddr = 0x0;
+	int vmpVersion = 0x0;
+	std::set<size_t> entryProbes;
+	try {
+		cereal::BinaryInputArchive archive(file);
+		archive(version, savedAddr, vmpVersion);
+		if (version != GraphSnapshotVersion || savedAddr != startAddr || vmpVersion != VmpVersionManager::CurrentVmpVersion()) {
+			return false;
+		}
+		archive(entryProbes);
+		if (!fd->cfg.LoadGraph(archive)) {
+			return false;
+		}
+	}
+	catch (cereal::Exception&) {
+		return false;
+	}
+	fd->startAddr = startAddr;
+	//no task records on disk, a change of these entries rebuilds the whole graph
+	fd->trace.entryProbes = std::move(entryProbes);
+	return true;
+}
+
+void VmpReEngine::saveGraphSnapshot(VmpFunction* fd)
+{
+	std::string filePath = graphSnapshotPath(fd->startAddr);
+	std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		return;
+	}
+	bool bSaved = true;
+	try {
+		cereal::BinaryOutputArchive archive(file);
+		archive(GraphSnapshotVersion, fd->startAddr, int(VmpVersionManager::CurrentVmpVersion()));
+		archive(fd->trace.entryProbes);
+		fd->cfg.SaveGraph(archive);
+	}
+	catch (cereal::Exception&) {
+		bSaved = false;
+	}
+	file.close();
+	//a half written snapshot would be rejected anyway, do not leave it around
+	if (!bSaved) {
+		DeleteFileA(filePath.c_str());
+	}
+}
+
+bool snapshotDependsOn(const std::string& filePath, size_t entryAddr)
+{
+	std::ifstream file(filePath, std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+	unsigned int version = 0x0;
+	size_t savedAddr = 0x0;
+	int vmpVersion = 0x0;
+	std::set<size_t> entryProbes;
+	try {
+		cereal::BinaryInputArchive archive(file);
+		archive(version, savedAddr, vmpVersion);
+		if (version != GraphSnapshotVersion) {
+			return true;
+		}
+		archive(entryProbes);
+	}
+	catch (cereal::Exception&) {
+		return true;
+	}
+	return entryProbes.count(entryAddr) != 0;
+}
+
+void VmpReEngine::clearGraphSnapshots(size_t entryAddr)
+{
+	std::string snapshotDir = IDAWrapper::idadir("plugins") + "\\Revampire\\";
+	WIN32_FIND_DATAA findData;
+	HANDLE hFind = FindFirstFileA((snapshotDir + IDAWrapper::get_input_file_md5() + "_*.vmcfg").c_str(), &findData);
+	if (hFind == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	do {
+		std::string filePath = snapshotDir + findData.cFileName;
+		if (snapshotDependsOn(filePath, entryAddr)) {
+			DeleteFileA(filePath.c_str());
+		}
+	} while (FindNextFileA(hFind, &findData));
+	FindClose(hFind);
 }
 
 void VmpReEngine::clearAllFunction()
@@ -136,62 +330,162 @@ void VmpReEngine::clearAllFunction()
 		}
 	}
 	funcCache.clear();
+	funcIndex.clear();
+	cacheFootprint = 0x0;
 }
 
 void VmpReEngine::clearFunction(size_t startAddr)
 {
-	auto it = std::find_if(funcCache.begin(), funcCache.end(),
-		[startAddr](const std::unique_ptr<VmpFunction>& func) {
-			return func->startAddr == startAddr;
-	});
-	if (it != funcCache.end()) {
+	auto it = funcIndex.find(startAddr);
+	if (it != funcIndex.end()) {
 		qstring graphTitle;
-		graphTitle.sprnt("vmp_%a", it->get()->startAddr);
+		graphTitle.sprnt("vmp_%a", startAddr);
 		TWidget* widget = find_widget(graphTitle.c_str());
 		if (widget) {
 			close_widget(widget, 0x0);
 		}
-		funcCache.erase(it);
+		eraseFunction(it->second.it);
+	}
+}
+
+VmpFunction* VmpReEngine::findFunction(size_t startAddr)
+{
+	auto it = funcIndex.find(startAddr);
+	if (it == funcIndex.end()) {
+		return nullptr;
 	}
+	//most recently used first
+	funcCache.splice(funcCache.begin(), funcCache, it->second.it);
+	return it->second.it->get();
 }
 
 VmpFunction* VmpReEngine::makeFunction(size_t startAddr)
 {
 	//һ
-	auto it = std::find_if(funcCache.begin(), funcCache.end(),
-		[startAddr](const std::unique_ptr<VmpFunction>& func) {
-			return func->startAddr == startAddr;
-	});
-	if (it != funcCache.end()) {
-		return it->get();
+	VmpFunction* retFunc = findFunction(startAddr);
+	if (retFunc) {
+		return retFunc;
+	}
+	std::unique_ptr<VmpFunction> retVmp = std::make_unique<VmpFunction>(arch, this);
+	retFunc = retVmp.get();
+	retFunc->startAddr = startAddr;
+	funcCache.push_front(std::move(retVmp));
+	funcIndex[startAddr].it = funcCache.begin();
+	return retFunc;
+}
+
+void VmpReEngine::updateFootprint(VmpFunction* fd)
+{
+	auto it = funcIndex.find(fd->startAddr);
+	if (it == funcIndex.end()) {
+		return;
 	}
+	size_t footprint = fd->EstimateFootprint();
+	cacheFootprint = cacheFootprint - it->second.footprint + footprint;
+	it->second.footprint = footprint;
+	if (cacheFootprint > peakFootprint) {
+		peakFootprint = cacheFootprint;
+	}
+}
+
+void VmpReEngine::trimFunctionCache()
+{
 	//ɾ
-	if (funcCache.size() >= 10) {
-		for (auto it = funcCache.begin(); it != funcCache.end(); ++it) {
-			qstring graphTitle;
-			graphTitle.sprnt("vmp_%a", it->get()->startAddr);
-			TWidget* widget = find_widget(graphTitle.c_str());
-			if (widget) {
-				continue;
-			}
-			funcCache.erase(it);
+	//the front is the function in use, functions with an open graph are still referenced by the viewer
+	auto it = funcCache.end();
+	while (cacheFootprint > FuncCacheBudget && it != funcCache.begin()) {
+		--it;
+		if (it == funcCache.begin()) {
 			break;
 		}
+		VmpFunction* func = it->get();
+		qstring graphTitle;
+		graphTitle.sprnt("vmp_%a", func->startAddr);
+		if (find_widget(graphTitle.c_str())) {
+			continue;
+		}
+		//spill to the graph store, the next PrintGraph loads it back
+		if (!func->cfg.blocksMap.empty()) {
+			saveGraphSnapshot(func);
+		}
+		it = eraseFunction(it);
 	}
-	std::unique_ptr<VmpFunction> retVmp = std::make_unique<VmpFunction>(arch, this);
-	VmpFunction* retFunc = retVmp.get();
-	funcCache.push_back(std::move(retVmp));
-	return retFunc;
 }
 
-void VmpReEngine::PrintGraph(size_t startAddr)
+std::list<std::unique_ptr<VmpFunction>>::iterator VmpReEngine::eraseFunction(std::list<std::unique_ptr<VmpFunction>>::iterator it)
+{
+	auto itIndex = funcIndex.find(it->get()->startAddr);
+	if (itIndex != funcIndex.end()) {
+		cacheFootprint -= itIndex->second.footprint;
+		funcIndex.erase(itIndex);
+	}
+	return funcCache.erase(it);
+}
+
+#ifdef DeveloperMode
+//a graph rebuilt from the trace after an entry was marked has to match a clean build
+static bool SameGraph(VmpControlFlow& incremental, VmpControlFlow& clean)
+{
+	if (incremental.blocksMap.size() != clean.blocksMap.size()) {
+		return false;
+	}
+	for (auto& eBlock : incremental.blocksMap) {
+		auto itClean = clean.blocksMap.find(eBlock.first);
+		if (itClean == clean.blocksMap.end()) {
+			return false;
+		}
+		VmpBasicBlock& block = eBlock.second;
+		VmpBasicBlock& cleanBlock = itClean->second;
+		if (block.insList.size() != cleanBlock.insList.size() || block.outBlocks.size() != cleanBlock.outBlocks.size()) {
+			return false;
+		}
+		std::set<VmAddress> outSet;
+		for (const auto& outBlock : block.outBlocks) {
+			outSet.insert(outBlock->blockEntry);
+		}
+		for (const auto& outBlock : cleanBlock.outBlocks) {
+			if (!outSet.count(outBlock->blockEntry)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+#endif
+
+void VmpReEngine::PrintGraph(size_t startAddr, bool bReanalyse)
 {
 	try {
+		if (bReanalyse) {
+			clearFunction(startAddr);
+		}
 		VmpFunction* fd = makeFunction(startAddr);
-		fd->FollowVmp(startAddr);
-		fd->cfg.MergeNodes();
+		if (fd->cfg.blocksMap.empty()) {
+			if (bReanalyse || !loadGraphSnapshot(fd, startAddr)) {
+#ifdef DeveloperMode
+				bool bIncremental = !fd->trace.records.empty();
+#endif
+				fd->FollowVmp(startAddr);
+				fd->cfg.MergeNodes();
+#ifdef DeveloperMode
+				if (bIncremental) {
+					VmpFunction cleanFunc(arch, this);
+					cleanFunc.startAddr = startAddr;
+					cleanFunc.FollowVmp(startAddr);
+					cleanFunc.cfg.MergeNodes();
+					if (!SameGraph(fd->cfg, cleanFunc.cfg)) {
+						msg("[Revampire] incremental rebuild of %a differs from a clean build\n", startAddr);
+					}
+				}
+#endif
+				saveGraphSnapshot(fd);
+			}
+		}
+		updateFootprint(fd);
+		trimFunctionCache();
 		fd->CreateGraph();
 		handlerFactory.SaveHandlerPattern();
+		dumpActionProfile();
 	}
 	catch (Exception& e) {
 		std::string what = e.what();
@@ -1,13 +1,20 @@
 #pragma once
 #include "../GhidraExtension/VmpFunction.h"
+#include "VmpHandlerPool.h"
+#include "VmpEntryIndex.h"
 #include <cereal/cereal.hpp>
 #include <cereal/types/vector.hpp>
 #include <cereal/types/map.hpp>
 #include <cereal/types/polymorphic.hpp>
 #include <cereal/archives/binary.hpp>
 #include <math.h>
+#include <mutex>
+#include <list>
+#include <unordered_map>
 
 class VmpArchitecture;
+class VmpHandlerFeature;
+class VmpHandlerSummary;
 
 class Vmp3xHandlerFactory
 {
@@ -34,15 +41,33 @@ public:
 			ar(startAddr, endAddr);
 		}
 	};
+	//handlers that did not produce a pattern
+	enum VmpHandlerStatus {
+		HANDLER_JUNK = 0x1,
+		HANDLER_CHECKESP,
+		HANDLER_UNKNOWN,
+	};
 public:
 	Vmp3xHandlerFactory();
 	~Vmp3xHandlerFactory();
 	bool LoadHandlerPattern();
 	void SaveHandlerPattern();
+	//summary of the handler starting at addr, nullptr if there is none
+	const VmpHandlerSummary* FindSummary(size_t addr);
 private:
 	void initWorkingDirectory();
 public:
 	std::map<VmpHandlerRange, std::unique_ptr<VmpInstruction>> handlerPatternMap;
+	//negative results, only kept for the current session
+	std::map<VmpHandlerRange, VmpHandlerStatus> handlerStatusMap;
+	//handlers analysed ahead of time by VmpHandlerPool, waiting to be classified
+	std::map<VmpHandlerRange, std::unique_ptr<VmpHandlerFeature>> handlerFeatureMap;
+	//compiled handlers keyed by their first instruction, nullptr when the handler can not be summarised
+	std::unordered_map<size_t, std::unique_ptr<VmpHandlerSummary>> handlerSummaryMap;
+	//walk known handlers with their summaries, unicorn only runs the rest
+	bool bFastWalk = true;
+	//guards the maps above while the cfg is built in parallel
+	std::mutex cacheMutex;
 private:
 	std::string workingDir;
 };
@@ -53,19 +78,54 @@ public:
 	VmpReEngine();
 	~VmpReEngine();
 	static VmpReEngine& Instance();
+	//false until the first Instance call, idb events must not start the engine
+	static bool IsStarted();
 public:
-	void PrintGraph(size_t startAddr);
+	//bReanalyse ignores the saved graph and builds it again
+	void PrintGraph(size_t startAddr, bool bReanalyse = false);
 	void MarkVmpEntry(size_t startAddr);
+	void UnmarkVmpEntry(size_t startAddr);
+	//the raw pcode caches of every architecture replay the old bytes, drop them
+	void OnBytesPatched();
 	void Decompile(size_t startAddr);
 	void Decompile_IDA(size_t startAddr);
 	VmpArchitecture* Arch();
 	Vmp3xHandlerFactory& HandlerCache();
+	VmpHandlerPool& HandlerPool();
+	VmpEntryIndex& EntryIndex();
+	//estimated bytes held by the cached functions
+	size_t CacheFootprint() { return cacheFootprint; };
+	size_t PeakCacheFootprint() { return peakFootprint; };
 private:
+	struct FuncCacheSlot
+	{
+		std::list<std::unique_ptr<VmpFunction>>::iterator it;
+		size_t footprint = 0x0;
+	};
+	VmpFunction* findFunction(size_t startAddr);
 	VmpFunction* makeFunction(size_t startAddr);
+	void updateFootprint(VmpFunction* fd);
+	void trimFunctionCache();
+	std::list<std::unique_ptr<VmpFunction>>::iterator eraseFunction(std::list<std::unique_ptr<VmpFunction>>::iterator it);
 	void clearFunction(size_t startAddr);
 	void clearAllFunction();
+	//write the action profile report next to the handler cache
+	void dumpActionProfile();
+	//finished graphs are saved per input file and start address
+	std::string graphSnapshotPath(size_t startAddr);
+	bool loadGraphSnapshot(VmpFunction* fd, size_t startAddr);
+	void saveGraphSnapshot(VmpFunction* fd);
+	//drop the saved graphs that looked the address up
+	void clearGraphSnapshots(size_t entryAddr);
+	void invalidateEntry(size_t entryAddr);
 private:
 	VmpArchitecture* arch = nullptr;
 	Vmp3xHandlerFactory handlerFactory;
+	VmpHandlerPool handlerPool;
+	VmpEntryIndex entryIndex;
+	//most recently used first
 	std::list<std::unique_ptr<VmpFunction>> funcCache;
+	std::unordered_map<size_t, FuncCacheSlot> funcIndex;
+	size_t cacheFootprint = 0x0;
+	size_t peakFootprint = 0x0;
 };
\ No newline at end of file